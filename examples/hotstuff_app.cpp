@@ -22,6 +22,17 @@
 #include <random>
 #include <unistd.h>
 #include <signal.h>
+#include <future>
+#include <atomic>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 
 #include "salticidae/stream.h"
 #include "salticidae/util.h"
@@ -35,6 +46,11 @@
 #include "hotstuff/client.h"
 #include "hotstuff/hotstuff.h"
 #include "hotstuff/liveness.h"
+#include "hotstuff/tracer.h"
+#include "hotstuff/metrics.h"
+#include "hotstuff/stack_sampler.h"
+#include "hotstuff/admin.h"
+#include "hotstuff/alloc_profile.h"
 
 #include "small_bank.h"
 
@@ -62,13 +78,25 @@ using hotstuff::DataStream;
 using hotstuff::ReplicaID;
 using hotstuff::MsgReqCmd;
 using hotstuff::MsgRespCmd;
+using hotstuff::MsgReqQuery;
+using hotstuff::MsgRespQuery;
+using hotstuff::MsgReqCkpt;
+using hotstuff::MsgRespCkpt;
+using hotstuff::MsgReqCkptChunk;
+using hotstuff::MsgRespCkptChunk;
 using hotstuff::get_hash;
+using hotstuff::get_hex10;
 using hotstuff::promise_t;
+using hotstuff::CmdTracer;
+using hotstuff::TraceEvent;
+using hotstuff::StackSampler;
+using hotstuff::AdminServer;
 
 using HotStuff = hotstuff::HotStuffSecp256k1;
 
 class HotStuffApp: public HotStuff {
     double stat_period;
+    uint32_t prune_staleness;
     double impeach_timeout;
     EventContext ec;
     EventContext req_ec;
@@ -81,23 +109,113 @@ class HotStuffApp: public HotStuff {
     TimerEvent impeach_timer;
     /** The listen address for client RPC */
     NetAddr clisten_addr;
+    /** number of profiling sessions started so far */
+    uint32_t nprofiles;
 
     std::unordered_map<const uint256_t, promise_t> unconfirmed;
 
     using conn_t = ClientNetwork<opcode_t>::conn_t;
-    using resp_queue_t = salticidae::MPSCQueueEventDriven<std::pair<Finality, NetAddr>>;
+    using resp_t = std::pair<Finality, NetAddr>;
+    /* only filled by the consensus thread, a block at a time */
+    using resp_queue_t = salticidae::SPSCRingEventDriven<resp_t>;
+
+    /* read-only queries, answered on the consensus thread from the last
+     * executed state, without being ordered */
+    struct Query {
+        uint64_t qid;
+        std::vector<uint64_t> payload;
+        NetAddr addr;
+    };
+    struct QueryAnswer {
+        uint64_t qid;
+        uint32_t height;
+        bool ok;
+        std::pair<uint64_t, uint64_t> result;
+        NetAddr addr;
+    };
+    using query_queue_t = salticidae::MPSCQueueEventDriven<Query>;
+    using query_resp_queue_t = salticidae::MPSCQueueEventDriven<QueryAnswer>;
 
     /* for the dedicated thread sending responses to the clients */
     std::thread req_thread;
     std::thread resp_thread;
     resp_queue_t resp_queue;
+    std::vector<resp_t> resp_buff;
+    query_queue_t query_queue;
+    query_resp_queue_t query_resp_queue;
     salticidae::BoxObj<salticidae::ThreadCall> resp_tcall;
     salticidae::BoxObj<salticidae::ThreadCall> req_tcall;
 
     /* database manager for in-memory database (Small Bank) */
     SmallBankManager *small_bank_manager;
+    /* executes the commands of a decided block, possibly in parallel */
+    salticidae::BoxObj<SmallBankExecutor> executor;
+
+    struct PendingExec {
+        const uint64_t *payload;
+        Finality fin;
+        NetAddr addr;
+    };
+    /* the commands of the block being decided, waiting for do_decide_block */
+    std::vector<PendingExec> exec_batch;
+    std::vector<const uint64_t *> exec_payloads;
+    std::vector<std::pair<uint64_t, uint64_t>> exec_results;
+
+    /* speculative execution: the blocks voted for are executed right away,
+     * and undone unless they commit */
+    bool speculation;
+    struct SpecBlock {
+        hotstuff::block_t blk;
+        /* the commands executed, in order */
+        std::vector<hotstuff::Hash256> cmds;
+        SmallBankManager::undo_log_t undo;
+    };
+    /* executed ahead of their commit, each extending the previous one */
+    std::deque<SpecBlock> spec_chain;
+    /* the payloads of the commands received from the clients and not yet
+     * executed upon commit (filled by the client thread) */
+    std::mutex pending_lock;
+    std::unordered_map<hotstuff::Hash256, const uint64_t *> pending_payloads;
+    hotstuff::Counter &spec_confirmed;
+    hotstuff::Counter &spec_undone;
+
+    /* checkpoints of the state, every ckpt_interval heights, in ckpt_dir */
+    std::string ckpt_dir;
+    uint32_t ckpt_interval;
+    /* the height of the checkpoint the state was loaded from: the blocks up
+     * to it are not executed again */
+    uint64_t base_height;
+    /* the child writing a checkpoint (-1 if none) and its height */
+    pid_t ckpt_pid;
+    uint64_t ckpt_pending_height;
+    struct Checkpoint {
+        uint64_t height;
+        uint256_t digest;
+        uint64_t size;
+        int fd;
+        std::string path;
+        ~Checkpoint() { close(fd); }
+    };
+    /* the latest complete checkpoints (oldest first), served to the
+     * replicas catching up from the client thread */
+    std::mutex ckpt_lock;
+    std::vector<std::shared_ptr<const Checkpoint>> ckpts;
+    /* catching up: once the state is more than catch_up_lag checkpoints
+     * behind those of nfaulty + 1 of the other replicas (ckpt_peers), the
+     * latest of them is fetched (on catch_up_thread) and replaces it */
+    uint32_t catch_up_lag;
+    std::vector<NetAddr> ckpt_peers;
+    size_t nfaulty;
+    double ckpt_fetch_timeout;
+    std::thread catch_up_thread;
+    std::atomic<bool> catch_up_running;
+    std::atomic<bool> catch_up_cancel;
 
     void client_request_cmd_handler(MsgReqCmd &&, const conn_t &);
+    void client_query_handler(MsgReqQuery &&, const conn_t &);
+    void client_ckpt_handler(MsgReqCkpt &&, const conn_t &);
+    void client_ckpt_chunk_handler(MsgReqCkptChunk &&, const conn_t &);
+    QueryAnswer answer_query(Query &&q);
 
     static command_t parse_cmd(DataStream &s) {
         auto cmd = new CommandDummy();
@@ -116,6 +234,32 @@ class HotStuffApp: public HotStuff {
         impeach_timer.add(impeach_timeout);
     }
 
+    void do_decide_block(const hotstuff::block_t &blk) override;
+    /* hand n responses to the client thread, waiting for it to make room
+     * in resp_queue if it is behind */
+    void queue_responses(resp_t *resps, size_t n);
+    void do_speculate(const hotstuff::block_t &blk,
+                    const std::vector<hotstuff::Hash256> &order) override;
+    void spec_execute(const hotstuff::block_t &blk,
+                    const std::vector<hotstuff::Hash256> &order);
+    /* undo the last speculated block */
+    void spec_undo_last();
+    /* the height of the last block in the state */
+    uint64_t get_state_height() {
+        return std::max<uint64_t>(get_last_executed()->get_height(), base_height);
+    }
+    /* start writing a checkpoint of the state as of height */
+    void take_checkpoint(uint64_t height);
+    /* collect the checkpoint being written, if done (or wait for it) */
+    void reap_checkpoint(bool wait);
+    /* serve the checkpoint file at path, and drop the oldest ones */
+    void add_checkpoint(const std::string &path);
+    /* look for a checkpoint far enough ahead of the state, in the
+     * background, unless already looking */
+    void start_catch_up();
+    /* go on from the state of the fetched checkpoint at height */
+    void install_checkpoint(SmallBank *bank, uint64_t height, const std::string &path);
+
     void state_machine_execute(const Finality &fin) override {
         reset_imp_timer();
 #ifndef HOTSTUFF_ENABLE_BENCHMARK
@@ -123,6 +267,9 @@ class HotStuffApp: public HotStuff {
 #endif
     }
 
+    /** Run `func` on the consensus thread and wait for its result. */
+    std::string call_on_loop(std::function<std::string()> func);
+
 #ifdef HOTSTUFF_MSG_STAT
     std::unordered_set<conn_t> client_conns;
     void print_stat() const;
@@ -132,9 +279,14 @@ class HotStuffApp: public HotStuff {
     HotStuffApp(uint64_t sb_n_users,
                 double sb_prob_choose_mtx,
                 double sb_skew_factor,
+                size_t exec_threads,
+                bool speculation,
+                const std::string &ckpt_dir,
+                uint32_t ckpt_interval,
                 double fairness_parameter,      // Us
                 uint32_t blk_size,
                 double stat_period,
+                uint32_t prune_staleness,
                 double impeach_timeout,
                 ReplicaID idx,
                 const bytearray_t &raw_privkey,
@@ -148,6 +300,21 @@ class HotStuffApp: public HotStuff {
 
     void start(const std::vector<std::tuple<NetAddr, bytearray_t, bytearray_t>> &reps, double fairness_parameter); // Us
     void stop();
+    /** Catch up with the checkpoints of the peers (the client addresses of
+     * the other replicas) when lagging lag checkpoints behind them. */
+    void set_catch_up(const std::vector<NetAddr> &peers, size_t nfaulty,
+                    uint32_t lag, double timeout) {
+        ckpt_peers = peers;
+        this->nfaulty = nfaulty;
+        catch_up_lag = lag;
+        ckpt_fetch_timeout = timeout;
+    }
+    /** Sample the stacks of all threads for `duration` seconds, into
+     * profile-<id>-<n>.folded. */
+    bool start_profile(double duration, unsigned freq);
+    /** Register the commands inspecting and tuning this replica. */
+    void reg_admin_cmds(AdminServer &admin,
+                        double profile_duration, unsigned profile_freq);
 };
 
 std::pair<std::string, std::string> split_ip_port_cport(const std::string &s) {
@@ -157,6 +324,279 @@ std::pair<std::string, std::string> split_ip_port_cport(const std::string &s) {
     return std::make_pair(ret[0], ret[1]);
 }
 
+/* the number of checkpoints a replica keeps */
+static const size_t CKPTS_KEPT = 2;
+
+/** The checkpoint files are named after the height of the last block they
+ * include. */
+static std::string ckpt_file(const std::string &dir, uint64_t height) {
+    return dir + "/sb-" + std::to_string(height) + ".ckpt";
+}
+
+/** The checkpoint files in dir, by increasing height. */
+static std::vector<std::pair<uint64_t, std::string>> list_ckpt_files(const std::string &dir) {
+    std::vector<std::pair<uint64_t, std::string>> res;
+    DIR *d = opendir(dir.c_str());
+    if (!d) return res;
+    while (auto e = readdir(d))
+    {
+        unsigned long long height;
+        int n = 0;
+        if (sscanf(e->d_name, "sb-%llu.ckpt%n", &height, &n) == 1 && n > 0 &&
+            e->d_name[n] == '\0')
+            res.push_back(std::make_pair(height, dir + "/" + e->d_name));
+    }
+    closedir(d);
+    std::sort(res.begin(), res.end());
+    return res;
+}
+
+/** Fetch into dir the latest checkpoint above height `above` that nfaulty + 1
+ * of the peers (the client addresses of the other replicas) have, and return
+ * its path; an empty string if none shows up within timeout seconds (or once
+ * all the peers answered), if the transfer fails or is cancelled (checked
+ * every second). The chunk hashes are fetched first and checked against the
+ * digest the peers vouched for; then the chunks are spread over the peers
+ * having the checkpoint, a few at a time, and each is checked against its
+ * hash before it is written: a peer sending a bad chunk is dropped, and the
+ * chunk asked again from the next one, as whenever the transfer stalls. */
+static std::string fetch_ckpt(const std::vector<NetAddr> &peers, size_t nfaulty,
+                            uint64_t n_users, uint64_t above,
+                            const std::string &dir, double timeout,
+                            const std::atomic<bool> *cancel = nullptr) {
+    using Net = MsgNetwork<opcode_t>;
+    const size_t window = 8;
+    const size_t max_stalls = 10;
+    const uint64_t size = SmallBank::ckpt_size(n_users);
+    const uint64_t data_size = SmallBank::ckpt_data_size(n_users);
+    const uint64_t hashes_offset = SmallBank::ckpt_hashes_offset(n_users);
+    const uint64_t hashes_size = size - hashes_offset;
+    enum { TODO, ASKED, DONE };
+
+    EventContext ec;
+    Net net(ec, Net::Config().max_msg_size(
+                std::max<uint64_t>(CKPT_CHUNK_SIZE, hashes_size) + 4096));
+    std::vector<Net::conn_t> conns;
+    /* the (height, digest) of the checkpoints of each peer */
+    std::vector<std::vector<std::pair<uint64_t, uint256_t>>> offers(peers.size());
+    std::vector<bool> answered(peers.size(), false);
+    std::pair<uint64_t, uint256_t> target;
+    std::vector<size_t> sources;
+    size_t next_source = 0;
+    /* the chunk hashes, once checked against the digest */
+    bytearray_t hashes;
+    std::vector<uint8_t> chunks(SmallBank::ckpt_nchunks(n_users), TODO);
+    size_t nasked = 0, ndone = 0, nstalls = 0;
+    bool failed = false;
+    int fd = -1;
+    std::string tmp;
+    ElapsedTime et;
+
+    auto peer_of = [&](const Net::conn_t &conn) {
+        return (size_t)(std::find(conns.begin(), conns.end(), conn) - conns.begin());
+    };
+    auto next_peer = [&]() {
+        return conns[sources[next_source++ % sources.size()]];
+    };
+    auto ask_chunks = [&]() {
+        if (hashes.empty())
+        {
+            net.send_msg(MsgReqCkptChunk(target.first, hashes_offset, hashes_size),
+                        next_peer());
+            return;
+        }
+        for (size_t i = 0; i < chunks.size() && nasked < window; i++)
+            if (chunks[i] == TODO)
+            {
+                uint64_t offset = i * (uint64_t)CKPT_CHUNK_SIZE;
+                net.send_msg(MsgReqCkptChunk(target.first, CKPT_DATA_OFFSET + offset,
+                                std::min<uint64_t>(CKPT_CHUNK_SIZE, data_size - offset)),
+                            next_peer());
+                chunks[i] = ASKED;
+                nasked++;
+            }
+    };
+    /* stop asking peer i; false if no peer is left */
+    auto drop = [&](size_t i) {
+        sources.erase(std::remove(sources.begin(), sources.end(), i), sources.end());
+        if (!sources.empty()) return true;
+        HOTSTUFF_LOG_WARN("no replica left to fetch the checkpoint at height %lu from",
+                        target.first);
+        failed = true;
+        ec.stop();
+        return false;
+    };
+    /* the highest checkpoint enough peers agree on */
+    auto choose = [&]() {
+        std::map<std::pair<uint64_t, uint256_t>, std::vector<size_t>> holders;
+        for (size_t i = 0; i < offers.size(); i++)
+            for (const auto &c: offers[i])
+                holders[c].push_back(i);
+        for (auto it = holders.rbegin(); it != holders.rend(); it++)
+            if (it->first.first > above && it->second.size() > nfaulty)
+            {
+                target = it->first;
+                sources = it->second;
+                tmp = ckpt_file(dir, target.first) + ".tmp";
+                fd = open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+                if (fd < 0 || ftruncate(fd, size))
+                    throw HotStuffError("cannot create %s: %s", tmp.c_str(), strerror(errno));
+                HOTSTUFF_LOG_INFO("fetching the checkpoint at height %lu (%lu bytes) from %lu replicas",
+                                target.first, size, sources.size());
+                et.start();
+                ask_chunks();
+                return;
+            }
+    };
+
+    net.reg_handler([&](MsgRespCkpt &&msg, const Net::conn_t &conn) {
+        size_t i = peer_of(conn);
+        if (i == conns.size() || fd >= 0) return;
+        /* a checkpoint of another size has another number of users */
+        if (msg.size == size) offers[i] = std::move(msg.ckpts);
+        answered[i] = true;
+        if (std::all_of(answered.begin(), answered.end(), [](bool a) { return a; }))
+        {
+            choose();
+            /* none newer anywhere */
+            if (fd < 0) ec.stop();
+        }
+    });
+    net.reg_handler([&](MsgRespCkptChunk &&msg, const Net::conn_t &conn) {
+        size_t i = peer_of(conn);
+        if (fd < 0 || failed || i == conns.size() || msg.height != target.first)
+            return;
+        uint8_t md[CKPT_HASH_SIZE];
+        if (hashes.empty())
+        {
+            if (msg.offset != hashes_offset) return;
+            SmallBank::sha256(msg.data.data(), msg.data.size(), md);
+            if (msg.data.size() == hashes_size &&
+                uint256_t(md) == target.second)
+            {
+                hashes = std::move(msg.data);
+                nstalls = 0;
+            }
+            else
+            {
+                HOTSTUFF_LOG_WARN("bad chunk hashes from replica %s", std::string(peers[i]).c_str());
+                if (!drop(i)) return;
+            }
+            ask_chunks();
+            return;
+        }
+        uint64_t offset = msg.offset - CKPT_DATA_OFFSET;
+        size_t c = offset / CKPT_CHUNK_SIZE;
+        if (msg.offset < CKPT_DATA_OFFSET || offset % CKPT_CHUNK_SIZE ||
+            c >= chunks.size() || chunks[c] != ASKED)
+            return;
+        chunks[c] = TODO;
+        nasked--;
+        SmallBank::sha256(msg.data.data(), msg.data.size(), md);
+        if (msg.data.size() != std::min<uint64_t>(CKPT_CHUNK_SIZE, data_size - offset) ||
+            memcmp(md, &hashes[c * CKPT_HASH_SIZE], CKPT_HASH_SIZE))
+        {
+            /* the peer no longer has the checkpoint, or lies about it */
+            if (!msg.data.empty())
+                HOTSTUFF_LOG_WARN("bad chunk %lu from replica %s", c, std::string(peers[i]).c_str());
+            if (!drop(i)) return;
+        }
+        else
+        {
+            if (pwrite(fd, msg.data.data(), msg.data.size(), msg.offset) != (ssize_t)msg.data.size())
+            {
+                HOTSTUFF_LOG_WARN("cannot write %s: %s", tmp.c_str(), strerror(errno));
+                failed = true;
+                ec.stop();
+                return;
+            }
+            chunks[c] = DONE;
+            nstalls = 0;
+            if (++ndone == chunks.size())
+            {
+                ec.stop();
+                return;
+            }
+        }
+        ask_chunks();
+    });
+    net.start();
+    for (const auto &addr: peers)
+        conns.push_back(net.connect_sync(addr));
+    for (const auto &conn: conns)
+        net.send_msg(MsgReqCkpt(), conn);
+
+    double waited = 0;
+    TimerEvent tick(ec, [&](TimerEvent &) {
+        if (cancel && cancel->load())
+        {
+            failed = true;
+            ec.stop();
+            return;
+        }
+        if (fd < 0)
+        {
+            /* go with the answers so far, or ask again */
+            choose();
+            if (fd < 0)
+            {
+                if ((waited += 1) >= timeout)
+                {
+                    ec.stop();
+                    return;
+                }
+                for (size_t i = 0; i < conns.size(); i++)
+                    if (!answered[i]) net.send_msg(MsgReqCkpt(), conns[i]);
+            }
+        }
+        else if (nstalls++ > 0)
+        {
+            if (nstalls > max_stalls)
+            {
+                HOTSTUFF_LOG_WARN("the transfer of the checkpoint at height %lu stalled",
+                                target.first);
+                failed = true;
+                ec.stop();
+                return;
+            }
+            /* nothing for a second: ask for the missing chunks again, from
+             * the next peers */
+            for (auto &c: chunks)
+                if (c == ASKED) c = TODO;
+            nasked = 0;
+            ask_chunks();
+        }
+        tick.add(1);
+    });
+    tick.add(1);
+    ec.dispatch();
+    tick.del();
+    net.stop();
+
+    if (fd < 0) return "";
+    /* the header is the one vouched for, the hashes were checked against it */
+    uint8_t head[CKPT_DATA_OFFSET] = {};
+    SmallBankCkptHeader header{CKPT_MAGIC, n_users, target.first, {}};
+    memcpy(header.digest, target.second.to_bytes().data(), CKPT_HASH_SIZE);
+    memcpy(head, &header, sizeof(header));
+    failed = failed ||
+            pwrite(fd, head, sizeof(head), 0) != (ssize_t)sizeof(head) ||
+            pwrite(fd, hashes.data(), hashes.size(), hashes_offset) != (ssize_t)hashes.size() ||
+            fsync(fd);
+    close(fd);
+    auto path = ckpt_file(dir, target.first);
+    if (failed || rename(tmp.c_str(), path.c_str()))
+    {
+        unlink(tmp.c_str());
+        HOTSTUFF_LOG_WARN("failed to fetch the checkpoint at height %lu", target.first);
+        return "";
+    }
+    et.stop();
+    HOTSTUFF_LOG_INFO("fetched the checkpoint at height %lu in %.3f sec",
+                    target.first, et.elapsed_sec);
+    return path;
+}
+
 salticidae::BoxObj<HotStuffApp> papp = nullptr;
 
 int main(int argc, char **argv) {
@@ -168,10 +608,28 @@ int main(int argc, char **argv) {
     auto opt_sb_users = Config::OptValInt::create(10);
     auto opt_sb_prob_choose_mtx = Config::OptValDouble::create(0.9);
     auto opt_sb_skew_factor = Config::OptValDouble::create(0.1);
+    auto opt_exec_threads = Config::OptValInt::create(1);
+    auto opt_speculate = Config::OptValFlag::create(false);
+    auto opt_ckpt_dir = Config::OptValStr::create();
+    auto opt_ckpt_interval = Config::OptValInt::create(1000);
+    auto opt_state_transfer = Config::OptValFlag::create(false);
+    auto opt_state_transfer_timeout = Config::OptValDouble::create(10);
+    auto opt_catch_up_lag = Config::OptValInt::create(2);
     auto opt_fairness_parameter = Config::OptValDouble::create(1/2);  // Themis
     auto opt_blk_size = Config::OptValInt::create(1);
-    auto opt_parent_limit = Config::OptValInt::create(-1);
+    auto opt_parent_limit = Config::OptValInt::create(1);
     auto opt_stat_period = Config::OptValDouble::create(10);
+    auto opt_prune_staleness = Config::OptValInt::create(0);
+    auto opt_blk_profile_csv = Config::OptValStr::create();
+    auto opt_trace_sample = Config::OptValDouble::create(0);
+    auto opt_trace_out = Config::OptValStr::create();
+    auto opt_metrics_port = Config::OptValInt::create(0);
+    auto opt_async_log = Config::OptValFlag::create(false);
+    auto opt_async_log_bin = Config::OptValStr::create();
+    auto opt_profile_duration = Config::OptValDouble::create(10);
+    auto opt_profile_freq = Config::OptValInt::create(99);
+    auto opt_admin_socket = Config::OptValStr::create();
+    auto opt_record = Config::OptValStr::create();
     auto opt_replicas = Config::OptValStrVec::create();
     auto opt_idx = Config::OptValInt::create(0);
     auto opt_client_port = Config::OptValInt::create(-1);
@@ -196,10 +654,28 @@ int main(int argc, char **argv) {
     config.add_opt("sb-users", opt_sb_users, Config::SET_VAL);
     config.add_opt("sb-prob-choose_mtx", opt_sb_prob_choose_mtx, Config::SET_VAL);
     config.add_opt("sb-skew-factor", opt_sb_skew_factor, Config::SET_VAL);
+    config.add_opt("exec-threads", opt_exec_threads, Config::SET_VAL, -1, "the number of threads executing the SmallBank transactions of a decided block");
+    config.add_opt("speculate", opt_speculate, Config::SWITCH_ON, -1, "execute the blocks upon voting and undo them if they do not commit");
+    config.add_opt("ckpt-dir", opt_ckpt_dir, Config::SET_VAL, -1, "keep checkpoints of the SmallBank state in this directory, and start from the latest one");
+    config.add_opt("ckpt-interval", opt_ckpt_interval, Config::SET_VAL, -1, "checkpoint the state every this many heights");
+    config.add_opt("state-transfer", opt_state_transfer, Config::SWITCH_ON, -1, "before starting, fetch into ckpt-dir the latest checkpoint of the other replicas if newer than ours");
+    config.add_opt("state-transfer-timeout", opt_state_transfer_timeout, Config::SET_VAL, -1, "how long to look for a checkpoint to fetch (in seconds)");
+    config.add_opt("catch-up-lag", opt_catch_up_lag, Config::SET_VAL, -1, "fetch the latest checkpoint of the other replicas when this many ckpt-intervals behind it, checked every stat-period (0 to disable)");
     config.add_opt("fairness-parameter", opt_fairness_parameter, Config::SET_VAL);  // Us
     config.add_opt("block-size", opt_blk_size, Config::SET_VAL);
-    config.add_opt("parent-limit", opt_parent_limit, Config::SET_VAL);
+    config.add_opt("parent-limit", opt_parent_limit, Config::SET_VAL, -1, "maximum number of parents of a proposed block (-1 for all tails)");
     config.add_opt("stat-period", opt_stat_period, Config::SET_VAL);
+    config.add_opt("prune-staleness", opt_prune_staleness, Config::SET_VAL, 'P', "prune the blocks this many heights below the last executed one (0 to disable)");
+    config.add_opt("blk-profile-csv", opt_blk_profile_csv, Config::SET_VAL, -1, "write the per-block phase timestamps to a CSV file (needs HOTSTUFF_BLK_PROFILE)");
+    config.add_opt("trace-sample", opt_trace_sample, Config::SET_VAL, -1, "trace the lifecycle of this fraction of the commands (0 to disable)");
+    config.add_opt("trace-out", opt_trace_out, Config::SET_VAL, -1, "where to write the command trace upon exit (default: trace-<idx>.json)");
+    config.add_opt("metrics-port", opt_metrics_port, Config::SET_VAL, -1, "serve the metrics in Prometheus format on this local port (0 to disable)");
+    config.add_opt("async-log", opt_async_log, Config::SWITCH_ON, -1, "format and write the log on a background thread");
+    config.add_opt("async-log-bin", opt_async_log_bin, Config::SET_VAL, -1, "write the log in binary to this file, to be read with hotstuff-logdecode");
+    config.add_opt("profile-duration", opt_profile_duration, Config::SET_VAL, -1, "how long to sample the stacks upon SIGUSR2 (in seconds)");
+    config.add_opt("profile-freq", opt_profile_freq, Config::SET_VAL, -1, "stack sampling frequency (in Hz)");
+    config.add_opt("record", opt_record, Config::SET_VAL, -1, "log the inputs of the consensus to this file, to be replayed by hotstuff-replay");
+    config.add_opt("admin-socket", opt_admin_socket, Config::SET_VAL, -1, "accept inspection and tuning commands on this Unix socket");
     config.add_opt("replica", opt_replicas, Config::APPEND, 'a', "add an replica to the list");
     config.add_opt("idx", opt_idx, Config::SET_VAL, 'i', "specify the index in the replica list");
     config.add_opt("cport", opt_client_port, Config::SET_VAL, 'c', "specify the port listening for clients");
@@ -228,6 +704,10 @@ int main(int argc, char **argv) {
         config.print_help();
         exit(0);
     }
+    if (!opt_async_log_bin->get().empty())
+        hotstuff::AsyncLogger::start(hotstuff::AsyncLogger::BINARY, opt_async_log_bin->get());
+    else if (opt_async_log->get())
+        hotstuff::AsyncLogger::start(hotstuff::AsyncLogger::TEXT);
     auto idx = opt_idx->get();
     auto client_port = opt_client_port->get();
     std::vector<std::tuple<std::string, std::string, std::string>> replicas;
@@ -287,12 +767,37 @@ int main(int argc, char **argv) {
         .nworker(opt_clinworker->get());
 
     HOTSTUFF_LOG_INFO("[[main]] sb_users = %ld", opt_sb_users->get());
+    auto ckpt_dir = opt_ckpt_dir->get();
+    if (opt_state_transfer->get() && ckpt_dir.empty())
+        throw HotStuffError("state transfer needs a ckpt-dir");
+    /* where the other replicas serve their checkpoints */
+    std::vector<NetAddr> ckpt_peers;
+    size_t nfaulty = (replicas.size() - 1) / 3;
+    for (size_t i = 0; i < replicas.size() && !ckpt_dir.empty(); i++)
+    {
+        if (i == (size_t)idx) continue;
+        auto p = split_ip_port_cport(std::get<0>(replicas[i]));
+        ckpt_peers.push_back(NetAddr(NetAddr(p.first).ip, htons(stoi(p.second))));
+    }
+    if (opt_state_transfer->get())
+    {
+        auto local = list_ckpt_files(ckpt_dir);
+        uint64_t above = local.empty() ? 0 : local.back().first;
+        if (fetch_ckpt(ckpt_peers, nfaulty, opt_sb_users->get(), above, ckpt_dir,
+                        opt_state_transfer_timeout->get()).empty())
+            HOTSTUFF_LOG_WARN("no checkpoint above height %lu fetched", above);
+    }
     papp = new HotStuffApp(opt_sb_users->get(),
                         opt_sb_prob_choose_mtx->get(),
                         opt_sb_skew_factor->get(),
+                        std::max(opt_exec_threads->get(), 1),
+                        opt_speculate->get(),
+                        ckpt_dir,
+                        std::max(opt_ckpt_interval->get(), 1),
                         opt_fairness_parameter->get(),   // Us
                         opt_blk_size->get(),
                         opt_stat_period->get(),
+                        opt_prune_staleness->get(),
                         opt_imp_timeout->get(),
                         idx,
                         hotstuff::from_hex(opt_privkey->get()),
@@ -303,6 +808,17 @@ int main(int argc, char **argv) {
                         opt_nworker->get(),
                         repnet_config,
                         clinet_config);
+    if (!ckpt_dir.empty() && opt_catch_up_lag->get() > 0)
+        papp->set_catch_up(ckpt_peers, nfaulty, opt_catch_up_lag->get(),
+                            opt_state_transfer_timeout->get());
+    if (!opt_blk_profile_csv->get().empty())
+    {
+#ifdef HOTSTUFF_BLK_PROFILE
+        papp->get_blk_profiler().open_csv(opt_blk_profile_csv->get());
+#else
+        HOTSTUFF_LOG_WARN("block profiling is not compiled in, ignoring --blk-profile-csv");
+#endif
+    }
     std::vector<std::tuple<NetAddr, bytearray_t, bytearray_t>> reps;
     for (auto &r: replicas)
     {
@@ -317,8 +833,36 @@ int main(int argc, char **argv) {
     salticidae::SigEvent ev_sigterm(ec, shutdown);
     ev_sigint.add(SIGINT);
     ev_sigterm.add(SIGTERM);
+    salticidae::SigEvent ev_sigusr2(ec, [&](int) {
+        if (!papp->start_profile(opt_profile_duration->get(), opt_profile_freq->get()))
+            HOTSTUFF_LOG_WARN("a profiling session is already running");
+    });
+    ev_sigusr2.add(SIGUSR2);
 
+    salticidae::BoxObj<hotstuff::MetricsServer> metrics_server;
+    if (opt_metrics_port->get() > 0)
+        metrics_server = new hotstuff::MetricsServer(papp->get_metrics(), opt_metrics_port->get());
+    salticidae::BoxObj<AdminServer> admin_server;
+    if (!opt_admin_socket->get().empty())
+    {
+        admin_server = new AdminServer(opt_admin_socket->get());
+        papp->reg_admin_cmds(*admin_server,
+                            opt_profile_duration->get(), opt_profile_freq->get());
+    }
+    CmdTracer::enable(opt_trace_sample->get());
+    if (!opt_record->get().empty())
+        papp->start_recording(opt_record->get());
     papp->start(reps, opt_fairness_parameter->get());  // Us
+    papp->stop_recording();
+    if (CmdTracer::is_enabled())
+    {
+        auto fname = opt_trace_out->get();
+        if (fname.empty()) fname = "trace-" + std::to_string(idx) + ".json";
+        size_t n = CmdTracer::export_chrome_trace(fname, idx);
+        HOTSTUFF_LOG_INFO("%lu traced commands written to %s", n, fname.c_str());
+    }
+    StackSampler::stop();
+    hotstuff::AsyncLogger::stop();
     elapsed.stop(true);
     return 0;
 }
@@ -326,9 +870,14 @@ int main(int argc, char **argv) {
 HotStuffApp::HotStuffApp(uint64_t sb_n_users,
                         double sb_prob_choose_mtx,
                         double sb_skew_factor,
+                        size_t exec_threads,
+                        bool speculation,
+                        const std::string &ckpt_dir,
+                        uint32_t ckpt_interval,
                         double fairness_parameter,  // Us
                         uint32_t blk_size,
                         double stat_period,
+                        uint32_t prune_staleness,
                         double impeach_timeout,
                         ReplicaID idx,
                         const bytearray_t &raw_privkey,
@@ -342,22 +891,79 @@ HotStuffApp::HotStuffApp(uint64_t sb_n_users,
     HotStuff(blk_size, idx, raw_privkey,
             plisten_addr, std::move(pmaker), ec, nworker, repnet_config),
     stat_period(stat_period),
+    prune_staleness(prune_staleness),
     impeach_timeout(impeach_timeout),
     ec(ec),
     cn(req_ec, clinet_config),
-    clisten_addr(clisten_addr) {
+    clisten_addr(clisten_addr),
+    nprofiles(0),
+    speculation(speculation),
+    spec_confirmed(metrics.counter("hotstuff_spec_blocks_confirmed",
+        "speculatively executed blocks that committed")),
+    spec_undone(metrics.counter("hotstuff_spec_blocks_undone",
+        "speculatively executed blocks that were rolled back")),
+    ckpt_dir(ckpt_dir),
+    ckpt_interval(ckpt_interval),
+    base_height(0),
+    ckpt_pid(-1),
+    ckpt_pending_height(0),
+    catch_up_lag(0),
+    nfaulty(0),
+    ckpt_fetch_timeout(0),
+    catch_up_running(false),
+    catch_up_cancel(false) {
 
     // small bank manager object
-    small_bank_manager = new SmallBankManager(sb_n_users, sb_prob_choose_mtx, sb_skew_factor);
+    SmallBank *bank = nullptr;
+    if (!ckpt_dir.empty())
+    {
+        /* start from the latest checkpoint that loads */
+        auto files = list_ckpt_files(ckpt_dir);
+        for (auto it = files.rbegin(); it != files.rend() && !bank; it++)
+        {
+            try {
+                ElapsedTime et;
+                SmallBankCkptHeader header;
+                et.start();
+                bank = new SmallBank(it->second, true, header);
+                et.stop();
+                if (header.n_users != sb_n_users)
+                {
+                    HOTSTUFF_LOG_WARN("%s does not have %lu users", it->second.c_str(), sb_n_users);
+                    delete bank;
+                    bank = nullptr;
+                    continue;
+                }
+                base_height = header.height;
+                HOTSTUFF_LOG_INFO("loaded the checkpoint at height %lu (digest %s) in %.3f sec",
+                                header.height, get_hex10(uint256_t(header.digest)).c_str(),
+                                et.elapsed_sec);
+            } catch (std::exception &e) {
+                /* not to be tried again on the next start */
+                HOTSTUFF_LOG_WARN("%s: removed", e.what());
+                unlink(it->second.c_str());
+            }
+        }
+        if (bank)
+            for (const auto &f: files)
+                if (f.first <= base_height) add_checkpoint(f.second);
+    }
+    small_bank_manager = bank ?
+        new SmallBankManager(bank, sb_prob_choose_mtx, sb_skew_factor) :
+        new SmallBankManager(sb_n_users, sb_prob_choose_mtx, sb_skew_factor);
+    executor = new SmallBankExecutor(small_bank_manager, exec_threads);
+    set_speculation(speculation);
 
     /* prepare the thread used for sending back confirmations */
     resp_tcall = new salticidae::ThreadCall(resp_ec);
     req_tcall = new salticidae::ThreadCall(req_ec);
     resp_queue.reg_handler(resp_ec, [this](resp_queue_t &q) {
-        std::pair<Finality, NetAddr> p;
+        HOTSTUFF_ALLOC_SCOPE(RESPOND);
+        resp_t p;
         while (q.try_dequeue(p))
         {
             try {
+                CmdTracer::record(p.first.cmd_hash, TraceEvent::RESPONDED);
                 cn.send_msg(MsgRespCmd(std::move(p.first)), p.second);
             } catch (std::exception &err) {
                 HOTSTUFF_LOG_WARN("unable to send to the client: %s", err.what());
@@ -366,16 +972,42 @@ HotStuffApp::HotStuffApp(uint64_t sb_n_users,
         return false;
     });
 
+    query_resp_queue.reg_handler(resp_ec, [this](query_resp_queue_t &q) {
+        QueryAnswer a;
+        while (q.try_dequeue(a))
+        {
+            try {
+                cn.send_msg(MsgRespQuery(a.qid, a.height, a.ok, a.result), a.addr);
+            } catch (std::exception &err) {
+                HOTSTUFF_LOG_WARN("unable to send to the client: %s", err.what());
+            }
+        }
+        return false;
+    });
+    query_queue.reg_handler(ec, [this](query_queue_t &q) {
+        Query query;
+        while (q.try_dequeue(query))
+            query_resp_queue.enqueue(answer_query(std::move(query)));
+        return false;
+    });
+
     /* register the handlers for msg from clients */
     cn.reg_handler(salticidae::generic_bind(&HotStuffApp::client_request_cmd_handler, this, _1, _2));
+    cn.reg_handler(salticidae::generic_bind(&HotStuffApp::client_query_handler, this, _1, _2));
+    cn.reg_handler(salticidae::generic_bind(&HotStuffApp::client_ckpt_handler, this, _1, _2));
+    cn.reg_handler(salticidae::generic_bind(&HotStuffApp::client_ckpt_chunk_handler, this, _1, _2));
+    auto threads = StackSampler::list_threads();
     cn.start();
+    StackSampler::set_new_threads_role(threads, "client-net");
     cn.listen(clisten_addr);
 }
 
 void HotStuffApp::client_request_cmd_handler(MsgReqCmd &&msg, const conn_t &conn) {
+    HOTSTUFF_ALLOC_SCOPE(INGRESS);
     const NetAddr addr = conn->get_addr();
     auto cmd = parse_cmd_with_payload(msg.serialized);
     const auto &cmd_hash = cmd->get_hash(); 
+    CmdTracer::record(cmd_hash, TraceEvent::CLIENT_IN);
 
     std::string data = "";
     for(int i=0; i<cmd->get_payload_size(); i++){
@@ -383,35 +1015,332 @@ void HotStuffApp::client_request_cmd_handler(MsgReqCmd &&msg, const conn_t &conn
     }
     HOTSTUFF_LOG_DEBUG("[[client_request_cmd_handler]] Payload Received [%.10s] = %s", get_hex(cmd->get_hash()).c_str(), data.c_str());                          
     HOTSTUFF_LOG_DEBUG("processing %s", std::string(*cmd).c_str()); 
+    if (speculation)
+    {
+        std::lock_guard<std::mutex> _(pending_lock);
+        pending_payloads.emplace(cmd_hash, cmd->get_payload());
+    }
 
     exec_command(cmd_hash, [this, addr, cmd](Finality fin) {
+        /* a duplicate of a command still pending: answered right away, the
+         * transaction is only executed once */
+        if (fin.decision != 1)
+        {
+            resp_t resp(std::move(fin), addr);
+            queue_responses(&resp, 1);
+            return;
+        }
+        /* Executed with the rest of the block, before sending the response
+         * to the client (see do_decide_block) */
+        exec_batch.push_back(PendingExec{cmd->get_payload(), std::move(fin), addr});
+    });
+}
+
+void HotStuffApp::client_query_handler(MsgReqQuery &&msg, const conn_t &conn) {
+    query_queue.enqueue(Query{msg.qid, std::move(msg.payload), conn->get_addr()});
+}
+
+void HotStuffApp::client_ckpt_handler(MsgReqCkpt &&, const conn_t &conn) {
+    std::vector<std::pair<uint64_t, uint256_t>> res;
+    uint64_t size = 0;
+    {
+        std::lock_guard<std::mutex> _(ckpt_lock);
+        for (const auto &c: ckpts)
+        {
+            res.push_back(std::make_pair(c->height, c->digest));
+            size = c->size;
+        }
+    }
+    cn.send_msg(MsgRespCkpt(res, size), conn);
+}
 
-         /* Execute the transaction before sending response to the client */
-        small_bank_manager->execute_transaction(cmd->get_payload());
+void HotStuffApp::client_ckpt_chunk_handler(MsgReqCkptChunk &&msg, const conn_t &conn) {
+    /* bounds the memory a request takes */
+    static const uint32_t max_chunk = 4 << 20;
+    std::shared_ptr<const Checkpoint> ckpt;
+    {
+        std::lock_guard<std::mutex> _(ckpt_lock);
+        for (const auto &c: ckpts)
+            if (c->height == msg.height) ckpt = c;
+    }
+    bytearray_t data;
+    if (ckpt && msg.offset < ckpt->size)
+    {
+        data.resize(std::min<uint64_t>(std::min(msg.len, max_chunk),
+                                        ckpt->size - msg.offset));
+        /* (the file outlives its removal while in use) */
+        if (pread(ckpt->fd, data.data(), data.size(), msg.offset) != (ssize_t)data.size())
+            data.clear();
+    }
+    cn.send_msg(MsgRespCkptChunk(msg.height, msg.offset, data), conn);
+}
 
+HotStuffApp::QueryAnswer HotStuffApp::answer_query(Query &&q) {
+    QueryAnswer a{q.qid, (uint32_t)get_state_height(), false, {0, 0}, q.addr};
+    std::vector<uint64_t> users;
+    /* only the SmallBank query reads a single user */
+    if (q.payload.size() < 2 || q.payload[0] != TX_TYPES - 1 ||
+        SmallBankManager::get_tx_users(q.payload.data(), users) ||
+        users.size() != 1 || users[0] >= small_bank_manager->get_n_users())
+        return a;
+    a.ok = true;
+    /* the state may be ahead with speculated blocks: the first undo entry
+     * of the user holds its accounts as of the last executed block */
+    for (const auto &sb: spec_chain)
+        for (const auto &e: sb.undo)
+            if (e.user_id == users[0])
+            {
+                a.result = std::make_pair(e.checking, e.saving);
+                return a;
+            }
+    a.result = small_bank_manager->execute_transaction(q.payload.data());
+    return a;
+}
 
-        // std::string data = "";
-        // for(int i=0; i<cmd->get_payload_size(); i++){
-        //     data += std::to_string(cmd->get_payload()[i]) + " ";
-        // }
-        // HOTSTUFF_LOG_DEBUG("[[Callback]] Payload Executed [%.10s] = %s", get_hex(cmd->get_hash()).c_str(), data.c_str());
+void HotStuffApp::do_speculate(const hotstuff::block_t &blk,
+                            const std::vector<hotstuff::Hash256> &order) {
+    /* the state is ahead of the committed blocks until they reach the
+     * checkpoint it was loaded from */
+    if (get_last_executed()->get_height() < base_height) return;
+    const auto &parent = blk->get_parents()[0];
+    /* undo what blk does not extend */
+    while (!spec_chain.empty() && spec_chain.back().blk != parent)
+        spec_undo_last();
+    if (spec_chain.empty())
+    {
+        /* start over from the last executed block, with the (uncommitted)
+         * blocks between it and blk */
+        const auto &b_exec = get_last_executed();
+        std::vector<hotstuff::block_t> path;
+        hotstuff::block_t b = parent;
+        for (; b != b_exec && b->get_height() > b_exec->get_height();
+                b = b->get_parents()[0])
+            path.push_back(b);
+        if (b != b_exec) return;
+        for (auto it = path.rbegin(); it != path.rend(); it++)
+            spec_execute(*it, fair_finalize(*it));
+    }
+    spec_execute(blk, order);
+}
 
-        resp_queue.enqueue(std::make_pair(fin, addr));
+void HotStuffApp::spec_execute(const hotstuff::block_t &blk,
+                            const std::vector<hotstuff::Hash256> &order) {
+    HOTSTUFF_ALLOC_SCOPE(EXECUTE);
+    spec_chain.push_back(SpecBlock{blk, {}, {}});
+    auto &sb = spec_chain.back();
+    exec_payloads.clear();
+    {
+        std::lock_guard<std::mutex> _(pending_lock);
+        for (const auto &cmd_hash: order)
+        {
+            auto it = pending_payloads.find(cmd_hash);
+            if (it == pending_payloads.end()) continue;
+            sb.cmds.push_back(cmd_hash);
+            exec_payloads.push_back(it->second);
+        }
+    }
+    small_bank_manager->log_undo(exec_payloads, sb.undo);
+    executor->execute_batch(exec_payloads, exec_results);
+}
+
+void HotStuffApp::spec_undo_last() {
+    small_bank_manager->rollback(spec_chain.back().undo);
+    spec_chain.pop_back();
+    spec_undone.inc();
+}
+
+void HotStuffApp::queue_responses(resp_t *resps, size_t n) {
+    while (n)
+    {
+        size_t k = resp_queue.enqueue_bulk(resps, n);
+        resps += k;
+        if (!(n -= k)) break;
+        std::this_thread::yield();
+    }
+}
+
+void HotStuffApp::do_decide_block(const hotstuff::block_t &blk) {
+    /* the blocks up to the checkpoint loaded are in the state already */
+    bool executed = blk->get_height() <= base_height;
+    if (!executed && !spec_chain.empty())
+    {
+        /* the speculation holds if it executed the very commands the
+         * commit does: a command may have reached the replica after the
+         * vote, or been decided in an earlier block meanwhile */
+        const auto &sb = spec_chain.front();
+        executed = sb.blk == blk && sb.cmds.size() == exec_batch.size();
+        for (size_t i = 0; executed && i < exec_batch.size(); i++)
+            executed = sb.cmds[i] == hotstuff::Hash256(exec_batch[i].fin.cmd_hash);
+        if (executed)
+        {
+            spec_chain.pop_front();
+            spec_confirmed.inc();
+        }
+        else
+        {
+            /* the rest of the chain was built on top of it */
+            while (!spec_chain.empty())
+                spec_undo_last();
+        }
+    }
+    if (!exec_batch.empty())
+    {
+        if (!executed)
+        {
+            HOTSTUFF_ALLOC_SCOPE(EXECUTE);
+            exec_payloads.clear();
+            for (const auto &e: exec_batch)
+                exec_payloads.push_back(e.payload);
+            executor->execute_batch(exec_payloads, exec_results);
+#ifdef HOTSTUFF_BLK_PROFILE
+            get_blk_profiler().rec_last(blk->get_hash(), hotstuff::BlockProfiler::EXECUTED);
+#endif
+        }
+        if (speculation)
+        {
+            std::lock_guard<std::mutex> _(pending_lock);
+            for (const auto &e: exec_batch)
+                pending_payloads.erase(e.fin.cmd_hash);
+        }
+        HOTSTUFF_ALLOC_SCOPE(RESPOND);
+        resp_buff.clear();
+        for (auto &e: exec_batch)
+        {
+            CmdTracer::record(e.fin.cmd_hash, TraceEvent::EXECUTED);
+            resp_buff.emplace_back(std::move(e.fin), e.addr);
+        }
+        queue_responses(resp_buff.data(), resp_buff.size());
+#ifdef HOTSTUFF_BLK_PROFILE
+        get_blk_profiler().rec_last(blk->get_hash(), hotstuff::BlockProfiler::RESPONDED);
+#endif
+        exec_batch.clear();
+    }
+    if (ckpt_dir.empty()) return;
+    reap_checkpoint(false);
+    if (blk->get_height() > base_height && blk->get_height() % ckpt_interval == 0)
+        take_checkpoint(blk->get_height());
+}
+
+void HotStuffApp::take_checkpoint(uint64_t height) {
+    if (ckpt_pid > 0)
+    {
+        HOTSTUFF_LOG_WARN("skipping the checkpoint at height %lu: "
+                        "the previous one is still being written", height);
+        return;
+    }
+    /* the speculated blocks are undone in the copy */
+    std::vector<SmallBankManager::undo_log_t *> undo;
+    for (auto &sb: spec_chain)
+        undo.push_back(&sb.undo);
+    ckpt_pid = small_bank_manager->checkpoint(ckpt_file(ckpt_dir, height), height, undo);
+    if (ckpt_pid < 0)
+        HOTSTUFF_LOG_WARN("cannot fork to checkpoint: %s", strerror(errno));
+    ckpt_pending_height = height;
+}
+
+void HotStuffApp::reap_checkpoint(bool wait) {
+    if (ckpt_pid < 0) return;
+    int status;
+    pid_t ret = waitpid(ckpt_pid, &status, wait ? 0 : WNOHANG);
+    if (ret == 0) return;
+    ckpt_pid = -1;
+    if (ret < 0 || !WIFEXITED(status) || WEXITSTATUS(status))
+    {
+        HOTSTUFF_LOG_WARN("failed to write the checkpoint at height %lu",
+                        ckpt_pending_height);
+        return;
+    }
+    add_checkpoint(ckpt_file(ckpt_dir, ckpt_pending_height));
+}
+
+void HotStuffApp::add_checkpoint(const std::string &path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    SmallBankCkptHeader header;
+    struct stat st;
+    if (fd < 0 || !SmallBank::read_checkpoint_header(fd, header) || fstat(fd, &st))
+    {
+        if (fd >= 0) close(fd);
+        HOTSTUFF_LOG_WARN("cannot read the checkpoint %s", path.c_str());
+        return;
+    }
+    HOTSTUFF_LOG_INFO("checkpoint at height %lu: digest %s",
+                    header.height, get_hex10(uint256_t(header.digest)).c_str());
+    std::lock_guard<std::mutex> _(ckpt_lock);
+    /* (one written here may complete after one fetched) */
+    auto it = std::find_if(ckpts.begin(), ckpts.end(),
+        [&](const std::shared_ptr<const Checkpoint> &c) { return c->height > header.height; });
+    ckpts.insert(it, std::shared_ptr<const Checkpoint>(
+        new Checkpoint{header.height, uint256_t(header.digest), (uint64_t)st.st_size, fd, path}));
+    while (ckpts.size() > CKPTS_KEPT)
+    {
+        unlink(ckpts.front()->path.c_str());
+        ckpts.erase(ckpts.begin());
+    }
+}
+
+void HotStuffApp::start_catch_up() {
+    if (catch_up_running) return;
+    if (catch_up_thread.joinable()) catch_up_thread.join();
+    uint64_t above = get_state_height() + (uint64_t)catch_up_lag * ckpt_interval;
+    uint64_t n_users = small_bank_manager->get_n_users();
+    catch_up_running = true;
+    catch_up_thread = std::thread([this, above, n_users]() {
+        auto path = fetch_ckpt(ckpt_peers, nfaulty, n_users, above, ckpt_dir,
+                                ckpt_fetch_timeout, &catch_up_cancel);
+        SmallBank *bank = nullptr;
+        SmallBankCkptHeader header;
+        if (!path.empty())
+        {
+            try {
+                bank = new SmallBank(path, true, header);
+            } catch (std::exception &e) {
+                HOTSTUFF_LOG_WARN("%s: removed", e.what());
+                unlink(path.c_str());
+            }
+        }
+        if (bank)
+        {
+            uint64_t height = header.height;
+            get_tcall().async_call([this, bank, height, path](salticidae::ThreadCall::Handle &) {
+                install_checkpoint(bank, height, path);
+            });
+        }
+        catch_up_running = false;
     });
 }
 
+void HotStuffApp::install_checkpoint(SmallBank *bank, uint64_t height, const std::string &path) {
+    if (height <= get_state_height())
+    {
+        /* caught up meanwhile (the file is as good as ours) */
+        delete bank;
+        return;
+    }
+    HOTSTUFF_LOG_INFO("catching up from height %lu to the checkpoint at height %lu",
+                    get_state_height(), height);
+    /* the speculated blocks are gone with the state, and the blocks up to
+     * height are not executed (see do_decide_block) */
+    spec_chain.clear();
+    small_bank_manager->replace_state(bank);
+    base_height = height;
+    add_checkpoint(path);
+}
+
 void HotStuffApp::start(const std::vector<std::tuple<NetAddr, bytearray_t, bytearray_t>> &reps, double fairness_parameter) {  // Us
     ev_stat_timer = TimerEvent(ec, [this](TimerEvent &) {
         HotStuff::print_stat();
         HotStuffApp::print_stat();
-        //HotStuffCore::prune(100);
+        if (prune_staleness)
+            HotStuffCore::prune(prune_staleness);
+        reap_checkpoint(false);
+        if (catch_up_lag) start_catch_up();
         ev_stat_timer.add(stat_period);
     });
     ev_stat_timer.add(stat_period);
     impeach_timer = TimerEvent(ec, [this](TimerEvent &) {
-        HOTSTUFF_LOG_DEBUG("***Impeach timer invoked with decision_waiting size = %ld", get_decision_waiting().size());
-        if (get_decision_waiting().size()){
-            HOTSTUFF_LOG_DEBUG("[Inside] Impeach timer invoked with decision_waiting size = %ld", get_decision_waiting().size());
+        HOTSTUFF_LOG_DEBUG("***Impeach timer invoked with decision_waiting size = %ld", get_decision_waiting_size());
+        if (get_decision_waiting_size()){
+            HOTSTUFF_LOG_DEBUG("[Inside] Impeach timer invoked with decision_waiting size = %ld", get_decision_waiting_size());
             get_pace_maker()->impeach();
         }
         reset_imp_timer();
@@ -431,8 +1360,19 @@ void HotStuffApp::start(const std::vector<std::tuple<NetAddr, bytearray_t, bytea
             client_conns.erase(conn);
         return true;
     });
-    req_thread = std::thread([this]() { req_ec.dispatch(); });
-    resp_thread = std::thread([this]() { resp_ec.dispatch(); });
+    req_thread = std::thread([this]() {
+        CmdTracer::set_thread_name("client-req");
+        StackSampler::set_thread_role("client-req");
+        req_ec.dispatch();
+    });
+    resp_thread = std::thread([this]() {
+        CmdTracer::set_thread_name("client-resp");
+        StackSampler::set_thread_role("client-resp");
+        resp_ec.dispatch();
+    });
+    CmdTracer::set_thread_name("consensus");
+    /* (the commands are executed on this thread as well) */
+    StackSampler::set_thread_role("consensus");
     /* enter the event main loop */
     ec.dispatch();
 }
@@ -447,9 +1387,162 @@ void HotStuffApp::stop() {
 
     req_thread.join();
     resp_thread.join();
+    catch_up_cancel = true;
+    if (catch_up_thread.joinable()) catch_up_thread.join();
+    reap_checkpoint(true);
     ec.stop();
 }
 
+bool HotStuffApp::start_profile(double duration, unsigned freq) {
+    auto fname = "profile-" + std::to_string(get_id()) + "-" +
+                std::to_string(nprofiles) + ".folded";
+    if (!StackSampler::start(duration, freq, fname)) return false;
+    nprofiles++;
+    return true;
+}
+
+std::string HotStuffApp::call_on_loop(std::function<std::string()> func) {
+    auto res = std::make_shared<std::promise<std::string>>();
+    auto fut = res->get_future();
+    get_tcall().async_call([func=std::move(func), res](salticidae::ThreadCall::Handle &) {
+        try {
+            res->set_value(func());
+        } catch (...) {
+            res->set_exception(std::current_exception());
+        }
+    });
+    /* the loop may be gone already if the replica is shutting down */
+    if (fut.wait_for(std::chrono::seconds(5)) != std::future_status::ready)
+        throw std::runtime_error("timed out waiting for the consensus thread");
+    return fut.get();
+}
+
+static double parse_positive(const std::string &s) {
+    size_t n = 0;
+    double v;
+    try {
+        v = std::stod(s, &n);
+    } catch (std::exception &) {
+        n = 0;
+    }
+    if (n != s.size() || !(v > 0))
+        throw std::invalid_argument("expected a positive number, got " + s);
+    return v;
+}
+
+static unsigned long parse_uint(const std::string &s, unsigned long min, unsigned long max) {
+    size_t n = 0;
+    unsigned long v = 0;
+    /* (stoul would take leading spaces and a sign) */
+    if (!s.empty() && isdigit((unsigned char)s[0]))
+    {
+        try {
+            v = std::stoul(s, &n);
+        } catch (std::exception &) {
+            n = 0;
+        }
+    }
+    if (n == 0 || n != s.size() || v < min || v > max)
+        throw std::invalid_argument("expected an integer from " + std::to_string(min) +
+                                    " to " + std::to_string(max) + ", got " + s);
+    return v;
+}
+
+/* bounds of the integer tunables set through the admin socket (a block
+ * holds at most UINT16_MAX commands, see Block::serialize) */
+static const unsigned long ADMIN_MAX_BLK_SIZE = UINT16_MAX;
+static const unsigned long ADMIN_MAX_NWORKER = 128;
+
+void HotStuffApp::reg_admin_cmds(AdminServer &admin,
+                                double profile_duration, unsigned profile_freq) {
+    admin.reg_cmd("get", "", [this](const AdminServer::args_t &) {
+        return call_on_loop([this]() {
+            char buff[512];
+            snprintf(buff, sizeof buff,
+                    "block-size %lu\nstat-period %g\nprune-staleness %u\n"
+                    "imp-timeout %g\nnworker %lu\n",
+                    blk_size, stat_period, prune_staleness,
+                    impeach_timeout, vpool.get_nworker());
+            std::string res = buff;
+            auto pm = dynamic_cast<hotstuff::PMRoundRobinProposer *>(get_pace_maker());
+            if (pm)
+            {
+                snprintf(buff, sizeof buff, "base-timeout %g\nprop-delay %g\n",
+                        pm->get_base_timeout(), pm->get_prop_delay());
+                res += buff;
+            }
+            return res;
+        });
+    });
+    admin.reg_cmd("set", "block-size|stat-period|prune-staleness|imp-timeout|"
+                        "nworker|base-timeout|prop-delay <value>",
+                [this](const AdminServer::args_t &args) {
+        if (args.size() != 3)
+            throw std::invalid_argument("usage: set <name> <value>");
+        auto name = args[1];
+        if (name == "block-size" || name == "prune-staleness" || name == "nworker")
+        {
+            /* prune-staleness 0 disables pruning */
+            auto val = name == "block-size" ? parse_uint(args[2], 1, ADMIN_MAX_BLK_SIZE) :
+                    name == "nworker" ? parse_uint(args[2], 1, ADMIN_MAX_NWORKER) :
+                    parse_uint(args[2], 0, UINT32_MAX);
+            return call_on_loop([this, name, val]() {
+                if (name == "block-size")
+                    blk_size = val;
+                else if (name == "prune-staleness")
+                    prune_staleness = val;
+                else
+                    vpool.set_nworker(val);
+                HOTSTUFF_LOG_INFO("admin: %s set to %lu", name.c_str(), val);
+                return std::string("ok");
+            });
+        }
+        /* the others are times, in seconds */
+        auto val = parse_positive(args[2]);
+        return call_on_loop([this, name, val]() {
+            if (name == "stat-period")
+            {
+                stat_period = val;
+                ev_stat_timer.del();
+                ev_stat_timer.add(stat_period);
+            }
+            else if (name == "imp-timeout")
+            {
+                impeach_timeout = val;
+                reset_imp_timer();
+            }
+            else if (name == "base-timeout" || name == "prop-delay")
+            {
+                auto pm = dynamic_cast<hotstuff::PMRoundRobinProposer *>(get_pace_maker());
+                if (!pm)
+                    throw std::invalid_argument(name + " needs the rr pace maker");
+                if (name == "base-timeout")
+                    pm->set_base_timeout(val);
+                else
+                    pm->set_prop_delay(val);
+            }
+            else
+                throw std::invalid_argument("unknown tunable " + name);
+            HOTSTUFF_LOG_INFO("admin: %s set to %g", name.c_str(), val);
+            return std::string("ok");
+        });
+    });
+    admin.reg_cmd("stats", "", [this](const AdminServer::args_t &) {
+        return get_metrics().render();
+    });
+    admin.reg_cmd("profile", "[duration] [freq]",
+                [this, profile_duration, profile_freq](const AdminServer::args_t &args) {
+        double duration = args.size() > 1 ? parse_positive(args[1]) : profile_duration;
+        unsigned freq = args.size() > 2 ? parse_uint(args[2], 1, 10000) : profile_freq;
+        return call_on_loop([this, duration, freq]() {
+            if (!start_profile(duration, freq))
+                throw std::runtime_error("a profiling session is already running");
+            return "profile-" + std::to_string(get_id()) + "-" +
+                    std::to_string(nprofiles - 1) + ".folded";
+        });
+    });
+}
+
 void HotStuffApp::print_stat() const {
 #ifdef HOTSTUFF_MSG_STAT
     HOTSTUFF_LOG_INFO("--- client msg. (10s) ---");
@@ -470,4 +1563,7 @@ void HotStuffApp::print_stat() const {
     }
     HOTSTUFF_LOG_INFO("--- end client msg. ---");
 #endif
+    if (speculation)
+        HOTSTUFF_LOG_INFO("speculation: %lu blocks confirmed, %lu undone",
+                        spec_confirmed.get(), spec_undone.get());
 }
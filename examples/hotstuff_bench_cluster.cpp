@@ -0,0 +1,558 @@
+/**
+ * Copyright 2018 VMware
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Local cluster benchmark.
+ *
+ * For every point of the sweep (replica count x block size x fairness
+ * parameter x pace maker), generate fresh keys and configuration files in a
+ * directory of the run, start the replicas (hotstuff-app) and then the load
+ * generators (hotstuff-loadgen) on localhost, wait for the load generators
+ * to finish, and append a line to a CSV file with the throughput, the
+ * latency percentiles (merged over the load generators) and the CPU usage of
+ * every replica during the load. The logs of all the processes stay in the
+ * directory of the run.
+ *
+ * With --netem, a netem qdisc (as with "tc qdisc add dev lo root netem
+ * ...") is installed on the loopback interface for the whole sweep; this
+ * needs CAP_NET_ADMIN. */
+
+#include <cerrno>
+#include <cinttypes>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <error.h>
+#include "salticidae/util.h"
+#include "salticidae/crypto.h"
+#include "hotstuff/type.h"
+#include "hotstuff/util.h"
+#include "hotstuff/crypto.h"
+
+using salticidae::Config;
+using hotstuff::HotStuffError;
+using hotstuff::privkey_bt;
+using hotstuff::pubkey_bt;
+
+struct Point {
+    int nreplicas;
+    int blk_size;
+    double fairness_parameter;
+    std::string pace_maker;
+    int run;
+
+    std::string name() const {
+        return salticidae::stringprintf("n%d-b%d-f%g-%s-r%d",
+                nreplicas, blk_size, fairness_parameter,
+                pace_maker.c_str(), run);
+    }
+};
+
+struct BenchConfig {
+    std::string app_bin;
+    std::string loadgen_bin;
+    std::string out_dir;
+    int pport;
+    int cport;
+    int nclients;
+    int client_threads;
+    double rate;
+    std::string payload;
+    double duration;
+    double drain;
+    double startup;
+    int sb_users;
+    bool notls;
+    bool local_reads;
+    /** verbatim lines appended to the hotstuff.conf of every run */
+    std::vector<std::string> app_opts;
+};
+
+/** Set upon SIGINT/SIGTERM: the current run is torn down and the sweep
+ * stops. */
+static volatile sig_atomic_t interrupted = 0;
+
+static void on_signal(int) { interrupted = 1; }
+
+template<typename T, typename F>
+static std::vector<T> parse_list(const std::string &s, F conv) {
+    std::vector<T> ret;
+    for (const auto &e: salticidae::trim_all(salticidae::split(s, ",")))
+    {
+        if (e.empty()) continue;
+        size_t idx;
+        ret.push_back(conv(e, &idx));
+        if (idx != e.size())
+            throw HotStuffError("invalid list element: %s", e.c_str());
+    }
+    if (ret.empty())
+        throw HotStuffError("empty list: %s", s.c_str());
+    return ret;
+}
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static std::string exe_dir() {
+    char buff[PATH_MAX];
+    ssize_t len = readlink("/proc/self/exe", buff, sizeof(buff) - 1);
+    if (len < 0) return ".";
+    std::string path(buff, len);
+    auto pos = path.rfind('/');
+    return pos == std::string::npos ? "." : path.substr(0, pos);
+}
+
+static void make_dir(const std::string &path) {
+    if (mkdir(path.c_str(), 0755) && errno != EEXIST)
+        throw HotStuffError("cannot create %s: %s", path.c_str(), strerror(errno));
+}
+
+static void write_file(const std::string &fname, const std::string &content) {
+    FILE *f = fopen(fname.c_str(), "w");
+    if (!f) throw HotStuffError("cannot create %s", fname.c_str());
+    fputs(content.c_str(), f);
+    fclose(f);
+}
+
+/** Generate the keys and write hotstuff.conf and hotstuff-sec<i>.conf (as
+ * scripts/gen_conf.py does) into dir. */
+static void gen_conf(const BenchConfig &bc, const Point &p, const std::string &dir) {
+    std::string main_conf = salticidae::stringprintf(
+        "block-size = %d\n"
+        "fairness-parameter = %g\n"
+        "pace-maker = %s\n"
+        "sb-users = %d\n",
+        p.blk_size, p.fairness_parameter, p.pace_maker.c_str(), bc.sb_users);
+    for (const auto &l: bc.app_opts)
+        main_conf += l + "\n";
+    for (int i = 0; i < p.nreplicas; i++)
+    {
+        privkey_bt priv_key = new hotstuff::PrivKeySecp256k1();
+        priv_key->from_rand();
+        pubkey_bt pub_key = priv_key->get_pubkey();
+        salticidae::PKey tls_priv_key = salticidae::PKey::create_privkey_rsa();
+        salticidae::X509 tls_cert = salticidae::X509::create_self_signed_from_pubkey(tls_priv_key);
+        main_conf += salticidae::stringprintf("replica = 127.0.0.1:%d;%d, %s, %s\n",
+                bc.pport + i, bc.cport + i,
+                salticidae::get_hex(*pub_key).c_str(),
+                salticidae::get_hex(salticidae::get_hash(tls_cert.get_der())).c_str());
+        std::string sec_conf = salticidae::stringprintf(
+            "privkey = %s\n"
+            "tls-privkey = %s\n"
+            "tls-cert = %s\n"
+            "idx = %d\n",
+            salticidae::get_hex(*priv_key).c_str(),
+            salticidae::get_hex(tls_priv_key.get_privkey_der()).c_str(),
+            salticidae::get_hex(tls_cert.get_der()).c_str(), i);
+        if (bc.notls)
+            sec_conf += "notls = true\n";
+        write_file(salticidae::stringprintf("%s/hotstuff-sec%d.conf", dir.c_str(), i), sec_conf);
+    }
+    write_file(dir + "/hotstuff.conf", main_conf);
+}
+
+/** Start bin in dir with its output going to log; returns the pid. */
+static pid_t spawn(const std::string &dir, const std::string &log,
+                    const std::string &bin, const std::vector<std::string> &args,
+                    bool unlimited_stack) {
+    pid_t pid = fork();
+    if (pid < 0)
+        throw HotStuffError("fork failed: %s", strerror(errno));
+    if (pid > 0) return pid;
+    /* the child */
+    if (chdir(dir.c_str()))
+        _exit(127);
+    int fd = open(log.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) _exit(127);
+    dup2(fd, 1);
+    dup2(fd, 2);
+    close(fd);
+    if (unlimited_stack)
+    {
+        /* as scripts/run_demo.sh: the bootstrapping replica may resolve a
+         * long chain of promises */
+        struct rlimit rl;
+        rl.rlim_cur = rl.rlim_max = RLIM_INFINITY;
+        if (setrlimit(RLIMIT_STACK, &rl))
+        {
+            getrlimit(RLIMIT_STACK, &rl);
+            rl.rlim_cur = rl.rlim_max;
+            setrlimit(RLIMIT_STACK, &rl);
+        }
+    }
+    std::vector<char *> argv;
+    argv.push_back(const_cast<char *>(bin.c_str()));
+    for (const auto &a: args)
+        argv.push_back(const_cast<char *>(a.c_str()));
+    argv.push_back(nullptr);
+    execv(bin.c_str(), argv.data());
+    fprintf(stderr, "cannot execute %s: %s\n", bin.c_str(), strerror(errno));
+    _exit(127);
+}
+
+/** User plus system CPU time of a process so far, in seconds (negative if
+ * it is gone). */
+static double cpu_time(pid_t pid) {
+    FILE *f = fopen(salticidae::stringprintf("/proc/%d/stat", pid).c_str(), "r");
+    if (!f) return -1;
+    char buff[1024];
+    size_t len = fread(buff, 1, sizeof(buff) - 1, f);
+    fclose(f);
+    buff[len] = 0;
+    /* the command name may contain spaces: skip to after its ')' */
+    char *p = strrchr(buff, ')');
+    unsigned long utime, stime;
+    if (!p || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+                    &utime, &stime) != 2)
+        return -1;
+    return (utime + stime) / double(sysconf(_SC_CLK_TCK));
+}
+
+static bool exited(pid_t pid, int *status = nullptr) {
+    int st;
+    pid_t ret = waitpid(pid, &st, WNOHANG);
+    if (ret == 0) return false;
+    if (status) *status = ret == pid ? st : -1;
+    return true;
+}
+
+/** SIGTERM, then SIGKILL after a grace period. */
+static void terminate(const std::vector<pid_t> &pids, double grace = 3) {
+    for (auto pid: pids) kill(pid, SIGTERM);
+    std::vector<bool> gone(pids.size(), false);
+    for (double t = 0; t < grace; t += 0.1)
+    {
+        bool all = true;
+        for (size_t i = 0; i < pids.size(); i++)
+            if (!gone[i] && !(gone[i] = exited(pids[i]))) all = false;
+        if (all) return;
+        usleep(100000);
+    }
+    for (size_t i = 0; i < pids.size(); i++)
+        if (!gone[i])
+        {
+            kill(pids[i], SIGKILL);
+            waitpid(pids[i], nullptr, 0);
+        }
+}
+
+/** Latencies merged from the --hist-out files of the load generators:
+ * number of commands per bucket upper bound (in ms). */
+struct MergedHist {
+    std::map<double, uint64_t> buckets;
+    uint64_t total = 0;
+
+    void add_file(const std::string &fname) {
+        FILE *f = fopen(fname.c_str(), "r");
+        if (!f) throw HotStuffError("missing %s", fname.c_str());
+        char line[256];
+        uint64_t prev = 0;
+        /* skip the header */
+        if (!fgets(line, sizeof(line), f)) { fclose(f); return; }
+        while (fgets(line, sizeof(line), f))
+        {
+            double value, pct;
+            uint64_t cnt;
+            if (sscanf(line, "%lf %lf %" SCNu64, &value, &pct, &cnt) != 3)
+                continue;
+            buckets[value] += cnt - prev;
+            total += cnt - prev;
+            prev = cnt;
+        }
+        fclose(f);
+    }
+
+    double quantile(double q) const {
+        if (!total) return NAN;
+        uint64_t seen = 0;
+        for (const auto &b: buckets)
+            if ((seen += b.second) >= q * total)
+                return b.first;
+        return buckets.rbegin()->first;
+    }
+};
+
+struct RunResult {
+    std::string status;
+    double throughput = 0;
+    double p50 = NAN;
+    double p99 = NAN;
+    std::vector<double> cpu;
+};
+
+static RunResult run_point(const BenchConfig &bc, const Point &p) {
+    RunResult res;
+    std::string dir = bc.out_dir + "/" + p.name();
+    make_dir(dir);
+    gen_conf(bc, p, dir);
+
+    std::vector<pid_t> replicas;
+    for (int i = 0; i < p.nreplicas; i++)
+        replicas.push_back(spawn(dir, salticidae::stringprintf("log%d", i), bc.app_bin,
+                {"--conf", salticidae::stringprintf("hotstuff-sec%d.conf", i)}, true));
+    usleep(bc.startup * 1e6);
+    for (auto pid: replicas)
+        if (exited(pid))
+        {
+            res.status = "replica-exited";
+            terminate(replicas);
+            return res;
+        }
+
+    std::vector<double> cpu_start;
+    for (auto pid: replicas)
+        cpu_start.push_back(cpu_time(pid));
+    double wall_start = now();
+    std::vector<pid_t> clients;
+    for (int i = 0; i < bc.nclients; i++)
+    {
+        std::vector<std::string> args{
+            "--cid", std::to_string(i),
+            "--idx", std::to_string(i % p.nreplicas),
+            "--threads", std::to_string(bc.client_threads),
+            "--rate", salticidae::stringprintf("%g", bc.rate / bc.nclients),
+            "--payload", bc.payload,
+            "--duration", salticidae::stringprintf("%g", bc.duration),
+            "--drain", salticidae::stringprintf("%g", bc.drain),
+            "--hist-out", salticidae::stringprintf("hist%d.txt", i)};
+        if (bc.local_reads) args.push_back("--local-reads");
+        clients.push_back(spawn(dir, salticidae::stringprintf("clog%d", i),
+                                bc.loadgen_bin, args, false));
+    }
+
+    /* the load generators stop by themselves after duration + drain */
+    double deadline = wall_start + bc.duration + bc.drain + 10;
+    std::vector<bool> done(clients.size(), false);
+    size_t ndone = 0;
+    bool failed = false;
+    while (ndone < clients.size() && !interrupted && now() < deadline)
+    {
+        for (size_t i = 0; i < clients.size(); i++)
+        {
+            int st;
+            if (done[i] || !exited(clients[i], &st)) continue;
+            done[i] = true;
+            ndone++;
+            if (!WIFEXITED(st) || WEXITSTATUS(st)) failed = true;
+        }
+        usleep(100000);
+    }
+    double wall = now() - wall_start;
+    for (size_t i = 0; i < replicas.size(); i++)
+    {
+        double t = cpu_time(replicas[i]);
+        res.cpu.push_back(t < 0 || cpu_start[i] < 0 ? NAN : 100 * (t - cpu_start[i]) / wall);
+    }
+    if (ndone < clients.size())
+    {
+        std::vector<pid_t> left;
+        for (size_t i = 0; i < clients.size(); i++)
+            if (!done[i]) left.push_back(clients[i]);
+        terminate(left);
+        res.status = interrupted ? "interrupted" : "client-timeout";
+    }
+    else if (failed)
+        res.status = "client-failed";
+    terminate(replicas);
+    if (!res.status.empty()) return res;
+
+    MergedHist hist;
+    for (int i = 0; i < bc.nclients; i++)
+        hist.add_file(salticidae::stringprintf("%s/hist%d.txt", dir.c_str(), i));
+    /* as hotstuff-loadgen, the completed commands over the load period */
+    res.throughput = hist.total / bc.duration;
+    res.p50 = hist.quantile(0.5);
+    res.p99 = hist.quantile(0.99);
+    res.status = "ok";
+    return res;
+}
+
+int main(int argc, char **argv) {
+    Config config("bench-cluster.conf");
+    auto opt_nreplicas = Config::OptValStr::create("4");
+    auto opt_blk_size = Config::OptValStr::create("1");
+    auto opt_fairness_parameter = Config::OptValStr::create("1");
+    auto opt_pace_maker = Config::OptValStr::create("dummy");
+    auto opt_runs = Config::OptValInt::create(1);
+    auto opt_app = Config::OptValStr::create();
+    auto opt_loadgen = Config::OptValStr::create();
+    auto opt_out_dir = Config::OptValStr::create("bench-cluster");
+    auto opt_csv = Config::OptValStr::create();
+    auto opt_pport = Config::OptValInt::create(10000);
+    auto opt_cport = Config::OptValInt::create(20000);
+    auto opt_nclients = Config::OptValInt::create(1);
+    auto opt_client_threads = Config::OptValInt::create(1);
+    auto opt_rate = Config::OptValDouble::create(1000);
+    auto opt_payload = Config::OptValStr::create("smallbank");
+    auto opt_duration = Config::OptValDouble::create(10);
+    auto opt_drain = Config::OptValDouble::create(5);
+    auto opt_startup = Config::OptValDouble::create(2);
+    auto opt_sb_users = Config::OptValInt::create(1000);
+    auto opt_notls = Config::OptValFlag::create(false);
+    auto opt_local_reads = Config::OptValFlag::create(false);
+    auto opt_app_opts = Config::OptValStrVec::create();
+    auto opt_netem = Config::OptValStr::create();
+    auto opt_help = Config::OptValFlag::create(false);
+    config.add_opt("nreplicas", opt_nreplicas, Config::SET_VAL, 'n', "comma-separated replica counts to sweep");
+    config.add_opt("block-size", opt_blk_size, Config::SET_VAL, 'b', "comma-separated block sizes to sweep");
+    config.add_opt("fairness-parameter", opt_fairness_parameter, Config::SET_VAL, 'f', "comma-separated fairness parameters to sweep");
+    config.add_opt("pace-maker", opt_pace_maker, Config::SET_VAL, 'p', "comma-separated pace makers to sweep (dummy, rr)");
+    config.add_opt("runs", opt_runs, Config::SET_VAL, -1, "repetitions of every point");
+    config.add_opt("app", opt_app, Config::SET_VAL, -1, "path to hotstuff-app (default: next to this program)");
+    config.add_opt("loadgen", opt_loadgen, Config::SET_VAL, -1, "path to hotstuff-loadgen (default: next to this program)");
+    config.add_opt("out-dir", opt_out_dir, Config::SET_VAL, 'o', "directory of the configurations and logs of the runs");
+    config.add_opt("csv", opt_csv, Config::SET_VAL, -1, "results file (default: <out-dir>/results.csv)");
+    config.add_opt("pport", opt_pport, Config::SET_VAL, -1, "first replica port");
+    config.add_opt("cport", opt_cport, Config::SET_VAL, -1, "first client port");
+    config.add_opt("clients", opt_nclients, Config::SET_VAL, 'k', "number of load generator processes");
+    config.add_opt("client-threads", opt_client_threads, Config::SET_VAL, -1, "sender threads of each load generator");
+    config.add_opt("rate", opt_rate, Config::SET_VAL, 'r', "offered load, in commands per second (all load generators together)");
+    config.add_opt("payload", opt_payload, Config::SET_VAL, -1, "smallbank or dummy");
+    config.add_opt("duration", opt_duration, Config::SET_VAL, 'd', "seconds of load per run");
+    config.add_opt("drain", opt_drain, Config::SET_VAL, -1, "seconds to wait for the last responses");
+    config.add_opt("startup", opt_startup, Config::SET_VAL, -1, "seconds given to the replicas to connect before the load");
+    config.add_opt("sb-users", opt_sb_users, Config::SET_VAL, -1, "number of SmallBank users");
+    config.add_opt("notls", opt_notls, Config::SWITCH_ON, -1, "disable TLS between the replicas");
+    config.add_opt("local-reads", opt_local_reads, Config::SWITCH_ON, -1, "have the load generators read the replicas' state without ordering the queries");
+    config.add_opt("app-opt", opt_app_opts, Config::APPEND, -1, "add a line (e.g. \"nworker = 4\") to the replica configuration");
+    config.add_opt("netem", opt_netem, Config::SET_VAL, -1, "netem parameters for the loopback interface (e.g. \"delay 5ms 1ms\")");
+    config.add_opt("help", opt_help, Config::SWITCH_ON, 'h', "show this help info");
+    config.parse(argc, argv);
+    if (opt_help->get())
+    {
+        config.print_help();
+        return 0;
+    }
+
+    bool netem = false;
+    try {
+        BenchConfig bc;
+        auto dir = exe_dir();
+        bc.app_bin = opt_app->get().empty() ? dir + "/hotstuff-app" : opt_app->get();
+        bc.loadgen_bin = opt_loadgen->get().empty() ? dir + "/hotstuff-loadgen" : opt_loadgen->get();
+        /* the processes run in the directories of the runs */
+        for (auto *bin: {&bc.app_bin, &bc.loadgen_bin})
+        {
+            char buff[PATH_MAX];
+            if (!realpath(bin->c_str(), buff) || access(buff, X_OK))
+                throw HotStuffError("cannot execute %s", bin->c_str());
+            *bin = buff;
+        }
+        bc.out_dir = opt_out_dir->get();
+        bc.pport = opt_pport->get();
+        bc.cport = opt_cport->get();
+        bc.nclients = opt_nclients->get();
+        bc.client_threads = opt_client_threads->get();
+        bc.rate = opt_rate->get();
+        bc.payload = opt_payload->get();
+        bc.duration = opt_duration->get();
+        bc.drain = opt_drain->get();
+        bc.startup = opt_startup->get();
+        bc.sb_users = opt_sb_users->get();
+        bc.notls = opt_notls->get();
+        bc.local_reads = opt_local_reads->get();
+        bc.app_opts = opt_app_opts->get();
+        if (bc.nclients < 1 || bc.client_threads < 1 || bc.rate <= 0 || bc.duration <= 0)
+            throw HotStuffError("invalid load");
+
+        auto nreplicas = parse_list<int>(opt_nreplicas->get(),
+            [](const std::string &s, size_t *idx) { return std::stoi(s, idx); });
+        auto blk_sizes = parse_list<int>(opt_blk_size->get(),
+            [](const std::string &s, size_t *idx) { return std::stoi(s, idx); });
+        auto fairness = parse_list<double>(opt_fairness_parameter->get(),
+            [](const std::string &s, size_t *idx) { return std::stod(s, idx); });
+        auto pace_makers = salticidae::trim_all(salticidae::split(opt_pace_maker->get(), ","));
+        for (auto n: nreplicas)
+            if (n < 1) throw HotStuffError("invalid replica count %d", n);
+        for (const auto &pm: pace_makers)
+            if (pm != "dummy" && pm != "rr")
+                throw HotStuffError("unknown pace maker %s", pm.c_str());
+
+        std::vector<Point> points;
+        for (auto n: nreplicas)
+            for (auto b: blk_sizes)
+                for (auto f: fairness)
+                    for (const auto &pm: pace_makers)
+                        for (int r = 0; r < opt_runs->get(); r++)
+                            points.push_back(Point{n, b, f, pm, r});
+
+        make_dir(bc.out_dir);
+        std::string csv_name = opt_csv->get().empty() ?
+            bc.out_dir + "/results.csv" : opt_csv->get();
+        FILE *csv = fopen(csv_name.c_str(), "w");
+        if (!csv) throw HotStuffError("cannot create %s", csv_name.c_str());
+        fprintf(csv, "nreplicas,block_size,fairness_parameter,pace_maker,run,"
+                    "offered_rate,throughput,p50_ms,p99_ms,"
+                    "cpu_mean,cpu_max,cpu_per_replica,status\n");
+        fflush(csv);
+
+        signal(SIGINT, on_signal);
+        signal(SIGTERM, on_signal);
+        if (!opt_netem->get().empty())
+        {
+            auto cmd = "tc qdisc add dev lo root netem " + opt_netem->get();
+            if (system(cmd.c_str()))
+                throw HotStuffError("failed: %s", cmd.c_str());
+            netem = true;
+        }
+
+        for (size_t i = 0; i < points.size() && !interrupted; i++)
+        {
+            const auto &p = points[i];
+            HOTSTUFF_LOG_INFO("[%lu/%lu] %s", i + 1, points.size(), p.name().c_str());
+            auto res = run_point(bc, p);
+            double cpu_sum = 0, cpu_max = 0;
+            std::string cpu_list;
+            for (auto c: res.cpu)
+            {
+                cpu_sum += c;
+                cpu_max = std::max(cpu_max, c);
+                if (!cpu_list.empty()) cpu_list += ";";
+                cpu_list += salticidae::stringprintf("%.1f", c);
+            }
+            double cpu_mean = res.cpu.empty() ? NAN : cpu_sum / res.cpu.size();
+            fprintf(csv, "%d,%d,%g,%s,%d,%g,%.1f,%.3f,%.3f,%.1f,%.1f,%s,%s\n",
+                    p.nreplicas, p.blk_size, p.fairness_parameter,
+                    p.pace_maker.c_str(), p.run, bc.rate,
+                    res.throughput, res.p50, res.p99,
+                    cpu_mean, cpu_max, cpu_list.c_str(), res.status.c_str());
+            fflush(csv);
+            HOTSTUFF_LOG_INFO("%s: %.1f cmds/s, p50 %.3f ms, p99 %.3f ms, cpu %.1f%% (max %.1f%%)",
+                    res.status.c_str(), res.throughput, res.p50, res.p99, cpu_mean, cpu_max);
+        }
+        fclose(csv);
+    } catch (std::exception &e) {
+        if (netem && system("tc qdisc del dev lo root")) {}
+        error(1, 0, "%s", e.what());
+    }
+    if (netem && system("tc qdisc del dev lo root"))
+        HOTSTUFF_LOG_WARN("failed to remove the netem qdisc from lo");
+    return interrupted ? 1 : 0;
+}
@@ -0,0 +1,523 @@
+/**
+ * Copyright 2018 VMware
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Open-loop load generator.
+ *
+ * Unlike hotstuff-client, which keeps a fixed number of requests
+ * outstanding (so that a slow system is offered less load), the senders
+ * follow a schedule fixed in advance: constant or Poisson arrivals at the
+ * requested rate, split over the sender threads. A sender that falls
+ * behind (e.g., stalled by the network) sends the late commands in a burst
+ * as soon as it can, and the latency of a command runs from the time it was
+ * scheduled, not from the time it went out, so that the stalls are charged
+ * to the latency instead of being hidden by the schedule (coordinated
+ * omission). A command completes with the nfaulty + 1-th response.
+ *
+ * With --local-reads, the queries are not ordered: every replica answers
+ * from its last executed state, tagged with its height, and a query
+ * completes with nfaulty + 1 matching answers at the same height. Once that
+ * can no longer happen, it falls back to the ordered path (still timed from
+ * its scheduled send). */
+
+#include <atomic>
+#include <cinttypes>
+#include <map>
+#include <tuple>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <thread>
+#include <signal.h>
+
+#include "salticidae/type.h"
+#include "salticidae/netaddr.h"
+#include "salticidae/network.h"
+#include "salticidae/util.h"
+
+#include "hotstuff/util.h"
+#include "hotstuff/type.h"
+#include "hotstuff/client.h"
+#include "hotstuff/metrics.h"
+#include "small_bank.h"
+
+using salticidae::Config;
+using salticidae::TimerEvent;
+using salticidae::ThreadCall;
+using salticidae::_1;
+using salticidae::_2;
+
+using hotstuff::NetAddr;
+using hotstuff::EventContext;
+using hotstuff::MsgReqCmd;
+using hotstuff::MsgRespCmd;
+using hotstuff::MsgReqQuery;
+using hotstuff::MsgRespQuery;
+using hotstuff::CommandDummy;
+using hotstuff::HotStuffError;
+using hotstuff::uint256_t;
+using hotstuff::opcode_t;
+using hotstuff::Histogram;
+using hotstuff::Counter;
+using hotstuff::Gauge;
+
+using Net = salticidae::MsgNetwork<opcode_t>;
+
+struct SenderConfig {
+    std::vector<NetAddr> replicas;
+    size_t nfaulty;
+    /** mean seconds between two commands of one sender */
+    double interval;
+    bool poisson;
+    /** SmallBank transactions, or read-only queries of account 0 */
+    bool small_bank;
+    uint64_t sb_users;
+    double sb_prob_choose_mtx;
+    double sb_skew_factor;
+    /** minimum payload, in 64-bit words */
+    size_t payload_size;
+    double duration;
+    /** seconds to wait for the last responses */
+    double drain;
+    size_t max_cli_msg;
+    /** answer the queries from the replicas' state instead of ordering them */
+    bool local_reads;
+};
+
+/** A sender thread, with its own event loop, connections and generator. */
+class Sender {
+    const SenderConfig &config;
+    EventContext ec;
+    Net net;
+    ThreadCall tcall;
+    std::vector<Net::conn_t> conns;
+    TimerEvent send_timer;
+    TimerEvent stop_timer;
+    std::thread thread;
+
+    const uint32_t cid;
+    uint32_t cnt;
+    std::unique_ptr<SmallBankManager> small_bank;
+    std::mt19937_64 rng;
+    /* the schedule, in us of Histogram::now_us() */
+    double next_us;
+    double end_us;
+
+    struct Pending {
+        uint64_t intended_us;
+        size_t confirmed;
+    };
+    std::unordered_map<uint256_t, Pending> waiting;
+
+    struct PendingQuery {
+        uint64_t intended_us;
+        std::vector<uint64_t> payload;
+        /* the replicas that answered (by index in conns), and how many */
+        std::vector<bool> answered;
+        size_t nanswers;
+        /* number of replicas per (height, result) */
+        std::map<std::tuple<uint32_t, uint64_t, uint64_t>, size_t> votes;
+        size_t best;
+    };
+    uint64_t next_qid;
+    std::unordered_map<uint64_t, PendingQuery> queries;
+
+    double next_gap_us() {
+        if (!config.poisson) return config.interval * 1e6;
+        return std::exponential_distribution<double>(1 / config.interval)(rng) * 1e6;
+    }
+
+    std::vector<uint64_t> next_payload() {
+        std::vector<uint64_t> payload;
+        if (small_bank)
+            payload = small_bank->get_next_transaction_serialized();
+        else
+            payload = {TX_TYPES - 1, 0};
+        if (payload.size() < config.payload_size)
+            payload.resize(config.payload_size);
+        return payload;
+    }
+
+    void send_ordered(uint64_t intended_us, std::vector<uint64_t> &&payload) {
+        CommandDummy cmd(cid, cnt++, std::move(payload));
+        MsgReqCmd msg(cmd);
+        for (auto &conn: conns) net.send_msg(msg, conn);
+        waiting.insert(std::make_pair(cmd.get_hash(), Pending{intended_us, 0}));
+    }
+
+    void send_one(uint64_t intended_us) {
+        auto payload = next_payload();
+        nsent.inc();
+        if (!config.local_reads || payload[0] != TX_TYPES - 1)
+        {
+            send_ordered(intended_us, std::move(payload));
+            return;
+        }
+        uint64_t qid = next_qid++;
+        MsgReqQuery msg(qid, payload);
+        for (auto &conn: conns) net.send_msg(msg, conn);
+        queries.insert(std::make_pair(qid,
+            PendingQuery{intended_us, std::move(payload),
+                        std::vector<bool>(conns.size(), false), 0, {}, 0}));
+    }
+
+    void complete(uint64_t intended_us) {
+        latency.observe(Histogram::now_us() - intended_us);
+        ncompleted.inc();
+    }
+
+    void on_send_timer() {
+        uint64_t now = Histogram::now_us();
+        uint64_t last = 0;
+        for (; next_us <= now && next_us < end_us; next_us += next_gap_us())
+            send_one(last = next_us);
+        if (last) lag_us.set(Histogram::now_us() - last);
+        if (next_us < end_us)
+            send_timer.add((next_us - now) / 1e6);
+        else
+            stop_timer.add(config.drain);
+    }
+
+    void resp_handler(MsgRespCmd &&msg, const Net::conn_t &) {
+        auto it = waiting.find(msg.fin.cmd_hash);
+        if (it == waiting.end()) return;
+        if (++it->second.confirmed <= config.nfaulty) return;
+        complete(it->second.intended_us);
+        waiting.erase(it);
+    }
+
+    void query_handler(MsgRespQuery &&msg, const Net::conn_t &conn) {
+        auto it = queries.find(msg.qid);
+        if (it == queries.end()) return;
+        auto &q = it->second;
+        /* one answer per replica: repeats would let a faulty one vote
+         * several times */
+        size_t r = std::find(conns.begin(), conns.end(), conn) - conns.begin();
+        if (r == conns.size() || q.answered[r]) return;
+        q.answered[r] = true;
+        q.nanswers++;
+        if (msg.ok)
+        {
+            size_t n = ++q.votes[std::make_tuple(msg.height,
+                                msg.result.first, msg.result.second)];
+            q.best = std::max(q.best, n);
+            if (q.best > config.nfaulty)
+            {
+                complete(q.intended_us);
+                nlocal_reads.inc();
+                queries.erase(it);
+                return;
+            }
+        }
+        /* the replicas not heard from could not make any answer win (a
+         * refusal counts as an answer without a vote) */
+        if (q.best + (conns.size() - q.nanswers) <= config.nfaulty)
+        {
+            nread_fallbacks.inc();
+            send_ordered(q.intended_us, std::move(q.payload));
+            queries.erase(it);
+        }
+    }
+
+    public:
+    Histogram latency;      /**< from the scheduled send to completion, in us */
+    Counter nsent;
+    Counter ncompleted;
+    Counter nlocal_reads;       /**< queries completed without ordering */
+    Counter nread_fallbacks;    /**< queries sent to the ordered path */
+    Gauge lag_us;           /**< how late the last burst of commands went out */
+    std::atomic<bool> done;
+
+    Sender(const SenderConfig &config, uint32_t cid, uint64_t seed):
+            config(config),
+            net(ec, Net::Config().max_msg_size(config.max_cli_msg)),
+            tcall(ec), cid(cid), cnt(0), rng(seed), next_qid(0), done(false) {
+        net.reg_handler(salticidae::generic_bind(&Sender::resp_handler, this, _1, _2));
+        net.reg_handler(salticidae::generic_bind(&Sender::query_handler, this, _1, _2));
+        net.start();
+        for (const auto &addr: config.replicas)
+            conns.push_back(net.connect_sync(addr));
+        if (config.small_bank)
+        {
+            small_bank = std::make_unique<SmallBankManager>(config.sb_users,
+                config.sb_prob_choose_mtx, config.sb_skew_factor);
+            small_bank->seed(seed);
+        }
+        send_timer = TimerEvent(ec, [this](TimerEvent &) { on_send_timer(); });
+        stop_timer = TimerEvent(ec, [this](TimerEvent &) { ec.stop(); });
+    }
+
+    ~Sender() {
+        stop();
+        if (thread.joinable()) thread.join();
+    }
+
+    void start(uint64_t start_us) {
+        /* the senders are staggered by their first gap */
+        next_us = start_us + next_gap_us();
+        end_us = start_us + config.duration * 1e6;
+        thread = std::thread([this]() {
+            send_timer.add(0);
+            ec.dispatch();
+            done = true;
+        });
+    }
+
+    void stop() {
+        tcall.async_call([this](ThreadCall::Handle &) { ec.stop(); });
+    }
+
+    size_t get_outstanding() const { return waiting.size() + queries.size(); }
+};
+
+class Reporter {
+    const std::vector<std::unique_ptr<Sender>> &senders;
+    std::vector<uint64_t> last_snap;
+    uint64_t last_nsent;
+    uint64_t last_ncompleted;
+    uint64_t last_us;
+    const uint64_t start_us;
+
+    static void add_snapshot(std::vector<uint64_t> &acc, const std::vector<uint64_t> &snap) {
+        if (acc.empty()) acc.resize(snap.size());
+        for (size_t i = 0; i < snap.size(); i++) acc[i] += snap[i];
+    }
+
+    public:
+    static const std::vector<double> qs;
+
+    Reporter(const std::vector<std::unique_ptr<Sender>> &senders, uint64_t start_us):
+        senders(senders), last_snap(Histogram::nbuckets),
+        last_nsent(0), last_ncompleted(0),
+        last_us(start_us), start_us(start_us) {}
+
+    /** All the latencies recorded so far. */
+    std::vector<uint64_t> snapshot() const {
+        std::vector<uint64_t> res;
+        for (const auto &s: senders) add_snapshot(res, s->latency.snapshot());
+        return res;
+    }
+
+    void interval() {
+        uint64_t now = Histogram::now_us();
+        uint64_t nsent = 0, ncompleted = 0;
+        int64_t lag = 0;
+        for (const auto &s: senders)
+        {
+            nsent += s->nsent.get();
+            ncompleted += s->ncompleted.get();
+            lag = std::max(lag, s->lag_us.get());
+        }
+        auto snap = snapshot();
+        auto delta = snap;
+        for (size_t i = 0; i < delta.size(); i++) delta[i] -= last_snap[i];
+        auto q = Histogram::quantiles(delta, qs);
+        double sec = (now - last_us) / 1e6;
+        HOTSTUFF_LOG_INFO("[%7.1fs] sent %8.1f/s, done %8.1f/s, "
+                        "latency (ms) p50 %.3f p90 %.3f p99 %.3f p99.9 %.3f, lag %.3f ms",
+                        (now - start_us) / 1e6,
+                        (nsent - last_nsent) / sec, (ncompleted - last_ncompleted) / sec,
+                        q[0] / 1e3, q[1] / 1e3, q[2] / 1e3, q[3] / 1e3, lag / 1e3);
+        last_snap = std::move(snap);
+        last_nsent = nsent;
+        last_ncompleted = ncompleted;
+        last_us = now;
+    }
+
+    void summary(double duration) const {
+        uint64_t nsent = 0, ncompleted = 0, outstanding = 0;
+        for (const auto &s: senders)
+        {
+            nsent += s->nsent.get();
+            ncompleted += s->ncompleted.get();
+            outstanding += s->get_outstanding();
+        }
+        auto q = Histogram::quantiles(snapshot(), qs);
+        HOTSTUFF_LOG_INFO("===== summary =====");
+        HOTSTUFF_LOG_INFO("sent %" PRIu64 " commands (%.1f/s), completed %" PRIu64
+                        " (%.1f/s), %" PRIu64 " outstanding",
+                        nsent, nsent / duration, ncompleted, ncompleted / duration,
+                        outstanding);
+        HOTSTUFF_LOG_INFO("latency (ms) p50 %.3f p90 %.3f p99 %.3f p99.9 %.3f",
+                        q[0] / 1e3, q[1] / 1e3, q[2] / 1e3, q[3] / 1e3);
+        uint64_t nlocal = 0, nfallbacks = 0;
+        for (const auto &s: senders)
+        {
+            nlocal += s->nlocal_reads.get();
+            nfallbacks += s->nread_fallbacks.get();
+        }
+        if (nlocal || nfallbacks)
+            HOTSTUFF_LOG_INFO("local reads: %" PRIu64 " answered, %" PRIu64 " ordered",
+                            nlocal, nfallbacks);
+    }
+
+    /** Write the latency distribution: one line per non-empty bucket with
+     * its upper bound (ms), the fraction of the commands at or below it and
+     * their number. */
+    void write_hist(const std::string &fname) const {
+        FILE *f = fopen(fname.c_str(), "w");
+        if (!f) throw HotStuffError("cannot create %s", fname.c_str());
+        auto snap = snapshot();
+        uint64_t total = 0, seen = 0;
+        for (auto c: snap) total += c;
+        fprintf(f, "%12s %12s %12s\n", "value", "percentile", "count");
+        for (size_t i = 0; i < snap.size(); i++)
+        {
+            if (!snap[i]) continue;
+            seen += snap[i];
+            fprintf(f, "%12.3f %12.6f %12" PRIu64 "\n",
+                    Histogram::bucket_range(i).second / 1e3,
+                    seen / double(total), seen);
+        }
+        fclose(f);
+    }
+};
+
+const std::vector<double> Reporter::qs = {0.5, 0.9, 0.99, 0.999};
+
+std::pair<std::string, std::string> split_ip_port_cport(const std::string &s) {
+    auto ret = salticidae::trim_all(salticidae::split(s, ";"));
+    return std::make_pair(ret[0], ret[1]);
+}
+
+int main(int argc, char **argv) {
+    Config config("hotstuff.conf");
+
+    auto opt_sb_users = Config::OptValInt::create(10);
+    auto opt_sb_prob_choose_mtx = Config::OptValDouble::create(0.9);
+    auto opt_sb_skew_factor = Config::OptValDouble::create(0.1);
+    auto opt_idx = Config::OptValInt::create(0);
+    auto opt_replicas = Config::OptValStrVec::create();
+    auto opt_cid = Config::OptValInt::create(-1);
+    auto opt_max_cli_msg = Config::OptValInt::create(65536); // 64K by default
+    auto opt_nthreads = Config::OptValInt::create(1);
+    auto opt_rate = Config::OptValDouble::create(1000);
+    auto opt_arrival = Config::OptValStr::create("poisson");
+    auto opt_payload = Config::OptValStr::create("smallbank");
+    auto opt_payload_size = Config::OptValInt::create(0);
+    auto opt_duration = Config::OptValDouble::create(30);
+    auto opt_drain = Config::OptValDouble::create(5);
+    auto opt_report_period = Config::OptValDouble::create(1);
+    auto opt_hist_out = Config::OptValStr::create("");
+    auto opt_seed = Config::OptValInt::create(0);
+    auto opt_local_reads = Config::OptValFlag::create(false);
+    auto opt_help = Config::OptValFlag::create(false);
+
+    config.add_opt("sb-users", opt_sb_users, Config::SET_VAL);
+    config.add_opt("sb-prob-choose_mtx", opt_sb_prob_choose_mtx, Config::SET_VAL);
+    config.add_opt("sb-skew-factor", opt_sb_skew_factor, Config::SET_VAL);
+    config.add_opt("idx", opt_idx, Config::SET_VAL);
+    config.add_opt("cid", opt_cid, Config::SET_VAL);
+    config.add_opt("replica", opt_replicas, Config::APPEND);
+    config.add_opt("max-cli-msg", opt_max_cli_msg, Config::SET_VAL, 'S', "the maximum client message size");
+    config.add_opt("threads", opt_nthreads, Config::SET_VAL, 't', "number of sender threads");
+    config.add_opt("rate", opt_rate, Config::SET_VAL, 'r', "offered load, in commands per second (all threads together)");
+    config.add_opt("arrival", opt_arrival, Config::SET_VAL, -1, "arrival process: poisson or constant");
+    config.add_opt("payload", opt_payload, Config::SET_VAL, -1, "smallbank transactions or dummy (read-only) commands");
+    config.add_opt("payload-size", opt_payload_size, Config::SET_VAL, -1, "pad the payloads to this many 64-bit words");
+    config.add_opt("duration", opt_duration, Config::SET_VAL, 'd', "seconds of load");
+    config.add_opt("drain", opt_drain, Config::SET_VAL, -1, "seconds to wait for the last responses");
+    config.add_opt("report-period", opt_report_period, Config::SET_VAL, -1, "seconds between two progress reports");
+    config.add_opt("hist-out", opt_hist_out, Config::SET_VAL, -1, "write the latency distribution to this file");
+    config.add_opt("local-reads", opt_local_reads, Config::SWITCH_ON, -1, "have the replicas answer the queries from their executed state, without ordering them");
+    config.add_opt("seed", opt_seed, Config::SET_VAL, -1, "random seed (the client id by default)");
+    config.add_opt("help", opt_help, Config::SWITCH_ON, 'h', "show this help info");
+    config.parse(argc, argv);
+    if (opt_help->get())
+    {
+        config.print_help();
+        return 0;
+    }
+
+    auto idx = opt_idx->get();
+    std::vector<std::string> raw;
+    for (const auto &s: opt_replicas->get())
+    {
+        auto res = salticidae::trim_all(salticidae::split(s, ","));
+        if (res.size() < 1)
+            throw HotStuffError("format error");
+        raw.push_back(res[0]);
+    }
+    if (!(0 <= idx && (size_t)idx < raw.size() && raw.size() > 0))
+        throw std::invalid_argument("out of range");
+    if (opt_nthreads->get() < 1 || opt_rate->get() <= 0)
+        throw std::invalid_argument("invalid load");
+    if (opt_arrival->get() != "poisson" && opt_arrival->get() != "constant")
+        throw std::invalid_argument("unknown arrival process");
+    if (opt_payload->get() != "smallbank" && opt_payload->get() != "dummy")
+        throw std::invalid_argument("unknown payload");
+
+    SenderConfig sc;
+    for (const auto &p: raw)
+    {
+        auto _p = split_ip_port_cport(p);
+        size_t _;
+        sc.replicas.push_back(NetAddr(NetAddr(_p.first).ip, htons(stoi(_p.second, &_))));
+    }
+    /* as hotstuff-client */
+    sc.nfaulty = sc.replicas.size() / 3;
+    size_t nthreads = opt_nthreads->get();
+    sc.interval = nthreads / opt_rate->get();
+    sc.poisson = opt_arrival->get() == "poisson";
+    sc.small_bank = opt_payload->get() == "smallbank";
+    sc.sb_users = opt_sb_users->get();
+    sc.sb_prob_choose_mtx = opt_sb_prob_choose_mtx->get();
+    sc.sb_skew_factor = opt_sb_skew_factor->get();
+    sc.payload_size = opt_payload_size->get();
+    sc.duration = opt_duration->get();
+    sc.drain = opt_drain->get();
+    sc.max_cli_msg = opt_max_cli_msg->get();
+    sc.local_reads = opt_local_reads->get();
+
+    /* every thread gets a client id of its own, so that the commands of
+     * two threads never collide */
+    uint32_t cid = opt_cid->get() != -1 ? opt_cid->get() : idx;
+    uint64_t seed = opt_seed->get() ? opt_seed->get() : cid;
+    HOTSTUFF_LOG_INFO("offering %.1f commands/s (%s) from %lu threads to %lu replicas, "
+                    "nfaulty = %lu", opt_rate->get(), opt_arrival->get().c_str(),
+                    nthreads, sc.replicas.size(), sc.nfaulty);
+    std::vector<std::unique_ptr<Sender>> senders;
+    for (size_t i = 0; i < nthreads; i++)
+        senders.emplace_back(new Sender(sc, cid * nthreads + i, seed * nthreads + i));
+
+    EventContext ec;
+    uint64_t start_us = Histogram::now_us();
+    Reporter reporter(senders, start_us);
+    auto shutdown = [&](int) {
+        for (auto &s: senders) s->stop();
+    };
+    salticidae::SigEvent ev_sigint(ec, shutdown);
+    salticidae::SigEvent ev_sigterm(ec, shutdown);
+    ev_sigint.add(SIGINT);
+    ev_sigterm.add(SIGTERM);
+    TimerEvent report_timer(ec, [&](TimerEvent &) {
+        reporter.interval();
+        for (auto &s: senders)
+            if (!s->done)
+            {
+                report_timer.add(opt_report_period->get());
+                return;
+            }
+        ec.stop();
+    });
+    report_timer.add(opt_report_period->get());
+    for (auto &s: senders) s->start(start_us);
+    ec.dispatch();
+
+    reporter.summary(std::min(sc.duration, (Histogram::now_us() - start_us) / 1e6));
+    if (!opt_hist_out->get().empty())
+        reporter.write_hist(opt_hist_out->get());
+    return 0;
+}
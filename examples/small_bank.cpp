@@ -3,23 +3,90 @@
  * 
  */
 
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <openssl/sha.h>
+
 #include "small_bank.h"
 
 
 SmallBank::SmallBank(uint64_t n_users){
     this->n_users = n_users;
-    
-    /* initialize random seed: */
-    srand (time(NULL));
-    uint64_t const max_amount = 10000;
+    map_size = 2*n_users*sizeof(uint64_t);
+    void *addr = mmap(nullptr, map_size, PROT_READ|PROT_WRITE,
+                    MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if(addr == MAP_FAILED){
+        throw std::bad_alloc();
+    }
+    set_mapping(addr);
 
-    /* Initialize accounts with random amount */
+    /* Initialize accounts with random amount, from a fixed seed: the
+     * replicas start from the same state, and their checkpoints can be
+     * compared */
+    std::mt19937_64 gen(n_users);
+    uint64_t const max_amount = 10000;
     for(uint64_t user_id=0; user_id<n_users; user_id++){
-        checking_accounts.push_back(rand()%max_amount);
-        saving_accounts.push_back(rand()%max_amount);
+        checking_accounts[user_id] = gen()%max_amount;
+        saving_accounts[user_id] = gen()%max_amount;
+    }
+}
+
+SmallBank::SmallBank(const std::string &ckpt_path, bool verify, SmallBankCkptHeader &header){
+    int fd = open(ckpt_path.c_str(), O_RDONLY);
+    if(fd < 0){
+        throw std::runtime_error("cannot open " + ckpt_path + ": " + strerror(errno));
+    }
+    struct stat st;
+    if(!read_checkpoint_header(fd, header) || fstat(fd, &st) ||
+        (uint64_t)st.st_size != ckpt_size(header.n_users)){
+        close(fd);
+        throw std::runtime_error(ckpt_path + " is not a valid checkpoint");
+    }
+    n_users = header.n_users;
+    map_size = ckpt_data_size(n_users);
+    std::vector<uint8_t> hashes(ckpt_nchunks(n_users)*CKPT_HASH_SIZE);
+    bool ok = !verify ||
+        pread(fd, hashes.data(), hashes.size(), ckpt_hashes_offset(n_users)) == (ssize_t)hashes.size();
+    void *addr = mmap(nullptr, map_size, PROT_READ|PROT_WRITE,
+                    MAP_PRIVATE, fd, CKPT_DATA_OFFSET);
+    /* the mapping keeps the file */
+    close(fd);
+    if(addr == MAP_FAILED){
+        throw std::runtime_error("cannot map " + ckpt_path + ": " + strerror(errno));
+    }
+    set_mapping(addr);
+    if(verify){
+        uint8_t md[CKPT_HASH_SIZE];
+        sha256(hashes.data(), hashes.size(), md);
+        ok = ok && memcmp(md, header.digest, CKPT_HASH_SIZE) == 0;
+        auto data = (const uint8_t *)accounts;
+        for(uint64_t c=0; ok && c<hashes.size()/CKPT_HASH_SIZE; c++){
+            sha256(data + c*CKPT_CHUNK_SIZE,
+                    std::min<uint64_t>(CKPT_CHUNK_SIZE, map_size - c*CKPT_CHUNK_SIZE), md);
+            ok = memcmp(md, &hashes[c*CKPT_HASH_SIZE], CKPT_HASH_SIZE) == 0;
+        }
+        if(!ok){
+            munmap(accounts, map_size);
+            throw std::runtime_error(ckpt_path + " does not match its digest");
+        }
     }
 }
 
+SmallBank::~SmallBank(){
+    munmap(accounts, map_size);
+}
+
+void SmallBank::set_mapping(void *addr){
+    accounts = (uint64_t *)addr;
+    checking_accounts = accounts;
+    saving_accounts = accounts + n_users;
+}
+
 void SmallBank::transaction_savings(uint64_t user_id, uint64_t amount){
     if(UINT64_MAX-saving_accounts[user_id] < amount){
         /* If amount is exceded to the maximum limit of uint64_t : discart transaction */
@@ -100,10 +167,66 @@ std::pair<uint64_t,uint64_t> SmallBank::query(uint64_t user_id){
     return std::make_pair(checking_accounts[user_id], saving_accounts[user_id]);
 }
 
-SmallBankManager::SmallBankManager(uint64_t n_users, double prob_choose_mtx, double skew_factor){
-    this->bank = new SmallBank(n_users);
+void SmallBank::restore(uint64_t user_id, uint64_t checking, uint64_t saving){
+    checking_accounts[user_id] = checking;
+    saving_accounts[user_id] = saving;
+}
 
-    this->n_users = n_users;
+uint64_t SmallBank::digest() const{
+    /* the checking accounts, then the saving ones */
+    uint64_t h = 14695981039346656037ULL;
+    for(uint64_t i=0; i<2*n_users; i++){
+        h = (h ^ accounts[i]) * 1099511628211ULL;
+    }
+    return h;
+}
+
+static bool write_all(int fd, const void *data, size_t size){
+    auto p = (const uint8_t *)data;
+    while(size){
+        ssize_t n = write(fd, p, size);
+        if(n < 0){
+            if(errno == EINTR) continue;
+            return false;
+        }
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+void SmallBank::sha256(const uint8_t *data, size_t len, uint8_t *md){
+    SHA256(data, len, md);
+}
+
+bool SmallBank::write_checkpoint(int fd, uint64_t height) const{
+    std::vector<uint8_t> hashes(ckpt_nchunks(n_users)*CKPT_HASH_SIZE);
+    auto data = (const uint8_t *)accounts;
+    for(uint64_t c=0; c<hashes.size()/CKPT_HASH_SIZE; c++){
+        sha256(data + c*CKPT_CHUNK_SIZE,
+                std::min<uint64_t>(CKPT_CHUNK_SIZE, map_size - c*CKPT_CHUNK_SIZE),
+                &hashes[c*CKPT_HASH_SIZE]);
+    }
+    uint8_t head[CKPT_DATA_OFFSET] = {};
+    SmallBankCkptHeader header{CKPT_MAGIC, n_users, height, {}};
+    sha256(hashes.data(), hashes.size(), header.digest);
+    memcpy(head, &header, sizeof(header));
+    return write_all(fd, head, sizeof(head)) && write_all(fd, accounts, map_size) &&
+            write_all(fd, hashes.data(), hashes.size());
+}
+
+bool SmallBank::read_checkpoint_header(int fd, SmallBankCkptHeader &header){
+    return pread(fd, &header, sizeof(header), 0) == sizeof(header) &&
+            header.magic == CKPT_MAGIC;
+}
+
+SmallBankManager::SmallBankManager(uint64_t n_users, double prob_choose_mtx, double skew_factor):
+    SmallBankManager(new SmallBank(n_users), prob_choose_mtx, skew_factor){}
+
+SmallBankManager::SmallBankManager(SmallBank *bank, double prob_choose_mtx, double skew_factor){
+    this->bank = bank;
+
+    this->n_users = bank->get_n_users();
     this->prob_choose_mtx = prob_choose_mtx;
 
     /* initialize random seed: */
@@ -138,6 +261,20 @@ SmallBankManager::SmallBankManager(uint64_t n_users, double prob_choose_mtx, dou
     // }
 }
 
+void SmallBankManager::replace_state(SmallBank *new_bank){
+    delete bank;
+    bank = new_bank;
+}
+
+void SmallBankManager::seed(uint64_t seed){
+    std::seed_seq seq{seed, seed >> 32};
+    std::vector<uint32_t> seeds(3);
+    seq.generate(seeds.begin(), seeds.end());
+    tx_generator.seed(seeds[0]);
+    mtx_generator.seed(seeds[1]);
+    user_generator.seed(seeds[2]);
+}
+
 std::vector<uint64_t> SmallBankManager::get_next_transaction_serialized(){
     uint64_t tx_type;
     uint64_t user_id;
@@ -416,6 +553,236 @@ std::pair<uint64_t, uint64_t> SmallBankManager::execute_transaction(const uint64
 std::pair<uint64_t,uint64_t> SmallBankManager::show_account_info(uint64_t user_id){
     return bank->query(user_id);
 }
+
+bool SmallBankManager::get_tx_users(const uint64_t* tx_payload, std::vector<uint64_t> &users){
+    size_t idx = 1;
+    switch (tx_payload[0])
+    {
+        case 0:
+        case 1:
+        case 2:
+        case 5:
+            /** payload format : [tx type, user id, ...] **/
+            users.push_back(tx_payload[idx]);
+            return true;
+
+        case 3:
+            /** payload format : [tx type, from user id, to user id, amount] **/
+            users.push_back(tx_payload[idx]);
+            users.push_back(tx_payload[idx + 1]);
+            return true;
+
+        case 4:{
+            /** payload format : [tx type, count of payors, payer_1 id, payer_1 amount, ..., party size, member_1, member_1, ...] **/
+            auto n_payors = tx_payload[idx++];
+            for(uint64_t i=0; i<n_payors; i++){
+                users.push_back(tx_payload[idx]);
+                idx += 2;
+            }
+            auto party_size = tx_payload[idx++];
+            for(uint64_t i=0; i<party_size; i++){
+                users.push_back(tx_payload[idx++]);
+            }
+            return true;
+        }
+
+        case 6:
+            /** payload format : [tx type, user id] **/
+            users.push_back(tx_payload[idx]);
+            return false;
+
+        default:
+            /* not executed: touches nothing */
+            return false;
+    }
+}
+
+void SmallBankManager::log_undo(const std::vector<const uint64_t*> &payloads, undo_log_t &undo){
+    std::vector<uint64_t> users;
+    for(auto tx_payload: payloads){
+        users.clear();
+        if(!get_tx_users(tx_payload, users)){
+            continue;
+        }
+        for(auto user_id: users){
+            auto accounts = bank->query(user_id);
+            undo.push_back(UndoEntry{user_id, accounts.first, accounts.second});
+        }
+    }
+}
+
+void SmallBankManager::rollback(undo_log_t &undo){
+    /* in reverse: the first entry of a user holds its oldest accounts */
+    for(auto it = undo.rbegin(); it != undo.rend(); it++){
+        bank->restore(it->user_id, it->checking, it->saving);
+    }
+    undo.clear();
+}
+
+pid_t SmallBankManager::checkpoint(const std::string &path, uint64_t height,
+                                const std::vector<undo_log_t *> &undo){
+    auto tmp = path + ".tmp";
+    pid_t pid = fork();
+    if(pid != 0){
+        return pid;
+    }
+    /* the child: only its copy of the state is rolled back */
+    for(auto it = undo.rbegin(); it != undo.rend(); it++){
+        rollback(**it);
+    }
+    int fd = open(tmp.c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0644);
+    bool ok = fd >= 0 && bank->write_checkpoint(fd, height) && fsync(fd) == 0;
+    if(fd >= 0){
+        ok = close(fd) == 0 && ok;
+    }
+    ok = ok && rename(tmp.c_str(), path.c_str()) == 0;
+    if(!ok){
+        unlink(tmp.c_str());
+    }
+    _exit(ok ? 0 : 1);
+}
+
+
+SmallBankExecutor::SmallBankExecutor(SmallBankManager *manager, size_t nthreads, size_t min_parallel):
+    manager(manager), min_parallel(min_parallel),
+    payloads(nullptr), results(nullptr), ndeps_cap(0), nremaining(0),
+    stopped(false){
+    for(size_t i=1; i<nthreads; i++){
+        workers.emplace_back([this](){ work(false); });
+    }
+}
+
+SmallBankExecutor::~SmallBankExecutor(){
+    {
+        std::lock_guard<std::mutex> _(ready_lock);
+        stopped = true;
+    }
+    ready_cv.notify_all();
+    for(auto &w: workers){
+        w.join();
+    }
+}
+
+void SmallBankExecutor::build_graph(){
+    size_t n = payloads->size();
+    if(successors.size() < n){
+        successors.resize(n);
+    }
+    if(ndeps_cap < n){
+        ndeps.reset(new std::atomic<uint32_t>[n]);
+        ndeps_cap = n;
+    }
+    users.clear();
+    for(uint32_t i=0; i<n; i++){
+        successors[i].clear();
+        tx_users.clear();
+        bool write = SmallBankManager::get_tx_users((*payloads)[i], tx_users);
+        std::sort(tx_users.begin(), tx_users.end());
+        tx_users.erase(std::unique(tx_users.begin(), tx_users.end()), tx_users.end());
+
+        uint32_t deps = 0;
+        for(auto user_id: tx_users){
+            auto &u = users.emplace(user_id, UserState{-1, {}}).first->second;
+            /* a transaction follows the last writer of each of its users
+             * and, if it writes, all the readers since then */
+            if(u.last_writer >= 0){
+                successors[u.last_writer].push_back(i);
+                deps++;
+            }
+            if(write){
+                for(auto r: u.readers){
+                    successors[r].push_back(i);
+                    deps++;
+                }
+                u.readers.clear();
+                u.last_writer = i;
+            }
+            else{
+                u.readers.push_back(i);
+            }
+        }
+        ndeps[i].store(deps, std::memory_order_relaxed);
+    }
+}
+
+void SmallBankExecutor::run(uint32_t tx){
+    (*results)[tx] = manager->execute_transaction((*payloads)[tx]);
+}
+
+void SmallBankExecutor::work(bool caller){
+    std::unique_lock<std::mutex> lk(ready_lock);
+    for(;;){
+        ready_cv.wait(lk, [this, caller](){
+            return !ready.empty() ||
+                (caller ? nremaining.load(std::memory_order_acquire) == 0 : stopped);
+        });
+        if(ready.empty()){
+            return;
+        }
+        uint32_t tx = ready.back();
+        ready.pop_back();
+        lk.unlock();
+
+        for(;;){
+            run(tx);
+            /* keep one of the transactions this one unblocks for this
+             * thread, hand out the others */
+            int64_t next = -1;
+            for(auto s: successors[tx]){
+                if(ndeps[s].fetch_sub(1, std::memory_order_acq_rel) != 1){
+                    continue;
+                }
+                if(next < 0){
+                    next = s;
+                }
+                else{
+                    std::lock_guard<std::mutex> _(ready_lock);
+                    ready.push_back(s);
+                    ready_cv.notify_one();
+                }
+            }
+            if(nremaining.fetch_sub(1, std::memory_order_acq_rel) == 1){
+                std::lock_guard<std::mutex> _(ready_lock);
+                ready_cv.notify_all();
+            }
+            if(next < 0){
+                break;
+            }
+            tx = next;
+        }
+        lk.lock();
+    }
+}
+
+void SmallBankExecutor::execute_batch(const std::vector<const uint64_t*> &payloads,
+                                    std::vector<std::pair<uint64_t, uint64_t>> &results){
+    size_t n = payloads.size();
+    results.resize(n);
+    if(workers.empty() || n < min_parallel){
+        for(size_t i=0; i<n; i++){
+            results[i] = manager->execute_transaction(payloads[i]);
+        }
+        return;
+    }
+
+    this->payloads = &payloads;
+    this->results = &results;
+    build_graph();
+    nremaining.store(n, std::memory_order_relaxed);
+    {
+        std::lock_guard<std::mutex> _(ready_lock);
+        /* the earliest ones are taken first */
+        for(size_t i=n; i-- > 0;){
+            if(ndeps[i].load(std::memory_order_relaxed) == 0){
+                ready.push_back(i);
+            }
+        }
+    }
+    ready_cv.notify_all();
+    work(true);
+    this->payloads = nullptr;
+    this->results = nullptr;
+}
  
 
 /******************************** Test Small Bank /********************************/
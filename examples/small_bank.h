@@ -2,8 +2,17 @@
 #define __SMALL_BANK_H__
 
 #include <vector>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <string>
 #include <stdlib.h>
 #include <time.h>
+#include <sys/types.h>
 #include <limits>
 #include <iostream>
 #include <random>
@@ -16,14 +25,50 @@
 #define MIN_SPLIT_TX_PARTY_SIZE 3
 #define MAX_SPLIT_TX_PARTY_SIZE 10
 
+/* A checkpoint file is this header, padded to CKPT_DATA_OFFSET, followed by
+ * the checking and then the saving accounts (in host byte order), and then
+ * by the SHA-256 of each CKPT_CHUNK_SIZE bytes of the accounts: a chunk
+ * fetched from another replica is checked on its own */
+#define CKPT_MAGIC 0x32544b4342534853ULL    /* "SHSBCKT2" */
+#define CKPT_DATA_OFFSET 4096
+#define CKPT_CHUNK_SIZE (1 << 20)
+#define CKPT_HASH_SIZE 32
 
+struct SmallBankCkptHeader {
+    uint64_t magic;
+    uint64_t n_users;
+    /* the height of the last block executed in the state */
+    uint64_t height;
+    /* SHA-256 of the chunk hashes */
+    uint8_t digest[CKPT_HASH_SIZE];
+};
+
+
+/* The accounts live in a private memory mapping: anonymous for the initial
+ * state, or of a checkpoint file, which is then paged in on demand and never
+ * written back (the modified pages are copies). */
 class SmallBank{
 private:
     uint64_t n_users;
-    std::vector<uint64_t> checking_accounts;
-    std::vector<uint64_t> saving_accounts;
+    uint64_t *accounts;
+    size_t map_size;
+    uint64_t *checking_accounts;
+    uint64_t *saving_accounts;
+
+    void set_mapping(void *addr);
 public:
+    /* The initial state, the same on every replica */
     SmallBank(uint64_t n_users);
+    /* The state of a checkpoint file; with verify, its chunks are checked
+     * against their hashes and these against the header digest (throws
+     * std::runtime_error) */
+    SmallBank(const std::string &ckpt_path, bool verify, SmallBankCkptHeader &header);
+    ~SmallBank();
+
+    SmallBank(const SmallBank &) = delete;
+    SmallBank &operator=(const SmallBank &) = delete;
+
+    uint64_t get_n_users() const { return n_users; }
     /* tx_type = 0 */
     void transaction_savings(uint64_t user_id, uint64_t amount);
     /* tx_type = 1 */    
@@ -38,6 +83,32 @@ public:
     void amalgamate(uint64_t user_id);
     /* tx_type = 6 */
     std::pair<uint64_t,uint64_t> query(uint64_t user_id);
+    /* FNV-1a hash of all the accounts, to compare two states */
+    uint64_t digest() const;
+    /* Put back the accounts of a user (to undo transactions) */
+    void restore(uint64_t user_id, uint64_t checking, uint64_t saving);
+    /* Write the state to fd as a checkpoint of the given height; returns
+     * false (with errno set) on a failed write */
+    bool write_checkpoint(int fd, uint64_t height) const;
+    /* Read and check the header of a checkpoint file */
+    static bool read_checkpoint_header(int fd, SmallBankCkptHeader &header);
+
+    /* The layout of the checkpoint of n_users: the accounts, in chunks,
+     * then the chunk hashes, up to the size of the file */
+    static uint64_t ckpt_data_size(uint64_t n_users){
+        return 2*n_users*sizeof(uint64_t);
+    }
+    static uint64_t ckpt_nchunks(uint64_t n_users){
+        return (ckpt_data_size(n_users) + CKPT_CHUNK_SIZE - 1) / CKPT_CHUNK_SIZE;
+    }
+    static uint64_t ckpt_hashes_offset(uint64_t n_users){
+        return CKPT_DATA_OFFSET + ckpt_data_size(n_users);
+    }
+    static uint64_t ckpt_size(uint64_t n_users){
+        return ckpt_hashes_offset(n_users) + ckpt_nchunks(n_users)*CKPT_HASH_SIZE;
+    }
+    /* SHA-256 of len bytes at data, into md */
+    static void sha256(const uint8_t *data, size_t len, uint8_t *md);
 };
 
 class SmallBankManager{
@@ -64,9 +135,45 @@ private:
     std::pair<uint64_t,uint64_t> show_account_info(uint64_t user_id);
 
 public:
+    struct UndoEntry {
+        uint64_t user_id;
+        uint64_t checking;
+        uint64_t saving;
+    };
+    using undo_log_t = std::vector<UndoEntry>;
+
     SmallBankManager(uint64_t n_users, double prob_choose_mtx, double skew_factor);
+    /* Over an existing state (e.g. loaded from a checkpoint), which it owns */
+    SmallBankManager(SmallBank *bank, double prob_choose_mtx, double skew_factor);
+    /* Reseed the transaction generators, so that several managers do not
+     * produce the same sequence */
+    void seed(uint64_t seed);
     std::vector<uint64_t> get_next_transaction_serialized();
     std::pair<uint64_t, uint64_t> execute_transaction(const uint64_t* tx_payload);
+    uint64_t state_digest() const { return bank->digest(); }
+    uint64_t get_n_users() const { return n_users; }
+    /* Go on from another state of the same users (e.g. a checkpoint fetched
+     * from other replicas), which it owns from now on */
+    void replace_state(SmallBank *new_bank);
+
+    /* The users whose accounts the transaction reads or writes (read from
+     * the payload, without executing it); returns false if it only reads */
+    static bool get_tx_users(const uint64_t* tx_payload, std::vector<uint64_t> &users);
+    /* Append to undo the current accounts of the users the transactions
+     * write, before executing them (in any way) */
+    void log_undo(const std::vector<const uint64_t*> &payloads, undo_log_t &undo);
+    /* Put the state back as it was before the transactions of undo, and
+     * empty it */
+    void rollback(undo_log_t &undo);
+
+    /* Write the state to the checkpoint file path, tagged with height, as
+     * it was before the transactions of the undo logs (oldest first). This
+     * is done by a forked child, which gets a copy-on-write snapshot of the
+     * state: the caller can go on executing transactions right away. The
+     * file appears under path only once complete. Returns the pid of the
+     * child (which exits with 0 on success) or -1 if fork() failed. */
+    pid_t checkpoint(const std::string &path, uint64_t height,
+                    const std::vector<undo_log_t *> &undo);
 
     // /* Just for testing they are public */
     // std::vector<uint64_t> get_next_transaction_by_type(uint64_t tx_type);
@@ -75,4 +182,60 @@ public:
     
 };
 
+/* Executes the transactions of a committed batch on a pool of threads, with
+ * the same outcome as executing them one after another in the batch order.
+ * The scheduling is deterministic (as in Calvin): the accounts touched by a
+ * transaction are known from its payload, so a transaction only waits for
+ * the earlier transactions of the batch touching the same users, and two
+ * queries never wait for each other. Transactions on distinct users run in
+ * parallel on the distinct entries of the account vectors. */
+class SmallBankExecutor{
+private:
+    struct UserState {
+        int64_t last_writer;
+        std::vector<uint32_t> readers;  /* since the last writer */
+    };
+
+    SmallBankManager *manager;
+    /* batches smaller than this are executed in order by the caller */
+    const size_t min_parallel;
+
+    /* the current batch */
+    const std::vector<const uint64_t*> *payloads;
+    std::vector<std::pair<uint64_t, uint64_t>> *results;
+    std::vector<std::vector<uint32_t>> successors;
+    std::unique_ptr<std::atomic<uint32_t>[]> ndeps;
+    size_t ndeps_cap;
+    std::atomic<size_t> nremaining;
+    std::unordered_map<uint64_t, UserState> users;
+    std::vector<uint64_t> tx_users;
+
+    std::vector<std::thread> workers;
+    std::mutex ready_lock;
+    std::condition_variable ready_cv;
+    std::vector<uint32_t> ready;
+    bool stopped;
+
+    void build_graph();
+    void run(uint32_t tx);
+    /* Execute ready transactions until the batch is done (or the pool is
+     * stopped, for a worker) */
+    void work(bool caller);
+
+public:
+    /* nthreads includes the calling thread: 1 executes everything in order */
+    SmallBankExecutor(SmallBankManager *manager, size_t nthreads, size_t min_parallel = 32);
+    ~SmallBankExecutor();
+
+    SmallBankExecutor(const SmallBankExecutor &) = delete;
+    SmallBankExecutor &operator=(const SmallBankExecutor &) = delete;
+
+    size_t get_nthreads() const { return workers.size() + 1; }
+
+    /* Execute the batch; results[i] is what execute_transaction() would
+     * have returned for payloads[i] */
+    void execute_batch(const std::vector<const uint64_t*> &payloads,
+                        std::vector<std::pair<uint64_t, uint64_t>> &results);
+};
+
 #endif
\ No newline at end of file
@@ -0,0 +1,83 @@
+/**
+ * Copyright 2018 VMware
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _HOTSTUFF_ADMIN_H
+#define _HOTSTUFF_ADMIN_H
+
+#include <atomic>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace hotstuff {
+
+/** Local control socket of a replica.
+ *
+ * Listens on a Unix-domain stream socket and reads one command per line
+ * (`name arg...`, separated by blanks); each command gets one reply,
+ * terminated by an empty line. A command that fails replies with a line
+ * starting with `error: `. The commands are registered by the application:
+ * their handlers run on the thread of the server and are expected to hand
+ * over anything touching the protocol state to the thread owning it. `help`
+ * lists the registered commands. Only one client is served at a time; access
+ * control is left to the permissions of the socket file.
+ *
+ * For example: `echo "set block-size 400" | socat - UNIX-CONNECT:admin.sock` */
+class AdminServer {
+    public:
+    using args_t = std::vector<std::string>;
+    /** Return the reply, or throw std::exception with the error. */
+    using handler_t = std::function<std::string(const args_t &)>;
+
+    private:
+    struct Command {
+        std::string usage;
+        handler_t handler;
+    };
+
+    std::string path;
+    int listen_fd;
+    std::atomic<bool> running;
+    std::mutex cmds_lock;
+    std::map<std::string, Command> cmds;
+    std::thread worker;
+
+    void serve();
+    void handle(int fd);
+
+    public:
+    /** Listen on the socket file `path`, replacing any stale one (throws
+     * HotStuffError on failure). The file is removed upon destruction. */
+    AdminServer(const std::string &path);
+    ~AdminServer();
+
+    AdminServer(const AdminServer &) = delete;
+    AdminServer &operator=(const AdminServer &) = delete;
+
+    /** Register the command `name`; `usage` describes its arguments. */
+    void reg_cmd(const std::string &name, const std::string &usage,
+                handler_t handler);
+
+    /** Run the command line `line` as if it came from the socket. */
+    std::string exec(const std::string &line);
+};
+
+}
+
+#endif
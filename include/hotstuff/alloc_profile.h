@@ -0,0 +1,104 @@
+/**
+ * Copyright 2018 VMware
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _HOTSTUFF_ALLOC_PROFILE_H
+#define _HOTSTUFF_ALLOC_PROFILE_H
+
+#include "hotstuff/config.h"
+
+#ifdef HOTSTUFF_ALLOC_PROFILE
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace hotstuff {
+
+/** Heap allocation accounting, compiled in with HOTSTUFF_ALLOC_PROFILE.
+ *
+ * The build replaces the global operator new (see alloc_profile.cpp) with
+ * one that counts the allocations and the bytes asked for, against the
+ * phase the calling thread is in. A thread enters a phase for the lifetime
+ * of a HOTSTUFF_ALLOC_SCOPE() and returns to the enclosing one afterwards,
+ * so a nested scope (e.g., the execution of a command within the
+ * finalization of its block) takes over for its own extent. What allocates
+ * out of any scope (e.g., the network threads) is counted as OTHER. Only
+ * the C++ allocations are seen, not the ones made with malloc() directly
+ * (libuv, OpenSSL). */
+class AllocProfiler {
+    public:
+    enum Phase {
+        OTHER,
+        INGRESS,        /**< client command received and queued */
+        LOCAL_ORDER,    /**< local order made, sent and merged */
+        PROPOSE,        /**< fair_propose() and the new block */
+        DELIVER,        /**< proposal received, block fetched and delivered */
+        VOTE,           /**< proposal processed, votes sent and received */
+        FINALIZE,       /**< commit and fair_finalize() */
+        EXECUTE,        /**< command applied to the state machine */
+        RESPOND,        /**< response sent back to the client */
+        NPHASES
+    };
+
+    /** Allocations counted so far, all threads together. */
+    struct Stats {
+        uint64_t nallocs[NPHASES];
+        uint64_t bytes[NPHASES];
+
+        uint64_t total_nallocs() const;
+        uint64_t total_bytes() const;
+        Stats operator-(const Stats &other) const;
+    };
+
+    static const char *phase_name(Phase phase);
+
+    static Phase get_phase() { return current; }
+    /** Enter `phase` and return the previous phase. */
+    static Phase set_phase(Phase phase) {
+        Phase prev = current;
+        current = phase;
+        return prev;
+    }
+
+    static Stats snapshot();
+    /** Summarize `delta` as allocations (and bytes) per `unit` (e.g., per
+     * committed command), one line per phase. */
+    static std::string report(const Stats &delta, size_t nunits,
+                            const char *unit = "committed command");
+
+    private:
+    inline static thread_local Phase current = OTHER;
+};
+
+class AllocScope {
+    AllocProfiler::Phase prev;
+
+    public:
+    AllocScope(AllocProfiler::Phase phase): prev(AllocProfiler::set_phase(phase)) {}
+    ~AllocScope() { AllocProfiler::set_phase(prev); }
+
+    AllocScope(const AllocScope &) = delete;
+    AllocScope &operator=(const AllocScope &) = delete;
+};
+
+}
+
+#define HOTSTUFF_ALLOC_SCOPE(phase) \
+    hotstuff::AllocScope _alloc_scope(hotstuff::AllocProfiler::phase)
+#else
+#define HOTSTUFF_ALLOC_SCOPE(phase) ((void)0)
+#endif
+
+#endif
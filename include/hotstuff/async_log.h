@@ -0,0 +1,179 @@
+/**
+ * Copyright 2018 VMware
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _HOTSTUFF_ASYNC_LOG_H
+#define _HOTSTUFF_ASYNC_LOG_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+
+namespace hotstuff {
+
+/** Asynchronous binary logger behind the HOTSTUFF_LOG_* macros.
+ *
+ * Once started, a log call does not format anything: it copies the id of
+ * its format string (registered once per call site) and its arguments into a
+ * fixed-size record, appended to a ring owned by the calling thread. A
+ * background thread drains the rings, and either formats the records as the
+ * synchronous logger would, or writes them as they are to a binary file to
+ * be decoded offline (see hotstuff-logdecode). The caller never waits: if
+ * its ring is full, the record is dropped and counted, and the drops are
+ * reported in the log. Strings are copied, truncated to what is left of the
+ * record. Errors are always logged synchronously. */
+class AsyncLogger {
+    public:
+    enum Level: uint8_t { INFO, DEBUG, WARN, PROTO, NLEVELS };
+
+    static const size_t record_size = 256;
+    static const size_t max_args = 10;
+    /** Capacity (in records) of the ring of each thread. */
+    static const size_t ring_size = 1 << 13;
+
+    /** What a log call leaves in the ring (and in the binary log). Each
+     * argument is tagged in `types`: 'i' and 'u' (8-byte integers), 'f' (a
+     * double), 'p' (a pointer), 's' (a length byte and the characters) or
+     * '?' (a type that cannot be logged, nothing stored). */
+    struct Record {
+        uint64_t ts;            /**< nanoseconds since the epoch */
+        uint32_t fmt_id;
+        uint8_t nargs;
+        uint8_t len;            /**< bytes of payload used */
+        char types[max_args];
+        uint8_t payload[record_size - 24];
+    };
+    static_assert(sizeof(Record) == record_size, "unexpected record layout");
+
+    /** Per-thread ring of records (see async_log.cpp). */
+    struct Ring;
+
+    private:
+    static std::atomic<bool> enabled;
+
+    static Ring *get_local_ring();
+    static Record *begin_record();
+    static void commit_record();
+
+    class Encoder {
+        Record &rec;
+
+        bool reserve(char type, size_t n) {
+            if (rec.nargs == max_args ||
+                rec.len + n > sizeof(rec.payload)) return false;
+            rec.types[rec.nargs++] = type;
+            return true;
+        }
+
+        void put_word(char type, uint64_t w) {
+            if (!reserve(type, sizeof w)) return;
+            memcpy(rec.payload + rec.len, &w, sizeof w);
+            rec.len += sizeof w;
+        }
+
+        void put_str(const char *s, size_t n) {
+            if (!reserve('s', 1)) return;
+            size_t room = sizeof(rec.payload) - rec.len - 1;
+            if (n > room) n = room;
+            if (n > 255) n = 255;
+            rec.payload[rec.len++] = n;
+            memcpy(rec.payload + rec.len, s, n);
+            rec.len += n;
+        }
+
+        public:
+        Encoder(Record &rec): rec(rec) {
+            rec.nargs = 0;
+            rec.len = 0;
+        }
+
+        template<typename T>
+        void put(const T &v) {
+            if constexpr (std::is_integral<T>::value || std::is_enum<T>::value)
+            {
+                if constexpr (std::is_signed<T>::value)
+                    put_word('i', (uint64_t)(int64_t)v);
+                else
+                    put_word('u', (uint64_t)v);
+            }
+            else if constexpr (std::is_floating_point<T>::value)
+            {
+                double d = v;
+                uint64_t w;
+                memcpy(&w, &d, sizeof w);
+                put_word('f', w);
+            }
+            else if constexpr (std::is_same<typename std::decay<T>::type, char *>::value ||
+                                std::is_same<typename std::decay<T>::type, const char *>::value)
+            {
+                const char *str = v;
+                put_str(str, str ? strlen(str) : 0);
+            }
+            else if constexpr (std::is_same<T, std::string>::value)
+                put_str(v.data(), v.size());
+            else if constexpr (std::is_pointer<T>::value)
+                put_word('p', (uint64_t)(uintptr_t)v);
+            else
+                reserve('?', 0);
+        }
+    };
+
+    public:
+    enum Mode {
+        TEXT,       /**< format in the background, write to stderr */
+        BINARY      /**< write the records to a file, decode them later */
+    };
+
+    static bool is_enabled() { return enabled.load(std::memory_order_relaxed); }
+
+    /** Start the background thread; `fname` is the binary log for the
+     * BINARY mode. Throws HotStuffError if the file cannot be opened. */
+    static void start(Mode mode, const std::string &fname = "");
+    /** Write out what is left in the rings and stop the background thread
+     * (log calls go back to the synchronous logger). */
+    static void stop();
+
+    /** The id of a format string, called once by each call site. */
+    static uint32_t register_format(Level level, const char *fmt);
+
+    template<typename... Args>
+    static void log(uint32_t fmt_id, const char *, const Args &...args) {
+        Record *rec = begin_record();
+        if (!rec) return;
+        rec->ts = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        rec->fmt_id = fmt_id;
+        Encoder enc(*rec);
+        (enc.put(args), ...);
+        commit_record();
+    }
+
+    /** Format a record as printf would have with its format string. */
+    static std::string format(const char *fmt, const Record &rec);
+    /** A full log line, as written by the synchronous logger. */
+    static std::string format_line(Level level, const char *fmt,
+                                    const Record &rec, bool color = false);
+
+    /** Decode a binary log into text lines written to `out`. Returns the
+     * number of records decoded. */
+    static size_t decode(const std::string &fname, int out);
+};
+
+}
+
+#endif
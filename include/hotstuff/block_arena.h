@@ -0,0 +1,225 @@
+/**
+ * Copyright 2018 VMware
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _HOTSTUFF_BLOCK_ARENA_H
+#define _HOTSTUFF_BLOCK_ARENA_H
+
+#include <cstdint>
+#include <map>
+#include <memory_resource>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace hotstuff {
+
+/** Height-bucketed bump allocator for the blocks and everything they own.
+ *
+ * Blocks whose heights fall into the same window of `span` heights are
+ * carved out of the same bucket, a list of fixed-size chunks handed out by
+ * bumping a pointer; their vectors, order lists and vote bitmaps are
+ * allocated from the bucket as well (it is a pmr memory resource), so a
+ * block ends up next to its own data and to its neighbours. Nothing is freed
+ * individually. A bucket counts the objects living in it, and once it is
+ * empty and its window is below the pruning watermark all of its chunks go
+ * back to the arena in one step. Spare chunks are kept for reuse rather than
+ * given back to malloc, so a long run settles on a fixed working set.
+ *
+ * Only the consensus thread uses the arena. Objects may outlive it: buckets
+ * that are still in use when the arena goes away free themselves once their
+ * last object is gone. */
+class BlockArena {
+    public:
+    class Bucket: public std::pmr::memory_resource {
+        friend BlockArena;
+        BlockArena *arena;      /**< null once the arena is gone */
+        uint32_t first_height;
+        size_t nlive;
+        std::vector<void *> chunks;
+        std::vector<std::pair<void *, size_t>> large;   /**< (ptr, align) */
+        char *cur;
+        char *end;
+
+        Bucket(BlockArena *arena, uint32_t first_height):
+            arena(arena), first_height(first_height), nlive(0),
+            cur(nullptr), end(nullptr) {}
+
+        ~Bucket() {
+            for (auto chunk: chunks)
+            {
+                if (arena) arena->put_chunk(chunk);
+                else ::operator delete(chunk);
+            }
+            for (const auto &p: large)
+                ::operator delete(p.first, std::align_val_t(p.second));
+        }
+
+        void *do_allocate(size_t bytes, size_t align) override {
+            if (bytes > chunk_size / 4 || align > max_align)
+            {
+                void *p = ::operator new(bytes, std::align_val_t(align));
+                large.push_back(std::make_pair(p, align));
+                return p;
+            }
+            char *p = align_up(cur, align);
+            if (p == nullptr || p + bytes > end)
+            {
+                cur = (char *)(arena ? arena->get_chunk() : ::operator new(chunk_size));
+                end = cur + chunk_size;
+                chunks.push_back(cur);
+                p = align_up(cur, align);
+            }
+            cur = p + bytes;
+            return p;
+        }
+
+        /* the space is given back along with the whole bucket */
+        void do_deallocate(void *, size_t, size_t) override {}
+
+        bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override {
+            return this == &other;
+        }
+
+        static char *align_up(char *p, size_t align) {
+            return (char *)(((uintptr_t)p + align - 1) & ~(uintptr_t)(align - 1));
+        }
+
+        public:
+        Bucket(const Bucket &) = delete;
+        Bucket &operator=(const Bucket &) = delete;
+
+        /** An object now lives in the bucket. */
+        void retain() { nlive++; }
+
+        /** An object living in the bucket is gone. */
+        void release() {
+            if (--nlive) return;
+            if (arena) arena->on_empty(this);
+            else delete this;
+        }
+
+        uint32_t get_first_height() const { return first_height; }
+    };
+
+    static const size_t chunk_size = 64 << 10;
+    static const size_t max_align = 64;
+
+    private:
+    const uint32_t span;
+    const size_t max_free_chunks;
+    /** buckets by the first height of their window */
+    std::map<uint32_t, Bucket *> buckets;
+    std::vector<void *> free_chunks;
+    size_t nchunks;             /**< chunks held by the buckets */
+    uint32_t watermark;         /**< windows below it can be reclaimed */
+    uint32_t frontier;          /**< highest height seen so far */
+
+    void *get_chunk() {
+        nchunks++;
+        if (free_chunks.empty()) return ::operator new(chunk_size);
+        void *chunk = free_chunks.back();
+        free_chunks.pop_back();
+        return chunk;
+    }
+
+    void put_chunk(void *chunk) {
+        nchunks--;
+        if (free_chunks.size() < max_free_chunks)
+            free_chunks.push_back(chunk);
+        else
+            ::operator delete(chunk);
+    }
+
+    bool is_reclaimable(const Bucket *bucket) const {
+        return bucket->first_height + span <= watermark;
+    }
+
+    void reclaim(std::map<uint32_t, Bucket *>::iterator it) {
+        delete it->second;
+        buckets.erase(it);
+    }
+
+    void on_empty(Bucket *bucket) {
+        if (is_reclaimable(bucket))
+            reclaim(buckets.find(bucket->first_height));
+    }
+
+    public:
+    BlockArena(uint32_t span = 64, size_t max_free_chunks = 1024):
+        span(span), max_free_chunks(max_free_chunks),
+        nchunks(0), watermark(0), frontier(0) {}
+
+    BlockArena(const BlockArena &) = delete;
+    BlockArena &operator=(const BlockArena &) = delete;
+
+    ~BlockArena() {
+        for (auto &p: buckets)
+        {
+            p.second->arena = nullptr;
+            if (!p.second->nlive) delete p.second;
+        }
+        for (auto chunk: free_chunks)
+            ::operator delete(chunk);
+    }
+
+    /** The bucket holding the window of the given height. */
+    Bucket *get_bucket(uint32_t height) {
+        advance(height);
+        uint32_t first = height - height % span;
+        auto it = buckets.lower_bound(first);
+        if (it != buckets.end() && it->first == first)
+            return it->second;
+        return buckets.emplace_hint(it, first, new Bucket(this, first))->second;
+    }
+
+    /** The bucket for an object whose height is not known yet (e.g., a
+     * fetched block before its delivery): new blocks are close to the
+     * highest height seen so far. */
+    Bucket *get_frontier_bucket() { return get_bucket(frontier); }
+
+    void advance(uint32_t height) {
+        if (height > frontier) frontier = height;
+    }
+
+    /** Allow the windows entirely below `height` to be reclaimed. Those
+     * already empty are freed at once and the others as soon as their last
+     * object goes. Returns the number of buckets freed now. */
+    size_t prune(uint32_t height) {
+        size_t n = 0;
+        if (height <= watermark) return 0;
+        watermark = height;
+        for (auto it = buckets.begin();
+                it != buckets.end() && is_reclaimable(it->second);)
+        {
+            auto cur = it++;
+            if (!cur->second->nlive)
+            {
+                reclaim(cur);
+                n++;
+            }
+        }
+        return n;
+    }
+
+    size_t get_nbuckets() const { return buckets.size(); }
+    /** Chunks in use, excluding the oversized allocations. */
+    size_t get_nchunks() const { return nchunks; }
+    size_t get_nfree_chunks() const { return free_chunks.size(); }
+};
+
+}
+
+#endif
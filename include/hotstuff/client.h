@@ -41,7 +41,12 @@ struct MsgRespCmd {
     uint8_t payload[HOTSTUFF_CMD_RESPSIZE];
 #endif
     Finality fin;
-    MsgRespCmd(const Finality &fin) {
+    MsgRespCmd(const Finality &fin):
+            serialized(BufferPool::acquire(Finality::serialized_size
+#if HOTSTUFF_CMD_RESPSIZE > 0
+                + sizeof(payload)
+#endif
+            )) {
         serialized << fin;
 #if HOTSTUFF_CMD_RESPSIZE > 0
         serialized.put_data(payload, payload + sizeof(payload));
@@ -52,6 +57,116 @@ struct MsgRespCmd {
     }
 };
 
+/** A read-only request, answered by every replica from its last executed
+ * state instead of being ordered. */
+struct MsgReqQuery {
+    static const opcode_t opcode = 0x6;
+    DataStream serialized;
+    /** chosen by the client to match the answers */
+    uint64_t qid;
+    std::vector<uint64_t> payload;
+    MsgReqQuery(uint64_t qid, const std::vector<uint64_t> &payload) {
+        serialized << qid << htole((uint32_t)payload.size());
+        for (auto w: payload) serialized << w;
+    }
+    MsgReqQuery(DataStream &&s) {
+        uint32_t n;
+        s >> qid >> n;
+        n = letoh(n);
+        /* the count comes from the wire: check it against what is there
+         * before allocating */
+        if (n > s.size() / sizeof(uint64_t))
+            throw HotStuffError("truncated MsgReqQuery");
+        payload.resize(n);
+        for (auto &w: payload) s >> w;
+    }
+};
+
+struct MsgRespQuery {
+    static const opcode_t opcode = 0x7;
+    DataStream serialized;
+    uint64_t qid;
+    /** height of the last executed block the answer reflects */
+    uint32_t height;
+    /** false if the request is not a query the replica answers locally */
+    bool ok;
+    std::pair<uint64_t, uint64_t> result;
+    MsgRespQuery(uint64_t qid, uint32_t height, bool ok,
+                const std::pair<uint64_t, uint64_t> &result) {
+        serialized << qid << height << (uint8_t)ok
+                    << result.first << result.second;
+    }
+    MsgRespQuery(DataStream &&s) {
+        uint8_t _ok;
+        s >> qid >> height >> _ok >> result.first >> result.second;
+        ok = _ok;
+    }
+};
+
+/** Asks a replica for the checkpoints of its application state it keeps. */
+struct MsgReqCkpt {
+    static const opcode_t opcode = 0x8;
+    DataStream serialized;
+    MsgReqCkpt() {}
+    MsgReqCkpt(DataStream &&) {}
+};
+
+struct MsgRespCkpt {
+    static const opcode_t opcode = 0x9;
+    DataStream serialized;
+    /** (height, digest) of each checkpoint, each of size bytes */
+    std::vector<std::pair<uint64_t, uint256_t>> ckpts;
+    uint64_t size;
+    MsgRespCkpt(const std::vector<std::pair<uint64_t, uint256_t>> &ckpts,
+                uint64_t size) {
+        serialized << htole((uint32_t)ckpts.size());
+        for (const auto &c: ckpts) serialized << c.first << c.second;
+        serialized << size;
+    }
+    MsgRespCkpt(DataStream &&s) {
+        uint32_t n;
+        s >> n;
+        n = letoh(n);
+        if (n > s.size() / (sizeof(uint64_t) + uint256_t::serialized_size))
+            throw HotStuffError("truncated MsgRespCkpt");
+        ckpts.resize(n);
+        for (auto &c: ckpts) s >> c.first >> c.second;
+        s >> size;
+    }
+};
+
+/** Asks for the bytes [offset, offset + len) of the checkpoint at height. */
+struct MsgReqCkptChunk {
+    static const opcode_t opcode = 0xa;
+    DataStream serialized;
+    uint64_t height;
+    uint64_t offset;
+    uint32_t len;
+    MsgReqCkptChunk(uint64_t height, uint64_t offset, uint32_t len) {
+        serialized << height << offset << len;
+    }
+    MsgReqCkptChunk(DataStream &&s) { s >> height >> offset >> len; }
+};
+
+struct MsgRespCkptChunk {
+    static const opcode_t opcode = 0xb;
+    DataStream serialized;
+    uint64_t height;
+    uint64_t offset;
+    /** empty if the replica no longer has the checkpoint */
+    bytearray_t data;
+    MsgRespCkptChunk(uint64_t height, uint64_t offset, const bytearray_t &data) {
+        serialized << height << offset << htole((uint32_t)data.size()) << data;
+    }
+    MsgRespCkptChunk(DataStream &&s) {
+        uint32_t len;
+        s >> height >> offset >> len;
+        len = letoh(len);
+        auto p = s.get_data_inplace(len);
+        data = bytearray_t(p, p + len);
+    }
+};
+
 //#ifdef HOTSTUFF_AUTOCLI
 //struct MsgDemandCmd {
 //    static const opcode_t opcode = 0x6;
@@ -0,0 +1,100 @@
+/**
+ * Copyright 2018 VMware
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _HOTSTUFF_CMD_TABLE_H
+#define _HOTSTUFF_CMD_TABLE_H
+
+#include <cstdint>
+#include <vector>
+
+#include "hotstuff/hash.h"
+#include "hotstuff/flat_hash.h"
+
+namespace hotstuff {
+
+/** Compact replica-local name of a command. */
+using cmd_id_t = uint32_t;
+
+const cmd_id_t CMD_ID_NULL = UINT32_MAX;
+
+/** Interning table mapping command hashes to dense 32-bit ids.
+ *
+ * The hash is looked up once when a command enters the replica; from then
+ * on the local structures carry the id and keep per-command state in plain
+ * arrays indexed by it. Each holder of an id takes a reference, and the id
+ * is recycled as soon as the last one lets go (after the command has been
+ * committed and answered). Only the consensus thread uses the table. */
+class CommandTable {
+    FlatHashMap<cmd_id_t> ids;
+    std::vector<Hash256> hashes;
+    std::vector<uint32_t> refcnt;
+    std::vector<cmd_id_t> free_ids;
+
+    public:
+    /** Intern the hash (if needed) and take a reference to its id. */
+    cmd_id_t acquire(const Hash256 &hash) {
+        auto it = ids.find(hash);
+        if (it != ids.end())
+        {
+            refcnt[it->second]++;
+            return it->second;
+        }
+        cmd_id_t id;
+        if (!free_ids.empty())
+        {
+            id = free_ids.back();
+            free_ids.pop_back();
+            hashes[id] = hash;
+        }
+        else
+        {
+            id = hashes.size();
+            hashes.push_back(hash);
+            refcnt.push_back(0);
+        }
+        refcnt[id] = 1;
+        ids.emplace(hash, id);
+        return id;
+    }
+
+    /** Take another reference to an id that is already held. */
+    void acquire(cmd_id_t id) { refcnt[id]++; }
+
+    void release(cmd_id_t id) {
+        if (--refcnt[id]) return;
+        ids.erase(hashes[id]);
+        free_ids.push_back(id);
+    }
+
+    /** The id of the hash, or CMD_ID_NULL if the command is not interned. */
+    cmd_id_t find(const Hash256 &hash) const {
+        auto it = ids.find(hash);
+        return it == ids.end() ? CMD_ID_NULL : it->second;
+    }
+
+    const Hash256 &get_hash(cmd_id_t id) const { return hashes[id]; }
+
+    /** Number of live ids. */
+    size_t size() const { return ids.size(); }
+
+    /** Upper bound (exclusive) of the ids handed out so far, i.e. the size
+     * an array indexed by cmd_id_t needs to have. */
+    size_t id_bound() const { return hashes.size(); }
+};
+
+}
+
+#endif
@@ -19,6 +19,8 @@
 #define _HOTSTUFF_CONSENSUS_H
 
 #include <cassert>
+#include <functional>
+#include <queue>
 #include <set>
 #include <unordered_map>
 
@@ -26,6 +28,8 @@
 #include "hotstuff/type.h"
 #include "hotstuff/entity.h"
 #include "hotstuff/crypto.h"
+#include "hotstuff/tail_index.h"
+#include "hotstuff/metrics.h"
 
 namespace hotstuff {
 
@@ -34,19 +38,21 @@ struct Vote;
 // LocalOrder Struct
 struct LocalOrder;
 struct Finality;
+class PaceMaker;
 
 /** Abstraction for HotStuff protocol state machine (without network implementation). */
 class HotStuffCore {
     block_t b0;                                  /** the genesis block */
     /* === state variables === */
     /** block containing the QC for the highest block having one */
-    std::pair<block_t, quorum_cert_bt> hqc;   /**< highest QC */
+    std::pair<block_t, quorum_cert_t> hqc;   /**< highest QC */
     block_t b_lock;                            /**< locked block */
     block_t b_exec;                            /**< last executed block */
     uint32_t vheight;          /**< height of the block last voted for */
+    uint32_t pruned_height;    /**< no ancestors kept below this height */
     /* === auxilliary variables === */
     privkey_bt priv_key;            /**< private key for signing votes */
-    std::set<block_t> tails;   /**< set of tail blocks */
+    TailIndex tails;           /**< tail blocks */
     ReplicaConfig config;                   /**< replica configuration */
     /* === async event queues === */
     std::unordered_map<block_t, promise_t> qc_waiting;
@@ -56,18 +62,34 @@ class HotStuffCore {
     /* == feature switches == */
     /** always vote negatively, useful for some PaceMakers */
     bool vote_disabled;
+    /** hand the fair order of every block voted for to do_speculate */
+    bool speculation;
+    /** fair orders computed upon voting (with the block heights), reused
+     * upon commit */
+    std::unordered_map<uint256_t, std::pair<uint32_t, std::vector<Hash256>>> spec_orders;
+    /** commands received, not yet sent in a local order */
+    std::queue<cmd_id_t> local_order_buffer;
 
     block_t get_delivered_blk(const uint256_t &blk_hash);
     void sanity_check_delivered(const block_t &blk);
     void update(const block_t &nblk);
-    void update_hqc(const block_t &_hqc, const quorum_cert_bt &qc);
+    void update_hqc(const block_t &_hqc, const quorum_cert_t &qc);
     void on_hqc_update();
     void on_qc_finish(const block_t &blk);
     void on_propose_(const Proposal &prop);
     void on_receive_proposal_(const Proposal &prop);
+    void speculate(const block_t &blk);
 
     protected:
     ReplicaID id;                  /**< identity of the replica itself */
+#ifdef HOTSTUFF_BLK_PROFILE
+    mutable BlockProfiler blk_profiler;
+#endif
+    /** metrics of the replica, updated without locking */
+    MetricsRegistry metrics;
+    Histogram &fair_finalize_time;
+    Histogram &local_order_merge_time;
+    Histogram &fair_propose_time;
 
     public:
     BoxObj<EntityStorage> storage;
@@ -105,25 +127,32 @@ class HotStuffCore {
      * contain at least one block, and the first block is the actual parent,
      * while the others are uncles/aunts */
     block_t on_propose(/* const std::vector<uint256_t> &cmds,*/                 // Us
-                    const std::unordered_map<ReplicaID, std::vector<uint256_t>> &orders,
+                    const std::unordered_map<ReplicaID, std::vector<Hash256>> &orders,
                     //const std::vector<std::pair<uint256_t, uint256_t>> &e_update,
                     const std::vector<block_t> &parents,
                     bytearray_t &&extra = bytearray_t());
     // print block message
     void print_block(std::string calling_method,const hotstuff::Proposal &prop);                       // Themis
     /** Call to submit local order to the current leader **/
-    void on_local_order (ReplicaID proposer, const std::vector<uint256_t> &order, bool is_reorder=false);       // Themis
+    void on_local_order (ReplicaID proposer, const std::vector<cmd_id_t> &order, bool is_reorder=false);       // Themis
     /** Called when local order is received on Leader from a Replica  **/
     bool on_receive_local_order (const LocalOrder &local_order, const std::vector<block_t> &parents);   // Themis
     // /** FairFinalize() **/
     // void print_all_blocks(const block_t &nblk, const block_t &blk);     // Themis
     // std::vector<uint256_t> fair_finalize(block_t const &blk, std::vector<std::pair<uint256_t, uint256_t>> const &e_update);       // Themis
     void print_all_blocks(const block_t &nblk, const block_t &blk);  //Us
-    std::vector<uint256_t> fair_finalize(block_t const &blk);  //Us:to finalize the order
+    std::vector<Hash256> fair_finalize(block_t const &blk);  //Us:to finalize the order
+    /** The final order of the commands of the first local order, given the
+     * local orders of the replicas: by the number of commands each one
+     * precedes in a majority of the orders (its Copeland score), then by
+     * weight, then by hash. Unlike a pairwise majority, this is a total order
+     * even when the majorities form cycles. */
+    static std::vector<Hash256> fair_order(const block_orders_t &orders,
+                                        double fairness_parameter);
     /** FairPropose() **/
     //std::unordered_map<uint256_t, std::unordered_set<uint256_t>> fair_propose();        // Themis
     //std::vector<std::pair<uint256_t, uint256_t>> fair_update();                         // Themis
-    std::unordered_map<ReplicaID, std::vector<uint256_t>> fair_propose();        // Us
+    std::unordered_map<ReplicaID, std::vector<Hash256>> fair_propose();        // Us
     void reorder(ReplicaID proposer);                                                                   // Themis
 
     /** Themis thereshold Initialization **/
@@ -140,6 +169,15 @@ class HotStuffCore {
     protected:
     /** Called by HotStuffCore upon the decision being made for cmd. */
     virtual void do_decide(Finality &&fin) = 0;
+    /** Called by HotStuffCore once all the commands of blk have been passed
+     * to do_decide, so that the user can execute them as a batch. */
+    virtual void do_decide_block(const block_t &) {}
+    /** Called by HotStuffCore (when speculation is on) after voting for blk,
+     * with the order in which its commands will be decided if it commits.
+     * The user may execute them ahead of time, as long as it can undo them:
+     * blk commits if and only if do_decide_block(blk) follows, otherwise
+     * the next committed block does not extend it. */
+    virtual void do_speculate(const block_t &, const std::vector<Hash256> &) {}
     virtual void do_consensus(const block_t &blk) = 0;
     /** Called by HotStuffCore upon broadcasting a new proposal.
      * The user should send the proposal message to all replicas except for
@@ -152,6 +190,22 @@ class HotStuffCore {
     /** Called upon sending out local ordering to the next proposer. */
     virtual void do_send_local_order(ReplicaID proposer, const LocalOrder &local_order) = 0;        // Themis
 
+    /* The glue between the state machine and a PaceMaker, shared by
+     * HotStuffBase and the replicas run without a network (the simulated
+     * and the replayed ones). */
+    /** Queue a command for the local order of this replica, taking over the
+     * reference the caller holds on it; once blk_size are queued, they are
+     * sent to the proposer.
+     * @return true if a local order was sent */
+    bool queue_local_cmd(cmd_id_t cid, ReplicaID proposer, uint32_t blk_size);
+    /** Merge a local order (received, or of this replica), and propose once
+     * enough of them are in, if this replica is the proposer. */
+    void process_local_order(PaceMaker &pmaker, const LocalOrder &local_order);
+    /** Pass the vote to the next proposer: to this replica directly, or to
+     * send otherwise. */
+    void route_vote(PaceMaker &pmaker, ReplicaID last_proposer, const Vote &vote,
+                    std::function<void(ReplicaID, const Vote &)> send);
+
     /* The user plugs in the detailed instances for those
      * polymorphic data types. */
     public:
@@ -162,7 +216,7 @@ class HotStuffCore {
     /** Create a quorum certificate that proves 2f+1 votes for a block. */
     virtual quorum_cert_bt create_quorum_cert(const uint256_t &blk_hash) = 0;
     /** Create a quorum certificate from its serialized form. */
-    virtual quorum_cert_bt parse_quorum_cert(DataStream &s) = 0;
+    virtual quorum_cert_t parse_quorum_cert(DataStream &s) = 0;
     /** Create a command object from its serialized form. */
     //virtual command_t parse_cmd(DataStream &s) = 0;
 
@@ -189,9 +243,17 @@ class HotStuffCore {
     const block_t &get_hqc() { return hqc.first; }
     const ReplicaConfig &get_config() const { return config; }
     ReplicaID get_id() const { return id; }
-    const std::set<block_t> get_tails() const { return tails; }
+    const TailIndex &get_tails() const { return tails; }
     operator std::string () const;
     void set_vote_disabled(bool f) { vote_disabled = f; }
+    void set_speculation(bool f) { speculation = f; }
+    /** The last block whose commands have been decided. */
+    const block_t &get_last_executed() const { return b_exec; }
+    std::queue<cmd_id_t> &get_local_order_buffer() { return local_order_buffer; }
+#ifdef HOTSTUFF_BLK_PROFILE
+    BlockProfiler &get_blk_profiler() { return blk_profiler; }
+#endif
+    const MetricsRegistry &get_metrics() const { return metrics; }
 };
 
 /** Abstraction for proposal messages. */
@@ -210,6 +272,10 @@ struct Proposal: public Serializable {
         proposer(proposer),
         blk(blk), hsc(hsc) {}
 
+    size_t get_serialized_size() const {
+        return sizeof(ReplicaID) + blk->get_serialized_size();
+    }
+
     void serialize(DataStream &s) const override {
         s << proposer
           << *blk;
@@ -238,28 +304,32 @@ struct Vote: public Serializable {
     /** block being voted */
     uint256_t blk_hash;
     /** proof of validity for the vote */
-    part_cert_bt cert;
+    part_cert_t cert;
     
     /** handle of the core object to allow polymorphism */
     HotStuffCore *hsc;
 
-    Vote(): cert(nullptr), hsc(nullptr) {}
+    Vote(): hsc(nullptr) {}
     Vote(ReplicaID voter,
         const uint256_t &blk_hash,
         part_cert_bt &&cert,
         HotStuffCore *hsc):
         voter(voter),
         blk_hash(blk_hash),
-        cert(std::move(cert)), hsc(hsc) {}
-
-    Vote(const Vote &other):
-        voter(other.voter),
-        blk_hash(other.blk_hash),
-        cert(other.cert ? other.cert->clone() : nullptr),
-        hsc(other.hsc) {}
+        cert(cert.unwrap()), hsc(hsc) {}
 
+    /* the certificate is shared, not copied */
+    Vote(const Vote &other) = default;
     Vote(Vote &&other) = default;
-    
+
+    /** The fixed part of the encoding, before the certificate. */
+    static constexpr size_t header_size =
+        sizeof(ReplicaID) + uint256_t::serialized_size;
+
+    size_t get_serialized_size() const {
+        return header_size + cert->get_serialized_size();
+    }
+
     void serialize(DataStream &s) const override {
         s << voter << blk_hash << *cert;
     }
@@ -267,7 +337,7 @@ struct Vote: public Serializable {
     void unserialize(DataStream &s) override {
         assert(hsc != nullptr);
         s >> voter >> blk_hash;
-        cert = hsc->parse_part_cert(s);
+        cert = hsc->parse_part_cert(s).unwrap();
     }
 
     bool verify() const {
@@ -297,7 +367,7 @@ struct Vote: public Serializable {
 struct LocalOrder: public Serializable {
     ReplicaID initiator;
     /** Local ordering as seen by replica "initiator" **/
-    std::vector<uint256_t> ordered_hashes;
+    std::vector<Hash256> ordered_hashes;
     /** Local transaction ordering for previously proposed shaded transaction and have missing edges **/
     //std::vector<std::pair<uint256_t, uint256_t>> l_update;
     /** handle of the core object to allow polymorphism */
@@ -305,7 +375,7 @@ struct LocalOrder: public Serializable {
 
     LocalOrder(): hsc(nullptr) {}
     LocalOrder(ReplicaID initiator, 
-                const std::vector<uint256_t> &ordered_hashes, 
+                const std::vector<Hash256> &ordered_hashes, 
                 //const std::vector<std::pair<uint256_t, uint256_t>> &l_update,
                 HotStuffCore *hsc) : 
                     initiator(initiator),
@@ -321,15 +391,18 @@ struct LocalOrder: public Serializable {
 
     LocalOrder(LocalOrder &&other) = default;
 
+    size_t get_serialized_size() const {
+        return sizeof(ReplicaID) + sizeof(uint32_t) +
+                ordered_hashes.size() * sizeof(Hash256);
+    }
+
     void serialize(DataStream &s) const override {
         /** Serilize replica ID **/
         s << initiator;
 
         /** Serialize local ordering transaction hashes **/
         s << htole((uint32_t)ordered_hashes.size());
-        for (const auto &h: ordered_hashes) {
-            s << h;
-        }
+        put_hash_array(s, ordered_hashes);
 
         /** Serialize edges that were missing in previous proposals and found now on the replica **/
         // s << htole((uint32_t)l_update.size());
@@ -349,11 +422,7 @@ struct LocalOrder: public Serializable {
         uint32_t size;
         s >> size;
         size = letoh(size);
-        ordered_hashes.resize(size);
-        for (auto &hashes: ordered_hashes)
-        {
-            s >> hashes;
-        }
+        get_hash_array(s, ordered_hashes, size);
 
         /** unserialized l_update **/
         // s >> size;
@@ -405,6 +474,18 @@ struct Finality: public Serializable {
         cmd_idx(cmd_idx), cmd_height(cmd_height),
         cmd_hash(cmd_hash), blk_hash(blk_hash) {}
 
+    /** Size of the encoding of a positive decision (which carries the block
+     * hash); other decisions are one hash shorter. */
+    static constexpr size_t serialized_size =
+        sizeof(ReplicaID) + sizeof(int8_t) +
+        sizeof(uint32_t) + sizeof(uint32_t) +
+        uint256_t::serialized_size + uint256_t::serialized_size;
+
+    size_t get_serialized_size() const {
+        return decision == 1 ?
+            serialized_size : serialized_size - uint256_t::serialized_size;
+    }
+
     void serialize(DataStream &s) const override {
         s << rid << decision
           << cmd_idx << cmd_height
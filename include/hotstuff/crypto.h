@@ -45,30 +45,38 @@ class PrivKey: public Serializable {
 
 using privkey_bt = BoxObj<PrivKey>;
 
-class PartCert: public Serializable, public Cloneable {
+class PartCert: public Serializable {
     public:
     virtual ~PartCert() = default;
-    virtual promise_t verify(const PubKey &pubkey, VeriPool &vpool) = 0;
-    virtual bool verify(const PubKey &pubkey) = 0;
+    virtual promise_t verify(const PubKey &pubkey, VeriPool &vpool) const = 0;
+    virtual bool verify(const PubKey &pubkey) const = 0;
     virtual const uint256_t &get_obj_hash() const = 0;
-    virtual PartCert *clone() override = 0;
+    /** Number of bytes written by serialize(). */
+    virtual size_t get_serialized_size() const = 0;
 };
 
 class ReplicaConfig;
 
-class QuorumCert: public Serializable, public Cloneable {
+class QuorumCert: public Serializable {
     public:
     virtual ~QuorumCert() = default;
     virtual void add_part(ReplicaID replica, const PartCert &pc) = 0;
     virtual void compute() = 0;
-    virtual promise_t verify(const ReplicaConfig &config, VeriPool &vpool) = 0;
-    virtual bool verify(const ReplicaConfig &config) = 0;
+    virtual promise_t verify(const ReplicaConfig &config, VeriPool &vpool) const = 0;
+    virtual bool verify(const ReplicaConfig &config) const = 0;
     virtual const uint256_t &get_obj_hash() const = 0;
-    virtual QuorumCert *clone() override = 0;
+    /** Number of bytes written by serialize(). */
+    virtual size_t get_serialized_size() const = 0;
 };
 
+/* A certificate is built (or parsed) in a BoxObj; once complete it never
+ * changes and is shared by reference, so copying one is a pointer copy.
+ * The counts are not atomic: certificates stay on the consensus thread
+ * (verification tasks carry their own copies of the data). */
 using part_cert_bt = BoxObj<PartCert>;
 using quorum_cert_bt = BoxObj<QuorumCert>;
+using part_cert_t = RcObj<const PartCert>;
+using quorum_cert_t = RcObj<const QuorumCert>;
 
 class PubKeyDummy: public PubKey {
     PubKeyDummy *clone() override { return new PubKeyDummy(*this); }
@@ -89,6 +97,13 @@ class PartCertDummy: public PartCert {
     PartCertDummy() {}
     PartCertDummy(const uint256_t &obj_hash):
         obj_hash(obj_hash) {}
+    PartCertDummy(const PrivKeyDummy &, const uint256_t &obj_hash):
+        obj_hash(obj_hash) {}
+
+    static constexpr size_t serialized_size =
+        sizeof(uint32_t) + uint256_t::serialized_size;
+
+    size_t get_serialized_size() const override { return serialized_size; }
 
     void serialize(DataStream &s) const override {
         s << (uint32_t)0 << obj_hash;
@@ -99,12 +114,8 @@ class PartCertDummy: public PartCert {
         s >> tmp >> obj_hash;
     }
 
-    PartCert *clone() override {
-        return new PartCertDummy(obj_hash);
-    }
-
-    bool verify(const PubKey &) override { return true; }
-    promise_t verify(const PubKey &, VeriPool &) override {
+    bool verify(const PubKey &) const override { return true; }
+    promise_t verify(const PubKey &, VeriPool &) const override {
         return promise_t([](promise_t &pm){ pm.resolve(true); });
     }
 
@@ -118,6 +129,11 @@ class QuorumCertDummy: public QuorumCert {
     QuorumCertDummy(const ReplicaConfig &, const uint256_t &obj_hash):
         obj_hash(obj_hash) {}
 
+    static constexpr size_t serialized_size =
+        sizeof(uint32_t) + uint256_t::serialized_size;
+
+    size_t get_serialized_size() const override { return serialized_size; }
+
     void serialize(DataStream &s) const override {
         s << (uint32_t)1 << obj_hash;
     }
@@ -127,14 +143,10 @@ class QuorumCertDummy: public QuorumCert {
         s >> tmp >> obj_hash;
     }
 
-    QuorumCert *clone() override {
-        return new QuorumCertDummy(*this);
-    }
-
     void add_part(ReplicaID, const PartCert &) override {}
     void compute() override {}
-    bool verify(const ReplicaConfig &) override { return true; }
-    promise_t verify(const ReplicaConfig &, VeriPool &) override {
+    bool verify(const ReplicaConfig &) const override { return true; }
+    promise_t verify(const ReplicaConfig &, VeriPool &) const override {
         return promise_t([](promise_t &pm) { pm.resolve(true); });
     }
 
@@ -285,25 +297,42 @@ class SigSecp256k1: public Serializable {
         sign(digest, priv_key);
     }
 
-    void serialize(DataStream &s) const override {
-        static uint8_t output[64];
+    SigSecp256k1(const secp256k1_ecdsa_signature &data,
+                const secp256k1_context_t &ctx =
+                        secp256k1_default_sign_ctx):
+        Serializable(), data(data), ctx(ctx) {}
+
+    /** A signature is always sent in its 64-byte compact form. */
+    static constexpr size_t serialized_size = 64;
+
+    /* (un)serialization of a bare signature */
+    static void put_compact(DataStream &s, const secp256k1_ecdsa_signature &data,
+                            const secp256k1_context_t &ctx) {
+        uint8_t output[serialized_size];
         (void)secp256k1_ecdsa_signature_serialize_compact(
             ctx->ctx, (unsigned char *)output,
             &data);
-        s.put_data(output, output + 64);
+        s.put_data(output, output + serialized_size);
     }
 
-    void unserialize(DataStream &s) override {
+    static void get_compact(DataStream &s, secp256k1_ecdsa_signature &data,
+                            const secp256k1_context_t &ctx) {
         static const auto _exc = std::invalid_argument("ill-formed signature");
         try {
             if (!secp256k1_ecdsa_signature_parse_compact(
-                    ctx->ctx, &data, s.get_data_inplace(64)))
+                    ctx->ctx, &data, s.get_data_inplace(serialized_size)))
                 throw _exc;
         } catch (std::ios_base::failure &) {
             throw _exc;
         }
     }
 
+    void serialize(DataStream &s) const override { put_compact(s, data, ctx); }
+
+    void unserialize(DataStream &s) override { get_compact(s, data, ctx); }
+
+    const secp256k1_ecdsa_signature &get_raw() const { return data; }
+
     void sign(const bytearray_t &msg, const PrivKeySecp256k1 &priv_key) {
         check_msg_length(msg);
         if (!secp256k1_ecdsa_sign(
@@ -315,8 +344,9 @@ class SigSecp256k1: public Serializable {
             throw std::invalid_argument("failed to create secp256k1 signature");
     }
 
-    bool verify(const bytearray_t &msg, const PubKeySecp256k1 &pub_key,
-                const secp256k1_context_t &_ctx) const {
+    static bool verify(const secp256k1_ecdsa_signature &data,
+                const bytearray_t &msg, const PubKeySecp256k1 &pub_key,
+                const secp256k1_context_t &_ctx) {
         check_msg_length(msg);
         return secp256k1_ecdsa_verify(
                 _ctx->ctx, &data,
@@ -324,6 +354,11 @@ class SigSecp256k1: public Serializable {
                 &pub_key.data) == 1;
     }
 
+    bool verify(const bytearray_t &msg, const PubKeySecp256k1 &pub_key,
+                const secp256k1_context_t &_ctx) const {
+        return verify(data, msg, pub_key, _ctx);
+    }
+
     bool verify(const bytearray_t &msg, const PubKeySecp256k1 &pub_key) {
         return verify(msg, pub_key, ctx);
     }
@@ -338,6 +373,10 @@ class Secp256k1VeriTask: public VeriTask {
                         const PubKeySecp256k1 &pubkey,
                         const SigSecp256k1 &sig):
         msg(msg), pubkey(pubkey), sig(sig) {}
+    Secp256k1VeriTask(const uint256_t &msg,
+                        const PubKeySecp256k1 &pubkey,
+                        const secp256k1_ecdsa_signature &sig):
+        msg(msg), pubkey(pubkey), sig(sig) {}
     virtual ~Secp256k1VeriTask() = default;
 
     bool verify() override {
@@ -355,13 +394,13 @@ class PartCertSecp256k1: public SigSecp256k1, public PartCert {
         PartCert(),
         obj_hash(obj_hash) {}
 
-    bool verify(const PubKey &pub_key) override {
+    bool verify(const PubKey &pub_key) const override {
         return SigSecp256k1::verify(obj_hash,
                                     static_cast<const PubKeySecp256k1 &>(pub_key),
                                     secp256k1_default_verify_ctx);
     }
 
-    promise_t verify(const PubKey &pub_key, VeriPool &vpool) override {
+    promise_t verify(const PubKey &pub_key, VeriPool &vpool) const override {
         return vpool.verify(new Secp256k1VeriTask(obj_hash,
                 static_cast<const PubKeySecp256k1 &>(pub_key),
                 static_cast<const SigSecp256k1 &>(*this)));
@@ -369,9 +408,10 @@ class PartCertSecp256k1: public SigSecp256k1, public PartCert {
 
     const uint256_t &get_obj_hash() const override { return obj_hash; }
 
-    PartCertSecp256k1 *clone() override {
-        return new PartCertSecp256k1(*this);
-    }
+    static constexpr size_t serialized_size =
+        uint256_t::serialized_size + SigSecp256k1::serialized_size;
+
+    size_t get_serialized_size() const override { return serialized_size; }
 
     void serialize(DataStream &s) const override {
         s << obj_hash;
@@ -384,10 +424,14 @@ class PartCertSecp256k1: public SigSecp256k1, public PartCert {
     }
 };
 
+/** Quorum certificate made of secp256k1 signatures.
+ *
+ * The signatures are kept in a flat array in the order of the replicas set
+ * in `rids`: the k-th set bit owns sigs[k]. */
 class QuorumCertSecp256k1: public QuorumCert {
     uint256_t obj_hash;
     salticidae::Bits rids;
-    std::unordered_map<ReplicaID, SigSecp256k1> sigs;
+    std::vector<secp256k1_ecdsa_signature> sigs;
 
     public:
     QuorumCertSecp256k1() = default;
@@ -396,32 +440,42 @@ class QuorumCertSecp256k1: public QuorumCert {
     void add_part(ReplicaID rid, const PartCert &pc) override {
         if (pc.get_obj_hash() != obj_hash)
             throw std::invalid_argument("PartCert does match the block hash");
-        sigs.insert(std::make_pair(
-            rid, static_cast<const PartCertSecp256k1 &>(pc)));
-        rids.set(rid);
+        if (rid >= rids.size())
+            throw std::invalid_argument("replica id out of range");
+        const auto &sig = static_cast<const PartCertSecp256k1 &>(pc).get_raw();
+        auto it = sigs.begin() + rids.rank(rid);
+        if (rids.get(rid))
+            *it = sig;
+        else
+        {
+            sigs.insert(it, sig);
+            rids.set(rid);
+        }
     }
 
     void compute() override {}
 
-    bool verify(const ReplicaConfig &config) override;
-    promise_t verify(const ReplicaConfig &config, VeriPool &vpool) override;
+    bool verify(const ReplicaConfig &config) const override;
+    promise_t verify(const ReplicaConfig &config, VeriPool &vpool) const override;
 
     const uint256_t &get_obj_hash() const override { return obj_hash; }
 
-    QuorumCertSecp256k1 *clone() override {
-        return new QuorumCertSecp256k1(*this);
+    size_t get_serialized_size() const override {
+        return uint256_t::serialized_size + rids.get_serialized_size() +
+                sigs.size() * SigSecp256k1::serialized_size;
     }
 
     void serialize(DataStream &s) const override {
         s << obj_hash << rids;
-        for (size_t i = 0; i < rids.size(); i++)
-            if (rids.get(i)) s << sigs.at(i);
+        for (const auto &sig: sigs)
+            SigSecp256k1::put_compact(s, sig, secp256k1_default_verify_ctx);
     }
 
     void unserialize(DataStream &s) override {
         s >> obj_hash >> rids;
-        for (size_t i = 0; i < rids.size(); i++)
-            if (rids.get(i)) s >> sigs[i];
+        sigs.resize(rids.rank(rids.size()));
+        for (auto &sig: sigs)
+            SigSecp256k1::get_compact(s, sig, secp256k1_default_verify_ctx);
     }
 };
 
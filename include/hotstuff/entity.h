@@ -25,6 +25,8 @@
 #include <ios>
 #include <queue>
 #include <deque>
+#include <memory>
+#include <memory_resource>
 
 #include "salticidae/netaddr.h"
 #include "salticidae/ref.h"
@@ -32,6 +34,8 @@
 #include "hotstuff/util.h"
 #include "hotstuff/crypto.h"
 #include "hotstuff/ordered_list.h"
+#include "hotstuff/flat_hash.h"
+#include "hotstuff/block_arena.h"
 
 namespace hotstuff {
 
@@ -107,8 +111,56 @@ class ReplicaConfig {
 
 class Block;
 class HotStuffCore;
+class EntityStorage;
 
-using block_t = salticidae::ArcObj<Block>;
+/** Counted reference to a Block.
+ *
+ * Blocks are created and used by the consensus thread only, so unlike
+ * ArcObj the count is a plain integer kept in the block itself, and dropping
+ * the last reference gives the block back to the arena bucket it was carved
+ * from (see BlockArena). */
+class BlockRef {
+    Block *obj;
+
+    inline void retain() const;
+    inline void release();
+
+    public:
+    using type = Block;
+    BlockRef(): obj(nullptr) {}
+    BlockRef(std::nullptr_t): obj(nullptr) {}
+    BlockRef(Block *obj): obj(obj) { retain(); }
+    BlockRef(const BlockRef &other) noexcept: obj(other.obj) { retain(); }
+    BlockRef(BlockRef &&other) noexcept: obj(other.obj) { other.obj = nullptr; }
+    ~BlockRef() { release(); }
+
+    void swap(BlockRef &other) noexcept { std::swap(obj, other.obj); }
+
+    BlockRef &operator=(const BlockRef &other) {
+        BlockRef tmp(other);
+        swap(tmp);
+        return *this;
+    }
+
+    BlockRef &operator=(BlockRef &&other) noexcept {
+        BlockRef tmp(std::move(other));
+        swap(tmp);
+        return *this;
+    }
+
+    inline size_t get_cnt() const;
+    Block &operator*() const { return *obj; }
+    Block *operator->() const { return obj; }
+    Block *get() const { return obj; }
+    operator bool() const { return obj != nullptr; }
+    bool operator==(const BlockRef &other) const { return obj == other.obj; }
+    bool operator!=(const BlockRef &other) const { return obj != other.obj; }
+    bool operator==(std::nullptr_t) const { return obj == nullptr; }
+    bool operator!=(std::nullptr_t) const { return obj != nullptr; }
+    bool operator<(const BlockRef &other) const { return obj < other.obj; }
+};
+
+using block_t = BlockRef;
 
 class Command: public Serializable {
     friend HotStuffCore;
@@ -134,69 +186,179 @@ get_hashes(const std::vector<Hashable> &plist) {
     return hashes;
 }
 
+template<typename Hashable>
+inline static std::pmr::vector<uint256_t>
+get_hashes(const std::vector<Hashable> &plist,
+            const std::pmr::polymorphic_allocator<uint256_t> &alloc) {
+    std::pmr::vector<uint256_t> hashes(alloc);
+    hashes.reserve(plist.size());
+    for (const auto &p: plist)
+        hashes.push_back(p->get_hash());
+    return hashes;
+}
+
+/** The replicas that voted for a block, as a bitmap indexed by ReplicaID. */
+class VoteSet {
+    std::pmr::vector<uint64_t> bits;
+    size_t nvotes;
+
+    public:
+    using allocator_type = std::pmr::polymorphic_allocator<uint64_t>;
+
+    VoteSet(const allocator_type &alloc = {}): bits(alloc), nvotes(0) {}
+    VoteSet(VoteSet &&other, const allocator_type &alloc):
+        bits(std::move(other.bits), alloc), nvotes(other.nvotes) {}
+
+    /** Returns false if the replica is already in the set. */
+    bool insert(ReplicaID rid) {
+        size_t w = rid >> 6;
+        uint64_t mask = (uint64_t)1 << (rid & 63);
+        if (w >= bits.size()) bits.resize(w + 1, 0);
+        if (bits[w] & mask) return false;
+        bits[w] |= mask;
+        nvotes++;
+        return true;
+    }
+
+    bool count(ReplicaID rid) const {
+        size_t w = rid >> 6;
+        return w < bits.size() && (bits[w] >> (rid & 63) & 1);
+    }
+
+    size_t size() const { return nvotes; }
+};
+
+using block_orders_t = std::pmr::unordered_map<ReplicaID, std::pmr::vector<Hash256>>;
+
+/** A block, always allocated from (and owned by) a BlockArena bucket once it
+ * enters the EntityStorage; its containers share the bucket memory. */
 class Block {
     friend HotStuffCore;
-    std::vector<uint256_t> parent_hashes;
-    std::unordered_map<ReplicaID, std::vector<uint256_t>> orders;
+    friend BlockRef;
+    friend EntityStorage;
+    std::pmr::vector<uint256_t> parent_hashes;
+    block_orders_t orders;
     // std::vector<uint256_t> cmds;                                         // Themis
     // std::unordered_map<uint256_t, std::unordered_set<uint256_t>> graph;     // Themis
     // std::vector<std::pair<uint256_t, uint256_t>> e_update;                  // Themis
-    quorum_cert_bt qc;
+    quorum_cert_t qc;
     bytearray_t extra;
 
     /* the following fields can be derived from above */
     uint256_t hash;
-    std::vector<block_t> parents;
+    std::pmr::vector<block_t> parents;
     block_t qc_ref;
+    /** Jump pointer to the ancestor at skip_height(height), set upon
+     * delivery; see get_ancestor(). It does not hold a reference: the
+     * ancestors of a live block are kept alive by the parent links, down to
+     * the height the chain was pruned at. */
+    Block *skip;
     quorum_cert_bt self_qc;
     uint32_t height;
     bool delivered;
     int8_t decision;
 
-    std::unordered_set<ReplicaID> voted;
+    VoteSet voted;
+
+    /* bookkeeping of BlockRef, only touched by the consensus thread */
+    uint32_t ref_cnt;
+    BlockArena::Bucket *bucket;     /**< null if allocated by new */
+
+    static block_orders_t copy_orders(
+            const std::unordered_map<ReplicaID, std::vector<Hash256>> &orders,
+            const block_orders_t::allocator_type &alloc) {
+        block_orders_t ret(alloc);
+        for (const auto &o: orders)
+            ret[o.first].assign(o.second.begin(), o.second.end());
+        return ret;
+    }
+
+    static void destroy(Block *blk) {
+        auto bucket = blk->bucket;
+        if (!bucket)
+        {
+            delete blk;
+            return;
+        }
+        blk->~Block();
+        bucket->release();
+    }
 
     public:
-    Block():
-        qc(nullptr),
-        qc_ref(nullptr),
+    using allocator_type = std::pmr::polymorphic_allocator<std::byte>;
+
+    Block(): Block(std::allocator_arg, allocator_type()) {}
+
+    Block(std::allocator_arg_t, const allocator_type &alloc):
+        parent_hashes(alloc),
+        orders(alloc),
+        qc(),
+        parents(alloc),
+        qc_ref(nullptr), skip(nullptr),
         self_qc(nullptr), height(0),
-        delivered(false), decision(0) {}
+        delivered(false), decision(0),
+        voted(alloc), ref_cnt(0), bucket(nullptr) {}
 
     Block(bool delivered, int8_t decision):
         qc(new QuorumCertDummy()),
         hash(salticidae::get_hash(*this)),
-        qc_ref(nullptr),
+        qc_ref(nullptr), skip(nullptr),
         self_qc(nullptr), height(0),
-        delivered(delivered), decision(decision) {}
+        delivered(delivered), decision(decision),
+        ref_cnt(0), bucket(nullptr) {}
 
     // new construct function
-    Block(const std::vector<block_t> &parents,
+    Block(std::allocator_arg_t, const allocator_type &alloc,
+        const std::vector<block_t> &parents,
         // const std::vector<uint256_t> &cmds,                                  // Themis
-        std::unordered_map<ReplicaID, std::vector<uint256_t>> orders,     // Themis
+        const std::unordered_map<ReplicaID, std::vector<Hash256>> &orders,     // Themis
         //std::vector<std::pair<uint256_t, uint256_t>> e_update,                  // Themis
-        quorum_cert_bt &&qc,
+        quorum_cert_t qc,
         bytearray_t &&extra,
         uint32_t height,
         const block_t &qc_ref,
         quorum_cert_bt &&self_qc,
         int8_t decision = 0):
-            parent_hashes(get_hashes(parents)),
+            parent_hashes(get_hashes(parents, alloc)),
             // cmds(cmds),          // Themis
             // graph(graph),           // Themis
             // e_update(e_update),     // Themis
-            orders(orders),
+            orders(copy_orders(orders, alloc)),
             qc(std::move(qc)),
             extra(std::move(extra)),
             hash(salticidae::get_hash(*this)),
-            parents(parents),
-            qc_ref(qc_ref),
+            parents(parents.begin(), parents.end(), alloc),
+            qc_ref(qc_ref), skip(nullptr),
             self_qc(std::move(self_qc)),
             height(height),
             delivered(0),
-            decision(decision) {}
+            decision(decision),
+            voted(alloc), ref_cnt(0), bucket(nullptr) {}
+
+    /** Move a block (typically one just parsed) into other memory. */
+    Block(std::allocator_arg_t, const allocator_type &alloc, Block &&other):
+        parent_hashes(std::move(other.parent_hashes), alloc),
+        orders(std::move(other.orders), alloc),
+        qc(std::move(other.qc)),
+        extra(std::move(other.extra)),
+        hash(other.hash),
+        parents(std::move(other.parents), alloc),
+        qc_ref(std::move(other.qc_ref)), skip(other.skip),
+        self_qc(std::move(other.self_qc)),
+        height(other.height),
+        delivered(other.delivered),
+        decision(other.decision),
+        voted(std::move(other.voted), alloc), ref_cnt(0), bucket(nullptr) {}
+
+    Block(const Block &) = delete;
+    Block &operator=(const Block &) = delete;
 
     void serialize(DataStream &s) const;
 
+    /** Upper bound on the number of bytes written by serialize(); it is
+     * exact unless the same command appears in several orders. */
+    size_t get_serialized_size() const;
+
     void unserialize(DataStream &s, HotStuffCore *hsc);
 
     // Themis
@@ -205,7 +367,7 @@ class Block {
     // }
 
     //Us
-    const std::unordered_map<ReplicaID, std::vector<uint256_t>> &get_orders() const {
+    const block_orders_t &get_orders() const {
         return orders;
     }
 
@@ -283,11 +445,11 @@ class Block {
     //     return e_update;
     // }
 
-    const std::vector<block_t> &get_parents() const {
+    const std::pmr::vector<block_t> &get_parents() const {
         return parents;
     }
 
-    const std::vector<uint256_t> &get_parent_hashes() const {
+    const std::pmr::vector<uint256_t> &get_parent_hashes() const {
         return parent_hashes;
     }
 
@@ -303,7 +465,31 @@ class Block {
 
     uint32_t get_height() const { return height; }
 
-    const quorum_cert_bt &get_qc() const { return qc; }
+    /** Height of the ancestor the jump pointer of a block at `height` leads
+     * to. Following jump pointers and first parents reaches any ancestor in
+     * O(log(height)) steps (the skip list of Bitcoin's block index). */
+    static uint32_t skip_height(uint32_t height) {
+        auto clear_lowest = [](uint32_t n) { return n & (n - 1); };
+        if (height < 2) return 0;
+        /* odd heights jump further back than the even ones next to them */
+        return (height & 1) ? clear_lowest(clear_lowest(height - 1)) + 1 :
+                            clear_lowest(height);
+    }
+
+    /** The ancestor (along the first parents) at the given height, or null
+     * if there is none. Only valid for delivered blocks, and `height` must
+     * not be below the height the chain was pruned at. */
+    Block *get_ancestor(uint32_t height);
+    const Block *get_ancestor(uint32_t height) const {
+        return const_cast<Block *>(this)->get_ancestor(height);
+    }
+
+    /** Whether this block is `blk` or extends it along the first parents. */
+    bool extends(const Block *blk) const {
+        return blk && get_ancestor(blk->height) == blk;
+    }
+
+    const quorum_cert_t &get_qc() const { return qc; }
 
     const block_t &get_qc_ref() const { return qc_ref; }
 
@@ -320,6 +506,16 @@ class Block {
     }
 };
 
+inline void BlockRef::retain() const {
+    if (obj) obj->ref_cnt++;
+}
+
+inline void BlockRef::release() {
+    if (obj && !--obj->ref_cnt) Block::destroy(obj);
+}
+
+inline size_t BlockRef::get_cnt() const { return obj ? obj->ref_cnt : 0; }
+
 struct BlockHeightCmp {
     bool operator()(const block_t &a, const block_t &b) const {
         return a->get_height() < b->get_height();
@@ -327,14 +523,16 @@ struct BlockHeightCmp {
 };
 
 class EntityStorage {
-    std::unordered_map<const uint256_t, block_t> blk_cache;
-    std::unordered_map<const uint256_t, command_t> cmd_cache;
-    std::unordered_map<ReplicaID, std::deque<std::vector<uint256_t>>> ordered_hash_cache;                     // Themis
+    BlockArena blk_arena;
+    FlatHashMap<block_t> blk_cache;
+    FlatHashMap<command_t> cmd_cache;
+    CommandTable cmd_table;
+    std::unordered_map<ReplicaID, std::deque<std::vector<cmd_id_t>>> ordered_hash_cache;                    // Themis
     //std::unordered_map<ReplicaID, std::queue<std::vector<std::pair<uint256_t, uint256_t>>>> l_update_cache;   // Themis
     OrderedList *local_order_seen_execute_level_cache;                                            // Themis
     //std::unordered_map<uint256_t, std::unordered_set<uint256_t>> edges_missing_cache;             // Themis
     OrderedList *local_order_seen_propose_level_cache;                                            // Themis
-    std::unordered_set<uint256_t> proposed_cmds_cache;                                            // Themis 
+    std::vector<uint8_t> proposed_cmds_cache;   /* indexed by cmd_id_t */      // Themis 
 
     public:
     EntityStorage() {
@@ -358,11 +556,44 @@ class EntityStorage {
         //    HOTSTUFF_LOG_WARN("invalid %s", std::string(_blk).c_str());
         //    return nullptr;
         //}
-        block_t blk = new Block(std::move(_blk));
+        auto it = blk_cache.find(_blk.get_hash());
+        if (it != blk_cache.end()) return it->second;
+        block_t blk = new_blk(blk_arena.get_frontier_bucket(), std::move(_blk));
         return blk_cache.insert(std::make_pair(blk->get_hash(), blk)).first->second;
     }
 
-    const block_t &add_blk(const block_t &blk) {
+    /** Construct a block in the arena bucket of the given height. */
+    template<typename... Args>
+    block_t new_blk(uint32_t height, Args &&...args) {
+        return new_blk(blk_arena.get_bucket(height), std::forward<Args>(args)...);
+    }
+
+    template<typename... Args>
+    block_t new_blk(BlockArena::Bucket *bucket, Args &&...args) {
+        void *p = bucket->allocate(sizeof(Block), alignof(Block));
+        bucket->retain();
+        Block *blk;
+        try {
+            blk = new (p) Block(std::allocator_arg, Block::allocator_type(bucket),
+                                std::forward<Args>(args)...);
+        } catch (...) {
+            bucket->release();
+            throw;
+        }
+        blk->bucket = bucket;
+        return blk;
+    }
+
+    /** Record that a block of this height has been delivered. */
+    void advance_blk_height(uint32_t height) { blk_arena.advance(height); }
+
+    /** Free the arena buckets below the height, once their blocks are
+     * released. */
+    size_t prune_blk_arena(uint32_t height) { return blk_arena.prune(height); }
+
+    const BlockArena &get_blk_arena() const { return blk_arena; }
+
+    block_t add_blk(const block_t &blk) {
         return blk_cache.insert(std::make_pair(blk->get_hash(), blk)).first->second;
     }
 
@@ -375,7 +606,7 @@ class EntityStorage {
         return cmd_cache.count(cmd_hash);
     }
 
-    const command_t &add_cmd(const command_t &cmd) {
+    command_t add_cmd(const command_t &cmd) {
         return cmd_cache.insert(std::make_pair(cmd->get_hash(), cmd)).first->second;
     }
 
@@ -411,6 +642,8 @@ class EntityStorage {
 //            for (const auto &cmd: blk->get_cmds())
 //                try_release_cmd(cmd);
             blk_cache.erase(blk_hash);
+            if (blk_cache.capacity() > 4 * blk_cache.size())
+                blk_cache.shrink_to_fit();
             return true;
         }
 #ifdef HOTSTUFF_PROTO_LOG
@@ -420,32 +653,68 @@ class EntityStorage {
         return false;
     }
 
+    /* command interning: every id stored below holds one reference */
+    cmd_id_t intern_cmd(const Hash256 &cmd_hash) { return cmd_table.acquire(cmd_hash); }
+    void retain_cmd(cmd_id_t cmd) { cmd_table.acquire(cmd); }
+    void release_cmd(cmd_id_t cmd) { cmd_table.release(cmd); }
+    cmd_id_t find_cmd_id(const Hash256 &cmd_hash) const { return cmd_table.find(cmd_hash); }
+    const Hash256 &get_cmd_hash(cmd_id_t cmd) const { return cmd_table.get_hash(cmd); }
+    size_t get_cmd_table_size() const { return cmd_table.size(); }
+    size_t get_cmd_id_bound() const { return cmd_table.id_bound(); }
+
     // Us
-    void add_local_order(ReplicaID rid, const std::vector<uint256_t> ordered_hash){ 
+    void add_local_order(ReplicaID rid, const std::vector<Hash256> &ordered_hash){ 
                             //,const std::vector<std::pair<uint256_t, uint256_t>> l_update){
         /* Overwriting old values if exists */
-        std::vector<uint256_t> unproposed_hashes;
-        for(auto cmd: ordered_hash){
-            if(!is_cmd_proposed(cmd)){
+        std::vector<cmd_id_t> unproposed_hashes;
+        unproposed_hashes.reserve(ordered_hash.size());
+        for(const auto &cmd_hash: ordered_hash){
+            cmd_id_t cmd = find_cmd_id(cmd_hash);
+            if(cmd == CMD_ID_NULL){
+                unproposed_hashes.push_back(intern_cmd(cmd_hash));
+            }
+            else if(!is_cmd_proposed(cmd)){
+                retain_cmd(cmd);
                 unproposed_hashes.push_back(cmd);
             }
         }
         if(!unproposed_hashes.empty()){
-            ordered_hash_cache[rid].push_back(unproposed_hashes);
+            ordered_hash_cache[rid].push_back(std::move(unproposed_hashes));
             HOTSTUFF_LOG_DEBUG("Unproposed");
         }
         // l_update_cache[rid].push(l_update);
     }
 
     // Us
-    void add_ordered_hash_to_front(ReplicaID rid, const std::vector<uint256_t> ordered_hash){
-        ordered_hash_cache[rid].push_front(ordered_hash);
+    /** Drop the already proposed commands from the front order of the replica. */
+    void clear_proposed_from_front_ordered_hash(ReplicaID replica) {
+        auto &front = ordered_hash_cache[replica].front();
+        size_t n = 0;
+        for(cmd_id_t cmd: front){
+            if(is_cmd_proposed(cmd)){
+                release_cmd(cmd);
+            }
+            else{
+                front[n++] = cmd;
+            }
+        }
+        if(n == front.size()){
+            return;
+        }
+        front.resize(n);
+        if(front.empty()){
+            clear_front_ordered_hash(replica);
+        }
     }
 
     // Us
     void clear_front_ordered_hash(ReplicaID replica) {
-        ordered_hash_cache[replica].pop_front();
-        if(ordered_hash_cache[replica].empty()){
+        auto &q = ordered_hash_cache[replica];
+        for(cmd_id_t cmd: q.front()){
+            release_cmd(cmd);
+        }
+        q.pop_front();
+        if(q.empty()){
             ordered_hash_cache.erase(replica);
         }
     }
@@ -460,7 +729,7 @@ class EntityStorage {
     // Themis
     void clear_ordered_hash_if_propose(){
         for(auto &cache: ordered_hash_cache){
-            std::deque<std::vector<uint256_t>> *q = &cache.second;
+            std::deque<std::vector<cmd_id_t>> *q = &cache.second;
             auto q_size = q->size();
             for(size_t qi=0; qi<q_size; qi++){
                 auto order_size = q->front().size();
@@ -470,7 +739,8 @@ class EntityStorage {
                         auto cmd = q->front()[i];
                         /* this cmd is already proposed */
                         q->front().erase(q->front().begin() + i);
-                        HOTSTUFF_LOG_INFO("[[clear_ordered_hash_if_propose]] cleared cmd = %.10s", get_hex(cmd).c_str());
+                        HOTSTUFF_LOG_INFO("[[clear_ordered_hash_if_propose]] cleared cmd = %.10s", get_hex(get_cmd_hash(cmd)).c_str());
+                        release_cmd(cmd);
                         break;
                     }
                 }
@@ -511,7 +781,7 @@ class EntityStorage {
     // }
 
     // Us
-    std::vector<uint256_t> get_ordered_hash_vector(ReplicaID replica) {
+    const std::vector<cmd_id_t> &get_ordered_hash_vector(ReplicaID replica) {
         return ordered_hash_cache[replica].front();
     }
 
@@ -521,28 +791,28 @@ class EntityStorage {
     // }
 
     // Us
-    void update_local_order_seen(std::vector<uint256_t> const &cmds) {
+    void update_local_order_seen(std::vector<cmd_id_t> const &cmds) {
         for(auto const &cmd: cmds){
             update_local_order_seen(cmd);
         }
     }
     // Us
-    void update_local_order_seen(uint256_t const &cmd) {
-            local_order_seen_execute_level_cache->push_back(cmd);
-            local_order_seen_propose_level_cache->push_back(cmd);
+    void update_local_order_seen(cmd_id_t cmd) {
+            if(local_order_seen_execute_level_cache->push_back(cmd)) retain_cmd(cmd);
+            if(local_order_seen_propose_level_cache->push_back(cmd)) retain_cmd(cmd);
     }
 
     // Us
-    void remove_local_order_seen_execute_level(uint256_t cmd) {
-        local_order_seen_execute_level_cache->remove(cmd);
+    void remove_local_order_seen_execute_level(cmd_id_t cmd) {
+        if(local_order_seen_execute_level_cache->remove(cmd)) release_cmd(cmd);
     }
     // Us
-    void remove_local_order_seen_propose_level(uint256_t cmd) {
-        local_order_seen_propose_level_cache->remove(cmd);
+    void remove_local_order_seen_propose_level(cmd_id_t cmd) {
+        if(local_order_seen_propose_level_cache->remove(cmd)) release_cmd(cmd);
     }
 
     // Us
-    std::vector<uint256_t> get_unproposed_cmds() {
+    std::vector<cmd_id_t> get_unproposed_cmds() {
         // std::vector<uint256_t> cmds;
         // for(auto it=local_order_seen_propose_level_cache->begin(); it!=local_order_seen_propose_level_cache->end(); it++) {
         //     cmds.push_back(*it);
@@ -602,24 +872,42 @@ class EntityStorage {
     // }   
 
     // Themis Dummy
-    void add_to_proposed_cmds_cache(uint256_t cmd){
-        HOTSTUFF_LOG_DEBUG("[[add_to_proposed_cmds_cache]] %.10s", cmd.to_hex().c_str());
-        proposed_cmds_cache.insert(cmd);
+    void add_to_proposed_cmds_cache(cmd_id_t cmd){
+        HOTSTUFF_LOG_DEBUG("[[add_to_proposed_cmds_cache]] %.10s", get_hex(get_cmd_hash(cmd)).c_str());
+        if(cmd >= proposed_cmds_cache.size()){
+            proposed_cmds_cache.resize(cmd_table.id_bound(), 0);
+        }
+        if(!proposed_cmds_cache[cmd]){
+            proposed_cmds_cache[cmd] = 1;
+            retain_cmd(cmd);
+        }
     }   
 
     // Themis Dummy
-    void remove_from_proposed_cmds_cache(uint256_t cmd){
-        HOTSTUFF_LOG_DEBUG("[[remove_from_proposed_cmds_cache]] %.10s", cmd.to_hex().c_str());
-        proposed_cmds_cache.erase(cmd);
+    void remove_from_proposed_cmds_cache(cmd_id_t cmd){
+        HOTSTUFF_LOG_DEBUG("[[remove_from_proposed_cmds_cache]] %.10s", get_hex(get_cmd_hash(cmd)).c_str());
+        if(is_cmd_proposed(cmd)){
+            proposed_cmds_cache[cmd] = 0;
+            release_cmd(cmd);
+        }
     }  
 
     // Themis Dummy
-    bool is_cmd_proposed(uint256_t cmd){
-        return proposed_cmds_cache.count(cmd)>0;
+    bool is_cmd_proposed(cmd_id_t cmd){
+        return cmd < proposed_cmds_cache.size() && proposed_cmds_cache[cmd];
     }     
 
 };
 
 }
 
+namespace std {
+    template<>
+    struct hash<hotstuff::BlockRef> {
+        size_t operator()(const hotstuff::BlockRef &k) const {
+            return (size_t)k.get();
+        }
+    };
+}
+
 #endif
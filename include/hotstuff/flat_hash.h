@@ -0,0 +1,375 @@
+/**
+ * Copyright 2018 VMware
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _HOTSTUFF_FLAT_HASH_H
+#define _HOTSTUFF_FLAT_HASH_H
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <utility>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "hotstuff/hash.h"
+
+namespace hotstuff {
+
+namespace flat_hash {
+
+/* A control byte is either EMPTY or the low 7 bits of the slot's hash. */
+static const int8_t CTRL_EMPTY = -128;
+static const size_t GROUP_WIDTH = 16;
+static const size_t MIN_CAPACITY = GROUP_WIDTH;
+
+inline uint64_t hash_key(const Hash256 &key) {
+    /* the keys are already cryptographic hashes, only fold two words so
+     * that structured (non-random) keys still spread */
+    uint64_t h = (key.data[0] ^ key.data[1]) * 0x9e3779b97f4a7c15ULL;
+    return h ^ (h >> 29);
+}
+
+inline size_t h1(uint64_t h) { return h >> 7; }
+inline int8_t h2(uint64_t h) { return h & 0x7f; }
+
+/** Sixteen control bytes probed in parallel. */
+class Group {
+#if defined(__SSE2__)
+    __m128i ctrl;
+    public:
+    explicit Group(const int8_t *p):
+        ctrl(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p))) {}
+    uint32_t match(int8_t h) const {
+        return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(h), ctrl));
+    }
+#else
+    const int8_t *ctrl;
+    public:
+    explicit Group(const int8_t *p): ctrl(p) {}
+    uint32_t match(int8_t h) const {
+        uint32_t mask = 0;
+        for (size_t i = 0; i < GROUP_WIDTH; i++)
+            if (ctrl[i] == h) mask |= 1u << i;
+        return mask;
+    }
+#endif
+    uint32_t match_empty() const { return match(CTRL_EMPTY); }
+};
+
+/** Open-addressing table with SIMD-probed control bytes.
+ *
+ * Probing is linear (group by group), so erase() can shift the following
+ * run back into the hole instead of leaving a tombstone; lookups never
+ * degrade with churn. The price is that both insertion and erasure may
+ * move elements: references and iterators are invalidated by any
+ * modification of the table. */
+template<typename Slot, typename KeyOf>
+class Table {
+    int8_t *ctrl;
+    Slot *slots;
+    size_t cap;
+    size_t nelem;
+
+    size_t mask() const { return cap - 1; }
+
+    static size_t capacity_for(size_t n) {
+        size_t c = MIN_CAPACITY;
+        /* max load factor 7/8 */
+        while (c - c / 8 < n) c <<= 1;
+        return c;
+    }
+
+    void set_ctrl(size_t i, int8_t c) {
+        ctrl[i] = c;
+        /* mirror the head so that a group load never wraps */
+        if (i < GROUP_WIDTH) ctrl[cap + i] = c;
+    }
+
+    size_t find_empty(uint64_t h) const {
+        size_t pos = h1(h) & mask();
+        for (;;)
+        {
+            uint32_t m = Group(ctrl + pos).match_empty();
+            if (m) return (pos + __builtin_ctz(m)) & mask();
+            pos = (pos + GROUP_WIDTH) & mask();
+        }
+    }
+
+    void alloc(size_t c) {
+        cap = c;
+        ctrl = new int8_t[c + GROUP_WIDTH];
+        memset(ctrl, CTRL_EMPTY, c + GROUP_WIDTH);
+        slots = std::allocator<Slot>().allocate(c);
+    }
+
+    void release() {
+        if (!cap) return;
+        for (size_t i = 0; i < cap; i++)
+            if (ctrl[i] != CTRL_EMPTY) slots[i].~Slot();
+        std::allocator<Slot>().deallocate(slots, cap);
+        delete [] ctrl;
+        ctrl = nullptr;
+        slots = nullptr;
+        cap = 0;
+    }
+
+    void rehash(size_t new_cap) {
+        int8_t *old_ctrl = ctrl;
+        Slot *old_slots = slots;
+        size_t old_cap = cap;
+        if (new_cap) alloc(new_cap);
+        else { ctrl = nullptr; slots = nullptr; cap = 0; }
+        for (size_t i = 0; i < old_cap; i++)
+        {
+            if (old_ctrl[i] == CTRL_EMPTY) continue;
+            uint64_t h = hash_key(KeyOf()(old_slots[i]));
+            size_t j = find_empty(h);
+            new (&slots[j]) Slot(std::move(old_slots[i]));
+            set_ctrl(j, h2(h));
+            old_slots[i].~Slot();
+        }
+        if (old_cap)
+        {
+            std::allocator<Slot>().deallocate(old_slots, old_cap);
+            delete [] old_ctrl;
+        }
+    }
+
+    public:
+    static const size_t npos = size_t(-1);
+
+    class iterator {
+        friend Table;
+        const Table *t;
+        size_t i;
+        void skip() { while (i < t->cap && t->ctrl[i] == CTRL_EMPTY) i++; }
+        public:
+        iterator(const Table *t, size_t i): t(t), i(i) { skip(); }
+        Slot &operator*() const { return t->slots[i]; }
+        Slot *operator->() const { return &t->slots[i]; }
+        iterator &operator++() { i++; skip(); return *this; }
+        bool operator==(const iterator &other) const { return i == other.i; }
+        bool operator!=(const iterator &other) const { return i != other.i; }
+    };
+
+    Table(): ctrl(nullptr), slots(nullptr), cap(0), nelem(0) {}
+    Table(const Table &) = delete;
+    Table &operator=(const Table &) = delete;
+    Table(Table &&other):
+            ctrl(other.ctrl), slots(other.slots),
+            cap(other.cap), nelem(other.nelem) {
+        other.ctrl = nullptr;
+        other.slots = nullptr;
+        other.cap = other.nelem = 0;
+    }
+    ~Table() { release(); }
+
+    size_t size() const { return nelem; }
+    bool empty() const { return nelem == 0; }
+    size_t capacity() const { return cap; }
+
+    iterator begin() const { return iterator(this, 0); }
+    iterator end() const { return iterator(this, cap); }
+
+    size_t find_index(const Hash256 &key) const {
+        if (!nelem) return npos;
+        uint64_t h = hash_key(key);
+        size_t pos = h1(h) & mask();
+        for (;;)
+        {
+            Group g(ctrl + pos);
+            for (uint32_t m = g.match(h2(h)); m; m &= m - 1)
+            {
+                size_t i = (pos + __builtin_ctz(m)) & mask();
+                if (KeyOf()(slots[i]) == key) return i;
+            }
+            /* linear probing keeps every key before the first empty slot */
+            if (g.match_empty()) return npos;
+            pos = (pos + GROUP_WIDTH) & mask();
+        }
+    }
+
+    iterator find(const Hash256 &key) const {
+        size_t i = find_index(key);
+        return iterator(this, i == npos ? cap : i);
+    }
+
+    size_t count(const Hash256 &key) const { return find_index(key) != npos; }
+
+    template<typename... Args>
+    std::pair<iterator, bool> emplace_key(const Hash256 &key, Args &&...args) {
+        size_t i = find_index(key);
+        if (i != npos) return std::make_pair(iterator(this, i), false);
+        if (nelem + 1 > cap - cap / 8) rehash(capacity_for(nelem + 1));
+        uint64_t h = hash_key(key);
+        i = find_empty(h);
+        new (&slots[i]) Slot(std::forward<Args>(args)...);
+        set_ctrl(i, h2(h));
+        nelem++;
+        return std::make_pair(iterator(this, i), true);
+    }
+
+    void erase_index(size_t i) {
+        slots[i].~Slot();
+        set_ctrl(i, CTRL_EMPTY);
+        nelem--;
+        /* backward-shift the rest of the run so no tombstone is needed */
+        for (size_t j = (i + 1) & mask(); ctrl[j] != CTRL_EMPTY; j = (j + 1) & mask())
+        {
+            size_t home = h1(hash_key(KeyOf()(slots[j]))) & mask();
+            if (((j - home) & mask()) < ((j - i) & mask())) continue;
+            new (&slots[i]) Slot(std::move(slots[j]));
+            set_ctrl(i, ctrl[j]);
+            slots[j].~Slot();
+            set_ctrl(j, CTRL_EMPTY);
+            i = j;
+        }
+    }
+
+    size_t erase(const Hash256 &key) {
+        size_t i = find_index(key);
+        if (i == npos) return 0;
+        erase_index(i);
+        return 1;
+    }
+
+    void erase(const iterator &it) { erase_index(it.i); }
+
+    void clear() {
+        release();
+        nelem = 0;
+    }
+
+    /** Make room for n elements without further rehashing. */
+    void reserve(size_t n) {
+        if (n > cap - cap / 8) rehash(capacity_for(n));
+    }
+
+    /** Give back memory after the table has drained. */
+    void shrink_to_fit() {
+        size_t c = nelem ? capacity_for(nelem) : 0;
+        if (c < cap) rehash(c);
+    }
+};
+
+struct SetKey {
+    const Hash256 &operator()(const Hash256 &k) const { return k; }
+};
+
+template<typename Value>
+struct MapKey {
+    const Hash256 &operator()(const std::pair<const Hash256, Value> &p) const {
+        return p.first;
+    }
+};
+
+}
+
+/** Flat hash map keyed by Hash256 (see flat_hash::Table for the iterator
+ * invalidation rules, which are stricter than std::unordered_map). */
+template<typename Value>
+class FlatHashMap {
+    public:
+    using value_type = std::pair<const Hash256, Value>;
+
+    private:
+    using table_t = flat_hash::Table<value_type, flat_hash::MapKey<Value>>;
+    table_t table;
+
+    public:
+    using iterator = typename table_t::iterator;
+    using const_iterator = iterator;
+
+    size_t size() const { return table.size(); }
+    bool empty() const { return table.empty(); }
+    size_t capacity() const { return table.capacity(); }
+    iterator begin() const { return table.begin(); }
+    iterator end() const { return table.end(); }
+
+    iterator find(const Hash256 &key) const { return table.find(key); }
+    size_t count(const Hash256 &key) const { return table.count(key); }
+
+    template<typename... Args>
+    std::pair<iterator, bool> emplace(const Hash256 &key, Args &&...args) {
+        return table.emplace_key(key, std::piecewise_construct,
+                                std::forward_as_tuple(key),
+                                std::forward_as_tuple(std::forward<Args>(args)...));
+    }
+
+    template<typename K, typename V>
+    std::pair<iterator, bool> insert(std::pair<K, V> &&p) {
+        return emplace(p.first, std::forward<V>(p.second));
+    }
+
+    template<typename K, typename V>
+    std::pair<iterator, bool> insert(const std::pair<K, V> &p) {
+        return emplace(p.first, p.second);
+    }
+
+    Value &operator[](const Hash256 &key) {
+        return table.emplace_key(key, std::piecewise_construct,
+                                std::forward_as_tuple(key),
+                                std::forward_as_tuple()).first->second;
+    }
+
+    Value &at(const Hash256 &key) const {
+        auto it = find(key);
+        if (it == end()) throw std::out_of_range("FlatHashMap::at");
+        return it->second;
+    }
+
+    size_t erase(const Hash256 &key) { return table.erase(key); }
+    void erase(const iterator &it) { table.erase(it); }
+    void clear() { table.clear(); }
+    void reserve(size_t n) { table.reserve(n); }
+    void shrink_to_fit() { table.shrink_to_fit(); }
+};
+
+/** Flat hash set of Hash256. */
+class FlatHashSet {
+    using table_t = flat_hash::Table<Hash256, flat_hash::SetKey>;
+    table_t table;
+
+    public:
+    using iterator = typename table_t::iterator;
+    using const_iterator = iterator;
+
+    size_t size() const { return table.size(); }
+    bool empty() const { return table.empty(); }
+    size_t capacity() const { return table.capacity(); }
+    iterator begin() const { return table.begin(); }
+    iterator end() const { return table.end(); }
+
+    iterator find(const Hash256 &key) const { return table.find(key); }
+    size_t count(const Hash256 &key) const { return table.count(key); }
+
+    std::pair<iterator, bool> insert(const Hash256 &key) {
+        return table.emplace_key(key, key);
+    }
+
+    size_t erase(const Hash256 &key) { return table.erase(key); }
+    void erase(const iterator &it) { table.erase(it); }
+    void clear() { table.clear(); }
+    void reserve(size_t n) { table.reserve(n); }
+    void shrink_to_fit() { table.shrink_to_fit(); }
+};
+
+}
+
+#endif
@@ -0,0 +1,182 @@
+/**
+ * Copyright 2018 VMware
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _HOTSTUFF_HASH_H
+#define _HOTSTUFF_HASH_H
+
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <ios>
+#include <type_traits>
+#include <vector>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "salticidae/stream.h"
+
+namespace hotstuff {
+
+using salticidae::uint256_t;
+using salticidae::DataStream;
+
+/** A plain 32-byte hash used by the hot-path containers.
+ *
+ * Unlike uint256_t (a Blob<256>, which carries a vtable and a "loaded" flag),
+ * Hash256 is trivially copyable and exactly 32 bytes, so it can be moved
+ * around with memcpy and packed densely in vectors and tables. The words are
+ * kept in the same layout as uint256_t, hence the conversion in both
+ * directions is a single 32-byte copy and the ordering is identical. */
+struct alignas(32) Hash256 {
+    uint64_t data[4];
+
+    Hash256() = default;
+    Hash256(const uint256_t &h) { memcpy(data, h.get_words(), sizeof(data)); }
+
+    operator uint256_t () const {
+        uint256_t h;
+        h.load_words(data);
+        return h;
+    }
+
+    uint256_t to_uint256() const { return *this; }
+
+    bool is_zero() const {
+        return (data[0] | data[1] | data[2] | data[3]) == 0;
+    }
+
+    /** Bit i is set iff byte i differs between the two hashes. */
+    uint32_t diff_mask(const Hash256 &other) const {
+#if defined(__AVX2__)
+        __m256i a = _mm256_load_si256(reinterpret_cast<const __m256i *>(data));
+        __m256i b = _mm256_load_si256(reinterpret_cast<const __m256i *>(other.data));
+        return ~(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, b));
+#elif defined(__SSE2__)
+        auto p = reinterpret_cast<const __m128i *>(data);
+        auto q = reinterpret_cast<const __m128i *>(other.data);
+        uint32_t lo = _mm_movemask_epi8(
+            _mm_cmpeq_epi8(_mm_load_si128(p), _mm_load_si128(q)));
+        uint32_t hi = _mm_movemask_epi8(
+            _mm_cmpeq_epi8(_mm_load_si128(p + 1), _mm_load_si128(q + 1)));
+        return ~(lo | (hi << 16));
+#else
+        uint32_t mask = 0;
+        for (int i = 0; i < 4; i++)
+            if (data[i] != other.data[i]) mask |= 0xffu << (i << 3);
+        return mask;
+#endif
+    }
+
+    bool operator==(const Hash256 &other) const {
+        return diff_mask(other) == 0;
+    }
+
+    bool operator!=(const Hash256 &other) const {
+        return !(*this == other);
+    }
+
+    /** Same ordering as uint256_t: the most significant word is data[3]. */
+    bool operator<(const Hash256 &other) const {
+        uint32_t mask = diff_mask(other);
+        if (!mask) return false;
+        int w = (31 - __builtin_clz(mask)) >> 3;
+        return data[w] < other.data[w];
+    }
+
+    bool operator>(const Hash256 &other) const { return other < *this; }
+    bool operator<=(const Hash256 &other) const { return !(other < *this); }
+    bool operator>=(const Hash256 &other) const { return !(*this < other); }
+
+    size_t cheap_hash() const { return data[0]; }
+
+    /* wire format is the same as uint256_t: four little-endian words */
+    void serialize(DataStream &s) const {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        auto p = reinterpret_cast<const uint8_t *>(data);
+        s.put_data(p, p + sizeof(data));
+#else
+        for (int i = 0; i < 4; i++)
+            s << salticidae::htole(data[i]);
+#endif
+    }
+
+    void unserialize(DataStream &s) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        memcpy(data, s.get_data_inplace(sizeof(data)), sizeof(data));
+#else
+        for (int i = 0; i < 4; i++)
+        {
+            s >> data[i];
+            data[i] = salticidae::letoh(data[i]);
+        }
+#endif
+    }
+};
+
+static_assert(sizeof(Hash256) == 32, "Hash256 must be 32 bytes");
+static_assert(std::is_trivially_copyable<Hash256>::value,
+            "Hash256 must be trivially copyable");
+
+/** Write a run of hashes; on little-endian hosts this is one bulk copy. */
+inline void put_hash_array(DataStream &s, const std::vector<Hash256> &hashes) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    auto p = reinterpret_cast<const uint8_t *>(hashes.data());
+    s.put_data(p, p + hashes.size() * sizeof(Hash256));
+#else
+    for (const auto &h: hashes) s << h;
+#endif
+}
+
+/** Read n hashes written by put_hash_array(); n comes from the wire, so it
+ * is checked against what is left of the stream before allocating. */
+inline void get_hash_array(DataStream &s, std::vector<Hash256> &hashes, size_t n) {
+    if (n > s.size() / sizeof(Hash256))
+        throw std::ios_base::failure("insufficient buffer");
+    hashes.resize(n);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    if (n) memcpy(hashes.data(), s.get_data_inplace(n * sizeof(Hash256)),
+                n * sizeof(Hash256));
+#else
+    for (auto &h: hashes) s >> h;
+#endif
+}
+
+template<typename Hashable>
+inline static std::vector<Hash256>
+to_hash256(const std::vector<Hashable> &hashes) {
+    return std::vector<Hash256>(hashes.begin(), hashes.end());
+}
+
+}
+
+namespace std {
+    template <>
+    struct hash<hotstuff::Hash256> {
+        size_t operator()(const hotstuff::Hash256 &k) const {
+            return k.cheap_hash();
+        }
+    };
+
+    template <>
+    struct hash<const hotstuff::Hash256> {
+        size_t operator()(const hotstuff::Hash256 &k) const {
+            return k.cheap_hash();
+        }
+    };
+}
+
+#endif
@@ -27,6 +27,8 @@
 #include "salticidae/msg.h"
 #include "hotstuff/util.h"
 #include "hotstuff/consensus.h"
+#include "hotstuff/alloc_profile.h"
+#include "hotstuff/replay.h"
 
 namespace hotstuff {
 
@@ -37,6 +39,8 @@ using salticidae::_2;
 
 const double ent_waiting_timeout = 10;
 const double double_inf = 1e10;
+/** how often the metric gauges are sampled (in seconds) */
+const double metrics_refresh_period = 1;
 
 /** Network message format for HotStuff. */
 
@@ -107,7 +111,8 @@ class FetchContext: public promise_t {
     public:
     FetchContext(const FetchContext &) = delete;
     FetchContext &operator=(const FetchContext &) = delete;
-    FetchContext(FetchContext &&other);
+    /* the timer is bound to this, so a context never moves */
+    FetchContext(FetchContext &&other) = delete;
 
     FetchContext(const uint256_t &ent_hash, HotStuffBase *hs);
     ~FetchContext() {}
@@ -163,18 +168,27 @@ class HotStuffBase: public HotStuffCore {
     /** network stack */
     Net pn;
     std::unordered_set<uint256_t> valid_tls_certs;
-#ifdef HOTSTUFF_BLK_PROFILE
-    BlockProfiler blk_profiler;
-#endif
     pacemaker_bt pmaker;
     /* queues for async tasks */
-    std::unordered_map<const uint256_t, BlockFetchContext> blk_fetch_waiting;
+    /* boxed: the table moves its entries around on rehash and erase */
+    FlatHashMap<BoxObj<BlockFetchContext>> blk_fetch_waiting;
     std::unordered_map<const uint256_t, BlockDeliveryContext> blk_delivery_waiting;
-    std::unordered_map<const uint256_t, commit_cb_t> decision_waiting;
-    using cmd_queue_t = salticidae::MPSCQueueEventDriven<std::pair<uint256_t, commit_cb_t>>;
+    /* indexed by the command id, see CommandTable */
+    std::vector<commit_cb_t> decision_waiting;
+    /** when the waiting commands were submitted, see Histogram::now_us() */
+    std::vector<uint64_t> decision_submitted;
+    size_t decision_waiting_size;
+    /** a command submitted through exec_command() */
+    struct PendingCmd {
+        uint256_t cmd_hash;
+        commit_cb_t callback;
+        uint64_t submitted;
+    };
+    using cmd_queue_t = salticidae::MPSCQueueEventDriven<PendingCmd>;
     cmd_queue_t cmd_pending;
+    /** number of commands taken out of cmd_pending so far */
+    uint64_t cmd_dequeued;
     std::queue<uint256_t> cmd_pending_buffer;
-    std::queue<uint256_t> local_order_buffer;               // Us
     /** Timer to send unproposed cmds and edges if any **/
     TimerEvent reorder_timer;                            // Us
 
@@ -193,6 +207,54 @@ class HotStuffBase: public HotStuffCore {
     mutable double part_delivery_time_min;
     mutable double part_delivery_time_max;
     mutable std::unordered_map<const PeerId, uint32_t> part_fetched_replica;
+#ifdef HOTSTUFF_ALLOC_PROFILE
+    /** allocations counted at the previous print_stat() */
+    mutable AllocProfiler::Stats alloc_last;
+#endif
+
+    /* metrics, registered in HotStuffCore::metrics; the gauges are sampled
+     * by metrics_timer */
+    static const opcode_t nopcodes = MsgLocalOrder::opcode + 1;
+    struct BaseMetrics {
+        Gauge &blk_fetch_waiting;
+        Gauge &blk_delivery_waiting;
+        Gauge &decision_waiting;
+        Gauge &cmd_pending;
+        Gauge &veripool_backlog;
+        Counter &cmd_received;
+        Counter *msgs_sent[nopcodes];
+        Counter *bytes_sent[nopcodes];
+        Counter *msgs_recv[nopcodes];
+        Counter *bytes_recv[nopcodes];
+        Histogram &commit_latency;
+        BaseMetrics(MetricsRegistry &metrics);
+    } mstat;
+    TimerEvent metrics_timer;
+
+    void update_metrics();
+
+    template<typename M>
+    void count_sent(const M &msg, size_t npeers = 1) {
+        mstat.msgs_sent[M::opcode]->inc(npeers);
+        mstat.bytes_sent[M::opcode]->inc(npeers * msg.serialized.size());
+    }
+
+    template<typename M>
+    void count_recv(const M &msg) {
+        mstat.msgs_recv[M::opcode]->inc();
+        mstat.bytes_recv[M::opcode]->inc(msg.serialized.size());
+    }
+
+    /** log of the inputs, if recording (see start_recording()) */
+    BoxObj<InputRecorder> recorder;
+
+    /* to be called before the message is parsed */
+    template<typename M>
+    void record_recv(M &msg) {
+        if (recorder)
+            recorder->record_msg(M::opcode, msg.serialized.data(),
+                                msg.serialized.size());
+    }
 
     void on_fetch_cmd(const command_t &cmd);
     void on_fetch_blk(const block_t &blk);
@@ -208,8 +270,6 @@ class HotStuffBase: public HotStuffCore {
     inline void resp_blk_handler(MsgRespBlock &&, const Net::conn_t &);
     /** receives local ordering on leader from replica **/
     inline void local_order_handler(MsgLocalOrder &&, const Net::conn_t &);     // Us
-     /** Called upon receiving local order from replicas to the Leader. */
-    inline void process_local_order(const LocalOrder &);                        // Us
 
     inline bool conn_handler(const salticidae::ConnPool::conn_t &, bool);
 
@@ -248,10 +308,14 @@ class HotStuffBase: public HotStuffCore {
                 double fairness_parameter,      // Us
                 bool ec_loop = false);
 
+    /** Log the inputs of the consensus to `fname`, to be replayed by
+     * hotstuff-replay. Must be called before start(). */
+    void start_recording(const std::string &fname);
+    /** Flush and close the input log. */
+    void stop_recording() { recorder = nullptr; }
+
     size_t size() const { return peers.size(); }
-    const auto &get_decision_waiting() const { return decision_waiting; }
-    // get local order function
-    auto &get_local_order_buffer() {return local_order_buffer; }
+    size_t get_decision_waiting_size() const { return decision_waiting_size; }
     ThreadCall &get_tcall() { return tcall; }
     PaceMaker *get_pace_maker() { return pmaker.get(); }
     void print_stat() const;
@@ -296,10 +360,10 @@ class HotStuff: public HotStuffBase {
         return new QuorumCertType(get_config(), blk_hash);
     }
 
-    quorum_cert_bt parse_quorum_cert(DataStream &s) override {
-        QuorumCert *qc = new QuorumCertType();
+    quorum_cert_t parse_quorum_cert(DataStream &s) override {
+        quorum_cert_bt qc = new QuorumCertType();
         s >> *qc;
-        return qc;
+        return qc.unwrap();
     }
 
     public:
@@ -340,19 +404,6 @@ using HotStuffNoSig = HotStuff<>;
 using HotStuffSecp256k1 = HotStuff<PrivKeySecp256k1, PubKeySecp256k1,
                                     PartCertSecp256k1, QuorumCertSecp256k1>;
 
-template<EntityType ent_type>
-FetchContext<ent_type>::FetchContext(FetchContext && other):
-        promise_t(static_cast<const promise_t &>(other)),
-        hs(other.hs),
-        fetch_msg(std::move(other.fetch_msg)),
-        ent_hash(other.ent_hash),
-        replicas(std::move(other.replicas)) {
-    other.timeout.del();
-    timeout = TimerEvent(hs->ec,
-            std::bind(&FetchContext::timeout_cb, this, _1));
-    reset_timeout();
-}
-
 template<>
 inline void FetchContext<ENT_TYPE_CMD>::timeout_cb(TimerEvent &) {
     HOTSTUFF_LOG_WARN("cmd fetching %.10s timeout", get_hex(ent_hash).c_str());
@@ -384,6 +435,7 @@ FetchContext<ent_type>::FetchContext(
 template<EntityType ent_type>
 void FetchContext<ent_type>::send(const PeerId &replica) {
     hs->part_fetched_replica[replica]++;
+    hs->count_sent(fetch_msg);
     hs->pn.send_msg(fetch_msg, replica);
 }
 
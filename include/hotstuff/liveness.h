@@ -58,75 +58,30 @@ class PaceMaker {
 using pacemaker_bt = BoxObj<PaceMaker>;
 
 /** Parent selection implementation for PaceMaker: select the highest tail that
- * follows the current hqc block. */
+ * follows the current hqc block, and the highest other tails as
+ * "uncles/aunts" up to parent_limit parents in total. */
 class PMHighTail: public virtual PaceMaker {
-    block_t hqc_tail;
     const int32_t parent_limit;         /**< maximum number of parents */
 
-    bool check_ancestry(const block_t &_a, const block_t &_b) {
-        block_t b;
-        for (b = _b;
-            b->get_height() > _a->get_height();
-            b = b->get_parents()[0]);
-        return b == _a;
-    }
-    
-    void reg_hqc_update() {
-        hsc->async_hqc_update().then([this](const block_t &hqc) {
-            hqc_tail = hqc;
-            for (const auto &tail: hsc->get_tails())
-                if (check_ancestry(hqc, tail) && tail->get_height() > hqc_tail->get_height()){
-                    hqc_tail = tail;
-                }
-                    
-            reg_hqc_update();
-        });
-    }
-
-    void reg_proposal() {
-        hsc->async_wait_proposal().then([this](const Proposal &prop) {
-            hqc_tail = prop.blk;
-            reg_proposal();
-        });
-    }
-
-    void reg_receive_proposal() {
-        hsc->async_wait_receive_proposal().then([this](const Proposal &prop) {
-            const auto &hqc = hsc->get_hqc();
-            const auto &blk = prop.blk;
-            if (check_ancestry(hqc, blk) && blk->get_height() > hqc_tail->get_height()){
-                hqc_tail = blk;
-            }
-            reg_receive_proposal();
-        });
-    }
-
     public:
     PMHighTail(int32_t parent_limit): parent_limit(parent_limit) {}
-    void init() {
-        hqc_tail = hsc->get_genesis();
-        reg_hqc_update();
-        reg_proposal();
-        reg_receive_proposal();
-    }
+    /* the tail index of HotStuffCore follows hqc by itself */
+    void init() {}
 
     std::vector<block_t> get_parents() override {
         const auto &tails = hsc->get_tails();
+        const auto &hqc_tail = tails.get_best();
         std::vector<block_t> parents{hqc_tail};
-        // TODO: inclusive block chain
-        // auto nparents = tails.size();
-        // if (parent_limit > 0)
-        //     nparents = std::min(nparents, (size_t)parent_limit);
-        // nparents--;
-        // /* add the rest of tails as "uncles/aunts" */
-        // for (const auto &blk: tails)
-        // {
-        //     if (blk != hqc_tail)
-        //     {
-        //         parents.push_back(blk);
-        //         if (!--nparents) break;
-        //     }
-        // }
+        auto nparents = tails.size();
+        if (parent_limit > 0)
+            nparents = std::min(nparents, (size_t)parent_limit);
+        /* add the rest of tails as "uncles/aunts" */
+        for (const auto &p: tails.by_height())
+            for (const auto &blk: p.second)
+            {
+                if (parents.size() >= nparents) return parents;
+                if (blk != hqc_tail) parents.push_back(blk);
+            }
         return parents;
     }
 };
@@ -303,7 +258,7 @@ class PMRoundRobinProposer: virtual public PaceMaker {
         // std::vector<std::pair<uint256_t, uint256_t>> e_update;
         // auto blk = hsc->on_propose(graph, e_update, get_parents(), bytearray_t());
         // auto blk = hsc->on_propose(cmds, get_parents(), bytearray_t()); //Us
-        std::unordered_map<ReplicaID, std::vector<uint256_t>> orders;
+        std::unordered_map<ReplicaID, std::vector<Hash256>> orders;
         auto blk = hsc->on_propose(orders,get_parents(),bytearray_t()); //Us
         pm_qc_manual.reject();
         (pm_qc_manual = hsc->async_qc_finish(blk))
@@ -414,6 +369,13 @@ class PMRoundRobinProposer: virtual public PaceMaker {
 
     size_t get_pending_size() override { return pending_beats.size(); }
 
+    double get_base_timeout() const { return base_timeout; }
+    double get_prop_delay() const { return prop_delay; }
+    /** Takes effect the next time the timeout is reset (upon consensus). */
+    void set_base_timeout(double t) { base_timeout = t; }
+    /** Takes effect from the next expiry of the timeout. */
+    void set_prop_delay(double t) { prop_delay = t; }
+
     void init() {
         exp_timeout = base_timeout;
         stop_rotate();
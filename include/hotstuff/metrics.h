@@ -0,0 +1,198 @@
+/**
+ * Copyright 2018 VMware
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _HOTSTUFF_METRICS_H
+#define _HOTSTUFF_METRICS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace hotstuff {
+
+/** Monotonic counter. Updates are relaxed atomics: a counter is meant to be
+ * bumped by one thread and read by the metrics server. */
+class Counter {
+    std::atomic<uint64_t> val;
+
+    public:
+    Counter(): val(0) {}
+    void inc(uint64_t n = 1) { val.fetch_add(n, std::memory_order_relaxed); }
+    uint64_t get() const { return val.load(std::memory_order_relaxed); }
+};
+
+/** Value that goes up and down (e.g., a queue depth). */
+class Gauge {
+    std::atomic<int64_t> val;
+
+    public:
+    Gauge(): val(0) {}
+    void set(int64_t v) { val.store(v, std::memory_order_relaxed); }
+    void add(int64_t n) { val.fetch_add(n, std::memory_order_relaxed); }
+    int64_t get() const { return val.load(std::memory_order_relaxed); }
+};
+
+/** Log-linear (HDR) histogram of durations in microseconds.
+ *
+ * Every power of two is split into 2^sub_bits buckets, so a recorded value
+ * is off by at most 1/2^sub_bits of itself, with a fixed memory footprint
+ * and no allocation when recording. Values above 2^max_bits us (about 12
+ * days) land in the last bucket. */
+class Histogram {
+    public:
+    static const int sub_bits = 5;
+    static const int max_bits = 40;
+    static const size_t sub_count = 1 << sub_bits;
+    static const size_t nbuckets = (max_bits - sub_bits + 1) * sub_count;
+
+    private:
+    std::atomic<uint64_t> buckets[nbuckets];
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> sum;
+
+    public:
+    static size_t bucket_of(uint64_t v) {
+        if (v < sub_count) return v;
+        int msb = 63 - __builtin_clzll(v);
+        if (msb >= max_bits) return nbuckets - 1;
+        int shift = msb - sub_bits;
+        return (shift + 1) * sub_count + (v >> shift) - sub_count;
+    }
+
+    /** The smallest and largest values falling into a bucket. */
+    static std::pair<uint64_t, uint64_t> bucket_range(size_t idx) {
+        if (idx < sub_count) return std::make_pair(idx, idx);
+        int shift = idx / sub_count - 1;
+        uint64_t m = idx % sub_count + sub_count;
+        return std::make_pair(m << shift, ((m + 1) << shift) - 1);
+    }
+
+    Histogram();
+
+    void observe(uint64_t us) {
+        buckets[bucket_of(us)].fetch_add(1, std::memory_order_relaxed);
+        count.fetch_add(1, std::memory_order_relaxed);
+        sum.fetch_add(us, std::memory_order_relaxed);
+    }
+
+    /** Record the time since `start` (taken from now_us()). */
+    void observe_since(uint64_t start) { observe(now_us() - start); }
+
+    uint64_t get_count() const { return count.load(std::memory_order_relaxed); }
+    uint64_t get_sum() const { return sum.load(std::memory_order_relaxed); }
+
+    /** Values at the given quantiles (in increasing order), estimated as
+     * the middle of the bucket they fall into. */
+    std::vector<double> quantiles(const std::vector<double> &qs) const;
+
+    /** The bucket counts; the difference of two snapshots gives the values
+     * recorded in between. */
+    std::vector<uint64_t> snapshot() const;
+    /** Quantiles of a snapshot (or of a difference of snapshots). */
+    static std::vector<double> quantiles(const std::vector<uint64_t> &snap,
+                                        const std::vector<double> &qs);
+
+    static uint64_t now_us() {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+};
+
+/** Named metrics rendered in the Prometheus text exposition format.
+ *
+ * Metrics are registered once (usually in a constructor) and the returned
+ * references stay valid for the lifetime of the registry; updating them
+ * takes no lock. Registration and rendering share a mutex, so scraping never
+ * waits on the threads updating the metrics, nor the other way around.
+ * Metrics with the same name and different labels (given preformatted, e.g.
+ * `opcode="vote"`) form one family. Histograms are exposed as summaries in
+ * seconds, so their names should end with `_seconds`. */
+class MetricsRegistry {
+    enum class Type { COUNTER, GAUGE, SUMMARY };
+
+    struct Metric {
+        std::string name;
+        std::string labels;
+        Type type;
+        std::unique_ptr<Counter> counter;
+        std::unique_ptr<Gauge> gauge;
+        std::unique_ptr<Histogram> histogram;
+    };
+
+    struct Family {
+        std::string name;
+        std::string help;
+        Type type;
+        std::vector<Metric *> metrics;
+    };
+
+    mutable std::mutex lock;
+    std::vector<std::unique_ptr<Family>> families;
+    std::vector<std::unique_ptr<Metric>> metrics;
+
+    Metric &add(const std::string &name, const std::string &help,
+                const std::string &labels, Type type);
+
+    public:
+    MetricsRegistry() = default;
+    MetricsRegistry(const MetricsRegistry &) = delete;
+    MetricsRegistry &operator=(const MetricsRegistry &) = delete;
+
+    Counter &counter(const std::string &name, const std::string &help,
+                    const std::string &labels = "");
+    Gauge &gauge(const std::string &name, const std::string &help,
+                const std::string &labels = "");
+    Histogram &histogram(const std::string &name, const std::string &help,
+                        const std::string &labels = "");
+
+    /** The current values in the Prometheus text format (version 0.0.4). */
+    std::string render() const;
+};
+
+/** Minimal HTTP server answering `GET /metrics` with the rendered registry.
+ *
+ * It runs on its own thread with blocking sockets and only reads the
+ * metrics, so a slow or stuck scraper cannot hold up the event loops. Only
+ * one request is served at a time. */
+class MetricsServer {
+    const MetricsRegistry &registry;
+    int listen_fd;
+    std::atomic<bool> running;
+    std::thread worker;
+
+    void serve();
+    void handle(int fd);
+
+    public:
+    /** Listen on the given local port (throws HotStuffError on failure).
+     * `host` is the address to bind, loopback by default. */
+    MetricsServer(const MetricsRegistry &registry, uint16_t port,
+                const std::string &host = "127.0.0.1");
+    ~MetricsServer();
+
+    MetricsServer(const MetricsServer &) = delete;
+    MetricsServer &operator=(const MetricsServer &) = delete;
+};
+
+}
+
+#endif
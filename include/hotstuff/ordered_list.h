@@ -26,17 +26,18 @@
 #include <unordered_set>
 #include "salticidae/stream.h"
 #include "hotstuff/util.h"
+#include "hotstuff/cmd_table.h"
 
 namespace hotstuff {
 
 struct LinkedNode
 {
-    uint256_t cmd_hash;
+    cmd_id_t cmd_id;
     LinkedNode* next;
     LinkedNode* prev;
 
     public:
-    LinkedNode(uint256_t cmd_hash) : cmd_hash(cmd_hash), next(nullptr), prev(nullptr) {}
+    LinkedNode(cmd_id_t cmd_id) : cmd_id(cmd_id), next(nullptr), prev(nullptr) {}
 };
 
 class OrderedList{
@@ -50,27 +51,31 @@ class OrderedList{
         Iterator();
         Iterator(LinkedNode* new_ptr);
         bool operator!=(const Iterator& it) const;
-        uint256_t operator*() const;
+        cmd_id_t operator*() const;
         Iterator operator++(int);
         Iterator operator+(int i);
         Iterator next();
     };
 
     private:
-    std::unordered_map<uint256_t, LinkedNode*> linked_cache;
+    /* indexed by command id, nullptr if the command is not in the list */
+    std::vector<LinkedNode*> linked_cache;
+    size_t nnodes;
     LinkedNode* head;
     LinkedNode* tail;
 
     public:
     OrderedList();
-    void push_back(uint256_t cmd_hash);
+    /** Returns false if the command was already in the list. */
+    bool push_back(cmd_id_t cmd_id);
     LinkedNode* get_head();
-    void remove(uint256_t cmd_hash);
+    /** Returns false if the command was not in the list. */
+    bool remove(cmd_id_t cmd_id);
     Iterator begin() const;
     Iterator end() const;
     size_t get_size();
 
-    std::vector<uint256_t> get_cmds();
+    std::vector<cmd_id_t> get_cmds();
     // no need for our implementation
     // std::vector<std::pair<uint256_t,uint256_t>> get_curr_missing_edges(std::unordered_map<uint256_t, std::unordered_set<uint256_t>>& missing);
 };
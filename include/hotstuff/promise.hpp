@@ -27,43 +27,268 @@
 #include <stack>
 #include <vector>
 #include <memory>
+#include <new>
+#include <cstddef>
+#include <stdexcept>
+#include <typeinfo>
 #include <functional>
 #include <type_traits>
 
-#if __cplusplus >= 201703L
-#ifdef __has_include
-#   if __has_include(<any>)
-#       include <any>
-#       ifdef __cpp_lib_any
-#           define _CPPROMISE_STD_ANY
-#       endif
-#   endif
-#endif
-#endif
-
-#ifndef _CPPROMISE_STD_ANY
-#include <boost/any.hpp>
-#endif
-
 /**
  * Implement type-safe Promise primitives similar to the ones specified by
  * Javascript Promise/A+.
  */
 namespace promise {
-#ifdef _CPPROMISE_STD_ANY
-    using pm_any_t = std::any;
-    template<typename T>
-    constexpr auto any_cast = static_cast<T(*)(const std::any&)>(std::any_cast<T>);
-    using bad_any_cast = std::bad_any_cast;
-#else
-#   warning "using boost::any"
-#   pragma message "using boost::any"
-    using pm_any_t = boost::any;
+    template<typename T, typename U>
+    using disable_if_same_ref = typename std::enable_if_t<
+            !std::is_same<
+                std::remove_cv_t<std::remove_reference_t<T>>, U>::value>;
+
+    class bad_any_cast: public std::bad_cast {
+        public:
+        const char *what() const noexcept override {
+            return "bad promise value cast";
+        }
+    };
+
+    /** Type-erased value carried by a promise.
+     *
+     * Values of up to three pointers that can be moved without throwing
+     * (bool, ReplicaID, ref-counted handles such as block_t, a values_t) are
+     * stored inline, so resolving with them does not allocate; larger values
+     * go to the heap. The stored type is identified by the address of its
+     * operation table, hence a cast is a pointer comparison. */
+    class pm_any_t {
+        static const size_t inline_size = 3 * sizeof(void *);
+
+        struct ops_t {
+            void (*copy)(pm_any_t &dst, const pm_any_t &src);
+            /* move to dst and destroy src, or only destroy src if !dst */
+            void (*move)(pm_any_t *dst, pm_any_t &src);
+        };
+
+        template<typename T>
+        using fits_inline = std::integral_constant<bool,
+            sizeof(T) <= inline_size &&
+            alignof(T) <= alignof(void *) &&
+            std::is_nothrow_move_constructible<T>::value>;
+
+        template<typename T, bool = fits_inline<T>::value>
+        struct holder {
+            static T *get(const pm_any_t &a) {
+                return reinterpret_cast<T *>(const_cast<unsigned char *>(a.buf));
+            }
+            static void create(pm_any_t &a, T &&v) { new (a.buf) T(std::move(v)); }
+            static void copy(pm_any_t &dst, const pm_any_t &src) {
+                new (dst.buf) T(*get(src));
+            }
+            static void move(pm_any_t *dst, pm_any_t &src) {
+                if (dst) new (dst->buf) T(std::move(*get(src)));
+                get(src)->~T();
+            }
+            static const ops_t *get_ops() {
+                static constexpr ops_t table{copy, move};
+                return &table;
+            }
+        };
+
+        template<typename T>
+        struct holder<T, false> {
+            static T *get(const pm_any_t &a) { return static_cast<T *>(a.ptr); }
+            static void create(pm_any_t &a, T &&v) { a.ptr = new T(std::move(v)); }
+            static void copy(pm_any_t &dst, const pm_any_t &src) {
+                dst.ptr = new T(*get(src));
+            }
+            static void move(pm_any_t *dst, pm_any_t &src) {
+                if (dst) dst->ptr = src.ptr;
+                else delete get(src);
+            }
+            static const ops_t *get_ops() {
+                static constexpr ops_t table{copy, move};
+                return &table;
+            }
+        };
+
+        union {
+            alignas(void *) unsigned char buf[inline_size];
+            void *ptr;
+        };
+        const ops_t *ops;
+
+        public:
+        pm_any_t(): ops(nullptr) {}
+
+        template<typename T, disable_if_same_ref<T, pm_any_t> * = nullptr>
+        pm_any_t(T &&v) {
+            using value_t = std::decay_t<T>;
+            holder<value_t>::create(*this, value_t(std::forward<T>(v)));
+            ops = holder<value_t>::get_ops();
+        }
+
+        pm_any_t(const pm_any_t &other): ops(other.ops) {
+            if (ops) ops->copy(*this, other);
+        }
+
+        pm_any_t(pm_any_t &&other) noexcept: ops(other.ops) {
+            if (ops) ops->move(this, other);
+            other.ops = nullptr;
+        }
+
+        ~pm_any_t() { reset(); }
+
+        pm_any_t &operator=(const pm_any_t &other) {
+            if (this != &other)
+            {
+                pm_any_t tmp(other);
+                *this = std::move(tmp);
+            }
+            return *this;
+        }
+
+        pm_any_t &operator=(pm_any_t &&other) noexcept {
+            if (this != &other)
+            {
+                reset();
+                if ((ops = other.ops)) ops->move(this, other);
+                other.ops = nullptr;
+            }
+            return *this;
+        }
+
+        void reset() {
+            if (ops) ops->move(nullptr, *this);
+            ops = nullptr;
+        }
+
+        bool has_value() const { return ops != nullptr; }
+
+        /** Pointer to the stored value if it is a T, nullptr otherwise. */
+        template<typename T>
+        const T *get_if() const {
+            return ops == holder<T>::get_ops() ? holder<T>::get(*this) : nullptr;
+        }
+    };
+
     template<typename T>
-    constexpr auto any_cast = static_cast<T(*)(const boost::any&)>(boost::any_cast<T>);
-    using bad_any_cast = boost::bad_any_cast;
-#endif
-    using callback_t = std::function<void()>;
+    inline T any_cast(const pm_any_t &v) {
+        auto p = v.get_if<std::remove_cv_t<std::remove_reference_t<T>>>();
+        if (!p) throw bad_any_cast();
+        return *p;
+    }
+
+    /** Move-only void() callable with inline storage.
+     *
+     * The closures built by then() hold a promise handle or two plus the
+     * user's callback, which is more than std::function keeps inline; they
+     * are stored here without a heap allocation up to inline_size bytes. */
+    class callback_t {
+        static const size_t inline_size = 64;
+
+        template<typename F>
+        using fits_inline = std::integral_constant<bool,
+            sizeof(F) <= inline_size &&
+            alignof(F) <= alignof(std::max_align_t) &&
+            std::is_nothrow_move_constructible<F>::value>;
+
+        template<typename F, bool = fits_inline<F>::value>
+        struct holder {
+            static F *get(callback_t &cb) { return reinterpret_cast<F *>(cb.buf); }
+            static void create(callback_t &cb, F &&f) { new (cb.buf) F(std::move(f)); }
+            static void invoke(callback_t &cb) { (*get(cb))(); }
+            static void move(callback_t *dst, callback_t &src) {
+                if (dst) new (dst->buf) F(std::move(*get(src)));
+                get(src)->~F();
+            }
+        };
+
+        template<typename F>
+        struct holder<F, false> {
+            static F *get(callback_t &cb) { return static_cast<F *>(cb.ptr); }
+            static void create(callback_t &cb, F &&f) { cb.ptr = new F(std::move(f)); }
+            static void invoke(callback_t &cb) { (*get(cb))(); }
+            static void move(callback_t *dst, callback_t &src) {
+                if (dst) dst->ptr = src.ptr;
+                else delete get(src);
+            }
+        };
+
+        union {
+            alignas(std::max_align_t) unsigned char buf[inline_size];
+            void *ptr;
+        };
+        void (*invoke)(callback_t &);
+        /* move to dst and destroy src, or only destroy src if !dst */
+        void (*move)(callback_t *dst, callback_t &src);
+
+        public:
+        callback_t(): invoke(nullptr), move(nullptr) {}
+
+        template<typename F, disable_if_same_ref<F, callback_t> * = nullptr>
+        callback_t(F &&f) {
+            using func_t = std::decay_t<F>;
+            holder<func_t>::create(*this, func_t(std::forward<F>(f)));
+            invoke = holder<func_t>::invoke;
+            move = holder<func_t>::move;
+        }
+
+        callback_t(const callback_t &) = delete;
+        callback_t &operator=(const callback_t &) = delete;
+
+        callback_t(callback_t &&other) noexcept:
+                invoke(other.invoke), move(other.move) {
+            if (move) move(this, other);
+            other.invoke = nullptr;
+            other.move = nullptr;
+        }
+
+        callback_t &operator=(callback_t &&other) noexcept {
+            if (this != &other)
+            {
+                reset();
+                invoke = other.invoke;
+                if ((move = other.move)) move(this, other);
+                other.invoke = nullptr;
+                other.move = nullptr;
+            }
+            return *this;
+        }
+
+        ~callback_t() { reset(); }
+
+        void reset() {
+            if (move) move(nullptr, *this);
+            invoke = nullptr;
+            move = nullptr;
+        }
+
+        explicit operator bool() const { return invoke != nullptr; }
+
+        void operator()() { invoke(*this); }
+    };
+
+    /** Callbacks waiting on a promise. Almost every promise has a single
+     * continuation, so the first one is kept inline. */
+    class callback_list_t {
+        callback_t first;
+        std::vector<callback_t> rest;
+
+        public:
+        void push_back(callback_t &&cb) {
+            if (!first) first = std::move(cb);
+            else rest.push_back(std::move(cb));
+        }
+
+        void run() {
+            if (first) first();
+            for (auto &cb: rest) cb();
+        }
+
+        void clear() {
+            first.reset();
+            rest.clear();
+        }
+    };
+
     using values_t = std::vector<pm_any_t>;
 
     /* match lambdas */
@@ -125,16 +350,10 @@ namespace promise {
             !std::is_same<typename function_traits<Func>::arg_type,
                          ArgType>::value>;
 
-    template<typename T, typename U>
-    using disable_if_same_ref = typename std::enable_if_t<
-            !std::is_same<
-                std::remove_cv_t<std::remove_reference_t<T>>, U>::value>;
-
     class Promise;
     //class promise_t: public std::shared_ptr<Promise> {
     class promise_t {
         Promise *pm;
-        size_t *ref_cnt;
         public:
         friend Promise;
         template<typename PList> friend promise_t all(const PList &promise_list);
@@ -147,7 +366,6 @@ namespace promise {
 
         void swap(promise_t &other) {
             std::swap(pm, other.pm);
-            std::swap(ref_cnt, other.ref_cnt);
         }
 
         promise_t &operator=(const promise_t &other) {
@@ -159,7 +377,7 @@ namespace promise {
             return *this;
         }
 
-        promise_t &operator=(promise_t &&other) {
+        promise_t &operator=(promise_t &&other) noexcept {
             if (this != &other)
             {
                 promise_t tmp(std::move(other));
@@ -168,15 +386,9 @@ namespace promise {
             return *this;
         }
 
-        promise_t(const promise_t &other):
-            pm(other.pm),
-            ref_cnt(other.ref_cnt) {
-            ++*ref_cnt;
-        }
+        inline promise_t(const promise_t &other) noexcept;
 
-        promise_t(promise_t &&other):
-            pm(other.pm),
-            ref_cnt(other.ref_cnt) {
+        promise_t(promise_t &&other) noexcept: pm(other.pm) {
             other.pm = nullptr;
         }
 
@@ -203,11 +415,29 @@ namespace promise {
 #define PROMISE_ERR_INVALID_STATE do {throw std::runtime_error("invalid promise state");} while (0)
 #define PROMISE_ERR_MISMATCH_TYPE do {throw std::runtime_error("mismatching promise value types");} while (0)
     
+    /** Free list of Promise objects kept by each thread. It is trivially
+     * destructible so that promises freed during thread teardown can still
+     * use it (cached objects are then simply leaked). */
+    struct promise_pool_t {
+        static const size_t max_size = 4096;
+        struct node_t { node_t *next; };
+        node_t *head;
+        size_t size;
+
+        static promise_pool_t &get() {
+            static thread_local promise_pool_t pool;
+            return pool;
+        }
+    };
+
     class Promise {
+        friend promise_t;
         template<typename PList> friend promise_t all(const PList &promise_list);
         template<typename PList> friend promise_t race(const PList &promise_list);
-        std::vector<callback_t> fulfilled_callbacks;
-        std::vector<callback_t> rejected_callbacks;
+        /* promise_t handles referring to this object */
+        size_t ref_cnt;
+        callback_list_t fulfilled_callbacks;
+        callback_list_t rejected_callbacks;
 #ifdef CPPROMISE_USE_STACK_FREE
         std::vector<Promise *> fulfilled_pms;
         std::vector<Promise *> rejected_pms;
@@ -224,6 +454,29 @@ namespace promise {
         pm_any_t result;
         pm_any_t reason;
 
+        static void *operator new(size_t size) {
+            auto &pool = promise_pool_t::get();
+            if (size != sizeof(Promise) || !pool.head)
+                return ::operator new(size);
+            auto p = pool.head;
+            pool.head = p->next;
+            pool.size--;
+            return p;
+        }
+
+        static void operator delete(void *ptr, size_t size) {
+            auto &pool = promise_pool_t::get();
+            if (size != sizeof(Promise) || pool.size == promise_pool_t::max_size)
+            {
+                ::operator delete(ptr);
+                return;
+            }
+            auto p = static_cast<promise_pool_t::node_t *>(ptr);
+            p->next = pool.head;
+            pool.head = p;
+            pool.size++;
+        }
+
         void add_on_fulfilled(callback_t &&cb) {
             fulfilled_callbacks.push_back(std::move(cb));
         }
@@ -239,15 +492,15 @@ namespace promise {
             return [&result, npm, f = std::forward<Func>(f)]() mutable {
 #ifndef CPPROMISE_USE_STACK_FREE
                 f(result)->then(
-                    [npm] (pm_any_t result) {npm->resolve(result);},
-                    [npm] (pm_any_t reason) {npm->reject(reason);});
+                    [npm] (const pm_any_t &result) {npm->resolve(result);},
+                    [npm] (const pm_any_t &reason) {npm->reject(reason);});
 #else
                 promise_t rpm{f(result)};
                 rpm->then(
-                    [rpm, npm] (pm_any_t result) {
+                    [rpm, npm] (const pm_any_t &result) {
                         npm->_resolve(result);
                     },
-                    [rpm, npm] (pm_any_t reason) {
+                    [rpm, npm] (const pm_any_t &reason) {
                         npm->_reject(reason);
                     });
                 rpm->_dep_resolve(npm);
@@ -263,15 +516,15 @@ namespace promise {
             return [npm, f = std::forward<Func>(f)]() mutable {
 #ifndef CPPROMISE_USE_STACK_FREE
                 f()->then(
-                    [npm] (pm_any_t result) {npm->resolve(result);},
-                    [npm] (pm_any_t reason) {npm->reject(reason);});
+                    [npm] (const pm_any_t &result) {npm->resolve(result);},
+                    [npm] (const pm_any_t &reason) {npm->reject(reason);});
 #else
                 promise_t rpm{f()};
                 rpm->then(
-                    [rpm, npm] (pm_any_t result) {
+                    [rpm, npm] (const pm_any_t &result) {
                         npm->_resolve(result);
                     },
-                    [rpm, npm] (pm_any_t reason) {
+                    [rpm, npm] (const pm_any_t &reason) {
                         npm->_reject(reason);
                     });
                 rpm->_dep_resolve(npm);
@@ -383,7 +636,7 @@ namespace promise {
                 if (pm->state == State::PreFulfilled)
                 {
                     pm->state = State::Fulfilled;
-                    for (auto &cb: pm->fulfilled_callbacks) cb();
+                    pm->fulfilled_callbacks.run();
                     s.push(std::make_tuple(pm->fulfilled_pms.begin(),
                                           &pm->fulfilled_pms,
                                           pm));
@@ -391,7 +644,7 @@ namespace promise {
                 else if (pm->state == State::PreRejected)
                 {
                     pm->state = State::Rejected;
-                    for (auto &cb: pm->rejected_callbacks) cb();
+                    pm->rejected_callbacks.run();
                     s.push(std::make_tuple(pm->rejected_pms.begin(),
                                           &pm->rejected_pms,
                                           pm));
@@ -451,7 +704,7 @@ namespace promise {
         void _resolve(pm_any_t _result) {
             if (state == State::Pending)
             {
-                result = _result;
+                result = std::move(_result);
                 state = State::PreFulfilled;
             }
         }
@@ -459,31 +712,35 @@ namespace promise {
         void _reject(pm_any_t _reason) {
             if (state == State::Pending)
             {
-                reason = _reason;
+                reason = std::move(_reason);
                 state = State::PreRejected;
             }
         }
 #else
         void _resolve() { resolve(); }
         void _reject() { reject(); }
-        void _resolve(pm_any_t result) { resolve(result); }
-        void _reject(pm_any_t reason) { reject(reason); }
+        void _resolve(pm_any_t result) { resolve(std::move(result)); }
+        void _reject(pm_any_t reason) { reject(std::move(reason)); }
 
+        /* the callbacks of the other outcome will never run, so they (and the
+         * promise handles they hold) are dropped right away */
         void trigger_fulfill() {
             state = State::Fulfilled;
-            for (const auto &cb: fulfilled_callbacks) cb();
+            rejected_callbacks.clear();
+            fulfilled_callbacks.run();
             fulfilled_callbacks.clear();
         }
 
         void trigger_reject() {
             state = State::Rejected;
-            for (const auto &cb: rejected_callbacks) cb();
+            fulfilled_callbacks.clear();
+            rejected_callbacks.run();
             rejected_callbacks.clear();
         }
 #endif
         public:
 
-        Promise(): state(State::Pending) {}
+        Promise(): ref_cnt(1), state(State::Pending) {}
         ~Promise() {}
 
         template<typename FuncFulfilled, typename FuncRejected>
@@ -554,7 +811,6 @@ namespace promise {
                 return promise_t([this,
                                 on_rejected = std::forward<FuncRejected>(on_rejected)
                                 ](promise_t &npm) {
-                    callback_t ret;
                     add_on_rejected(gen_on_rejected(std::move(on_rejected), npm));
                     add_on_fulfilled([this, npm]() {npm->_resolve(result);});
 #ifdef CPPROMISE_USE_STACK_FREE
@@ -585,7 +841,7 @@ namespace promise {
         void resolve(pm_any_t _result) {
             if (state == State::Pending)
             {
-                result = _result;
+                result = std::move(_result);
                 trigger_fulfill();
             }
         }
@@ -593,7 +849,7 @@ namespace promise {
         void reject(pm_any_t _reason) {
             if (state == State::Pending)
             {
-                reason = _reason;
+                reason = std::move(_reason);
                 trigger_reject();
             }
         }
@@ -601,19 +857,23 @@ namespace promise {
         
     template<typename PList> promise_t all(const PList &promise_list) {
         return promise_t([&promise_list] (promise_t &npm) {
-            auto size = std::make_shared<size_t>(promise_list.size());
-            auto results = std::make_shared<values_t>();
-            if (!*size) PROMISE_ERR_MISMATCH_TYPE;
-            results->resize(*size);
+            struct state_t {
+                size_t pending;
+                values_t results;
+            };
+            auto st = std::make_shared<state_t>();
+            st->pending = promise_list.size();
+            if (!st->pending) PROMISE_ERR_MISMATCH_TYPE;
+            st->results.resize(st->pending);
             size_t idx = 0;
             for (const auto &pm: promise_list) {
                 pm->then(
-                    [results, size, idx, npm](pm_any_t result) {
-                        (*results)[idx] = result;
-                        if (!--(*size))
-                            npm->_resolve(*results);
+                    [st, idx, npm](const pm_any_t &result) {
+                        st->results[idx] = result;
+                        if (!--st->pending)
+                            npm->_resolve(std::move(st->results));
                     },
-                    [npm](pm_any_t reason) {npm->_reject(reason);});
+                    [npm](const pm_any_t &reason) {npm->_reject(reason);});
 #ifdef CPPROMISE_USE_STACK_FREE
                 pm->_dep_resolve(npm);
                 pm->_dep_reject(npm);
@@ -626,8 +886,8 @@ namespace promise {
     template<typename PList> promise_t race(const PList &promise_list) {
         return promise_t([&promise_list] (promise_t &npm) {
             for (const auto &pm: promise_list) {
-                pm->then([npm](pm_any_t result) {npm->_resolve(result);},
-                        [npm](pm_any_t reason) {npm->_reject(reason);});
+                pm->then([npm](const pm_any_t &result) {npm->_resolve(result);},
+                        [npm](const pm_any_t &reason) {npm->_reject(reason);});
 #ifdef CPPROMISE_USE_STACK_FREE
                 pm->_dep_resolve(npm);
                 pm->_dep_reject(npm);
@@ -637,23 +897,18 @@ namespace promise {
     }
 
     template<typename Func, disable_if_same_ref<Func, promise_t> *>
-    inline promise_t::promise_t(Func &&callback):
-            pm(new Promise()),
-        ref_cnt(new size_t(1)) {
+    inline promise_t::promise_t(Func &&callback): pm(new Promise()) {
         callback(*this);
     }
 
-    inline promise_t::promise_t():
-        pm(new Promise()),
-        ref_cnt(new size_t(1)) {}
+    inline promise_t::promise_t(): pm(new Promise()) {}
+
+    inline promise_t::promise_t(const promise_t &other) noexcept: pm(other.pm) {
+        if (pm) pm->ref_cnt++;
+    }
 
     inline promise_t::~promise_t() {
-        if (pm)
-        {
-            if (--*ref_cnt) return;
-            delete pm;
-            delete ref_cnt;
-        }
+        if (pm && !--pm->ref_cnt) delete pm;
     }
 
     template<typename T>
@@ -679,10 +934,11 @@ namespace promise {
         typename function_traits<Func>::non_empty_arg * = nullptr>
     constexpr auto gen_any_callback(Func &&f) {
         using func_t = callback_types<Func>;
-        return [f = std::forward<Func>(f)](pm_any_t v) mutable {
-            try {
-                f(any_cast<typename func_t::arg_type>(v));
-            } catch (bad_any_cast &e) { PROMISE_ERR_MISMATCH_TYPE; }
+        return [f = std::forward<Func>(f)](const pm_any_t &v) mutable {
+            auto p = v.get_if<std::remove_cv_t<std::remove_reference_t<
+                                typename func_t::arg_type>>>();
+            if (!p) PROMISE_ERR_MISMATCH_TYPE;
+            f(*p);
         };
     }
 
@@ -691,7 +947,7 @@ namespace promise {
         enable_if_return<Func, void> * = nullptr,
         typename function_traits<Func>::non_empty_arg * = nullptr>
     constexpr auto gen_any_callback(Func &&f) {
-        return [f = std::forward<Func>(f)](pm_any_t v) mutable {f(v);};
+        return [f = std::forward<Func>(f)](const pm_any_t &v) mutable {f(v);};
     }
 
     template<typename Func,
@@ -705,7 +961,7 @@ namespace promise {
         typename function_traits<Func>::non_empty_arg * = nullptr>
     constexpr auto gen_any_callback(Func &&f) {
         using func_t = callback_types<Func>;
-        return [f = std::forward<Func>(f)](pm_any_t v) mutable {
+        return [f = std::forward<Func>(f)](const pm_any_t &v) mutable {
             return typename func_t::ret_type(f(v));
         };
     }
@@ -716,11 +972,11 @@ namespace promise {
         typename function_traits<Func>::non_empty_arg * = nullptr>
     constexpr auto gen_any_callback(Func &&f) {
         using func_t = callback_types<Func>;
-        return [f = std::forward<Func>(f)](pm_any_t v) mutable {
-            try {
-                return typename func_t::ret_type(
-                    f(any_cast<typename func_t::arg_type>(v)));
-            } catch (bad_any_cast &e) { PROMISE_ERR_MISMATCH_TYPE; }
+        return [f = std::forward<Func>(f)](const pm_any_t &v) mutable {
+            auto p = v.get_if<std::remove_cv_t<std::remove_reference_t<
+                                typename func_t::arg_type>>>();
+            if (!p) PROMISE_ERR_MISMATCH_TYPE;
+            return typename func_t::ret_type(f(*p));
         };
     }
 
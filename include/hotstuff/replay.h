@@ -0,0 +1,120 @@
+/**
+ * Copyright 2018 VMware
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _HOTSTUFF_REPLAY_H
+#define _HOTSTUFF_REPLAY_H
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "hotstuff/type.h"
+
+namespace hotstuff {
+
+/** Binary log of the inputs of a replica, to replay its consensus offline
+ * (see hotstuff-replay).
+ *
+ * The log starts with what it takes to rebuild the replica (its id, the
+ * protocol parameters and the identities of all replicas, but not its
+ * private key), followed by one record per input, in the order the
+ * consensus thread took them: the replica messages feeding HotStuffCore
+ * (proposals, votes, local orders and block responses) with their payload
+ * as received, and the client commands with the proposer they were ordered
+ * for. Each record is stamped with the time since the recording started.
+ * Integers are little-endian; lengths and time deltas are LEB128 varints. */
+struct InputLog {
+    static const char magic[8];
+
+    enum RecordType: uint8_t {
+        MSG = 'M',
+        CMD = 'C'
+    };
+
+    struct Replica {
+        uint256_t peer_id;
+        bytearray_t pubkey;     /**< serialized public key */
+    };
+
+    struct Header {
+        ReplicaID id;
+        uint32_t nfaulty;
+        double fairness_parameter;
+        uint32_t blk_size;
+        std::vector<Replica> replicas;
+    };
+
+    struct Record {
+        RecordType type;
+        uint64_t ts_us;         /**< since the start of the recording */
+        /* MSG */
+        opcode_t opcode;
+        bytearray_t payload;
+        /* CMD */
+        uint256_t cmd_hash;
+        ReplicaID proposer;
+    };
+};
+
+/** Writes an input log; only used by the consensus thread. */
+class InputRecorder {
+    FILE *f;
+    std::chrono::steady_clock::time_point t0;
+    uint64_t last_us;
+    bytearray_t buff;
+
+    void begin_record(InputLog::RecordType type);
+    void write();
+
+    public:
+    /** Throws HotStuffError if the file cannot be created. */
+    InputRecorder(const std::string &fname);
+    ~InputRecorder();
+
+    InputRecorder(const InputRecorder &) = delete;
+    InputRecorder &operator=(const InputRecorder &) = delete;
+
+    /** Must come first; also starts the clock. */
+    void write_header(const InputLog::Header &header);
+    void record_msg(opcode_t opcode, const uint8_t *payload, size_t size);
+    void record_cmd(const uint256_t &cmd_hash, ReplicaID proposer);
+    void flush() { fflush(f); }
+};
+
+/** Reads an input log back. */
+class InputReader {
+    FILE *f;
+    InputLog::Header header;
+    uint64_t ts_us;
+
+    public:
+    /** Reads the header; throws HotStuffError if it is not an input log. */
+    InputReader(const std::string &fname);
+    ~InputReader();
+
+    InputReader(const InputReader &) = delete;
+    InputReader &operator=(const InputReader &) = delete;
+
+    const InputLog::Header &get_header() const { return header; }
+    /** Read the next record; false at the end of the log (a truncated last
+     * record, left by a replica that was killed, also ends it). */
+    bool next(InputLog::Record &rec);
+};
+
+}
+
+#endif
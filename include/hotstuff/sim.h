@@ -0,0 +1,200 @@
+/**
+ * Copyright 2018 VMware
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _HOTSTUFF_SIM_H
+#define _HOTSTUFF_SIM_H
+
+#include <functional>
+#include <memory>
+#include <queue>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "hotstuff/type.h"
+#include "hotstuff/metrics.h"
+
+namespace hotstuff {
+
+/** Distribution of a delay, in seconds. */
+struct DelayDist {
+    enum Type {
+        CONST,
+        UNIFORM,    /**< mean +- jitter */
+        EXP,        /**< exponential with the given mean */
+        NORMAL      /**< jitter is the standard deviation */
+    };
+
+    Type type;
+    double mean;
+    double jitter;
+
+    DelayDist(Type type = CONST, double mean = 0, double jitter = 0):
+        type(type), mean(mean), jitter(jitter) {}
+
+    /** Parse "const:MEAN", "uniform:MEAN:JITTER", "exp:MEAN" or
+     * "normal:MEAN:STDDEV" (throws HotStuffError). */
+    static DelayDist parse(const std::string &spec);
+    /** Draw a delay; never negative. */
+    double sample(std::mt19937_64 &rng) const;
+};
+
+struct SimConfig {
+    size_t nreplicas = 4;
+    double fairness_parameter = 1;
+    uint32_t blk_size = 1;
+    int32_t parent_limit = 1;
+    /** the fixed proposer (PaceMakerDummyFixed) */
+    ReplicaID proposer = 0;
+    /** secp256k1 certificates, verified on delivery, instead of dummy ones */
+    bool real_crypto = false;
+    /** one-way delay between two replicas */
+    DelayDist link_delay{DelayDist::CONST, 0.001};
+    /** delay from the clients to each replica */
+    DelayDist client_delay{DelayDist::UNIFORM, 0.001, 0.0005};
+    /** outgoing bytes per second of each replica (0 for unlimited) */
+    double bandwidth = 0;
+    /** virtual seconds charged per second of real processing in a replica
+     * (0 for free processing, which keeps the simulation deterministic) */
+    double cpu_scale = 0;
+    /** the last ncrashed replicas never start */
+    size_t ncrashed = 0;
+    /** the nslow replicas before the crashed ones have all their link
+     * delays multiplied by slow_factor */
+    size_t nslow = 0;
+    double slow_factor = 10;
+    /** client commands per second (Poisson arrivals) */
+    double cmd_rate = 1000;
+    /** commands are submitted during this many virtual seconds */
+    double duration = 10;
+    /** commands submitted before this are not measured */
+    double warmup = 1;
+    /** virtual seconds given to the last commands to commit */
+    double drain = 5;
+    uint32_t prune_staleness = 0;
+    uint64_t seed = 1;
+};
+
+class SimReplica;
+
+/** Discrete-event simulation of a cluster of HotStuffCore replicas.
+ *
+ * All replicas live in the calling thread and everything happens in virtual
+ * time: a single queue orders the events (message arrivals and client
+ * commands) and the clock jumps from one to the next, so a cluster runs much
+ * faster than real time when the network dominates. Messages are
+ * serialized and parsed as they would be on the wire, and a replica fetches
+ * the blocks it is missing from the sender, as HotStuffBase does. Links are
+ * FIFO, as TCP connections are.
+ *
+ * Clients submit each command to every running replica. A command counts
+ * as committed once nfaulty + 1 replicas have decided it (what a client
+ * waits for), and its latency runs from its submission. The fairness of
+ * the decided order is checked against the order in which the replicas
+ * received the commands: a violation is a pair of consecutive commands
+ * decided in one order while at least fairness_parameter * n of the running
+ * replicas received them in the other. */
+class Simulator {
+    public:
+    struct Result {
+        double virtual_sec = 0;
+        double wall_sec = 0;
+        uint64_t nsubmitted = 0;    /**< measured commands submitted */
+        uint64_t ncommitted = 0;    /**< measured commands committed */
+        uint64_t nproposed = 0;     /**< blocks proposed */
+        uint64_t nmsgs = 0;
+        uint64_t nbytes = 0;
+        uint64_t nfetches = 0;      /**< block requests */
+        uint64_t npairs = 0;        /**< pairs checked for fairness */
+        uint64_t nunfair = 0;       /**< pairs decided against the majority */
+    };
+
+    private:
+    struct Event {
+        double time;
+        uint64_t seq;
+        /** the replica doing the work, or -1 */
+        int target;
+        std::function<void()> fn;
+    };
+
+    struct Later {
+        bool operator()(const Event &a, const Event &b) const {
+            return a.time > b.time || (a.time == b.time && a.seq > b.seq);
+        }
+    };
+
+    struct CmdState {
+        double submitted;
+        bool measured;
+        uint32_t ndecided;
+        /** when each replica received it (infinite if not yet) */
+        std::vector<double> recv;
+    };
+
+    const SimConfig config;
+    size_t nfaulty;
+    size_t nrunning;
+    std::mt19937_64 rng;
+    double now;
+    uint64_t seq;
+    std::priority_queue<Event, std::vector<Event>, Later> events;
+    std::vector<std::unique_ptr<SimReplica>> replicas;
+    /** when the uplink of each replica is free again */
+    std::vector<double> nic_free;
+    /** when each replica is done with its last event */
+    std::vector<double> cpu_free;
+    /** last arrival on each link, to keep the links FIFO */
+    std::vector<double> link_last;
+    std::unordered_map<uint256_t, CmdState> cmds;
+    uint64_t ncmds;
+    /** the command the observer (the proposer) decided last */
+    uint256_t last_decided;
+    bool has_last_decided;
+    Result result;
+    Histogram latency;
+
+    friend class SimReplica;
+    void schedule(double time, int target, std::function<void()> fn);
+    bool is_slow(ReplicaID rid) const;
+    void send(ReplicaID from, ReplicaID to, opcode_t opcode,
+            std::shared_ptr<const bytearray_t> payload);
+    void submit_cmd();
+    void on_decide(ReplicaID rid, const uint256_t &cmd_hash);
+    void check_fairness(const uint256_t &prev, const uint256_t &next);
+
+    public:
+    /** Throws HotStuffError if the configuration makes no sense. */
+    Simulator(const SimConfig &config);
+    ~Simulator();
+
+    Simulator(const Simulator &) = delete;
+    Simulator &operator=(const Simulator &) = delete;
+
+    /** Run the whole simulation (only once). */
+    void run();
+
+    const Result &get_result() const { return result; }
+    /** Commit latencies of the measured commands, in virtual microseconds. */
+    const Histogram &get_latency() const { return latency; }
+    /** The result in a human-readable form. */
+    std::string report() const;
+};
+
+}
+
+#endif
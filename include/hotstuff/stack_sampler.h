@@ -0,0 +1,66 @@
+/**
+ * Copyright 2018 VMware
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _HOTSTUFF_STACK_SAMPLER_H
+#define _HOTSTUFF_STACK_SAMPLER_H
+
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+
+namespace hotstuff {
+
+/** On-demand sampling profiler of the threads of the process.
+ *
+ * A session opens a perf_event_open() CPU clock counter on every thread of
+ * the process, collects the user space call chains it samples for a given
+ * time, and writes them as folded stacks (`role;outer;...;inner count`),
+ * ready for flamegraph.pl or speedscope. The sampling and the symbolization
+ * run on a thread of their own. The root frame of each stack is the role of
+ * the thread (e.g., consensus, veripool): threads either declare it
+ * themselves, or get it from the component that started them (see
+ * set_new_threads_role()); the others are named after their comm.
+ *
+ * The call chains are walked by the kernel through the frame pointers, so
+ * the stacks are only complete when compiled with -fno-omit-frame-pointer,
+ * and the symbols of the executable are only found if it exports them
+ * (-rdynamic). Sampling needs kernel.perf_event_paranoid <= 2 (or
+ * CAP_PERFMON). */
+class StackSampler {
+    public:
+    /** Declare the role of the calling thread. */
+    static void set_thread_role(const std::string &role);
+    /** The threads of the process. */
+    static std::vector<pid_t> list_threads();
+    /** Give a role to the threads started since `before` was taken with
+     * list_threads() and that did not declare one. */
+    static void set_new_threads_role(const std::vector<pid_t> &before,
+                                    const std::string &role);
+
+    /** Start a session sampling at `freq` Hz for `duration` seconds, written
+     * to `fname` once done. Returns false if a session is still running;
+     * failures are reported to the log. */
+    static bool start(double duration, unsigned freq, const std::string &fname);
+    static bool is_running();
+    /** Cut the running session short (its stacks are still written) and
+     * wait for it. */
+    static void stop();
+};
+
+}
+
+#endif
@@ -0,0 +1,131 @@
+/**
+ * Copyright 2018 VMware
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _HOTSTUFF_TAIL_INDEX_H
+#define _HOTSTUFF_TAIL_INDEX_H
+
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <vector>
+
+#include "hotstuff/entity.h"
+
+namespace hotstuff {
+
+/** The tails (delivered blocks without delivered children) indexed by
+ * height, highest first.
+ *
+ * The index also keeps the highest tail extending an anchor block (the
+ * hqc block), which is what a proposer builds upon: it is adjusted as tails
+ * come and go, and only searched for again when the anchor moves or the
+ * tail itself is extended through another parent. Only the consensus thread
+ * uses the index. */
+class TailIndex {
+    public:
+    using map_t = std::map<uint32_t, std::vector<block_t>, std::greater<uint32_t>>;
+
+    private:
+    map_t tails;
+    size_t ntails;
+    block_t anchor;
+    /** highest tail extending the anchor, null if it has to be searched */
+    mutable block_t best;
+
+    void search_best() const {
+        const uint32_t height = anchor->get_height();
+        for (const auto &p: tails)
+        {
+            if (p.first < height) break;
+            for (const auto &blk: p.second)
+                if (blk->extends(anchor.get()))
+                {
+                    best = blk;
+                    return;
+                }
+        }
+        /* the anchor is always extended by some tail; this only happens
+         * when its branch was pruned from the index */
+        best = anchor;
+    }
+
+    public:
+    TailIndex(): ntails(0) {}
+
+    void insert(const block_t &blk) {
+        auto &v = tails[blk->get_height()];
+        if (std::find(v.begin(), v.end(), blk) != v.end()) return;
+        v.push_back(blk);
+        ntails++;
+        if (best && blk->get_height() > best->get_height() &&
+            blk->extends(anchor.get()))
+            best = blk;
+    }
+
+    bool erase(const block_t &blk) {
+        auto it = tails.find(blk->get_height());
+        if (it == tails.end()) return false;
+        auto &v = it->second;
+        auto bit = std::find(v.begin(), v.end(), blk);
+        if (bit == v.end()) return false;
+        *bit = std::move(v.back());
+        v.pop_back();
+        if (v.empty()) tails.erase(it);
+        ntails--;
+        if (blk == best) best = nullptr;
+        return true;
+    }
+
+    /** Drop the tails below the given height: they are on abandoned
+     * branches. Returns the number of tails dropped. */
+    size_t prune(uint32_t height) {
+        size_t n = 0;
+        for (auto it = tails.upper_bound(height); it != tails.end();)
+        {
+            for (const auto &blk: it->second)
+                if (blk == best) best = nullptr;
+            n += it->second.size();
+            it = tails.erase(it);
+        }
+        ntails -= n;
+        return n;
+    }
+
+    /** Move the anchor (e.g., upon an hqc update). */
+    void set_anchor(const block_t &blk) {
+        if (blk == anchor) return;
+        anchor = blk;
+        best = nullptr;
+    }
+
+    const block_t &get_anchor() const { return anchor; }
+
+    /** The highest tail extending the anchor (the anchor itself if it is
+     * a tail). */
+    const block_t &get_best() const {
+        if (!best) search_best();
+        return best;
+    }
+
+    /** All tails, grouped by height in decreasing order. */
+    const map_t &by_height() const { return tails; }
+
+    size_t size() const { return ntails; }
+};
+
+}
+
+#endif
@@ -17,12 +17,14 @@
 #ifndef _HOTSTUFF_WORKER_H
 #define _HOTSTUFF_WORKER_H
 
+#include <atomic>
 #include <thread>
 #include <unordered_map>
 #include <unistd.h>
 
 #include "salticidae/event.h"
 #include "hotstuff/util.h"
+#include "hotstuff/stack_sampler.h"
 
 namespace hotstuff {
 
@@ -37,7 +39,8 @@ class VeriTask {
 using salticidae::ThreadCall;
 using veritask_ut = BoxObj<VeriTask>;
 using mpmc_queue_t = salticidae::MPMCQueueEventDriven<VeriTask *>;
-using mpsc_queue_t = salticidae::MPSCQueueEventDriven<VeriTask *>;
+/* the results go back through a bounded ring, drained in bulk */
+using mpsc_queue_t = salticidae::MPSCRingEventDriven<VeriTask *>;
 
 class VeriPool {
     mpmc_queue_t in_queue;
@@ -49,28 +52,32 @@ class VeriPool {
         BoxObj<ThreadCall> tcall;
     };
 
+    const size_t burst_size;
     std::vector<Worker> workers;
+    /* workers whose thread has not returned yet */
+    std::atomic<size_t> nrunning;
     std::unordered_map<VeriTask *, std::pair<veritask_ut, promise_t>> pms;
+    std::vector<VeriTask *> out_buff;
 
-    public:
-    VeriPool(EventContext ec, size_t nworker, size_t burst_size = 128) {
-        out_queue.reg_handler(ec, [this, burst_size](mpsc_queue_t &q) {
-            size_t cnt = burst_size;
-            VeriTask *task;
-            while (q.try_dequeue(task))
-            {
-                auto it = pms.find(task);
-                it->second.second.resolve(task->result);
-                pms.erase(it);
-                if (!--cnt) return true;
-            }
-            return false;
-        });
+    /* take a burst of results out of out_queue, resolving their promises
+     * unless the pool is going away */
+    size_t drain_results(bool resolve) {
+        auto tasks = out_buff.data();
+        size_t n = out_queue.try_dequeue_bulk(tasks, burst_size);
+        for (size_t i = 0; i < n && resolve; i++)
+        {
+            auto it = pms.find(tasks[i]);
+            it->second.second.resolve(tasks[i]->result);
+            pms.erase(it);
+        }
+        return n;
+    }
 
+    void start_workers(size_t nworker) {
         workers.resize(nworker);
         for (size_t i = 0; i < nworker; i++)
         {
-            in_queue.reg_handler(workers[i].ec, [this, burst_size](mpmc_queue_t &q) {
+            in_queue.reg_handler(workers[i].ec, [this](mpmc_queue_t &q) {
                 size_t cnt = burst_size;
                 VeriTask *task;
                 while (q.try_dequeue(task))
@@ -78,28 +85,69 @@ class VeriPool {
                     HOTSTUFF_LOG_DEBUG("%lx working on %u",
                                         std::this_thread::get_id(), (uintptr_t)task);
                     task->result = task->verify();
-                    out_queue.enqueue(task);
+                    /* results are handed back right away; the consensus
+                     * thread is only woken up if it is not already pending */
+                    while (!out_queue.enqueue(task))
+                        std::this_thread::yield();
                     if (!--cnt) return true;
                 }
                 return false;
             });
         }
+        nrunning = workers.size();
         for (auto &w: workers)
         {
             w.tcall = new ThreadCall(w.ec);
-            w.handle = std::thread([ec=w.ec]() { ec.dispatch(); });
+            w.handle = std::thread([this, ec=w.ec]() {
+                StackSampler::set_thread_role("veripool");
+                ec.dispatch();
+                nrunning.fetch_sub(1, std::memory_order_release);
+            });
         }
     }
 
-    ~VeriPool() {
+    void stop_workers(bool resolve) {
         for (auto &w: workers)
             w.tcall->async_call([ec=w.ec](ThreadCall::Handle &) {
                 ec.stop();
             });
+        /* a worker may be waiting for room in out_queue, which only this
+         * thread drains: keep draining it until they are all out */
+        while (nrunning.load(std::memory_order_acquire))
+            if (!drain_results(resolve)) std::this_thread::yield();
         for (auto &w: workers)
             w.handle.join();
+        /* the workers only stop between two bursts, so whatever is left in
+         * in_queue has its notification pending for the next ones */
+        in_queue.unreg_handlers();
+        workers.clear();
     }
 
+    public:
+    VeriPool(EventContext ec, size_t nworker, size_t burst_size = 128):
+            burst_size(burst_size), nrunning(0), out_buff(burst_size) {
+        out_queue.reg_handler(ec, [this](mpsc_queue_t &) {
+            return drain_results(true) == this->burst_size;
+        });
+        start_workers(nworker);
+    }
+
+    ~VeriPool() { stop_workers(false); }
+
+    /** Replace the workers with `nworker` new ones. Must be called from the
+     * thread owning the pool; the tasks being verified are not lost, and
+     * the results coming in meanwhile are resolved before it returns. */
+    void set_nworker(size_t nworker) {
+        if (nworker == 0 || nworker == workers.size()) return;
+        stop_workers(true);
+        start_workers(nworker);
+    }
+
+    size_t get_nworker() const { return workers.size(); }
+
+    /** Number of tasks handed out and not yet resolved. */
+    size_t get_backlog() const { return pms.size(); }
+
     promise_t verify(veritask_ut &&task) {
         auto ptr = task.get();
         auto ret = pms.insert(std::make_pair(ptr,
@@ -0,0 +1,106 @@
+/**
+ * Copyright 2018 VMware
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _HOTSTUFF_TRACER_H
+#define _HOTSTUFF_TRACER_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <chrono>
+#endif
+
+#include "hotstuff/hash.h"
+
+namespace hotstuff {
+
+/** Steps of the life of a command, in their usual order. */
+enum class TraceEvent: uint8_t {
+    CLIENT_IN,          /**< request received from the client */
+    LOCAL_ORDER,        /**< sent in a local order */
+    LEADER_MERGE,       /**< local order merged by the leader */
+    PROPOSED,           /**< part of a block proposed or received */
+    COMMITTED,          /**< finally ordered in a committed block */
+    EXECUTED,           /**< executed against the state */
+    RESPONDED,          /**< response sent to the client */
+    NEVENTS
+};
+
+/** Sampling tracer of the command lifecycle.
+ *
+ * A command is traced if the low word of its hash falls under the sampling
+ * threshold, so every thread (and every replica) picks the same commands
+ * without coordination. Each thread appends (command, event, timestamp)
+ * records to its own ring, overwriting the oldest ones; nothing is shared
+ * on the recording path apart from reading the threshold. The timestamps
+ * come from the TSC where available and are converted when the rings are
+ * exported as a Chrome trace (JSON), readable by chrome://tracing and
+ * Perfetto. */
+class CmdTracer {
+    static std::atomic<uint64_t> threshold;
+
+    static void record_(uint64_t cmd, TraceEvent ev, uint64_t ts);
+
+    public:
+    /** Capacity (in records) of the ring of each thread. */
+    static const size_t ring_size = 1 << 16;
+
+    /** Trace the given fraction of the commands (0 to stop tracing). */
+    static void enable(double sample_rate);
+    static bool is_enabled() {
+        return threshold.load(std::memory_order_relaxed) != 0;
+    }
+
+    static uint64_t now() {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+    }
+
+    static uint64_t cmd_key(const Hash256 &cmd_hash) { return cmd_hash.data[0]; }
+    static uint64_t cmd_key(const uint256_t &cmd_hash) { return cmd_hash.get_words()[0]; }
+
+    template<typename H>
+    static bool is_sampled(const H &cmd_hash) {
+        return cmd_key(cmd_hash) < threshold.load(std::memory_order_relaxed);
+    }
+
+    template<typename H>
+    static void record(const H &cmd_hash, TraceEvent ev) {
+        if (is_sampled(cmd_hash))
+            record_(cmd_key(cmd_hash), ev, now());
+    }
+
+    /** Name the calling thread in the exported trace. */
+    static void set_thread_name(const std::string &name);
+
+    /** Write what the rings currently hold as a Chrome trace. Each traced
+     * command becomes a track of async slices, one per step it went
+     * through, and each record also shows up as an instant event on the
+     * thread that made it. Returns the number of commands written. */
+    static size_t export_chrome_trace(const std::string &fname, uint32_t pid);
+};
+
+}
+
+#endif
@@ -25,6 +25,7 @@
 #include "salticidae/stream.h"
 #include "salticidae/type.h"
 #include "salticidae/util.h"
+#include "hotstuff/hash.h"
 
 namespace hotstuff {
 
@@ -39,6 +40,7 @@ using salticidae::letoh;
 using salticidae::get_hex;
 using salticidae::from_hex;
 using salticidae::bytearray_t;
+using salticidae::BufferPool;
 using salticidae::get_hex10;
 using salticidae::get_hash;
 
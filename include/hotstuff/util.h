@@ -18,8 +18,19 @@
 #define _HOTSTUFF_UTIL_H
 
 #include "hotstuff/config.h"
+#include "hotstuff/async_log.h"
 #include "salticidae/util.h"
 
+#ifdef HOTSTUFF_BLK_PROFILE
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "hotstuff/type.h"
+#endif
+
 namespace hotstuff {
 
 class Logger: public salticidae::Logger {
@@ -54,26 +65,41 @@ extern Logger logger;
 #define HOTSTUFF_ENABLE_LOG_WARN
 #endif
 
+/* Route a log call to the asynchronous logger if it is running, or to the
+ * synchronous one otherwise. The format string gets its id the first time
+ * the call site logs asynchronously. */
+#define HOTSTUFF_LOG_FMT_(fmt, ...) fmt
+#define HOTSTUFF_LOG_(level, sync_call, ...) do { \
+        if (hotstuff::AsyncLogger::is_enabled()) \
+        { \
+            static const uint32_t _hotstuff_fmt_id = \
+                hotstuff::AsyncLogger::register_format( \
+                    hotstuff::AsyncLogger::level, HOTSTUFF_LOG_FMT_(__VA_ARGS__, 0)); \
+            hotstuff::AsyncLogger::log(_hotstuff_fmt_id, __VA_ARGS__); \
+        } \
+        else sync_call(__VA_ARGS__); \
+    } while (0)
+
 #ifdef HOTSTUFF_ENABLE_LOG_INFO
-#define HOTSTUFF_LOG_INFO(...) hotstuff::logger.info(__VA_ARGS__)
+#define HOTSTUFF_LOG_INFO(...) HOTSTUFF_LOG_(INFO, hotstuff::logger.info, __VA_ARGS__)
 #else
 #define HOTSTUFF_LOG_INFO(...) ((void)0)
 #endif
 
 #ifdef HOTSTUFF_ENABLE_LOG_DEBUG
-#define HOTSTUFF_LOG_DEBUG(...) hotstuff::logger.debug(__VA_ARGS__)
+#define HOTSTUFF_LOG_DEBUG(...) HOTSTUFF_LOG_(DEBUG, hotstuff::logger.debug, __VA_ARGS__)
 #else
 #define HOTSTUFF_LOG_DEBUG(...) ((void)0)
 #endif
 
 #ifdef HOTSTUFF_ENABLE_LOG_WARN
-#define HOTSTUFF_LOG_WARN(...) hotstuff::logger.warning(__VA_ARGS__)
+#define HOTSTUFF_LOG_WARN(...) HOTSTUFF_LOG_(WARN, hotstuff::logger.warning, __VA_ARGS__)
 #else
 #define HOTSTUFF_LOG_WARN(...) ((void)0)
 #endif
 
 #ifdef HOTSTUFF_ENABLE_LOG_PROTO
-#define HOTSTUFF_LOG_PROTO(...) hotstuff::logger.proto(__VA_ARGS__)
+#define HOTSTUFF_LOG_PROTO(...) HOTSTUFF_LOG_(PROTO, hotstuff::logger.proto, __VA_ARGS__)
 #else
 #define HOTSTUFF_LOG_PROTO(...) ((void)0)
 #endif
@@ -81,73 +107,88 @@ extern Logger logger;
 #define HOTSTUFF_LOG_ERROR(...) hotstuff::logger.error(__VA_ARGS__)
 
 #ifdef HOTSTUFF_BLK_PROFILE
+/** Per-block phase timestamps, compiled in with HOTSTUFF_BLK_PROFILE.
+ *
+ * Each phase is stamped (with a monotonic clock) the first time it happens
+ * to a block, except for the execution and the responses, which keep the
+ * time of the last command. Once a block has been executed, the time spent
+ * in each phase (since the previous phase the block went through) goes into
+ * a per-phase sample set, summarized by print_stat() as percentiles, and
+ * the raw timestamps are optionally appended to a CSV file. Only the
+ * consensus thread uses the profiler. */
 class BlockProfiler {
-    enum BlockState {
-        BLK_SEEN,
-        BLK_FETCH,
-        BLK_CC
+    public:
+    enum Phase {
+        LOCAL_ORDER_SENT,   /**< (last) local order sent before the block */
+        PROPOSED,           /**< built by this replica */
+        RECEIVED,           /**< proposal received */
+        DELIVERED,
+        VOTED,
+        QC_FORMED,          /**< QC formed or seen in a child */
+        COMMITTED,
+        FINALIZED,          /**< fair_finalize() done */
+        EXECUTED,           /**< commands executed by the application */
+        RESPONDED,          /**< responses queued to the clients */
+        NPHASES
     };
 
+    static const char *phase_name(Phase phase);
+
+    private:
     struct BlockProfile {
-        bool is_local;          /* is the block proposed by the replica itself? */
-        BlockState state;
-        double hash_seen_time;  /* the first time to see block hash */
-        double full_fetch_time; /* the first time to get full block content */
-        double cc_time;         /* the time when it receives cc */
-        double commit_time;     /* the time when it commits */
+        uint32_t height;
+        double t[NPHASES];
     };
 
-    std::unordered_map<const uint256, BlockProfile> blocks;
-    ElapsedTime timer;
+    std::unordered_map<uint256_t, BlockProfile> blocks;
+    std::vector<double> samples[NPHASES];
+    std::vector<double> total_samples;
+    std::chrono::steady_clock::time_point t0;
+    double last_local_order_sent;
+    /** unfinished blocks are forgotten after this long */
+    double stale_sec;
+    FILE *csv;
+
+    double now() const {
+        return std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - t0).count();
+    }
+
+    BlockProfile &get(const uint256_t &blk_hash);
 
     public:
-    BlockProfiler() { timer.start(); }
-
-    auto rec_blk(const uint256 &blk_hash, bool is_local) {
-        auto it = blocks.find(blk_hash);
-        assert(it == blocks.end());
-        timer.stop(false);
-        return blocks.insert(std::make_pair(blk_hash,
-            BlockProfile{is_local, BLK_SEEN, timer.elapsed_sec, 0, 0, 0})).first;
-    }
+    BlockProfiler(double stale_sec = 60);
+    ~BlockProfiler();
 
-    void get_blk(const uint256 &blk_hash) {
-        auto it = blocks.find(blk_hash);
-        if (it == blocks.end())
-            it = rec_blk(blk_hash, false);
-        BlockProfile &blkp = it->second;
-        assert(blkp.state == BLK_SEEN);
-        timer.stop(false);
-        blkp.full_fetch_time = timer.elapsed_sec;
-        blkp.state = BLK_FETCH;
-    }
+    BlockProfiler(const BlockProfiler &) = delete;
+    BlockProfiler &operator=(const BlockProfiler &) = delete;
+
+    /** Also write one line per executed block to the given file. */
+    void open_csv(const std::string &fname);
 
-    void have_cc(const uint256 &blk_hash) {
-        auto it = blocks.find(blk_hash);
-        assert(it != blocks.end());
-        BlockProfile &blkp = it->second;
-        assert(blkp.state == BLK_FETCH);
-        timer.stop(false);
-        blkp.polling_start_time = timer.elapsed_sec;
-        blkp.state = BLK_CC;
+    /** This replica sent its local order to the proposer. */
+    void local_order_sent() { last_local_order_sent = now(); }
+
+    /** Stamp a phase that tells more about the block: its height (if not
+     * zero) and, for PROPOSED/RECEIVED, whether it carries a local order of
+     * this replica, which is then assumed to be the last one sent. */
+    void seen(const uint256_t &blk_hash, uint32_t height,
+                Phase phase, bool has_own_order);
+
+    void rec(const uint256_t &blk_hash, Phase phase) {
+        auto &t = get(blk_hash).t[phase];
+        if (t < 0) t = now();
     }
 
-    const char *decide_blk(const uint256 &blk_hash) {
-        static char buff[1024];
-        auto it = blocks.find(blk_hash);
-        assert(it != blocks.end());
-        BlockProfile &blkp = it->second;
-        assert(blkp.state == BLK_CC);
-        timer.stop(false);
-        blkp.commit_time = timer.elapsed_sec;
-        snprintf(buff, sizeof buff, "(%d,%.4f,%.4f,%.4f,%.4f,%.4f)",
-                blkp.is_local,
-                blkp.hash_seen_time, blkp.full_fetch_time,
-                blkp.polling_start_time, blkp.polling_end_time,
-                blkp.commit_time);
-        blocks.erase(it);
-        return buff;
+    void rec_last(const uint256_t &blk_hash, Phase phase) {
+        get(blk_hash).t[phase] = now();
     }
+
+    /** The block is done with: account for it and forget it. */
+    void finish(const uint256_t &blk_hash);
+
+    /** Log the percentiles of the samples gathered since the last call. */
+    void print_stat();
 };
 
 #endif
@@ -641,9 +641,85 @@ class MPSCQueueEventDriven: public MPSCQueue<T> {
         return true;
     }
 
+    /** Enqueue n elements moved from the range starting at first, waking up
+     * the consumer once for the whole batch; returns the number taken (less
+     * than n only if bounded and out of space). */
+    template<typename It>
+    size_t enqueue_bulk(It first, size_t n, bool unbounded = true) {
+        size_t i = 0;
+        for (; i < n; i++, ++first)
+            if (!MPSCQueue<T>::enqueue(std::move(*first), unbounded)) break;
+        if (i && wait_sig.exchange(false, std::memory_order_acq_rel))
+            nfd.notify();
+        return i;
+    }
+
     template<typename U> bool try_enqueue(U &&e) = delete;
 };
 
+/** Event-driven front end of a bounded ring (SPSCRing or MPSCRing).
+ *
+ * The handler is invoked on the consumer's event loop like with
+ * MPSCQueueEventDriven, and should drain the ring with try_dequeue_bulk().
+ * A producer only signals the consumer when it is not already pending, so
+ * a bulk enqueue wakes it up at most once. Being bounded, enqueue() fails
+ * when the ring is full and it is up to the producer to retry (or drop). */
+template<typename Ring>
+class RingEventDriven: public Ring {
+    private:
+    std::atomic<bool> wait_sig;
+    NotifyFd nfd;
+    FdEvent ev;
+
+    void notify() {
+        if (wait_sig.exchange(false, std::memory_order_acq_rel))
+            nfd.notify();
+    }
+
+    public:
+    RingEventDriven(size_t capacity = 65536):
+            Ring(capacity), wait_sig(true) {}
+    ~RingEventDriven() { unreg_handler(); }
+
+    template<typename Func>
+    void reg_handler(const EventContext &ec, Func &&func) {
+        ev = FdEvent(ec, nfd.read_fd(),
+                    [this, func=std::forward<Func>(func)](int, int) {
+                    nfd.reset();
+                    /* see MPSCQueueEventDriven::reg_handler */
+                    wait_sig.exchange(true, std::memory_order_acq_rel);
+                    if (func(*this))
+                        nfd.notify();
+                });
+        ev.add(FdEvent::READ);
+    }
+
+    void unreg_handler() { ev.clear(); }
+
+    template<typename U>
+    bool enqueue(U &&e) {
+        if (!Ring::try_enqueue(std::forward<U>(e)))
+            return false;
+        notify();
+        return true;
+    }
+
+    /** Enqueue up to n elements (as many as there is room for) and wake up
+     * the consumer once; returns the number taken. */
+    template<typename It>
+    size_t enqueue_bulk(It first, size_t n) {
+        size_t k = Ring::try_enqueue_bulk(first, n);
+        if (k) notify();
+        return k;
+    }
+
+    template<typename U> bool try_enqueue(U &&e) = delete;
+    template<typename It> size_t try_enqueue_bulk(It first, size_t n) = delete;
+};
+
+template<typename T> using SPSCRingEventDriven = RingEventDriven<SPSCRing<T>>;
+template<typename T> using MPSCRingEventDriven = RingEventDriven<MPSCRing<T>>;
+
 // NOTE: the MPMC implementation below hasn't been heavily tested.
 template<typename T>
 class MPMCQueueEventDriven: public MPMCQueue<T> {
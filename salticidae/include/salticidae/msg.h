@@ -67,6 +67,16 @@ class MsgBase {
         set_checksum();
     }
 
+    /** Take over the serialized payload of a temporary message without
+     * copying it. */
+    template<typename MsgType, typename = typename std::enable_if<
+                !std::is_lvalue_reference<MsgType>::value>::type>
+    MsgBase(MsgType &&msg, uint32_t magic): magic(magic) {
+        set_opcode(MsgType::opcode);
+        set_payload(std::move(msg.serialized));
+        set_checksum();
+    }
+
 #ifdef SALTICIDAE_CBINDINGS
     MsgBase(const OpcodeType &opcode, bytearray_t &&payload): magic(0x0) {
         set_opcode(opcode);
@@ -146,7 +156,7 @@ class MsgBase {
         return *this;
     }
 
-    ~MsgBase() {}
+    ~MsgBase() { BufferPool::release(std::move(payload)); }
 
     size_t get_length() const { return length; }
 
@@ -227,7 +237,7 @@ class MsgBase {
 #endif
 
     bytearray_t serialize() const {
-        DataStream s;
+        DataStream s(BufferPool::acquire(header_size + payload.size()));
         s << htole(magic)
           << opcode
           << htole(length)
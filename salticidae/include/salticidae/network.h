@@ -126,7 +126,9 @@ class MsgNetwork: public ConnPool {
     std::unordered_map<
         typename Msg::opcode_t,
         std::function<void(const Msg &msg, const conn_t &)>> handler_map;
-    using queue_t = MPSCQueueEventDriven<std::pair<Msg, conn_t>>;
+    /* bounded: a worker whose message does not fit stops reading the
+     * connection and retries (see on_worker_setup) */
+    using queue_t = MPSCRingEventDriven<std::pair<Msg, conn_t>>;
     queue_t incoming_msgs;
 
     protected:
@@ -138,7 +140,7 @@ class MsgNetwork: public ConnPool {
         auto conn = static_pointer_cast<Conn>(_conn);
         conn->ev_enqueue_poll = TimerEvent(conn->worker->get_ec(),
             [this, conn](TimerEvent &) {
-                if (!incoming_msgs.enqueue(std::make_pair(conn->msg, conn), false))
+                if (!incoming_msgs.enqueue(std::make_pair(conn->msg, conn)))
                 {
                     conn->msg_sleep = true;
                     conn->ev_enqueue_poll.add(0);
@@ -256,7 +258,7 @@ class MsgNetwork: public ConnPool {
     }
 
     template<typename MsgType>
-    inline bool send_msg(const MsgType &msg, const conn_t &conn);
+    inline bool send_msg(MsgType &&msg, const conn_t &conn);
     inline bool _send_msg(const Msg &msg, const conn_t &conn);
     template<typename MsgType>
     inline int32_t send_msg_deferred(MsgType &&msg, const conn_t &conn);
@@ -303,7 +305,7 @@ class ClientNetwork: public MsgNetwork<OpcodeType> {
 
     using MsgNet::send_msg;
     template<typename MsgType>
-    inline bool send_msg(const MsgType &msg, const NetAddr &addr);
+    inline bool send_msg(MsgType &&msg, const NetAddr &addr);
     inline bool _send_msg(const Msg &msg, const NetAddr &addr);
     template<typename MsgType>
     inline int32_t send_msg_deferred(MsgType &&msg, const NetAddr &addr);
@@ -627,7 +629,7 @@ class PeerNetwork: public MsgNetwork<OpcodeType> {
     conn_t get_peer_conn(const PeerId &addr) const;
     using MsgNet::send_msg;
     template<typename MsgType>
-    inline bool send_msg(const MsgType &msg, const PeerId &peer);
+    inline bool send_msg(MsgType &&msg, const PeerId &peer);
     inline bool _send_msg(const Msg &msg, const PeerId &peer);
     template<typename MsgType>
     inline int32_t send_msg_deferred(MsgType &&msg, const PeerId &peer);
@@ -683,7 +685,7 @@ void MsgNetwork<OpcodeType>::on_read(const ConnPool::conn_t &_conn) {
                 break;
             }
 #endif
-            if (!incoming_msgs.enqueue(std::make_pair(msg, conn), false))
+            if (!incoming_msgs.enqueue(std::make_pair(msg, conn)))
             {
                 conn->msg_sleep = true;
                 conn->ev_enqueue_poll.add(0);
@@ -722,8 +724,8 @@ inline int32_t MsgNetwork<OpcodeType>::_send_msg_deferred(Msg &&msg, const conn_
 
 template<typename OpcodeType>
 template<typename MsgType>
-inline bool MsgNetwork<OpcodeType>::send_msg(const MsgType &msg, const conn_t &conn) {
-    return _send_msg(Msg(msg, msg_magic), conn);
+inline bool MsgNetwork<OpcodeType>::send_msg(MsgType &&msg, const conn_t &conn) {
+    return _send_msg(Msg(std::forward<MsgType>(msg), msg_magic), conn);
 }
 
 template<typename OpcodeType>
@@ -1329,8 +1331,8 @@ inline int32_t PeerNetwork<O, _, __>::_send_msg_deferred(Msg &&msg, const PeerId
 
 template<typename O, O _, O __>
 template<typename MsgType>
-inline bool PeerNetwork<O, _, __>::send_msg(const MsgType &msg, const PeerId &pid) {
-    return _send_msg(Msg(msg, this->msg_magic), pid);
+inline bool PeerNetwork<O, _, __>::send_msg(MsgType &&msg, const PeerId &pid) {
+    return _send_msg(Msg(std::forward<MsgType>(msg), this->msg_magic), pid);
 }
 
 template<typename O, O _, O __>
@@ -1401,8 +1403,8 @@ inline int32_t ClientNetwork<OpcodeType>::_send_msg_deferred(Msg &&msg, const Ne
 
 template<typename OpcodeType>
 template<typename MsgType>
-inline bool ClientNetwork<OpcodeType>::send_msg(const MsgType &msg, const NetAddr &addr) {
-    return _send_msg(Msg(msg, this->msg_magic), addr);
+inline bool ClientNetwork<OpcodeType>::send_msg(MsgType &&msg, const NetAddr &addr) {
+    return _send_msg(Msg(std::forward<MsgType>(msg), this->msg_magic), addr);
 }
 
 template<typename OpcodeType>
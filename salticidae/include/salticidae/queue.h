@@ -5,6 +5,7 @@
 #include <vector>
 #include <cassert>
 #include <thread>
+#include <type_traits>
 
 namespace salticidae {
 
@@ -289,6 +290,275 @@ struct MPSCQueue: public MPMCQueue<T> {
     }
 };
 
+/* round up to a power of two (at least 2) */
+inline size_t ring_capacity(size_t capacity) {
+    size_t c = 2;
+    while (c < capacity) c <<= 1;
+    return c;
+}
+
+/** Bounded single-producer single-consumer ring buffer.
+ *
+ * The capacity is rounded up to a power of two. Each side owns its index,
+ * kept on its own cache line next to a cached copy of the other side's
+ * index, so the shared indices are only read when the cached view says the
+ * ring is full (producer) or empty (consumer). The bulk operations move a
+ * whole run of elements with a single index update. */
+template<typename T>
+class SPSCRing {
+    using storage_t = typename std::aligned_storage<sizeof(T), alignof(T)>::type;
+    size_t mask;
+    storage_t *buff;
+    cacheline_pad _pad0;
+    /* producer side */
+    std::atomic<size_t> tail;
+    size_t head_cache;
+    cacheline_pad _pad1;
+    /* consumer side */
+    std::atomic<size_t> head;
+    size_t tail_cache;
+    cacheline_pad _pad2;
+
+    T *elem(size_t pos) { return reinterpret_cast<T *>(&buff[pos & mask]); }
+
+    public:
+    SPSCRing(size_t capacity = 65536):
+            mask(ring_capacity(capacity) - 1),
+            buff(new storage_t[mask + 1]),
+            tail(0), head_cache(0), head(0), tail_cache(0) {}
+
+    SPSCRing(const SPSCRing &) = delete;
+    SPSCRing(SPSCRing &&) = delete;
+
+    ~SPSCRing() {
+        for (auto h = head.load(), t = tail.load(); h != t; h++)
+            elem(h)->~T();
+        delete [] buff;
+    }
+
+    /** Reallocate the ring; only valid while it is empty and not in use. */
+    void set_capacity(size_t capacity) {
+        assert(head.load() == tail.load());
+        delete [] buff;
+        mask = ring_capacity(capacity) - 1;
+        buff = new storage_t[mask + 1];
+    }
+
+    size_t capacity() const { return mask + 1; }
+
+    size_t size_approx() const {
+        return tail.load(std::memory_order_relaxed) - head.load(std::memory_order_relaxed);
+    }
+
+    template<typename U>
+    bool try_enqueue(U &&e) {
+        auto t = tail.load(std::memory_order_relaxed);
+        if (t - head_cache > mask)
+        {
+            head_cache = head.load(std::memory_order_acquire);
+            if (t - head_cache > mask) return false;
+        }
+        new (elem(t)) T(std::forward<U>(e));
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    /** Move up to n elements from the range starting at first into the
+     * ring; returns the number taken. */
+    template<typename It>
+    size_t try_enqueue_bulk(It first, size_t n) {
+        auto t = tail.load(std::memory_order_relaxed);
+        size_t room = mask + 1 - (t - head_cache);
+        if (room < n)
+        {
+            head_cache = head.load(std::memory_order_acquire);
+            room = mask + 1 - (t - head_cache);
+            if (room < n) n = room;
+        }
+        for (size_t i = 0; i < n; i++, ++first)
+            new (elem(t + i)) T(std::move(*first));
+        if (n) tail.store(t + n, std::memory_order_release);
+        return n;
+    }
+
+    bool try_dequeue(T &e) {
+        auto h = head.load(std::memory_order_relaxed);
+        if (h == tail_cache)
+        {
+            tail_cache = tail.load(std::memory_order_acquire);
+            if (h == tail_cache) return false;
+        }
+        T *p = elem(h);
+        e = std::move(*p);
+        p->~T();
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    /** Move up to max elements out to the output iterator; returns the number
+     * dequeued. */
+    template<typename OutIt>
+    size_t try_dequeue_bulk(OutIt out, size_t max) {
+        auto h = head.load(std::memory_order_relaxed);
+        if (tail_cache - h < max)
+        {
+            tail_cache = tail.load(std::memory_order_acquire);
+            if (tail_cache - h < max) max = tail_cache - h;
+        }
+        for (size_t i = 0; i < max; i++, ++out)
+        {
+            T *p = elem(h + i);
+            *out = std::move(*p);
+            p->~T();
+        }
+        if (max) head.store(h + max, std::memory_order_release);
+        return max;
+    }
+};
+
+/** Bounded multi-producer single-consumer ring buffer.
+ *
+ * Producers claim a run of positions with one CAS on the tail and publish
+ * each slot through its sequence number, so a bulk enqueue costs a single
+ * atomic read-modify-write however many elements it carries. The consumer
+ * is the only writer of the head, which it publishes once per (bulk)
+ * dequeue; producers read it to make sure the slots they claim are free. */
+template<typename T>
+class MPSCRing {
+    using storage_t = typename std::aligned_storage<sizeof(T), alignof(T)>::type;
+    struct Cell {
+        std::atomic<size_t> seq;    /**< position + 1 once the element is in */
+        storage_t data;
+    };
+
+    size_t mask;
+    Cell *cells;
+    cacheline_pad _pad0;
+    std::atomic<size_t> tail;
+    cacheline_pad _pad1;
+    std::atomic<size_t> head;
+    cacheline_pad _pad2;
+
+    void init_cells() {
+        for (size_t i = 0; i <= mask; i++)
+            cells[i].seq.store(0, std::memory_order_relaxed);
+    }
+
+    /* claim up to n free positions, returns the first one and updates n */
+    size_t claim(size_t &n) {
+        for (;;)
+        {
+            /* the tail first: a head read later can only be newer, so
+             * t - h does not overstate the room, unless the tail moved on
+             * meanwhile (and then the CAS fails) */
+            auto t = tail.load(std::memory_order_relaxed);
+            auto h = head.load(std::memory_order_acquire);
+            if (t - h > mask + 1) continue;
+            size_t room = mask + 1 - (t - h);
+            size_t k = n < room ? n : room;
+            if (!k)
+            {
+                n = 0;
+                return t;
+            }
+            if (tail.compare_exchange_weak(t, t + k, std::memory_order_relaxed))
+            {
+                n = k;
+                return t;
+            }
+        }
+    }
+
+    template<typename U>
+    void put(size_t pos, U &&e) {
+        Cell &c = cells[pos & mask];
+        new (&c.data) T(std::forward<U>(e));
+        c.seq.store(pos + 1, std::memory_order_release);
+    }
+
+    public:
+    MPSCRing(size_t capacity = 65536):
+            mask(ring_capacity(capacity) - 1),
+            cells(new Cell[mask + 1]),
+            tail(0), head(0) { init_cells(); }
+
+    MPSCRing(const MPSCRing &) = delete;
+    MPSCRing(MPSCRing &&) = delete;
+
+    ~MPSCRing() {
+        for (auto h = head.load(), t = tail.load(); h != t; h++)
+            reinterpret_cast<T *>(&cells[h & mask].data)->~T();
+        delete [] cells;
+    }
+
+    /** Reallocate the ring; only valid while it is empty and not in use. */
+    void set_capacity(size_t capacity) {
+        assert(head.load() == tail.load());
+        delete [] cells;
+        mask = ring_capacity(capacity) - 1;
+        cells = new Cell[mask + 1];
+        init_cells();
+        head.store(0);
+        tail.store(0);
+    }
+
+    size_t capacity() const { return mask + 1; }
+
+    size_t size_approx() const {
+        return tail.load(std::memory_order_relaxed) - head.load(std::memory_order_relaxed);
+    }
+
+    template<typename U>
+    bool try_enqueue(U &&e) {
+        size_t n = 1;
+        auto pos = claim(n);
+        if (!n) return false;
+        put(pos, std::forward<U>(e));
+        return true;
+    }
+
+    /** Move up to n elements from the range starting at first into the
+     * ring; returns the number taken. */
+    template<typename It>
+    size_t try_enqueue_bulk(It first, size_t n) {
+        auto pos = claim(n);
+        for (size_t i = 0; i < n; i++, ++first)
+            put(pos + i, std::move(*first));
+        return n;
+    }
+
+    /* the following functions are called by the same (consumer) thread */
+
+    bool try_dequeue(T &e) {
+        auto h = head.load(std::memory_order_relaxed);
+        Cell &c = cells[h & mask];
+        if (c.seq.load(std::memory_order_acquire) != h + 1) return false;
+        T *p = reinterpret_cast<T *>(&c.data);
+        e = std::move(*p);
+        p->~T();
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    /** Move up to max elements out to the output iterator, stopping at the
+     * first slot a producer is still filling; returns the number dequeued. */
+    template<typename OutIt>
+    size_t try_dequeue_bulk(OutIt out, size_t max) {
+        auto h = head.load(std::memory_order_relaxed);
+        size_t i = 0;
+        for (; i < max; i++, ++out)
+        {
+            Cell &c = cells[(h + i) & mask];
+            if (c.seq.load(std::memory_order_acquire) != h + i + 1) break;
+            T *p = reinterpret_cast<T *>(&c.data);
+            *out = std::move(*p);
+            p->~T();
+        }
+        if (i) head.store(h + i, std::memory_order_release);
+        return i;
+    }
+};
+
 }
 
 #endif
@@ -71,7 +71,7 @@ class _BoxObj {
     constexpr _BoxObj(): obj(nullptr) {}
     constexpr _BoxObj(T *obj): obj(obj) {}
     _BoxObj(const _BoxObj &other) = delete;
-    _BoxObj(_BoxObj &&other): obj(other.obj) {
+    _BoxObj(_BoxObj &&other) noexcept: obj(other.obj) {
         other.obj = nullptr;
     }
 
@@ -301,12 +301,12 @@ class _RcObjBase {
         box_ref.obj = nullptr;
     }
 
-    _RcObjBase(const _RcObjBase &other):
+    _RcObjBase(const _RcObjBase &other) noexcept:
             obj(other.obj), ctl(other.ctl) {
         if (ctl) ctl->add_ref();
     }
 
-    _RcObjBase(_RcObjBase &&other):
+    _RcObjBase(_RcObjBase &&other) noexcept:
             obj(other.obj), ctl(other.ctl) {
         other.ctl = nullptr;
     }
@@ -318,7 +318,7 @@ class _RcObjBase {
     }
 
     template<typename T_, typename D_>
-    _RcObjBase(_RcObjBase<T_, R, D_> &&other):
+    _RcObjBase(_RcObjBase<T_, R, D_> &&other) noexcept:
             obj(other.obj), ctl(other.ctl) {
         other.ctl = nullptr;
     }
@@ -35,6 +35,88 @@ namespace salticidae {
 template<size_t N, typename T> class Blob;
 using uint256_t = Blob<256, uint64_t>;
 
+/** Recycles byte arrays so that building and sending messages does not touch
+ * the heap once the pool is warm.
+ *
+ * Each thread keeps a small cache of spare buffers. Messages are usually
+ * built on one thread and written out (and thus freed) by a connection
+ * worker, so the caches exchange whole batches with a shared depot: a thread
+ * that only releases spills its surplus there, and a thread that only
+ * acquires refills from it, taking the lock once per batch. */
+class BufferPool {
+    public:
+    /** Buffers with a larger capacity are freed instead of being kept. */
+    static const size_t max_buffer_size = 1 << 20;
+    static const size_t cache_size = 64;
+    static const size_t batch_size = 32;
+    static const size_t depot_size = 4096;
+
+    private:
+    struct Depot {
+        std::mutex lock;
+        std::vector<bytearray_t> buffers;
+        Depot() { buffers.reserve(depot_size); }
+    };
+
+    static Depot &get_depot() {
+        static Depot depot;
+        return depot;
+    }
+
+    static std::vector<bytearray_t> &get_cache() {
+        static thread_local std::vector<bytearray_t> cache;
+        if (!cache.capacity()) cache.reserve(cache_size);
+        return cache;
+    }
+
+    public:
+    /** Get an empty buffer that can hold at least `capacity` bytes. */
+    static bytearray_t acquire(size_t capacity) {
+        auto &cache = get_cache();
+        if (cache.empty())
+        {
+            auto &depot = get_depot();
+            std::lock_guard<std::mutex> _(depot.lock);
+            size_t n = depot.buffers.size();
+            if (n > batch_size) n = batch_size;
+            for (size_t i = 0; i < n; i++)
+            {
+                cache.push_back(std::move(depot.buffers.back()));
+                depot.buffers.pop_back();
+            }
+        }
+        bytearray_t buff;
+        if (!cache.empty())
+        {
+            buff = std::move(cache.back());
+            cache.pop_back();
+            buff.clear();
+        }
+        buff.reserve(capacity);
+        return buff;
+    }
+
+    /** Give a buffer back to the pool (its content is discarded). */
+    static void release(bytearray_t &&buff) {
+        if (!buff.capacity() || buff.capacity() > max_buffer_size) return;
+        auto &cache = get_cache();
+        if (cache.size() == cache_size)
+        {
+            auto &depot = get_depot();
+            std::lock_guard<std::mutex> _(depot.lock);
+            size_t n = depot_size - depot.buffers.size();
+            if (n > batch_size) n = batch_size;
+            for (size_t i = 0; i < n; i++)
+            {
+                depot.buffers.push_back(std::move(cache.back()));
+                cache.pop_back();
+            }
+            if (cache.size() == cache_size) return;
+        }
+        cache.push_back(std::move(buff));
+    }
+};
+
 class DataStream {
     bytearray_t buffer;
     size_t offset;
@@ -90,6 +172,12 @@ class DataStream {
         return buffer.size() - offset;
     }
 
+    /** Make room for len more bytes so that the following writes do not
+     * reallocate. */
+    void reserve(size_t len) {
+        buffer.reserve(buffer.size() + len);
+    }
+
     template<typename T>
     typename std::enable_if<std::is_integral<T>::value, DataStream &>::type
     operator<<(T d) {
@@ -188,7 +276,7 @@ class DataStream {
     }
 
     operator bytearray_t () && {
-        return buffer;
+        return std::move(buffer);
     }
 
     operator std::string () const & {
@@ -240,6 +328,8 @@ class Blob: public Serializable {
     bool loaded;
 
     public:
+    /** Number of bytes written by serialize(). */
+    static constexpr size_t serialized_size = N / 8;
 
     Blob(): loaded(false) { memset(data, 0, sizeof(data)); }
     Blob(const bytearray_t &arr) {
@@ -264,6 +354,15 @@ class Blob: public Serializable {
 
     bool is_null() const { return !loaded; }
 
+    /** Raw access to the words (host byte order) for POD mirrors of the
+     * blob that want to avoid the byte-wise load(). */
+    const _impl_type *get_words() const { return data; }
+
+    void load_words(const _impl_type *words) {
+        memcpy(data, words, sizeof(data));
+        loaded = true;
+    }
+
     bool operator==(const Blob<N> &other) const {
         for (size_t i = 0; i < _len; i++)
             if (data[i] != other.data[i])
@@ -363,6 +462,10 @@ class _Bits {
 
     size_t cheap_hash() const { return *data; }
 
+    size_t get_serialized_size() const {
+        return sizeof(nbits) + (data ? ndata * sizeof(_impl_type) : 0);
+    }
+
     void serialize(DataStream &s) const {
         s << htole(nbits);
         if (data)
@@ -425,6 +528,18 @@ class _Bits {
    
     uint8_t operator[](uint32_t idx) const { return get(idx); }
 
+    /** Number of set bits before position idx (idx <= size()). */
+    uint32_t rank(uint32_t idx) const {
+        uint32_t n = 0;
+        auto i = idx >> shift_per_datum;
+        for (uint32_t j = 0; j < i; j++)
+            n += __builtin_popcountll(data[j]);
+        auto pos = idx & (bit_per_datum - 1);
+        if (pos)
+            n += __builtin_popcountll(data[i] & ((((_impl_type)1) << pos) - 1));
+        return n;
+    }
+
     uint32_t size() const { return nbits; }
 };
 
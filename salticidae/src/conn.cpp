@@ -89,13 +89,18 @@ void ConnPool::Conn::_send_data(const conn_t &conn, int fd, int events) {
                 }
             }
             else
+            {
                 /* rewind the leftover */
                 conn->send_buffer.rewind(
                     bytearray_t(buff_seg.begin() + ret, buff_seg.end()));
+                BufferPool::release(std::move(buff_seg));
+            }
             /* wait for the next write callback */
             conn->ready_send = false;
             return;
         }
+        /* the whole segment is out, recycle its storage */
+        BufferPool::release(std::move(buff_seg));
     }
     /* the send_buffer is empty though the kernel buffer is still available, so
      * temporarily mask the WRITE event and mark the `ready_send` flag */
@@ -179,13 +184,18 @@ void ConnPool::Conn::_send_data_tls(const conn_t &conn, int fd, int events) {
                 }
             }
             else
+            {
                 /* rewind the leftover */
                 conn->send_buffer.rewind(
                     bytearray_t(buff_seg.begin() + ret, buff_seg.end()));
+                BufferPool::release(std::move(buff_seg));
+            }
             /* wait for the next write callback */
             conn->ready_send = false;
             return;
         }
+        /* the whole segment is out, recycle its storage */
+        BufferPool::release(std::move(buff_seg));
     }
     conn->ev_socket.del();
     conn->ev_socket.add(conn->ready_recv ? 0 : FdEvent::READ);
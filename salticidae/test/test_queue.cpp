@@ -1,12 +1,15 @@
 #include <cstdio>
 #include <thread>
 #include <atomic>
+#include <vector>
+#include <unistd.h>
 
 #include "salticidae/event.h"
 #include "salticidae/util.h"
 
 using salticidae::TimerEvent;
 using salticidae::Config;
+using salticidae::ElapsedTime;
 
 void masksigs() {
 	sigset_t mask;
@@ -127,6 +130,157 @@ void test_mpmc(int nproducers, int nconsumers, int nops, size_t burst_size) {
     SALTICIDAE_LOG_INFO("consumers terminate");
 }
 
+/* give both kinds of queues the same bulk interface */
+template<typename T>
+size_t enqueue_some(salticidae::MPSCQueueEventDriven<T> &q, T *items, size_t n) {
+    return q.enqueue_bulk(items, n, false);
+}
+
+template<typename T>
+size_t dequeue_some(salticidae::MPSCQueueEventDriven<T> &q, T *out, size_t max) {
+    size_t n = 0;
+    while (n < max && q.try_dequeue(out[n])) n++;
+    return n;
+}
+
+template<typename Ring, typename T>
+size_t enqueue_some(salticidae::RingEventDriven<Ring> &q, T *items, size_t n) {
+    return q.enqueue_bulk(items, n);
+}
+
+template<typename Ring, typename T>
+size_t dequeue_some(salticidae::RingEventDriven<Ring> &q, T *out, size_t max) {
+    return q.try_dequeue_bulk(out, max);
+}
+
+/* producers push runs of `bulk` elements, the consumer drains up to
+ * `burst_size` per wake-up and checks the per-producer FIFO order */
+template<typename queue_t>
+void bench_queue(const char *name, queue_t &q, int nproducers, int nops,
+                size_t bulk, size_t burst_size) {
+    size_t total = (size_t)nproducers * nops;
+    salticidae::EventContext ec;
+    size_t collected = 0;
+    size_t nwakeups = 0;
+    size_t nerrors = 0;
+    std::vector<int> last(nproducers, -1);
+    std::vector<int> buff(burst_size);
+    q.reg_handler(ec, [&](queue_t &q) {
+        nwakeups++;
+        size_t n = dequeue_some(q, buff.data(), burst_size);
+        for (size_t i = 0; i < n; i++)
+        {
+            int x = buff[i];
+            if (x / nproducers != last[x % nproducers] + 1) nerrors++;
+            last[x % nproducers] = x / nproducers;
+        }
+        if ((collected += n) == total) ec.stop();
+        return n == burst_size;
+    });
+    std::vector<std::thread> producers;
+    ElapsedTime et;
+    et.start();
+    std::thread consumer([&ec]() {
+        masksigs();
+        ec.dispatch();
+    });
+    for (int i = 0; i < nproducers; i++)
+    {
+        producers.emplace(producers.end(), std::thread([&q, nops, bulk, i, nproducers]() {
+            masksigs();
+            std::vector<int> items(bulk);
+            for (int j = 0; j < nops;)
+            {
+                size_t n = std::min(bulk, (size_t)(nops - j));
+                for (size_t k = 0; k < n; k++)
+                    items[k] = i + (j + k) * nproducers;
+                for (size_t k = 0; k < n;)
+                {
+                    size_t m = enqueue_some(q, items.data() + k, n - k);
+                    if (!m) std::this_thread::yield();
+                    k += m;
+                }
+                j += n;
+            }
+        }));
+    }
+    for (auto &t: producers) t.join();
+    consumer.join();
+    et.stop();
+    q.unreg_handler();
+    printf("%-22s %2d producers, bulk %4lu: %8.2f Mops/s, %8lu wake-ups, %lu errors\n",
+            name, nproducers, bulk, total / et.elapsed_sec / 1e6, nwakeups, nerrors);
+}
+
+/* producers keep a tiny MPSCRing full (with bulk and single enqueues) while
+ * the consumer takes elements out at an uneven pace: each element must come
+ * out exactly once, in the order of its producer */
+void stress_mpsc_ring(int nproducers, int nops, size_t capacity) {
+    salticidae::MPSCRing<int> q(capacity);
+    std::atomic<bool> failed(false);
+    std::vector<std::thread> producers;
+    for (int i = 0; i < nproducers; i++)
+    {
+        producers.emplace(producers.end(), std::thread([&q, nops, i, nproducers]() {
+            int items[4];
+            for (int j = 0; j < nops;)
+            {
+                size_t n = std::min(1 + (size_t)(j % 4), (size_t)(nops - j));
+                for (size_t k = 0; k < n; k++)
+                    items[k] = i + (j + k) * nproducers;
+                for (size_t k = 0; k < n;)
+                {
+                    size_t m = n - k == 1 ? (size_t)q.try_enqueue(items[k]) :
+                                            q.try_enqueue_bulk(items + k, n - k);
+                    if (!m) std::this_thread::yield();
+                    k += m;
+                }
+                j += n;
+            }
+        }));
+    }
+    size_t total = (size_t)nproducers * nops;
+    std::vector<int> last(nproducers, -1);
+    int buff[8];
+    for (size_t collected = 0, round = 0; collected < total; round++)
+    {
+        size_t n = round & 1 ? (size_t)q.try_dequeue(buff[0]) :
+                                q.try_dequeue_bulk(buff, 1 + round % 8);
+        if (!n && round % 16 == 0) std::this_thread::yield();
+        for (size_t i = 0; i < n; i++)
+        {
+            int x = buff[i];
+            if (x < 0 || x / nproducers != last[x % nproducers] + 1)
+                failed = true;
+            else
+                last[x % nproducers] = x / nproducers;
+        }
+        collected += n;
+        if (failed) break;
+    }
+    printf("MPSCRing stress: %d producers, capacity %lu: %s\n",
+            nproducers, q.capacity(), failed ? "FAILED" : "ok");
+    /* (the producers may be stuck on a corrupted ring) */
+    if (failed) _exit(1);
+    for (auto &t: producers) t.join();
+}
+
+void bench(int nproducers, int nops, size_t bulk, size_t burst_size, size_t capacity) {
+    {
+        salticidae::MPSCQueueEventDriven<int> q;
+        q.set_capacity(capacity);
+        bench_queue("MPSCQueueEventDriven", q, nproducers, nops, bulk, burst_size);
+    }
+    {
+        salticidae::MPSCRingEventDriven<int> q(capacity);
+        bench_queue("MPSCRingEventDriven", q, nproducers, nops, bulk, burst_size);
+    }
+    {
+        salticidae::SPSCRingEventDriven<int> q(capacity);
+        bench_queue("SPSCRingEventDriven", q, 1, nops, bulk, burst_size);
+    }
+}
+
 int main(int argc, char **argv) {
     Config config;
     auto opt_nproducers = Config::OptValInt::create(16);
@@ -136,12 +290,20 @@ int main(int argc, char **argv) {
     auto opt_mpmc = Config::OptValFlag::create(false);
     auto opt_help = Config::OptValFlag::create(false);
     auto opt_rewind = Config::OptValFlag::create(false);
+    auto opt_bench = Config::OptValFlag::create(false);
+    auto opt_bulk = Config::OptValInt::create(32);
+    auto opt_capacity = Config::OptValInt::create(65536);
+    auto opt_ring_stress = Config::OptValFlag::create(false);
     config.add_opt("nproducers", opt_nproducers, Config::SET_VAL);
     config.add_opt("nconsumers", opt_nconsumers, Config::SET_VAL);
     config.add_opt("burst-size", opt_burst_size, Config::SET_VAL);
     config.add_opt("nops", opt_nops, Config::SET_VAL);
     config.add_opt("mpmc", opt_mpmc, Config::SWITCH_ON);
     config.add_opt("rewind", opt_rewind, Config::SWITCH_ON);
+    config.add_opt("bench", opt_bench, Config::SWITCH_ON, 'b', "measure the throughput of the MPSC queue and rings");
+    config.add_opt("bulk", opt_bulk, Config::SET_VAL, 'k', "number of elements enqueued at a time (with --bench)");
+    config.add_opt("capacity", opt_capacity, Config::SET_VAL, 'c', "queue capacity (with --bench)");
+    config.add_opt("ring-stress", opt_ring_stress, Config::SWITCH_ON, 's', "keep a small MPSC ring full from many producers and check what comes out");
     config.add_opt("help", opt_help, Config::SWITCH_ON, 'h', "show this help info");
     config.parse(argc, argv);
     srand(time(0));
@@ -151,7 +313,12 @@ int main(int argc, char **argv) {
         exit(0);
     }
 
-    if (!opt_mpmc->get())
+    if (opt_ring_stress->get())
+        stress_mpsc_ring(opt_nproducers->get(), opt_nops->get(), 8);
+    else if (opt_bench->get())
+        bench(opt_nproducers->get(), opt_nops->get(), opt_bulk->get(),
+                opt_burst_size->get(), opt_capacity->get());
+    else if (!opt_mpmc->get())
     {
         SALTICIDAE_LOG_INFO("testing an MPSC queue...");
         test_mpsc(opt_nproducers->get(), opt_nops->get(),
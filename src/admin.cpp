@@ -0,0 +1,175 @@
+/**
+ * Copyright 2018 VMware
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cerrno>
+#include <cstring>
+#include <exception>
+#include <sstream>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "hotstuff/admin.h"
+#include "hotstuff/type.h"
+
+namespace hotstuff {
+
+/* a client that stays silent for this long is dropped (in ms) */
+static const int idle_timeout = 60000;
+static const size_t max_line = 4096;
+
+AdminServer::AdminServer(const std::string &path):
+        path(path), running(true) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof addr.sun_path)
+        throw HotStuffError("invalid admin socket path \"%s\"", path.c_str());
+    strcpy(addr.sun_path, path.c_str());
+    listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0)
+        throw HotStuffError("admin socket: %s", strerror(errno));
+    /* left behind by a replica that did not exit cleanly */
+    unlink(path.c_str());
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof addr) < 0 ||
+        listen(listen_fd, 4) < 0)
+    {
+        int err = errno;
+        close(listen_fd);
+        throw HotStuffError("cannot listen on %s for admin: %s",
+                            path.c_str(), strerror(err));
+    }
+    reg_cmd("help", "", [this](const args_t &) {
+        std::string res;
+        std::lock_guard<std::mutex> _(cmds_lock);
+        for (const auto &c: cmds)
+        {
+            res += c.first;
+            if (!c.second.usage.empty())
+                res += " " + c.second.usage;
+            res += "\n";
+        }
+        return res;
+    });
+    worker = std::thread([this]() { serve(); });
+}
+
+AdminServer::~AdminServer() {
+    running.store(false, std::memory_order_relaxed);
+    worker.join();
+    close(listen_fd);
+    unlink(path.c_str());
+}
+
+void AdminServer::reg_cmd(const std::string &name, const std::string &usage,
+                        handler_t handler) {
+    std::lock_guard<std::mutex> _(cmds_lock);
+    cmds[name] = Command{usage, std::move(handler)};
+}
+
+std::string AdminServer::exec(const std::string &line) {
+    std::istringstream is(line);
+    args_t args;
+    std::string word;
+    while (is >> word) args.push_back(word);
+    if (args.empty()) return "";
+    handler_t handler;
+    {
+        std::lock_guard<std::mutex> _(cmds_lock);
+        auto it = cmds.find(args[0]);
+        if (it == cmds.end())
+            return "error: unknown command " + args[0] + " (try help)\n";
+        handler = it->second.handler;
+    }
+    std::string res;
+    try {
+        res = handler(args);
+    } catch (std::exception &e) {
+        return std::string("error: ") + e.what() + "\n";
+    }
+    if (!res.empty() && res.back() != '\n') res += "\n";
+    /* an empty line ends the reply */
+    std::string out;
+    out.reserve(res.size());
+    for (size_t i = 0; i < res.size(); i++)
+        if (res[i] != '\n' || (i && res[i - 1] != '\n'))
+            out += res[i];
+    return out;
+}
+
+void AdminServer::serve() {
+    struct pollfd pfd;
+    pfd.fd = listen_fd;
+    pfd.events = POLLIN;
+    while (running.load(std::memory_order_relaxed))
+    {
+        /* wake up now and then to notice the shutdown */
+        if (poll(&pfd, 1, 200) <= 0) continue;
+        int fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0) continue;
+        struct timeval tv = {1, 0};
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof tv);
+        handle(fd);
+        close(fd);
+    }
+}
+
+void AdminServer::handle(int fd) {
+    std::string buff;
+    char chunk[1024];
+    struct pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    int idle = 0;
+    while (running.load(std::memory_order_relaxed))
+    {
+        size_t pos;
+        while ((pos = buff.find('\n')) != std::string::npos)
+        {
+            auto resp = exec(buff.substr(0, pos)) + "\n";
+            buff.erase(0, pos + 1);
+            for (size_t off = 0; off < resp.size();)
+            {
+                ssize_t n = send(fd, resp.data() + off, resp.size() - off, MSG_NOSIGNAL);
+                if (n <= 0) return;
+                off += n;
+            }
+        }
+        if (buff.size() > max_line) return;
+        int ret = poll(&pfd, 1, 200);
+        if (ret < 0) return;
+        if (ret == 0)
+        {
+            if ((idle += 200) >= idle_timeout) return;
+            continue;
+        }
+        idle = 0;
+        ssize_t n = recv(fd, chunk, sizeof chunk, 0);
+        if (n <= 0)
+        {
+            /* a last command without its newline */
+            if (n == 0 && !buff.empty()) buff += '\n';
+            else return;
+        }
+        else
+            buff.append(chunk, n);
+    }
+}
+
+}
@@ -0,0 +1,185 @@
+/**
+ * Copyright 2018 VMware
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "hotstuff/alloc_profile.h"
+
+#ifdef HOTSTUFF_ALLOC_PROFILE
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+namespace hotstuff {
+
+namespace {
+
+/* Each thread counts into a slot of its own, so that the threads do not
+ * fight over the same cache lines; past the number of slots, the threads
+ * share the last one. The slots are static so that counting never
+ * allocates. */
+const size_t nslots = 256;
+
+struct alignas(64) Slot {
+    std::atomic<uint64_t> nallocs[AllocProfiler::NPHASES];
+    std::atomic<uint64_t> bytes[AllocProfiler::NPHASES];
+};
+
+Slot slots[nslots];
+std::atomic<size_t> nslots_used(0);
+thread_local Slot *local_slot = nullptr;
+
+inline void count(size_t size) {
+    Slot *s = local_slot;
+    if (!s)
+    {
+        size_t i = nslots_used.fetch_add(1, std::memory_order_relaxed);
+        s = local_slot = &slots[i < nslots ? i : nslots - 1];
+    }
+    auto phase = AllocProfiler::get_phase();
+    s->nallocs[phase].fetch_add(1, std::memory_order_relaxed);
+    s->bytes[phase].fetch_add(size, std::memory_order_relaxed);
+}
+
+inline void *alloc(size_t size) noexcept {
+    count(size);
+    return malloc(size ? size : 1);
+}
+
+inline void *alloc(size_t size, std::align_val_t align) noexcept {
+    count(size);
+    size_t a = static_cast<size_t>(align);
+    if (a < sizeof(void *)) a = sizeof(void *);
+    void *p;
+    return posix_memalign(&p, a, size ? size : 1) ? nullptr : p;
+}
+
+}
+
+uint64_t AllocProfiler::Stats::total_nallocs() const {
+    uint64_t res = 0;
+    for (size_t i = 0; i < NPHASES; i++) res += nallocs[i];
+    return res;
+}
+
+uint64_t AllocProfiler::Stats::total_bytes() const {
+    uint64_t res = 0;
+    for (size_t i = 0; i < NPHASES; i++) res += bytes[i];
+    return res;
+}
+
+AllocProfiler::Stats AllocProfiler::Stats::operator-(const Stats &other) const {
+    Stats res;
+    for (size_t i = 0; i < NPHASES; i++)
+    {
+        res.nallocs[i] = nallocs[i] - other.nallocs[i];
+        res.bytes[i] = bytes[i] - other.bytes[i];
+    }
+    return res;
+}
+
+const char *AllocProfiler::phase_name(Phase phase) {
+    static const char *names[NPHASES] = {
+        "other", "ingress", "local_order", "propose", "deliver",
+        "vote", "finalize", "execute", "respond"
+    };
+    return names[phase];
+}
+
+AllocProfiler::Stats AllocProfiler::snapshot() {
+    Stats res = {};
+    size_t n = nslots_used.load(std::memory_order_relaxed);
+    if (n > nslots) n = nslots;
+    for (size_t i = 0; i < n; i++)
+        for (size_t j = 0; j < NPHASES; j++)
+        {
+            res.nallocs[j] += slots[i].nallocs[j].load(std::memory_order_relaxed);
+            res.bytes[j] += slots[i].bytes[j].load(std::memory_order_relaxed);
+        }
+    return res;
+}
+
+std::string AllocProfiler::report(const Stats &delta, size_t nunits,
+                                const char *unit) {
+    std::string res;
+    char buff[128];
+    if (!nunits)
+    {
+        snprintf(buff, sizeof buff, "no %s, %lu allocations (%lu bytes)",
+                unit, delta.total_nallocs(), delta.total_bytes());
+        return buff;
+    }
+    snprintf(buff, sizeof buff, "per %s (%lu): %.1f allocations, %.0f bytes",
+            unit, nunits, delta.total_nallocs() / double(nunits),
+            delta.total_bytes() / double(nunits));
+    res += buff;
+    for (size_t i = 0; i < NPHASES; i++)
+    {
+        snprintf(buff, sizeof buff, "\n  %-12s %8.2f allocations, %10.0f bytes",
+                phase_name((Phase)i), delta.nallocs[i] / double(nunits),
+                delta.bytes[i] / double(nunits));
+        res += buff;
+    }
+    return res;
+}
+
+}
+
+using hotstuff::alloc;
+
+void *operator new(size_t size) {
+    if (void *p = alloc(size)) return p;
+    throw std::bad_alloc();
+}
+
+void *operator new[](size_t size) {
+    if (void *p = alloc(size)) return p;
+    throw std::bad_alloc();
+}
+
+void *operator new(size_t size, std::align_val_t align) {
+    if (void *p = alloc(size, align)) return p;
+    throw std::bad_alloc();
+}
+
+void *operator new[](size_t size, std::align_val_t align) {
+    if (void *p = alloc(size, align)) return p;
+    throw std::bad_alloc();
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept { return alloc(size); }
+void *operator new[](size_t size, const std::nothrow_t &) noexcept { return alloc(size); }
+
+void *operator new(size_t size, std::align_val_t align, const std::nothrow_t &) noexcept {
+    return alloc(size, align);
+}
+
+void *operator new[](size_t size, std::align_val_t align, const std::nothrow_t &) noexcept {
+    return alloc(size, align);
+}
+
+void operator delete(void *p) noexcept { free(p); }
+void operator delete[](void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+void operator delete[](void *p, size_t) noexcept { free(p); }
+void operator delete(void *p, std::align_val_t) noexcept { free(p); }
+void operator delete[](void *p, std::align_val_t) noexcept { free(p); }
+void operator delete(void *p, size_t, std::align_val_t) noexcept { free(p); }
+void operator delete[](void *p, size_t, std::align_val_t) noexcept { free(p); }
+void operator delete(void *p, const std::nothrow_t &) noexcept { free(p); }
+void operator delete[](void *p, const std::nothrow_t &) noexcept { free(p); }
+void operator delete(void *p, std::align_val_t, const std::nothrow_t &) noexcept { free(p); }
+void operator delete[](void *p, std::align_val_t, const std::nothrow_t &) noexcept { free(p); }
+#endif
@@ -0,0 +1,439 @@
+/**
+ * Copyright 2018 VMware
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <ctime>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "salticidae/util.h"
+#include "hotstuff/async_log.h"
+#include "hotstuff/type.h"
+
+namespace hotstuff {
+
+/* Layout of the binary log: the magic, then frames starting with a tag
+ * byte. A format frame ('F': id (4), level (1), length (2), characters)
+ * comes before the first record using it; a record frame ('R': thread (2),
+ * the record) is followed by a drop frame ('D': thread (2), count (8)) when
+ * the thread had to drop records. Integers are in host order. */
+static const char log_magic[8] = {'H', 'S', 'B', 'L', 'O', 'G', '0', '1'};
+
+struct AsyncLogger::Ring {
+    std::atomic<uint64_t> head;     /**< records ever written */
+    std::atomic<uint64_t> tail;     /**< records ever consumed */
+    std::atomic<uint64_t> dropped;
+    uint64_t dropped_reported;      /**< only used by the background thread */
+    uint16_t tid;
+    Record recs[ring_size];
+
+    Ring(uint16_t tid): head(0), tail(0), dropped(0), dropped_reported(0), tid(tid) {}
+};
+
+namespace {
+
+const char *level_tags[AsyncLogger::NLEVELS] = {"info", "debug", "warn", "proto"};
+const char *level_colors[AsyncLogger::NLEVELS] = {
+    salticidae::TTY_COLOR_GREEN, salticidae::TTY_COLOR_BLUE,
+    salticidae::TTY_COLOR_YELLOW, salticidae::TTY_COLOR_MAGENTA
+};
+
+struct Format {
+    AsyncLogger::Level level;
+    const char *fmt;
+};
+
+/* the rings and the formats outlive the threads that made them */
+std::mutex registry_lock;
+std::vector<AsyncLogger::Ring *> rings;
+std::vector<Format> formats;
+thread_local AsyncLogger::Ring *local_ring = nullptr;
+
+std::thread worker;
+std::atomic<bool> running(false);
+AsyncLogger::Mode mode;
+int out_fd = -1;
+bool color = false;
+
+/* background thread state */
+std::vector<Format> formats_seen;
+std::vector<bool> formats_written;
+
+struct Item {
+    AsyncLogger::Record rec;
+    uint16_t tid;
+};
+
+std::string datetime(uint64_t ts) {
+    char fmt[64], buf[64];
+    time_t sec = ts / 1000000000;
+    struct tm tm;
+    localtime_r(&sec, &tm);
+    strftime(fmt, sizeof fmt, "%Y-%m-%d %H:%M:%S.%%06u", &tm);
+    snprintf(buf, sizeof buf, fmt, (unsigned)(ts / 1000 % 1000000));
+    return buf;
+}
+
+void write_all(int fd, const void *data, size_t size) {
+    auto p = (const char *)data;
+    while (size)
+    {
+        ssize_t n = ::write(fd, p, size);
+        if (n <= 0) return;
+        p += n;
+        size -= n;
+    }
+}
+
+template<typename T>
+void put_raw(std::string &buf, const T &v) {
+    buf.append((const char *)&v, sizeof v);
+}
+
+const Format *lookup_format(uint32_t id) {
+    if (id >= formats_seen.size())
+    {
+        std::lock_guard<std::mutex> _(registry_lock);
+        formats_seen = formats;
+        formats_written.resize(formats_seen.size());
+    }
+    return id < formats_seen.size() ? &formats_seen[id] : nullptr;
+}
+
+void report_drops(std::string &buf, AsyncLogger::Ring *ring, uint64_t now) {
+    uint64_t dropped = ring->dropped.load(std::memory_order_relaxed);
+    uint64_t n = dropped - ring->dropped_reported;
+    if (!n) return;
+    ring->dropped_reported = dropped;
+    if (mode == AsyncLogger::BINARY)
+    {
+        buf.push_back('D');
+        put_raw(buf, ring->tid);
+        put_raw(buf, n);
+    }
+    else
+        buf += datetime(now) + " [hotstuff warn] async log: " +
+                std::to_string(n) + " records dropped by thread " +
+                std::to_string(ring->tid) + "\n";
+}
+
+/* Move what the rings hold out to the output; returns whether anything
+ * was found. */
+bool drain() {
+    static std::vector<Item> items;
+    std::vector<AsyncLogger::Ring *> snapshot;
+    {
+        std::lock_guard<std::mutex> _(registry_lock);
+        snapshot = rings;
+    }
+    std::string buf, drops;
+    uint64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    items.clear();
+    for (auto ring: snapshot)
+    {
+        uint64_t t = ring->tail.load(std::memory_order_relaxed);
+        uint64_t h = ring->head.load(std::memory_order_acquire);
+        for (; t < h; t++)
+            items.push_back(Item{ring->recs[t & (AsyncLogger::ring_size - 1)], ring->tid});
+        ring->tail.store(t, std::memory_order_release);
+        report_drops(drops, ring, now);
+    }
+    /* interleave the threads by time */
+    std::stable_sort(items.begin(), items.end(), [](const Item &a, const Item &b) {
+        return a.rec.ts < b.rec.ts;
+    });
+    for (const auto &it: items)
+    {
+        auto f = lookup_format(it.rec.fmt_id);
+        if (!f) continue;
+        if (mode == AsyncLogger::BINARY)
+        {
+            if (!formats_written[it.rec.fmt_id])
+            {
+                formats_written[it.rec.fmt_id] = true;
+                uint16_t len = strlen(f->fmt);
+                buf.push_back('F');
+                put_raw(buf, it.rec.fmt_id);
+                put_raw(buf, (uint8_t)f->level);
+                put_raw(buf, len);
+                buf.append(f->fmt, len);
+            }
+            buf.push_back('R');
+            put_raw(buf, it.tid);
+            put_raw(buf, it.rec);
+        }
+        else
+            buf += AsyncLogger::format_line(f->level, f->fmt, it.rec, color);
+    }
+    /* the drops came after what was drained */
+    buf += drops;
+    if (!buf.empty()) write_all(out_fd, buf.data(), buf.size());
+    return !items.empty();
+}
+
+}
+
+std::atomic<bool> AsyncLogger::enabled(false);
+
+AsyncLogger::Ring *AsyncLogger::get_local_ring() {
+    if (!local_ring)
+    {
+        std::lock_guard<std::mutex> _(registry_lock);
+        local_ring = new Ring(rings.size() + 1);
+        rings.push_back(local_ring);
+    }
+    return local_ring;
+}
+
+AsyncLogger::Record *AsyncLogger::begin_record() {
+    auto ring = get_local_ring();
+    uint64_t h = ring->head.load(std::memory_order_relaxed);
+    if (h - ring->tail.load(std::memory_order_acquire) >= ring_size)
+    {
+        ring->dropped.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    return &ring->recs[h & (ring_size - 1)];
+}
+
+void AsyncLogger::commit_record() {
+    auto ring = local_ring;
+    ring->head.store(ring->head.load(std::memory_order_relaxed) + 1,
+                    std::memory_order_release);
+}
+
+uint32_t AsyncLogger::register_format(Level level, const char *fmt) {
+    std::lock_guard<std::mutex> _(registry_lock);
+    formats.push_back(Format{level, fmt});
+    return formats.size() - 1;
+}
+
+void AsyncLogger::start(Mode _mode, const std::string &fname) {
+    if (running.load()) return;
+    mode = _mode;
+    if (mode == BINARY)
+    {
+        out_fd = open(fname.c_str(), O_CREAT | O_WRONLY | O_TRUNC, 0644);
+        if (out_fd == -1)
+            throw HotStuffError("cannot open the binary log %s", fname.c_str());
+        write_all(out_fd, log_magic, sizeof log_magic);
+    }
+    else
+    {
+        out_fd = 2;
+        color = isatty(out_fd);
+    }
+    running.store(true);
+    worker = std::thread([]() {
+        while (running.load(std::memory_order_relaxed))
+            if (!drain())
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    });
+    enabled.store(true);
+}
+
+void AsyncLogger::stop() {
+    if (!running.load()) return;
+    enabled.store(false);
+    running.store(false);
+    worker.join();
+    /* what was logged while the thread was stopping */
+    drain();
+    if (mode == BINARY) close(out_fd);
+    out_fd = -1;
+}
+
+std::string AsyncLogger::format(const char *fmt, const Record &rec) {
+    std::string out;
+    /* the record may come from a corrupted binary log */
+    size_t nargs = std::min<size_t>(rec.nargs, max_args);
+    size_t i = 0, off = 0;
+    char buf[512];
+    for (const char *p = fmt; *p; p++)
+    {
+        if (*p != '%')
+        {
+            out.push_back(*p);
+            continue;
+        }
+        if (p[1] == '%')
+        {
+            out.push_back('%');
+            p++;
+            continue;
+        }
+        /* flags, width and precision are kept, the length modifier is
+         * replaced by the one of the stored type */
+        std::string spec = "%";
+        const char *q = p + 1;
+        while (*q && strchr("-+ #0", *q)) spec.push_back(*q++);
+        while (*q && (isdigit(*q) || *q == '.')) spec.push_back(*q++);
+        while (*q && strchr("hlqjztL", *q)) q++;
+        char conv = *q;
+        if (!conv) break;
+        p = q;
+        if (i >= nargs)
+        {
+            out += "<?>";
+            continue;
+        }
+        char type = rec.types[i++];
+        uint64_t w = 0;
+        const char *str = nullptr;
+        size_t slen = 0;
+        if (type == 's')
+        {
+            if (off + 1 > sizeof(rec.payload) ||
+                off + 1 + rec.payload[off] > sizeof(rec.payload))
+            {
+                /* nothing after it can be trusted either */
+                nargs = 0;
+                out += "<?>";
+                continue;
+            }
+            slen = rec.payload[off];
+            str = (const char *)rec.payload + off + 1;
+            off += 1 + slen;
+        }
+        else if (type != '?')
+        {
+            if (off + sizeof w > sizeof(rec.payload))
+            {
+                nargs = 0;
+                out += "<?>";
+                continue;
+            }
+            memcpy(&w, rec.payload + off, sizeof w);
+            off += sizeof w;
+        }
+        if (conv == 'c' && (type == 'i' || type == 'u'))
+        {
+            spec.push_back('c');
+            snprintf(buf, sizeof buf, spec.c_str(), (int)w);
+        }
+        else if (strchr("diouxX", conv) && (type == 'i' || type == 'u' || type == 'p'))
+        {
+            spec += "ll";
+            spec.push_back(conv);
+            snprintf(buf, sizeof buf, spec.c_str(), (long long)w);
+        }
+        else if (strchr("fFeEgGaA", conv) && type == 'f')
+        {
+            double d;
+            memcpy(&d, &w, sizeof d);
+            spec.push_back(conv);
+            snprintf(buf, sizeof buf, spec.c_str(), d);
+        }
+        else if (conv == 's' && type == 's')
+        {
+            std::string s(str, slen);
+            spec.push_back('s');
+            snprintf(buf, sizeof buf, spec.c_str(), s.c_str());
+        }
+        else if (conv == 'p' && type == 'p')
+            snprintf(buf, sizeof buf, "%p", (void *)(uintptr_t)w);
+        else
+            snprintf(buf, sizeof buf, "<?>");
+        out += buf;
+    }
+    return out;
+}
+
+std::string AsyncLogger::format_line(Level level, const char *fmt,
+                                    const Record &rec, bool color) {
+    std::string line = color ? level_colors[level] : "";
+    line += datetime(rec.ts) + " [hotstuff " + level_tags[level] + "] ";
+    if (color) line += salticidae::TTY_COLOR_RESET;
+    line += format(fmt, rec);
+    line.push_back('\n');
+    return line;
+}
+
+size_t AsyncLogger::decode(const std::string &fname, int out) {
+    FILE *f = fopen(fname.c_str(), "rb");
+    if (!f) throw HotStuffError("cannot open the binary log %s", fname.c_str());
+    char magic[sizeof log_magic];
+    if (fread(magic, 1, sizeof magic, f) != sizeof magic ||
+        memcmp(magic, log_magic, sizeof magic))
+    {
+        fclose(f);
+        throw HotStuffError("%s is not a binary log", fname.c_str());
+    }
+    /* far more call sites than any build has */
+    static const uint32_t max_fmts = 1 << 20;
+    std::vector<std::pair<Level, std::string>> fmts;
+    size_t n = 0;
+    int tag;
+    while ((tag = fgetc(f)) != EOF)
+    {
+        if (tag == 'F')
+        {
+            uint32_t id;
+            uint8_t level;
+            uint16_t len;
+            if (fread(&id, sizeof id, 1, f) != 1 ||
+                fread(&level, sizeof level, 1, f) != 1 ||
+                fread(&len, sizeof len, 1, f) != 1) break;
+            std::string fmt(len, '\0');
+            if (fread(&fmt[0], 1, len, f) != len) break;
+            if (id >= max_fmts)
+            {
+                fclose(f);
+                throw HotStuffError("corrupted binary log %s", fname.c_str());
+            }
+            if (id >= fmts.size()) fmts.resize(id + 1);
+            fmts[id] = std::make_pair((Level)std::min<uint8_t>(level, NLEVELS - 1), fmt);
+        }
+        else if (tag == 'R')
+        {
+            uint16_t tid;
+            Record rec;
+            if (fread(&tid, sizeof tid, 1, f) != 1 ||
+                fread(&rec, sizeof rec, 1, f) != 1) break;
+            if (rec.fmt_id >= fmts.size()) continue;
+            const auto &fmt = fmts[rec.fmt_id];
+            auto line = format_line(fmt.first, fmt.second.c_str(), rec);
+            write_all(out, line.data(), line.size());
+            n++;
+        }
+        else if (tag == 'D')
+        {
+            uint16_t tid;
+            uint64_t cnt;
+            if (fread(&tid, sizeof tid, 1, f) != 1 ||
+                fread(&cnt, sizeof cnt, 1, f) != 1) break;
+            auto line = "[" + std::to_string(cnt) + " records dropped by thread " +
+                        std::to_string(tid) + "]\n";
+            write_all(out, line.data(), line.size());
+        }
+        else
+        {
+            fclose(f);
+            throw HotStuffError("corrupted binary log %s", fname.c_str());
+        }
+    }
+    fclose(f);
+    return n;
+}
+
+}
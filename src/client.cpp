@@ -20,6 +20,12 @@ namespace hotstuff {
 
 const opcode_t MsgReqCmd::opcode;
 const opcode_t MsgRespCmd::opcode;
+const opcode_t MsgReqQuery::opcode;
+const opcode_t MsgRespQuery::opcode;
+const opcode_t MsgReqCkpt::opcode;
+const opcode_t MsgRespCkpt::opcode;
+const opcode_t MsgReqCkptChunk::opcode;
+const opcode_t MsgRespCkptChunk::opcode;
 //#ifdef HOTSTUFF_AUTOCLI
 //const opcode_t MsgDemandCmd::opcode;
 //#endif
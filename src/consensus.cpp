@@ -27,6 +27,9 @@
 #include "hotstuff/util.h"
 #include "hotstuff/consensus.h"
 #include "hotstuff/graph.h"
+#include "hotstuff/tracer.h"
+#include "hotstuff/alloc_profile.h"
+#include "hotstuff/liveness.h"
 
 #define LOG_INFO HOTSTUFF_LOG_INFO
 #define LOG_DEBUG HOTSTUFF_LOG_DEBUG
@@ -43,12 +46,21 @@ HotStuffCore::HotStuffCore(ReplicaID id,
         b_lock(b0),
         b_exec(b0),
         vheight(0),
+        pruned_height(0),
         priv_key(std::move(priv_key)),
-        tails{b0},
         vote_disabled(false),
+        speculation(false),
         id(id),
+        fair_finalize_time(metrics.histogram("hotstuff_fairness_stage_seconds",
+            "time spent in each stage of the fair ordering", "stage=\"finalize\"")),
+        local_order_merge_time(metrics.histogram("hotstuff_fairness_stage_seconds",
+            "time spent in each stage of the fair ordering", "stage=\"merge\"")),
+        fair_propose_time(metrics.histogram("hotstuff_fairness_stage_seconds",
+            "time spent in each stage of the fair ordering", "stage=\"propose\"")),
         storage(new EntityStorage()) {
     storage->add_blk(b0);
+    tails.insert(b0);
+    tails.set_anchor(b0);
 }
 
 void HotStuffCore::sanity_check_delivered(const block_t &blk) {
@@ -64,6 +76,7 @@ block_t HotStuffCore::get_delivered_blk(const uint256_t &blk_hash) {
 }
 
 bool HotStuffCore::on_deliver_blk(const block_t &blk) {
+    HOTSTUFF_ALLOC_SCOPE(DELIVER);
     if (blk->delivered)
     {
         LOG_WARN("attempt to deliver a block twice");
@@ -73,6 +86,10 @@ bool HotStuffCore::on_deliver_blk(const block_t &blk) {
     for (const auto &hash: blk->parent_hashes)
         blk->parents.push_back(get_delivered_blk(hash));
     blk->height = blk->parents[0]->height + 1;
+    uint32_t skip_height = Block::skip_height(blk->height);
+    if (skip_height >= pruned_height)
+        blk->skip = blk->parents[0]->get_ancestor(skip_height);
+    storage->advance_blk_height(blk->height);
 
     if (blk->qc)
     {
@@ -90,10 +107,11 @@ bool HotStuffCore::on_deliver_blk(const block_t &blk) {
     return true;
 }
 
-void HotStuffCore::update_hqc(const block_t &_hqc, const quorum_cert_bt &qc) {
+void HotStuffCore::update_hqc(const block_t &_hqc, const quorum_cert_t &qc) {
     if (_hqc->height > hqc.first->height)
     {
-        hqc = std::make_pair(_hqc, qc->clone());
+        hqc = std::make_pair(_hqc, qc);
+        tails.set_anchor(_hqc);
         on_hqc_update();
     }
 }
@@ -115,9 +133,15 @@ void HotStuffCore::update(const block_t &nblk) {
     //     HOTSTUFF_LOG_DEBUG("[[update]] [R-%d] [L-] Adding missing edge = %.10s -> %.10s", get_id(), get_hex(edge.first).c_str(), get_hex(edge.second).c_str());
     // }
     /* Update proposal level local order cache */
-    for(auto const &cmd: nblk->get_orders().begin()->second){
-        storage->remove_local_order_seen_propose_level(cmd);
-        HOTSTUFF_LOG_DEBUG("[[update]] [R-%d] [L-] Removing Proposed cmd from seen = %.10s", get_id(), get_hex(g.first).c_str());
+    if(!nblk->get_orders().empty()){
+        for(auto const &cmd: nblk->get_orders().begin()->second){
+            cmd_id_t cid = storage->find_cmd_id(cmd);
+            if(cid == CMD_ID_NULL){
+                continue;
+            }
+            storage->remove_local_order_seen_propose_level(cid);
+            HOTSTUFF_LOG_DEBUG("[[update]] [R-%d] [L-] Removing Proposed cmd from seen = %.10s", get_id(), get_hex(cmd).c_str());
+        }
     }
     // for(auto const &g: nblk->get_graph()) {
     //     storage->remove_local_order_seen_propose_level(g.first);
@@ -130,6 +154,9 @@ void HotStuffCore::update(const block_t &nblk) {
     /* three-step HotStuff */
     const block_t &blk2 = nblk->qc_ref;
     if (blk2 == nullptr) return;
+#ifdef HOTSTUFF_BLK_PROFILE
+    blk_profiler.rec(blk2->get_hash(), BlockProfiler::QC_FORMED);
+#endif
     HOTSTUFF_LOG_DEBUG("[[update 1]] blk2 = %.10s, decision = %d, b0 = %.10s, decision = %d", get_hex(blk2->get_hash()).c_str(), blk2->decision, get_hex(b0->get_hash()).c_str(), b0->decision);
     /* decided blk could possible be incomplete due to pruning */
     if (blk2->decision) return;
@@ -156,6 +183,9 @@ void HotStuffCore::update(const block_t &nblk) {
     /* two-step HotStuff */
     const block_t &blk1 = nblk->qc_ref;
     if (blk1 == nullptr) return;
+#ifdef HOTSTUFF_BLK_PROFILE
+    blk_profiler.rec(blk1->get_hash(), BlockProfiler::QC_FORMED);
+#endif
     if (blk1->decision) return;
     update_hqc(blk1, nblk->qc);
     if (blk1->height > b_lock->height) b_lock = blk1;
@@ -169,7 +199,12 @@ void HotStuffCore::update(const block_t &nblk) {
 #endif
     /* b0 - - - - -> blk -> blk1 -> blk2 */
     /* otherwise commit */
+    if (!blk->extends(b_exec.get()))
+        throw std::runtime_error("safety breached :( " +
+                                std::string(*blk) + " " +
+                                std::string(*b_exec));
     std::vector<block_t> commit_queue;
+    commit_queue.reserve(blk->height - b_exec->height);
     block_t b;
 
 
@@ -180,21 +215,33 @@ void HotStuffCore::update(const block_t &nblk) {
     { /* TODO: also commit the uncles/aunts */
         commit_queue.push_back(b);
     }
-    if (b != b_exec)
-        throw std::runtime_error("safety breached :( " +
-                                std::string(*blk) + " " +
-                                std::string(*b_exec));
 
     HOTSTUFF_LOG_DEBUG("[[update]] [R-%d] [L-] Commit queue Size = %d", get_id(), commit_queue.size());
     for (auto it = commit_queue.rbegin(); it != commit_queue.rend(); it++)
     {
+        HOTSTUFF_ALLOC_SCOPE(FINALIZE);
         const block_t &blk = *it;
 
         // Themis
         //HOTSTUFF_LOG_DEBUG("[[update]] [R-%d] [L-] Graph Size = %d, block = %.10s", get_id(), blk->get_graph().size(), get_hex(blk->get_hash()).c_str());
         HOTSTUFF_LOG_DEBUG("[[update]] [R-%d] [L-] Local Order Size = %d, block = %.10s", get_id(), blk->get_orders().size(), get_hex(blk->get_hash()).c_str());
         //auto const &order = fair_finalize(blk, nblk->get_e_update());
-        auto const &order = fair_finalize(blk);
+#ifdef HOTSTUFF_BLK_PROFILE
+        blk_profiler.rec(blk->get_hash(), BlockProfiler::COMMITTED);
+#endif
+        std::vector<Hash256> order;
+        auto sit = spec_orders.find(blk->get_hash());
+        if (sit != spec_orders.end())
+            order = std::move(sit->second.second);
+        else
+        {
+            uint64_t t = Histogram::now_us();
+            order = fair_finalize(blk);
+            fair_finalize_time.observe_since(t);
+        }
+#ifdef HOTSTUFF_BLK_PROFILE
+        blk_profiler.rec(blk->get_hash(), BlockProfiler::FINALIZED);
+#endif
         HOTSTUFF_LOG_DEBUG("[[update]] [R-%d] [L-] Final Order Size = %d", get_id(), order.size());
         if(order.empty() && !blk->get_orders().empty()) {
             /* this is not a tournament graph: stop looking at further blocks */
@@ -208,11 +255,20 @@ void HotStuffCore::update(const block_t &nblk) {
         LOG_PROTO("commit %s", std::string(*blk).c_str());
         size_t n = order.size();
         for (size_t i=0; i<n; i++) {
+            CmdTracer::record(order[i], TraceEvent::COMMITTED);
             do_decide(Finality(id, 1, i, blk->height, order[i], blk->get_hash()));
-            storage->remove_local_order_seen_execute_level(order[i]);
-            storage->remove_from_proposed_cmds_cache(order[i]);
+            /* drop the local references, the id is recycled with the last one */
+            cmd_id_t cid = storage->find_cmd_id(order[i]);
+            if(cid != CMD_ID_NULL){
+                storage->remove_local_order_seen_execute_level(cid);
+                storage->remove_from_proposed_cmds_cache(cid);
+            }
         }
+        do_decide_block(blk);
         b_exec = blk;
+#ifdef HOTSTUFF_BLK_PROFILE
+        blk_profiler.finish(blk->get_hash());
+#endif
 
         HOTSTUFF_LOG_DEBUG("[[update Decided]] [R-%d] [L-]", get_id());
 
@@ -223,6 +279,14 @@ void HotStuffCore::update(const block_t &nblk) {
         //     do_decide(Finality(id, 1, i, blk->height,
         //                         blk->cmds[i], blk->get_hash()));
     }
+    /* the orders of the blocks committed, or of those which never will be */
+    for (auto it = spec_orders.begin(); it != spec_orders.end();)
+    {
+        if (it->second.first <= b_exec->height)
+            it = spec_orders.erase(it);
+        else
+            it++;
+    }
     // b_exec = blk;                        
     HOTSTUFF_LOG_DEBUG("[[update Ends]] [R-%d] [L-]", get_id());
 }
@@ -253,54 +317,96 @@ void HotStuffCore::print_all_blocks(const block_t &nblk, const block_t &blk){
     //                     get_hex(b_exec->get_hash()).c_str(), b_exec->get_height());
 }
 
-bool cmp(std::pair<uint256_t,double> a, std::pair<uint256_t,double> b) {
-	return a.second < b.second;
-}
-
 // Us
-std::vector<uint256_t> HotStuffCore::
+std::vector<Hash256> HotStuffCore::
                         fair_finalize(block_t const &blk){
-    auto &orders = blk->get_orders();
-    std::vector<uint256_t> order;
-    int i;
-    std::map<uint256_t,double> cmd_weight;
-    for(auto cmd:orders.begin()->second){
-            cmd_weight.insert(std::make_pair(cmd,0));
-    }
-    for(auto o:orders){
-        i = 1;
-        for(auto cmd:o.second){
-            cmd_weight[cmd]+=(1-std::pow(config.fairness_parameter,i));
-            i++;
-        }
+    return fair_order(blk->get_orders(), config.fairness_parameter);
+}
+
+std::vector<Hash256> HotStuffCore::fair_order(const block_orders_t &orders,
+                                            double fairness_parameter){
+    std::vector<Hash256> order;
+    if(orders.empty()){
+        return order;
     }
-    std::vector<std::pair<uint256_t,double>> vec;
-    for(auto it=cmd_weight.begin();it!=cmd_weight.end();it++){
-        vec.push_back(std::pair<uint256_t,double>(it->first,it->second));
+    /* in replica order: the weights are sums of doubles, which must come
+     * out the same on every replica */
+    std::vector<const block_orders_t::value_type *> by_replica;
+    for(const auto &o: orders){
+        by_replica.push_back(&o);
     }
-    std::sort(vec.begin(),vec.end(),cmp);
-    for(auto it = vec.begin();it!=vec.end();it++){
-        order.push_back(it->first);
+    std::sort(by_replica.begin(), by_replica.end(), [](auto a, auto b) {
+        return a->first < b->first;
+    });
+    /* index the commands of all the orders once, so that weights live in
+     * flat arrays */
+    std::unordered_map<Hash256, uint32_t> cmd_to_idx;
+    cmd_to_idx.reserve(by_replica.front()->second.size());
+    for(auto o: by_replica){
+        for(const auto &cmd: o->second){
+            /* (try_emplace does not allocate for the commands seen already,
+             * which are most of them) */
+            if(cmd_to_idx.try_emplace(cmd, order.size()).second){
+                order.push_back(cmd);
+            }
+        }
     }
-    
-    std::unordered_map<uint256_t,std::unordered_map<uint256_t,u_int16_t>> weight_count;
-    size_t len = orders.begin()->second.size();
-    
-    for(auto o:orders){
-        std::vector<uint256_t> tmp = o.second;
-        for(size_t from=0;from<len;from++){
-            for(size_t to=from+1;to<len;to++){
-                weight_count[tmp[from]][tmp[to]]++;
+    size_t len = order.size();
+    std::vector<double> cmd_weight(len, 0);
+    std::vector<uint16_t> weight_count(len * len, 0);
+    std::vector<uint32_t> idx;
+    for(auto o: by_replica){
+        int i = 1;
+        idx.clear();
+        for(const auto &cmd: o->second){
+            uint32_t k = cmd_to_idx.find(cmd)->second;
+            cmd_weight[k] += (1-std::pow(fairness_parameter,i));
+            idx.push_back(k);
+            i++;
+        }
+        for(size_t from=0;from<idx.size();from++){
+            for(size_t to=from+1;to<idx.size();to++){
+                weight_count[idx[from] * len + idx[to]]++;
             }
         }
     }
-    // std::sort(order.begin(),order.end(),)
-    std::sort(order.begin(), order.end(), [](const uint256_t & a, const uint256_t & b) { 
-        return weight_count[a][b]==weight_count[b][a]?a<b:weight_count[a][b]>weight_count[b][a]});
-    // std::sort(cmds.begin(), cmds.end(), 
-    //     [](const uint256_t & a, const uint256_t & b) { return a.operator<(b);});
 
-    return order;
+    /* the pairwise majorities may form cycles (a > b > c > a): sorting
+     * with them directly is not a strict weak order, so each command is
+     * ranked by the number of pairwise majorities it wins instead */
+    std::vector<uint32_t> wins(len, 0);
+    for(size_t a=0;a<len;a++){
+        for(size_t b=a+1;b<len;b++){
+            uint16_t ab = weight_count[a * len + b], ba = weight_count[b * len + a];
+            if(ab > ba){
+                wins[a]++;
+            }
+            else if(ba > ab){
+                wins[b]++;
+            }
+        }
+    }
+    std::vector<uint32_t> rank(len);
+    for(uint32_t i=0;i<len;i++){
+        rank[i] = i;
+    }
+    /* ties are broken by weight, then by hash, identically everywhere */
+    std::sort(rank.begin(), rank.end(), [&](uint32_t a, uint32_t b) {
+        if(wins[a] != wins[b]){
+            return wins[a] > wins[b];
+        }
+        if(cmd_weight[a] != cmd_weight[b]){
+            return cmd_weight[a] < cmd_weight[b];
+        }
+        return order[a] < order[b];
+    });
+
+    std::vector<Hash256> final_order;
+    final_order.reserve(len);
+    for(auto i: rank){
+        final_order.push_back(order[i]);
+    }
+    return final_order;
     //auto &graph = blk->get_graph();
 
     
@@ -374,9 +480,10 @@ std::vector<uint256_t> HotStuffCore::
 block_t HotStuffCore::on_propose(/* const std::vector<uint256_t> &cmds,*/               // Themis
                             //const std::unordered_map<uint256_t, std::unordered_set<uint256_t>> &graph,
                             //const std::vector<std::pair<uint256_t, uint256_t>> &e_update,
-                            const std::unordered_map<ReplicaID,std::vector<uint256_t>> &orders,
+                            const std::unordered_map<ReplicaID,std::vector<Hash256>> &orders,
                             const std::vector<block_t> &parents,
                             bytearray_t &&extra) {
+    HOTSTUFF_ALLOC_SCOPE(PROPOSE);
     if (parents.empty())
         throw std::runtime_error("empty parents");
     for (const auto &_: parents) tails.erase(_);
@@ -387,10 +494,11 @@ block_t HotStuffCore::on_propose(/* const std::vector<uint256_t> &cmds,*/
     // }
 
     /* create the new block */
+    uint32_t height = parents[0]->height + 1;
     block_t bnew = storage->add_blk(
-        new Block(parents, /*cmds,graph, e_update,*/ orders,
-            hqc.second->clone(), std::move(extra),
-            parents[0]->height + 1,
+        storage->new_blk(height, parents, /*cmds,graph, e_update,*/ orders,
+            hqc.second, std::move(extra),
+            height,
             hqc.first,
             nullptr
         ));
@@ -410,6 +518,10 @@ block_t HotStuffCore::on_propose(/* const std::vector<uint256_t> &cmds,*/
 #endif
     
     const uint256_t bnew_hash = bnew->get_hash();
+#ifdef HOTSTUFF_BLK_PROFILE
+    blk_profiler.seen(bnew_hash, height, BlockProfiler::PROPOSED,
+                    bnew->get_orders().count(id));
+#endif
     bnew->self_qc = create_quorum_cert(bnew_hash);
     on_deliver_blk(bnew);
     update(bnew);
@@ -452,6 +564,7 @@ void HotStuffCore::print_block(std::string calling_method, const hotstuff::Propo
 }
 
 void HotStuffCore::on_receive_proposal(const Proposal &prop) {
+    HOTSTUFF_ALLOC_SCOPE(VOTE);
     LOG_PROTO("got %s", std::string(prop).c_str());
     bool self_prop = prop.proposer == get_id();
     block_t bnew = prop.blk;
@@ -468,6 +581,10 @@ void HotStuffCore::on_receive_proposal(const Proposal &prop) {
     }
 #endif
 
+    if (CmdTracer::is_enabled())
+        for (const auto &o: bnew->get_orders())
+            for (const auto &cmd: o.second)
+                CmdTracer::record(cmd, TraceEvent::PROPOSED);
     if (!self_prop)
     {
         sanity_check_delivered(bnew);
@@ -485,11 +602,7 @@ void HotStuffCore::on_receive_proposal(const Proposal &prop) {
         }
         else
         {   // safety condition (extend the locked branch)
-            block_t b;
-            for (b = bnew;
-                b->height > b_lock->height;
-                b = b->parents[0]);
-            if (b == b_lock) /* on the same branch */
+            if (bnew->extends(b_lock.get())) /* on the same branch */
             {
                 opinion = true;
                 vheight = bnew->height;
@@ -505,18 +618,32 @@ void HotStuffCore::on_receive_proposal(const Proposal &prop) {
         do_vote(prop.proposer,
             Vote(id, bnew->get_hash(),
                 create_part_cert(*priv_key, bnew->get_hash()), this));
+        if (speculation)
+            speculate(bnew);
     }
         
 }
 
+void HotStuffCore::speculate(const block_t &blk) {
+    /* fair_finalize() only depends on the block itself: its order is final
+     * whenever the block commits */
+    uint64_t t = Histogram::now_us();
+    auto &e = spec_orders[blk->get_hash()];
+    e.first = blk->height;
+    e.second = fair_finalize(blk);
+    fair_finalize_time.observe_since(t);
+    do_speculate(blk, e.second);
+}
+
 void HotStuffCore::on_receive_vote(const Vote &vote) {
+    HOTSTUFF_ALLOC_SCOPE(VOTE);
     LOG_PROTO("got %s", std::string(vote).c_str());
     LOG_PROTO("now state: %s", std::string(*this).c_str());
     block_t blk = get_delivered_blk(vote.blk_hash);
     assert(vote.cert);
     size_t qsize = blk->voted.size();
     if (qsize >= config.nmajority) return;
-    if (!blk->voted.insert(vote.voter).second)
+    if (!blk->voted.insert(vote.voter))
     {
         LOG_WARN("duplicate vote for %s from %d", get_hex10(vote.blk_hash).c_str(), vote.voter);
         return;
@@ -531,13 +658,18 @@ void HotStuffCore::on_receive_vote(const Vote &vote) {
     if (qsize + 1 == config.nmajority)
     {
         qc->compute();
-        update_hqc(blk, qc);
+#ifdef HOTSTUFF_BLK_PROFILE
+        blk_profiler.rec(blk->get_hash(), BlockProfiler::QC_FORMED);
+#endif
+        /* the certificate is complete: from now on it is only shared */
+        update_hqc(blk, quorum_cert_t(qc.unwrap()));
         on_qc_finish(blk);
     }
 }
 
 // Us
-void HotStuffCore::on_local_order (ReplicaID proposer, const std::vector<uint256_t> &order, bool is_reorder) {
+void HotStuffCore::on_local_order (ReplicaID proposer, const std::vector<cmd_id_t> &order, bool is_reorder) {
+    HOTSTUFF_ALLOC_SCOPE(LOCAL_ORDER);
     HOTSTUFF_LOG_DEBUG("[[on_local_order]] [R-%d] [L-%d] START", get_id(), proposer);
     /** Add seen but Unproposed commands to the local order **/
     auto cmds = order;
@@ -571,7 +703,15 @@ void HotStuffCore::on_local_order (ReplicaID proposer, const std::vector<uint256
     // std::vector<std::pair<uint256_t, uint256_t>> l_update;
     /** create LocalOrder struct Object **/
     //LocalOrder local_order = LocalOrder(get_id(), cmds, l_update, this);
-    LocalOrder local_order = LocalOrder(get_id(), cmds, this);
+    std::vector<Hash256> cmd_hashes;
+    cmd_hashes.reserve(cmds.size());
+    for(cmd_id_t cmd: cmds){
+        cmd_hashes.push_back(storage->get_cmd_hash(cmd));
+    }
+    if (CmdTracer::is_enabled())
+        for (const auto &cmd: cmd_hashes)
+            CmdTracer::record(cmd, TraceEvent::LOCAL_ORDER);
+    LocalOrder local_order = LocalOrder(get_id(), cmd_hashes, this);
     /** send local order to leader **/
 
 #ifdef HOTSTUFF_ENABLE_LOG_DEBUG
@@ -585,6 +725,7 @@ void HotStuffCore::on_local_order (ReplicaID proposer, const std::vector<uint256
 
 // Us
 bool HotStuffCore::on_receive_local_order (const LocalOrder &local_order, const std::vector<block_t> &parents) {
+    HOTSTUFF_ALLOC_SCOPE(LOCAL_ORDER);
     LOG_PROTO("got %s", std::string(local_order).c_str());
     LOG_PROTO("now state: %s", std::string(*this).c_str());
     
@@ -599,31 +740,23 @@ bool HotStuffCore::on_receive_local_order (const LocalOrder &local_order, const
     /** add new local order to the storage **/
     //storage->add_local_order(local_order.initiator, local_order.ordered_hashes, local_order.l_update);
     storage->add_local_order(local_order.initiator, local_order.ordered_hashes);
+    if (CmdTracer::is_enabled())
+        for (const auto &cmd: local_order.ordered_hashes)
+            CmdTracer::record(cmd, TraceEvent::LEADER_MERGE);
 
     /** Trigger FairPropose() and FairUpdate() **/
     if(storage->get_local_order_cache_size() >= config.nmajority){
         // Check if the commands in front of all the queues are proposed OR not
         std::vector<ReplicaID> replicas = storage->get_ordered_hash_replia_vector();
         for(ReplicaID replica: replicas){
-            std::vector<uint256_t> unproposed_hashes;
-            for(uint256_t tx_hash: storage->get_ordered_hash_vector(replica)){
-                if(!storage->is_cmd_proposed(tx_hash)){
-                    unproposed_hashes.push_back(tx_hash);
-                }
-            }
-            if(unproposed_hashes.size() < storage->get_ordered_hash_vector(replica).size()){
-                storage->clear_front_ordered_hash(replica);
-                if(!unproposed_hashes.empty()){
-                    storage->add_ordered_hash_to_front(replica, unproposed_hashes);
-                }
-            }
+            storage->clear_proposed_from_front_ordered_hash(replica);
         }
 
 #ifdef HOTSTUFF_ENABLE_LOG_DEBUG
 // #ifdef NOTDEFINE
         for(auto const &replica: storage->get_ordered_hash_replia_vector()){
             for(auto const &h: storage->get_ordered_hash_vector(replica)){
-                HOTSTUFF_LOG_DEBUG("[[on_receive_local_order]] [fromR-%d] [thisL-%d] Global Order started for (%d) = %.10s", local_order.initiator, get_id(), replica, get_hex(h).c_str());
+                HOTSTUFF_LOG_DEBUG("[[on_receive_local_order]] [fromR-%d] [thisL-%d] Global Order started for (%d) = %.10s", local_order.initiator, get_id(), replica, get_hex(storage->get_cmd_hash(h)).c_str());
             }
         }
 #endif
@@ -634,37 +767,58 @@ bool HotStuffCore::on_receive_local_order (const LocalOrder &local_order, const
 }
 
 // Us
-std::unordered_map<ReplicaID, std::vector<uint256_t>> HotStuffCore::fair_propose() {
+std::unordered_map<ReplicaID, std::vector<Hash256>> HotStuffCore::fair_propose() {
+    HOTSTUFF_ALLOC_SCOPE(PROPOSE);
     HOTSTUFF_LOG_DEBUG("[[fairPropose START]] [R-%d]", get_id());
     /** (1) get those replicas from which Leader has received their local order **/
     std::vector<ReplicaID> replicas = storage->get_ordered_hash_replia_vector();
 
     /** (2) Create an empty merge orders = (R,O) **/
-    std::unordered_map<ReplicaID, std::vector<uint256_t>> orders;
+    std::unordered_map<ReplicaID, std::vector<Hash256>> orders;
     size_t repLen = replicas.size();
     if(repLen==0){
         return orders;
     }
-    std::vector<uint256_t> ordered_hash = storage->get_ordered_hash_vector(replicas[0]);
-    orders[replicas[0]] = ordered_hash;
+    /* the merge runs on command ids, so membership is a flat array */
+    size_t id_bound = storage->get_cmd_id_bound();
+    std::vector<uint8_t> seen(id_bound, 0);
+    /* the first replica's order is extended to the union of all orders */
+    std::vector<cmd_id_t> merged = storage->get_ordered_hash_vector(replicas[0]);
+    for(cmd_id_t cmd: merged){
+        seen[cmd] = 1;
+    }
     for(size_t i=1;i<repLen;i++){
-        std::vector<uint256_t> ordered_hash = storage->get_ordered_hash_vector(replicas[i]);
-        orders[replicas[i]] = ordered_hash;
-        std::vector<uint256_t> vc = orders[replicas[0]];
-        for(uint256_t cmd: ordered_hash){
-            if(std::find(vc.begin(),vc.end(),cmd)==vc.end()){
-                orders[replicas[0]].push_back(cmd);
+        for(cmd_id_t cmd: storage->get_ordered_hash_vector(replicas[i])){
+            if(!seen[cmd]){
+                seen[cmd] = 1;
+                merged.push_back(cmd);
             }
         }
     }
-    std::vector<uint256_t> ordered_hash = orders[replicas[0]];
-    for(size_t j=1;j<repLen;j++){
-        std::vector<uint256_t> vc = orders[replicas[j]];
-        for(uint256_t cmd: ordered_hash){
-            if(std::find(vc.begin(),vc.end(),cmd)==vc.end()){
-                orders[replicas[j]].push_back(cmd);
+    /* every other order is padded with the commands it has not seen */
+    std::vector<uint8_t> has(id_bound, 0);
+    for(size_t j=0;j<repLen;j++){
+        const auto &vc = j == 0 ? merged : storage->get_ordered_hash_vector(replicas[j]);
+        auto &order = orders[replicas[j]];
+        order.reserve(merged.size());
+        for(cmd_id_t cmd: vc){
+            order.push_back(storage->get_cmd_hash(cmd));
+            has[cmd] = 1;
+        }
+        for(cmd_id_t cmd: merged){
+            if(!has[cmd]){
+                order.push_back(storage->get_cmd_hash(cmd));
             }
         }
+        for(cmd_id_t cmd: vc){
+            has[cmd] = 0;
+        }
+    }
+
+    /* Store proposed commands (this also keeps their ids alive once the
+     * local orders below are dropped) */
+    for(cmd_id_t cmd: merged){
+        storage->add_to_proposed_cmds_cache(cmd);
     }
 
     // for(ReplicaID replica: replicas){
@@ -856,10 +1010,55 @@ void HotStuffCore::reorder(ReplicaID proposer) {
 
     HOTSTUFF_LOG_DEBUG("[[reorder]] [R-%d] invoked", get_id());
     /** Create Local Order **/
-    on_local_order(proposer, std::vector<uint256_t>(), true);  
+    on_local_order(proposer, std::vector<cmd_id_t>(), true);  
 }
 
 /*** end HotStuff protocol logic ***/
+
+bool HotStuffCore::queue_local_cmd(cmd_id_t cid, ReplicaID proposer, uint32_t blk_size) {
+    local_order_buffer.push(cid);
+    if (local_order_buffer.size() < blk_size) return false;
+    std::vector<cmd_id_t> cmds;
+    cmds.reserve(blk_size);
+    for (uint32_t i = 0; i < blk_size; i++)
+    {
+        cmds.push_back(local_order_buffer.front());
+        local_order_buffer.pop();
+    }
+    HOTSTUFF_LOG_DEBUG("[[queue_local_cmd]] [R-%d] [L-%d] %u commands sent to the proposer", get_id(), proposer, blk_size);
+    on_local_order(proposer, cmds);
+    for (cmd_id_t cmd: cmds)
+        storage->release_cmd(cmd);
+    return true;
+}
+
+void HotStuffCore::process_local_order(PaceMaker &pmaker, const LocalOrder &local_order) {
+    HOTSTUFF_ALLOC_SCOPE(LOCAL_ORDER);
+    uint64_t t = Histogram::now_us();
+    bool ready = on_receive_local_order(local_order, pmaker.get_parents());
+    local_order_merge_time.observe_since(t);
+    if (!ready) return;
+    /* (the proposed commands are recorded by fair_propose itself) */
+    t = Histogram::now_us();
+    auto orders = fair_propose();
+    fair_propose_time.observe_since(t);
+    HOTSTUFF_LOG_DEBUG("[[process_local_order]] [fromR-%d] [thisL-%d] Cleared Local Order", local_order.initiator, get_id());
+    /** Create a new proposal block and broadcast to the replicas **/
+    pmaker.beat().then([this, &pmaker, orders = std::move(orders)](ReplicaID proposer) {
+        if (proposer == get_id())
+            on_propose(orders, pmaker.get_parents());
+    });
+}
+
+void HotStuffCore::route_vote(PaceMaker &pmaker, ReplicaID last_proposer, const Vote &vote,
+                            std::function<void(ReplicaID, const Vote &)> send) {
+    pmaker.beat_resp(last_proposer).then([this, vote, send = std::move(send)](ReplicaID proposer) {
+        if (proposer == get_id())
+            on_receive_vote(vote);
+        else
+            send(proposer, vote);
+    });
+}
 void HotStuffCore::on_init(uint32_t nfaulty, double fairness_parameter) {   // Us
     config.nmajority = config.nreplicas - nfaulty;
     config.fairness_parameter = fairness_parameter;                 // Us
@@ -867,12 +1066,12 @@ void HotStuffCore::on_init(uint32_t nfaulty, double fairness_parameter) {   // U
     //config.solid_tx_threshold = get_solid_tx_threshold();           // Themis
     //config.non_blank_tx_threshold = get_non_blank_tx_threshold();   // Themis
     //config.tx_edge_threshold = get_tx_edge_threshold();             // Themis
-    HOTSTUFF_LOG_INFO("[[on_init]] [R-%d]  nmajority = %d, fairness_parameter = %f", get_id(), config.nmajority, config.fairness_parameter);
-    b0->qc = create_quorum_cert(b0->get_hash());
-    b0->qc->compute();
-    b0->self_qc = b0->qc->clone();
+    HOTSTUFF_LOG_DEBUG("[[on_init]] [R-%d]  nmajority = %d, fairness_parameter = %f", get_id(), config.nmajority, config.fairness_parameter);
+    auto qc = create_quorum_cert(b0->get_hash());
+    qc->compute();
+    b0->qc = quorum_cert_t(qc.unwrap());
     b0->qc_ref = b0;
-    hqc = std::make_pair(b0, b0->qc->clone());
+    hqc = std::make_pair(b0, b0->qc);
 }
 
 // // Themis
@@ -908,8 +1107,16 @@ void HotStuffCore::prune(uint32_t staleness) {
     /* skip the blocks */
     for (start = b_exec; staleness; staleness--, start = start->parents[0])
         if (!start->parents.size()) return;
+    /* everything below start goes away with the walk below; the arena
+     * frees those height windows in bulk as soon as they are unused */
+    storage->prune_blk_arena(start->height);
+    /* from now on, no ancestor below start is looked up, so the jump
+     * pointers leading there are never followed */
+    pruned_height = start->height;
+    tails.prune(pruned_height);
     std::stack<block_t> s;
     start->qc_ref = nullptr;
+    start->skip = nullptr;
     s.push(start);
     while (!s.empty())
     {
@@ -28,14 +28,14 @@ QuorumCertSecp256k1::QuorumCertSecp256k1(
     rids.clear();
 }
    
-bool QuorumCertSecp256k1::verify(const ReplicaConfig &config) {
+bool QuorumCertSecp256k1::verify(const ReplicaConfig &config) const {
     if (sigs.size() < config.nmajority) return false;
-    for (size_t i = 0; i < rids.size(); i++)
+    for (size_t i = 0, k = 0; i < rids.size(); i++)
         if (rids.get(i))
         {
             HOTSTUFF_LOG_DEBUG("checking cert(%d), obj_hash=%s",
                                 i, get_hex10(obj_hash).c_str());
-            if (!sigs[i].verify(obj_hash,
+            if (!SigSecp256k1::verify(sigs[k++], obj_hash,
                             static_cast<const PubKeySecp256k1 &>(config.get_pubkey(i)),
                             secp256k1_default_verify_ctx))
             return false;
@@ -43,18 +43,19 @@ bool QuorumCertSecp256k1::verify(const ReplicaConfig &config) {
     return true;
 }
 
-promise_t QuorumCertSecp256k1::verify(const ReplicaConfig &config, VeriPool &vpool) {
+promise_t QuorumCertSecp256k1::verify(const ReplicaConfig &config, VeriPool &vpool) const {
     if (sigs.size() < config.nmajority)
         return promise_t([](promise_t &pm) { pm.resolve(false); });
     std::vector<promise_t> vpm;
-    for (size_t i = 0; i < rids.size(); i++)
+    vpm.reserve(sigs.size());
+    for (size_t i = 0, k = 0; i < rids.size(); i++)
         if (rids.get(i))
         {
             HOTSTUFF_LOG_DEBUG("checking cert(%d), obj_hash=%s",
                                 i, get_hex10(obj_hash).c_str());
             vpm.push_back(vpool.verify(new Secp256k1VeriTask(obj_hash,
                             static_cast<const PubKeySecp256k1 &>(config.get_pubkey(i)),
-                            sigs[i])));
+                            sigs[k++])));
         }
     return promise::all(vpm).then([](const promise::values_t &values) {
         for (const auto &v: values)
@@ -14,6 +14,8 @@
  * limitations under the License.
  */
 
+#include <algorithm>
+
 #include "hotstuff/entity.h"
 #include "hotstuff/hotstuff.h"
 
@@ -37,98 +39,78 @@ void Block::serialize(DataStream &s) const {
     for (const auto &hash: parent_hashes){
         s << hash;
     }
-    
-    // /** Serialize graph **/
-    // HOTSTUFF_LOG_DEBUG("[[serialize]] G size = %ld", graph.size());
-    // s << htole((uint32_t)graph.size());
 
     /** Serialize orders **/
     HOTSTUFF_LOG_DEBUG("[[serialize]] Orders size = %ld",orders.size());
     s << htole((uint32_t)orders.size());
+    if (orders.empty()){
+        s << *qc << htole((uint32_t)extra.size()) << extra;
+        return;
+    }
 
-    // /* store all the graph nodes into a vector */
-    // std::vector<uint256_t> keys;
-    // for (auto g: graph){
-    //     keys.push_back(g.first);
-    // }
-
-    /* store all the orders replicas into a vector */
+    /* the block hash is taken over this encoding, so the replicas are
+     * written in a canonical (sorted) order */
     std::vector<ReplicaID> replicas;
-    for (auto o: orders){
+    replicas.reserve(orders.size());
+    for (const auto &o: orders){
         replicas.push_back(o.first);
     }
+    std::sort(replicas.begin(), replicas.end());
 
-    /*store all the cmds into a vector*/
-    std::vector<uint256_t> cmds;
-    for (auto c: orders.at(replicas[0])){
-        cmds.push_back(c);
+    /* all the commands appearing in the orders, sorted, sent only once */
+    std::vector<Hash256> cmds;
+    for (const auto &o: orders){
+        cmds.insert(cmds.end(), o.second.begin(), o.second.end());
     }
-
-    /* Sort all the CmdID */
-    std::sort(cmds.begin(), cmds.end(), 
-        [](const uint256_t & a, const uint256_t & b) { return a.operator<(b);});
-
-    /* Create a node_to_idx hash map */
-    std::unordered_map<uint256_t, size_t> cmd_to_idx;
-    for(size_t idx=0; idx<cmds.size(); idx++){
-        cmd_to_idx[cmds[idx]] = idx;
+    std::sort(cmds.begin(), cmds.end());
+    cmds.erase(std::unique(cmds.begin(), cmds.end()), cmds.end());
+    if (cmds.size() > UINT16_MAX)
+        throw HotStuffInvalidEntity("too many commands in a block: %lu", cmds.size());
+
+    size_t nidx = 0;
+    for (const auto &o: orders){
+        nidx += o.second.size();
     }
-
-    /* Optimize graph serialization */
+    s.reserve(sizeof(uint32_t) + cmds.size() * sizeof(Hash256) +
+            replicas.size() * (sizeof(ReplicaID) + sizeof(uint32_t)) +
+            nidx * sizeof(uint16_t));
+    s << htole((uint32_t)cmds.size());
+    put_hash_array(s, cmds);
+
+    /* each local order is a list of indices into the command table (found
+     * by bisection, as cmds is sorted), written at once */
+    std::vector<uint16_t> idx;
     for (auto const &replica: replicas){
-        // HOTSTUFF_LOG_DEBUG("[[serialize]] added replica = %.10s", replica.to_hex().c_str());
-        s << replica;
-
-        std::vector<uint64_t> vals;
-        for(int i=0; i<MAX_PROPOSAL_SIZE_SUPPORTED/64; i++){
-            vals.push_back(0x00);
-        }
-        for(auto const &cmd: orders.at(replica)){
-            // HOTSTUFF_LOG_DEBUG("[[serialize]] neighbor is = %.10s", neighbor.to_hex().c_str());
-            int group_i = cmd_to_idx[cmd]/64;
-            vals[group_i] = vals[group_i] | (1UL << (node_to_idx[cmd]-(64*group_i)));
-            // HOTSTUFF_LOG_DEBUG("[[serialize]] group number = %d, group = 0x%x, bit set = %d", group_i, vals[group_i], node_to_idx[neighbor]-(64*group_i));
-        }
-
-        /* IMPORTANT: Max block size supported is 64*8*4=2176 */
-        for(auto val: vals){
-            // HOTSTUFF_LOG_DEBUG("[[serialize]] added group = 0x%x (%lu)", val, val);
-            s << htole(val);
+        const auto &order = orders.at(replica);
+        s << htole(replica) << htole((uint32_t)order.size());
+        idx.clear();
+        for(auto const &cmd: order){
+            idx.push_back(htole((uint16_t)(
+                std::lower_bound(cmds.begin(), cmds.end(), cmd) - cmds.begin())));
         }
+        auto p = reinterpret_cast<const uint8_t *>(idx.data());
+        s.put_data(p, p + idx.size() * sizeof(uint16_t));
     }
-    // for (auto const &key: keys){
-    //     // HOTSTUFF_LOG_DEBUG("[[serialize]] added key = %.10s", key.to_hex().c_str());
-    //     s << key;
-
-    //     std::vector<uint64_t> vals;
-    //     for(int i=0; i<MAX_PROPOSAL_SIZE_SUPPORTED/64; i++){
-    //         vals.push_back(0x00);
-    //     }
-    //     for(auto const &neighbor: graph.at(key)){
-    //         // HOTSTUFF_LOG_DEBUG("[[serialize]] neighbor is = %.10s", neighbor.to_hex().c_str());
-    //         int group_i = node_to_idx[neighbor]/64;
-    //         vals[group_i] = vals[group_i] | (1UL << (node_to_idx[neighbor]-(64*group_i)));
-    //         // HOTSTUFF_LOG_DEBUG("[[serialize]] group number = %d, group = 0x%x, bit set = %d", group_i, vals[group_i], node_to_idx[neighbor]-(64*group_i));
-    //     }
-
-    //     /* IMPORTANT: Max block size supported is 64*8*4=2176 */
-    //     for(auto val: vals){
-    //         // HOTSTUFF_LOG_DEBUG("[[serialize]] added group = 0x%x (%lu)", val, val);
-    //         s << htole(val);
-    //     }
-    // }
-
-    /** Serialize e_update **/
-    // s << htole((uint32_t)e_update.size());
-    // for (auto edge: e_update){
-    //     s << edge.first;
-    //     s << edge.second;
-    // }
 
     /** Serialize QC **/
     s << *qc << htole((uint32_t)extra.size()) << extra;
 }
 
+size_t Block::get_serialized_size() const {
+    size_t size = sizeof(uint32_t) +
+        parent_hashes.size() * uint256_t::serialized_size +
+        sizeof(uint32_t);
+    if (!orders.empty())
+    {
+        size += sizeof(uint32_t);
+        for (const auto &o: orders)
+            size += sizeof(ReplicaID) + sizeof(uint32_t) +
+                    o.second.size() * (sizeof(Hash256) + sizeof(uint16_t));
+    }
+    return size + (qc ? qc->get_serialized_size() : 0) +
+            sizeof(uint32_t) + extra.size();
+}
+
 // Themis
 // void Block::unserialize(DataStream &s, HotStuffCore *hsc) {
 //     uint32_t n;
@@ -157,75 +139,56 @@ void Block::serialize(DataStream &s) const {
 //     this->hash = salticidae::get_hash(*this);
 // }
 
-// Themis
+// Us
 void Block::unserialize(DataStream &s, HotStuffCore *hsc) {
     uint32_t n;
 
     /** unserialize parent hashes **/
+    /* (the counts come from the wire: they are checked against what is
+     * left of the stream before allocating anything) */
     s >> n;
     n = letoh(n);
+    if (n > s.size() / uint256_t::serialized_size)
+        throw HotStuffInvalidEntity("truncated block parents");
     parent_hashes.resize(n);
     for (auto &hash: parent_hashes){
         s >> hash;
     }
-        
 
     /** unserialize orders **/
     s >> n;
     n = letoh(n);
     HOTSTUFF_LOG_DEBUG("[[unserialize]] Order size = %ld", n);
-
-    std::vector<std::pair<ReplicaID, std::vector<uint64_t>>> orders_matrix;
-    //std::vector<std::pair<uint256_t, std::vector<uint64_t>>> adj_matrix;
-    //uint256_t key;
-    ReplicaID replica;
-    uint64_t val;
-    for(size_t key_i=0; key_i<n; key_i++){
-        s >> replica;
-        // HOTSTUFF_LOG_DEBUG("[[unserialize]] extracted key = %.10s", key.to_hex().c_str());
-        std::vector<uint64_t> vals;
-
-        for(int i=0; i<MAX_PROPOSAL_SIZE_SUPPORTED/64; i++){
-            s >> val;
-            val = letoh(val);
-            // HOTSTUFF_LOG_DEBUG("[[unserialize]] extracted group = %.ld", val);
-            vals.push_back(val);
-        }
-
-        orders_matrix.push_back(std::make_pair(replica, vals));
-    }
-    /* Create a graph using adj matrix */
-    // HOTSTUFF_LOG_DEBUG("[[unserialize]] number of nodes = %ld", adj_matrix.size());
-    for(auto const &element: orders_matrix){
-        orders[element.first] = std::vector<uint256_t>();
-        //graph[element.first] = std::unordered_set<uint256_t>();
-        // HOTSTUFF_LOG_DEBUG("[[unserialize]] adj matrix key picked = %.10s", element.first.to_hex().c_str());
-        for(int group_i=0; group_i<MAX_PROPOSAL_SIZE_SUPPORTED/64; group_i++){
-            uint64_t group = element.second[group_i];
-            // HOTSTUFF_LOG_DEBUG("[[unserialize]] group number = %d, group = 0x%x", group_i, group);
-            if(group==0){
-                continue;
-            }
-            for(int i=0; i<64; i++){
-                if(((uint64_t)group & (1UL<<i)) != 0){
-                    // HOTSTUFF_LOG_DEBUG("[[unserialize]] Matrix index = %d, anding = 0x%x", (i+(group_i*64)), group&(1<<i));
-                    //graph[element.first].insert(adj_matrix[i+(group_i*64)].first);
-                    orders[element.first].insert(orders_matrix[i+(group_i*64)].first);
-                    // HOTSTUFF_LOG_DEBUG("[[unserialize]] Created graph = %.10s -> %.10s", element.first.to_hex().c_str(), adj_matrix[i+(group_i*64)].first.to_hex().c_str());
-                }
+    orders.clear();
+    if (n > 0){
+        uint32_t ncmds;
+        s >> ncmds;
+        ncmds = letoh(ncmds);
+        if (ncmds > UINT16_MAX)
+            throw HotStuffInvalidEntity("too many commands in a block: %u", ncmds);
+        std::vector<Hash256> cmds;
+        get_hash_array(s, cmds, ncmds);
+        for(size_t replica_i=0; replica_i<n; replica_i++){
+            ReplicaID replica;
+            uint32_t len;
+            s >> replica >> len;
+            replica = letoh(replica);
+            len = letoh(len);
+            if (len > s.size() / sizeof(uint16_t))
+                throw HotStuffInvalidEntity("truncated block orders");
+            auto &order = orders[replica];
+            order.reserve(len);
+            for(uint32_t i=0; i<len; i++){
+                uint16_t idx;
+                s >> idx;
+                idx = letoh(idx);
+                if (idx >= cmds.size())
+                    throw HotStuffInvalidEntity("invalid command index in block orders");
+                order.push_back(cmds[idx]);
             }
         }
     }
 
-    /** unserialize e_update **/
-    // s >> n;
-    // n = letoh(n);
-    // e_update.resize(n);
-    // for (auto &edge: e_update) {
-    //     s >> edge.first;
-    //     s >> edge.second;
-    // }
-
     /** unserialize QC **/
     qc = hsc->parse_quorum_cert(s);
     s >> n;
@@ -240,6 +203,34 @@ void Block::unserialize(DataStream &s, HotStuffCore *hsc) {
     this->hash = salticidae::get_hash(*this);
 }
 
+Block *Block::get_ancestor(uint32_t target) {
+    if (target > height) return nullptr;
+    Block *b = this;
+    uint32_t h = height;
+    while (h > target)
+    {
+        uint32_t h_skip = skip_height(h);
+        uint32_t h_skip_prev = skip_height(h - 1);
+        /* take the jump unless it overshoots, or the parent has a jump that
+         * is a better fit */
+        if (b->skip != nullptr &&
+            (h_skip == target ||
+             (h_skip > target &&
+              !(h_skip_prev + 2 < h_skip && h_skip_prev >= target))))
+        {
+            b = b->skip;
+            h = h_skip;
+        }
+        else
+        {
+            if (b->parents.empty()) return nullptr; /* pruned */
+            b = b->parents[0].get();
+            h--;
+        }
+    }
+    return b;
+}
+
 bool Block::verify(const HotStuffCore *hsc) const {
     if (qc->get_obj_hash() == hsc->get_genesis()->get_hash())
         return true;
@@ -18,6 +18,11 @@
 #include "hotstuff/hotstuff.h"
 #include "hotstuff/client.h"
 #include "hotstuff/liveness.h"
+#include "hotstuff/stack_sampler.h"
+
+#ifdef HOTSTUFF_ALLOC_PROFILE
+#include <sstream>
+#endif
 
 using salticidae::static_pointer_cast;
 
@@ -28,21 +33,29 @@ using salticidae::static_pointer_cast;
 namespace hotstuff {
 
 const opcode_t MsgPropose::opcode;
-MsgPropose::MsgPropose(const Proposal &proposal) { serialized << proposal; }
+MsgPropose::MsgPropose(const Proposal &proposal):
+        serialized(BufferPool::acquire(proposal.get_serialized_size())) {
+    serialized << proposal;
+}
 void MsgPropose::postponed_parse(HotStuffCore *hsc) {
     proposal.hsc = hsc;
     serialized >> proposal;
 }
 
 const opcode_t MsgVote::opcode;
-MsgVote::MsgVote(const Vote &vote) { serialized << vote; }
+MsgVote::MsgVote(const Vote &vote):
+        serialized(BufferPool::acquire(vote.get_serialized_size())) {
+    serialized << vote;
+}
 void MsgVote::postponed_parse(HotStuffCore *hsc) {
     vote.hsc = hsc;
     serialized >> vote;
 }
 
 const opcode_t MsgReqBlock::opcode;
-MsgReqBlock::MsgReqBlock(const std::vector<uint256_t> &blk_hashes) {
+MsgReqBlock::MsgReqBlock(const std::vector<uint256_t> &blk_hashes):
+        serialized(BufferPool::acquire(sizeof(uint32_t) +
+                    blk_hashes.size() * uint256_t::serialized_size)) {
     serialized << htole((uint32_t)blk_hashes.size());
     for (const auto &h: blk_hashes)
         serialized << h;
@@ -58,6 +71,9 @@ MsgReqBlock::MsgReqBlock(DataStream &&s) {
 
 const opcode_t MsgRespBlock::opcode;
 MsgRespBlock::MsgRespBlock(const std::vector<block_t> &blks) {
+    size_t size = sizeof(uint32_t);
+    for (const auto &blk: blks) size += blk->get_serialized_size();
+    serialized = DataStream(BufferPool::acquire(size));
     serialized << htole((uint32_t)blks.size());
     for (auto blk: blks) serialized << *blk;
 }
@@ -78,7 +94,10 @@ void MsgRespBlock::postponed_parse(HotStuffCore *hsc) {
 
 // Us
 const opcode_t MsgLocalOrder::opcode;
-MsgLocalOrder::MsgLocalOrder(const LocalOrder &local_order) { serialized << local_order; }
+MsgLocalOrder::MsgLocalOrder(const LocalOrder &local_order):
+        serialized(BufferPool::acquire(local_order.get_serialized_size())) {
+    serialized << local_order;
+}
 void MsgLocalOrder::postponed_parse(HotStuffCore *hsc) {
     local_order.hsc = hsc;
     serialized >> local_order;
@@ -87,13 +106,13 @@ void MsgLocalOrder::postponed_parse(HotStuffCore *hsc) {
 
 // TODO: improve this function
 void HotStuffBase::exec_command(uint256_t cmd_hash, commit_cb_t callback) {
-    cmd_pending.enqueue(std::make_pair(cmd_hash, callback));
+    HOTSTUFF_ALLOC_SCOPE(INGRESS);
+    mstat.cmd_received.inc();
+    cmd_pending.enqueue(PendingCmd{cmd_hash, std::move(callback), Histogram::now_us()});
 }
 
 void HotStuffBase::on_fetch_blk(const block_t &blk) {
-#ifdef HOTSTUFF_BLK_PROFILE
-    blk_profiler.get_tx(blk->get_hash());
-#endif
+    HOTSTUFF_ALLOC_SCOPE(DELIVER);
     LOG_DEBUG("fetched %.10s", get_hex(blk->get_hash()).c_str());
     part_fetched++;
     fetched++;
@@ -102,12 +121,16 @@ void HotStuffBase::on_fetch_blk(const block_t &blk) {
     auto it = blk_fetch_waiting.find(blk_hash);
     if (it != blk_fetch_waiting.end())
     {
-        it->second.resolve(blk);
+        /* take the promise out first: resolving may start new fetches,
+         * which would move entries around in the table */
+        promise_t pm = static_cast<promise_t &>(*it->second);
         blk_fetch_waiting.erase(it);
+        pm.resolve(blk);
     }
 }
 
 bool HotStuffBase::on_deliver_blk(const block_t &blk) {
+    HOTSTUFF_ALLOC_SCOPE(DELIVER);
     const uint256_t &blk_hash = blk->get_hash();
     bool valid;
     /* sanity check: all parents must be delivered */
@@ -120,6 +143,10 @@ bool HotStuffBase::on_deliver_blk(const block_t &blk) {
         part_parent_size += blk->get_parent_hashes().size();
         part_delivered++;
         delivered++;
+#ifdef HOTSTUFF_BLK_PROFILE
+        blk_profiler.seen(blk_hash, blk->get_height(),
+                        BlockProfiler::DELIVERED, false);
+#endif
     }
     else
     {
@@ -162,17 +189,13 @@ promise_t HotStuffBase::async_fetch_blk(const uint256_t &blk_hash,
     auto it = blk_fetch_waiting.find(blk_hash);
     if (it == blk_fetch_waiting.end())
     {
-#ifdef HOTSTUFF_BLK_PROFILE
-        blk_profiler.rec_tx(blk_hash, false);
-#endif
-        it = blk_fetch_waiting.insert(
-            std::make_pair(
+        it = blk_fetch_waiting.emplace(
                 blk_hash,
-                BlockFetchContext(blk_hash, this))).first;
+                new BlockFetchContext(blk_hash, this)).first;
     }
     if (replica != nullptr)
-        it->second.add_replica(*replica, fetch_now);
-    return static_cast<promise_t &>(it->second);
+        it->second->add_replica(*replica, fetch_now);
+    return static_cast<promise_t &>(*it->second);
 }
 
 promise_t HotStuffBase::async_deliver_blk(const uint256_t &blk_hash,
@@ -210,8 +233,11 @@ promise_t HotStuffBase::async_deliver_blk(const uint256_t &blk_hash,
 }
 
 void HotStuffBase::propose_handler(MsgPropose &&msg, const Net::conn_t &conn) {
+    HOTSTUFF_ALLOC_SCOPE(DELIVER);
     const PeerId &peer = conn->get_peer_id();
     if (peer.is_null()) return;
+    record_recv(msg);
+    count_recv(msg);
     msg.postponed_parse(this);
     auto &prop = msg.proposal;
     block_t blk = prop.blk;
@@ -223,6 +249,11 @@ void HotStuffBase::propose_handler(MsgPropose &&msg, const Net::conn_t &conn) {
         LOG_WARN("invalid proposal from %d", prop.proposer);
         return;
     }
+#ifdef HOTSTUFF_BLK_PROFILE
+    /* the height is only known upon delivery */
+    blk_profiler.seen(blk->get_hash(), 0, BlockProfiler::RECEIVED,
+                    blk->get_orders().count(get_id()));
+#endif
     promise::all(std::vector<promise_t>{
         async_deliver_blk(blk->get_hash(), peer)
     }).then([this, prop = std::move(prop)]() {
@@ -252,8 +283,11 @@ void HotStuffBase::propose_handler(MsgPropose &&msg, const Net::conn_t &conn) {
 // }
 
 void HotStuffBase::vote_handler(MsgVote &&msg, const Net::conn_t &conn) {
+    HOTSTUFF_ALLOC_SCOPE(VOTE);
     const auto &peer = conn->get_peer_id();
     if (peer.is_null()) return;
+    record_recv(msg);
+    count_recv(msg);
     msg.postponed_parse(this);
     //auto &vote = msg.vote;
     RcObj<Vote> v(new Vote(std::move(msg.vote)));
@@ -269,8 +303,10 @@ void HotStuffBase::vote_handler(MsgVote &&msg, const Net::conn_t &conn) {
 }
 
 void HotStuffBase::req_blk_handler(MsgReqBlock &&msg, const Net::conn_t &conn) {
+    HOTSTUFF_ALLOC_SCOPE(DELIVER);
     const PeerId replica = conn->get_peer_id();
     if (replica.is_null()) return;
+    count_recv(msg);
     auto &blk_hashes = msg.blk_hashes;
     std::vector<promise_t> pms;
     for (const auto &h: blk_hashes)
@@ -282,11 +318,16 @@ void HotStuffBase::req_blk_handler(MsgReqBlock &&msg, const Net::conn_t &conn) {
             auto blk = promise::any_cast<block_t>(v);
             blks.push_back(blk);
         }
-        pn.send_msg(MsgRespBlock(blks), replica);
+        MsgRespBlock resp(blks);
+        count_sent(resp);
+        pn.send_msg(std::move(resp), replica);
     });
 }
 
 void HotStuffBase::resp_blk_handler(MsgRespBlock &&msg, const Net::conn_t &) {
+    HOTSTUFF_ALLOC_SCOPE(DELIVER);
+    record_recv(msg);
+    count_recv(msg);
     msg.postponed_parse(this);
     for (const auto &blk: msg.blks)
         if (blk) on_fetch_blk(blk);
@@ -294,8 +335,11 @@ void HotStuffBase::resp_blk_handler(MsgRespBlock &&msg, const Net::conn_t &) {
 
 // Us
 void HotStuffBase::local_order_handler(MsgLocalOrder &&msg, const Net::conn_t &conn) {
+    HOTSTUFF_ALLOC_SCOPE(LOCAL_ORDER);
     const PeerId &peer = conn->get_peer_id();
     if (peer.is_null()) return;
+    record_recv(msg);
+    count_recv(msg);
     msg.postponed_parse(this);
     auto &local_order = msg.local_order;
     if (peer != get_config().get_peer_id(local_order.initiator))
@@ -304,34 +348,7 @@ void HotStuffBase::local_order_handler(MsgLocalOrder &&msg, const Net::conn_t &c
         return;
     }
 
-    process_local_order(local_order);
-    
-}
-
-// Us
-void HotStuffBase::process_local_order(const LocalOrder &local_order){
-    if(on_receive_local_order(local_order, pmaker->get_parents())==true){
-        /* FairPropose() */
-        //std::unordered_map<uint256_t, std::unordered_set<uint256_t>> graph = fair_propose();
-        std::unordered_map<ReplicaID,std::vector<uint256_t>> orders = fair_propose();
-        ///* FairUpdate() */
-        //std::vector<std::pair<uint256_t, uint256_t>> e_update = fair_update();
-        /* Store proposed commands */
-        for(auto cmd: orders.begin()->second){
-            storage->add_to_proposed_cmds_cache(cmd);
-        }
-        // for(auto g: graph){
-        //     storage->add_to_proposed_cmds_cache(g.first);
-        // }
-        // storage->clear_local_order();
-        HOTSTUFF_LOG_DEBUG("[[process_local_order]] [fromR-%d] [thisL-%d] Cleared Local Order", local_order.initiator, get_id());
-        /** Create a new proposal block and broadcast to the replicas **/
-        pmaker->beat().then([this, orders = std::move(orders)](ReplicaID proposer) {
-            if (proposer == get_id())
-                //on_propose(graph, e_up, pmaker->get_parents());
-                on_propose(orders,pmaker->get_parents());
-        });
-    }
+    process_local_order(*pmaker, local_order);
 }
 
 
@@ -352,12 +369,17 @@ void HotStuffBase::print_stat() const {
     LOG_INFO("-------- queues -------");
     LOG_INFO("blk_fetch_waiting: %lu", blk_fetch_waiting.size());
     LOG_INFO("blk_delivery_waiting: %lu", blk_delivery_waiting.size());
-    LOG_INFO("decision_waiting: %lu", decision_waiting.size());
+    LOG_INFO("decision_waiting: %lu", decision_waiting_size);
+    LOG_INFO("cmd_table: %lu", storage->get_cmd_table_size());
     LOG_INFO("-------- misc ---------");
     LOG_INFO("fetched: %lu", fetched);
     LOG_INFO("delivered: %lu", delivered);
     LOG_INFO("cmd_cache: %lu", storage->get_cmd_cache_size());
     LOG_INFO("blk_cache: %lu", storage->get_blk_cache_size());
+    LOG_INFO("blk_arena: %lu buckets, %lu chunks (%lu spare)",
+            storage->get_blk_arena().get_nbuckets(),
+            storage->get_blk_arena().get_nchunks(),
+            storage->get_blk_arena().get_nfree_chunks());
     LOG_INFO("------ misc (10s) -----");
     LOG_INFO("fetched: %lu", part_fetched);
     LOG_INFO("delivered: %lu", part_delivered);
@@ -370,6 +392,17 @@ void HotStuffBase::print_stat() const {
             part_delivery_time_min == double_inf ? 0 : part_delivery_time_min,
             part_delivery_time_max);
 
+#ifdef HOTSTUFF_ALLOC_PROFILE
+    {
+        auto now = AllocProfiler::snapshot();
+        LOG_INFO("--- allocations (10s) ---");
+        std::istringstream report(AllocProfiler::report(now - alloc_last, part_decided));
+        for (std::string line; std::getline(report, line);)
+            LOG_INFO("%s", line.c_str());
+        alloc_last = now;
+    }
+#endif
+
     part_parent_size = 0;
     part_fetched = 0;
     part_delivered = 0;
@@ -378,6 +411,9 @@ void HotStuffBase::print_stat() const {
     part_delivery_time = 0;
     part_delivery_time_min = double_inf;
     part_delivery_time_max = 0;
+#ifdef HOTSTUFF_BLK_PROFILE
+    blk_profiler.print_stat();
+#endif
 #ifdef HOTSTUFF_MSG_STAT
     LOG_INFO("--- replica msg. (10s) ---");
     size_t _nsent = 0;
@@ -424,6 +460,8 @@ HotStuffBase::HotStuffBase(uint32_t blk_size,
         vpool(ec, nworker),
         pn(ec, netconfig),
         pmaker(std::move(pmaker)),
+        decision_waiting_size(0),
+        cmd_dequeued(0),
 
         fetched(0), delivered(0),
         nsent(0), nrecv(0),
@@ -434,7 +472,8 @@ HotStuffBase::HotStuffBase(uint32_t blk_size,
         part_gened(0),
         part_delivery_time(0),
         part_delivery_time_min(double_inf),
-        part_delivery_time_max(0)
+        part_delivery_time_max(0),
+        mstat(metrics)
 {
     /* register the handlers for msg from replicas */
     pn.reg_handler(salticidae::generic_bind(&HotStuffBase::propose_handler, this, _1, _2));
@@ -450,11 +489,59 @@ HotStuffBase::HotStuffBase(uint32_t blk_size,
             HOTSTUFF_LOG_WARN("network async error: %s\n", err.what());
         }
     });
+    auto threads = StackSampler::list_threads();
     pn.start();
+    StackSampler::set_new_threads_role(threads, "replica-net");
     pn.listen(listen_addr);
 }
 
+HotStuffBase::BaseMetrics::BaseMetrics(MetricsRegistry &metrics):
+    blk_fetch_waiting(metrics.gauge("hotstuff_blk_fetch_waiting",
+        "blocks being fetched")),
+    blk_delivery_waiting(metrics.gauge("hotstuff_blk_delivery_waiting",
+        "blocks waiting for their delivery")),
+    decision_waiting(metrics.gauge("hotstuff_decision_waiting",
+        "commands waiting for their decision")),
+    cmd_pending(metrics.gauge("hotstuff_cmd_pending",
+        "commands submitted and not yet taken by the consensus thread")),
+    veripool_backlog(metrics.gauge("hotstuff_veripool_backlog",
+        "signature verifications not yet resolved")),
+    cmd_received(metrics.counter("hotstuff_cmd_received_total",
+        "commands submitted")),
+    commit_latency(metrics.histogram("hotstuff_commit_latency_seconds",
+        "time from the submission of a command to its decision")) {
+    static const char *opcode_names[nopcodes] = {
+        "propose", "vote", "req_blk", "resp_blk", "local_order"
+    };
+    for (opcode_t i = 0; i < nopcodes; i++)
+    {
+        auto label = std::string("opcode=\"") + opcode_names[i] + "\"";
+        msgs_sent[i] = &metrics.counter("hotstuff_msgs_sent_total",
+            "replica messages sent", label);
+        bytes_sent[i] = &metrics.counter("hotstuff_msg_bytes_sent_total",
+            "payload bytes of the replica messages sent", label);
+        msgs_recv[i] = &metrics.counter("hotstuff_msgs_received_total",
+            "replica messages received", label);
+        bytes_recv[i] = &metrics.counter("hotstuff_msg_bytes_received_total",
+            "payload bytes of the replica messages received", label);
+    }
+}
+
+void HotStuffBase::update_metrics() {
+    mstat.blk_fetch_waiting.set(blk_fetch_waiting.size());
+    mstat.blk_delivery_waiting.set(blk_delivery_waiting.size());
+    mstat.decision_waiting.set(decision_waiting_size);
+    mstat.cmd_pending.set(mstat.cmd_received.get() - cmd_dequeued);
+    mstat.veripool_backlog.set(vpool.get_backlog());
+}
+
+void HotStuffBase::start_recording(const std::string &fname) {
+    recorder = new InputRecorder(fname);
+    HOTSTUFF_LOG_INFO("recording the inputs to %s", fname.c_str());
+}
+
 void HotStuffBase::do_broadcast_proposal(const Proposal &prop) {
+    HOTSTUFF_ALLOC_SCOPE(PROPOSE);
 #ifdef HOTSTUFF_ENABLE_LOG_DEBUG
 // #ifdef NOTDEFINE
     for ( auto const &o: prop.blk->get_orders()) {
@@ -469,35 +556,41 @@ void HotStuffBase::do_broadcast_proposal(const Proposal &prop) {
     }
 #endif
 
-    //MsgPropose prop_msg(prop);
-    pn.multicast_msg(MsgPropose(prop), peers);
+    MsgPropose prop_msg(prop);
+    count_sent(prop_msg, peers.size());
+    pn.multicast_msg(std::move(prop_msg), peers);
     //for (const auto &replica: peers)
     //    pn.send_msg(prop_msg, replica);
 }
 
 void HotStuffBase::do_vote(ReplicaID last_proposer, const Vote &vote) {
-    pmaker->beat_resp(last_proposer)
-            .then([this, vote](ReplicaID proposer) {
-        if (proposer == get_id())
-        {
-            //throw HotStuffError("unreachable line");
-            on_receive_vote(vote);
-        }
-        else
-            pn.send_msg(MsgVote(vote), get_config().get_peer_id(proposer));
+    HOTSTUFF_ALLOC_SCOPE(VOTE);
+#ifdef HOTSTUFF_BLK_PROFILE
+    blk_profiler.rec(vote.blk_hash, BlockProfiler::VOTED);
+#endif
+    route_vote(*pmaker, last_proposer, vote, [this](ReplicaID proposer, const Vote &vote) {
+        MsgVote vote_msg(vote);
+        count_sent(vote_msg);
+        pn.send_msg(std::move(vote_msg), get_config().get_peer_id(proposer));
     });
 }
 
 // Us
 void HotStuffBase::do_send_local_order(ReplicaID proposer, const LocalOrder &local_order) {
+    HOTSTUFF_ALLOC_SCOPE(LOCAL_ORDER);
+#ifdef HOTSTUFF_BLK_PROFILE
+    blk_profiler.local_order_sent();
+#endif
     if (proposer == get_id())
     {
         HOTSTUFF_LOG_DEBUG("[[do_send_local_order]] [R-%d] [L-%d] deliver LocalOrder to itself = %s", get_id(), proposer, local_order);
-        process_local_order(local_order);
+        process_local_order(*pmaker, local_order);
     }
     else{
         HOTSTUFF_LOG_DEBUG("[[do_send_local_order]] [R-%d] [L-%d] Send LocalOrder to Leader = %s", get_id(), proposer, local_order);
-        pn.send_msg(MsgLocalOrder(local_order), get_config().get_peer_id(proposer));
+        MsgLocalOrder lo_msg(local_order);
+        count_sent(lo_msg);
+        pn.send_msg(std::move(lo_msg), get_config().get_peer_id(proposer));
     }
 }
 
@@ -510,12 +603,16 @@ void HotStuffBase::do_decide(Finality &&fin) {
     part_decided++;
     state_machine_execute(fin);
     HOTSTUFF_LOG_DEBUG("[[do_decide After State Machine Execute]] [R-%d] [L-] command = %.10s", get_id() ,get_hex(fin.cmd_hash).c_str());
-    auto it = decision_waiting.find(fin.cmd_hash);
-    if (it != decision_waiting.end())
+    cmd_id_t cid = storage->find_cmd_id(fin.cmd_hash);
+    if (cid != CMD_ID_NULL && cid < decision_waiting.size() && decision_waiting[cid])
     {
         HOTSTUFF_LOG_DEBUG("[[do_decide Execute]] [R-%d] [L-] command = %.10s", get_id() ,get_hex(fin.cmd_hash).c_str());
-        it->second(std::move(fin));
-        decision_waiting.erase(it);
+        auto cb = std::move(decision_waiting[cid]);
+        decision_waiting[cid] = nullptr;
+        decision_waiting_size--;
+        mstat.commit_latency.observe_since(decision_submitted[cid]);
+        cb(std::move(fin));
+        storage->release_cmd(cid);
     }
 }
 
@@ -555,14 +652,35 @@ void HotStuffBase::start(
     if (nfaulty == 0)
         LOG_WARN("too few replicas in the system to tolerate any failure");
     on_init(nfaulty, fairness_parameter);       // Us
+    if (recorder)
+    {
+        InputLog::Header header{id, nfaulty, fairness_parameter, (uint32_t)blk_size, {}};
+        for (size_t i = 0; i < replicas.size(); i++)
+        {
+            const auto &info = get_config().get_info(i);
+            DataStream s;
+            s << *info.pubkey;
+            header.replicas.push_back(InputLog::Replica{info.peer_id, bytearray_t(std::move(s))});
+        }
+        recorder->write_header(header);
+    }
     pmaker->init(this);
+#ifdef HOTSTUFF_ALLOC_PROFILE
+    alloc_last = AllocProfiler::snapshot();
+#endif
+    metrics_timer = TimerEvent(ec, [this](TimerEvent &) {
+        update_metrics();
+        metrics_timer.add(metrics_refresh_period);
+    });
+    metrics_timer.add(metrics_refresh_period);
     if (ec_loop)
         ec.dispatch();
 
     cmd_pending.reg_handler(ec, [this](cmd_queue_t &q) {
+        HOTSTUFF_ALLOC_SCOPE(INGRESS);
         HOTSTUFF_LOG_DEBUG("[[cmd_pending.reg_handler]] [R-%d] [L-%d] cmd_pending reg_handler Invoked", get_id(), pmaker->get_proposer());
 
-        std::pair<uint256_t, commit_cb_t> e;
+        PendingCmd e;
 
         // TODO: Themis : Add pending decisions into this round local order again, 
         // as they were skipped previously by the leader (due to non majority) ???
@@ -570,38 +688,33 @@ void HotStuffBase::start(
         while (q.try_dequeue(e))
         {
             ReplicaID proposer = pmaker->get_proposer();
-
-            const auto &cmd_hash = e.first;
-            auto it = decision_waiting.find(cmd_hash);
-            if (it == decision_waiting.end())
-                it = decision_waiting.insert(std::make_pair(cmd_hash, e.second)).first;
+            cmd_dequeued++;
+            if (recorder) recorder->record_cmd(e.cmd_hash, proposer);
+
+            const auto &cmd_hash = e.cmd_hash;
+            /* the command gets its id here; this reference is owned by
+             * local_order_buffer, the one below by decision_waiting */
+            cmd_id_t cid = storage->intern_cmd(cmd_hash);
+            if (cid >= decision_waiting.size())
+            {
+                decision_waiting.resize(storage->get_cmd_id_bound());
+                decision_submitted.resize(storage->get_cmd_id_bound());
+            }
+            if (!decision_waiting[cid])
+            {
+                decision_waiting[cid] = std::move(e.callback);
+                decision_submitted[cid] = e.submitted;
+                decision_waiting_size++;
+                storage->retain_cmd(cid);
+            }
             else
-                e.second(Finality(id, 0, 0, 0, cmd_hash, uint256_t()));
+                e.callback(Finality(id, 0, 0, 0, cmd_hash, uint256_t()));
 
 
             // Us
-            local_order_buffer.push(cmd_hash);
             HOTSTUFF_LOG_DEBUG("[[cmd_pending.reg_handler]] [R-%d] [L-%d] Push commans to local buffer = %.10s", get_id(), proposer, get_hex(cmd_hash).c_str());
-
-            if(local_order_buffer.size() >= blk_size){
-                ReplicaID proposer = pmaker->get_proposer();
-                std::vector<uint256_t> cmds;
-                for (uint32_t i = 0; i < blk_size; i++)
-                {
-                    cmds.push_back(local_order_buffer.front());
-                    local_order_buffer.pop();
-                }
-
-#ifdef HOTSTUFF_ENABLE_LOG_DEBUG
-// #ifdef NOTDEFINE
-                for (uint32_t i = 0; i < blk_size; i++){
-                    HOTSTUFF_LOG_DEBUG("[[cmd_pending.reg_handler]] [R-%d] [L-%d] Created List of commands and sending to pacemaker (%d) = %.10s", get_id(), proposer, i, get_hex(cmds[i]).c_str());
-                }
-#endif
-                on_local_order(proposer, cmds);
-
+            if (queue_local_cmd(cid, proposer, blk_size))
                 return true;
-            }
             /*
             if (proposer != get_id()) continue;
             cmd_pending_buffer.push(cmd_hash);
@@ -0,0 +1,45 @@
+/**
+ * Copyright 2018 VMware
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <error.h>
+#include "salticidae/util.h"
+#include "hotstuff/async_log.h"
+
+using salticidae::Config;
+using hotstuff::AsyncLogger;
+
+/* Turn binary logs (written with --async-log-bin) into text. */
+int main(int argc, char **argv) {
+    Config config("hotstuff.conf");
+    auto opt_help = Config::OptValFlag::create(false);
+    config.add_opt("help", opt_help, Config::SWITCH_ON, 'h', "show this help info");
+    int first = config.parse(argc, argv);
+    if (opt_help->get() || first >= argc)
+    {
+        config.print_help();
+        fprintf(stderr, "usage: %s <binary log>...\n", argv[0]);
+        return 1;
+    }
+    for (int i = first; i < argc; i++)
+    {
+        try {
+            AsyncLogger::decode(argv[i], 1);
+        } catch (std::exception &e) {
+            error(1, 0, "%s", e.what());
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,387 @@
+/**
+ * Copyright 2018 VMware
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#include <error.h>
+#include "salticidae/util.h"
+#include "hotstuff/hotstuff.h"
+#include "hotstuff/liveness.h"
+#include "hotstuff/replay.h"
+
+using salticidae::Config;
+using hotstuff::HotStuffCore;
+using hotstuff::PaceMakerDummy;
+using hotstuff::InputLog;
+using hotstuff::InputReader;
+using hotstuff::ReplicaID;
+using hotstuff::promise_t;
+using hotstuff::block_t;
+using hotstuff::uint256_t;
+using hotstuff::cmd_id_t;
+using hotstuff::DataStream;
+using hotstuff::Finality;
+using hotstuff::Proposal;
+using hotstuff::Vote;
+using hotstuff::LocalOrder;
+using hotstuff::PrivKey;
+using hotstuff::PrivKeySecp256k1;
+using hotstuff::PubKeySecp256k1;
+using hotstuff::PartCertSecp256k1;
+using hotstuff::QuorumCertSecp256k1;
+using hotstuff::MsgPropose;
+using hotstuff::MsgVote;
+using hotstuff::MsgRespBlock;
+using hotstuff::MsgLocalOrder;
+
+/* Replays an input log (written by hotstuff-app --record) through
+ * HotStuffCore, without any networking.
+ *
+ * The glue of HotStuffBase is the one it shares with HotStuffCore (local
+ * orders, votes), except that every input is carried through to the core
+ * before the next one is read: the blocks are delivered
+ * as soon as their ancestors have arrived, the signatures are verified on
+ * the spot (or not at all), and what the replica sends is only counted. The
+ * proposer is the one each recorded command was ordered for. */
+
+/** PaceMakerDummy following the proposer of the recorded commands. */
+class ReplayPaceMaker: public PaceMakerDummy {
+    ReplicaID proposer;
+
+    public:
+    ReplayPaceMaker(int32_t parent_limit):
+        PaceMakerDummy(parent_limit), proposer(0) {}
+
+    void set_proposer(ReplicaID p) { proposer = p; }
+
+    ReplicaID get_proposer() override { return proposer; }
+
+    promise_t beat_resp(ReplicaID) override {
+        return promise_t([this](promise_t &pm) { pm.resolve(proposer); });
+    }
+};
+
+class ReplayCore: public HotStuffCore {
+    ReplayPaceMaker pmaker;
+    const uint32_t blk_size;
+    const bool verify;
+    std::vector<bool> decision_waiting;
+    /* inputs waiting for blocks that have not arrived yet */
+    std::vector<std::function<bool()>> waiting;
+
+    void run(std::function<bool()> input) {
+        if (!input()) waiting.push_back(std::move(input));
+    }
+
+    void retry_waiting() {
+        for (bool progress = !waiting.empty(); progress;)
+        {
+            progress = false;
+            auto pending = std::move(waiting);
+            waiting.clear();
+            for (auto &input: pending)
+            {
+                if (input()) progress = true;
+                else waiting.push_back(std::move(input));
+            }
+        }
+    }
+
+    /* deliver the block and its ancestors, as HotStuffBase::async_deliver_blk
+     * would; false if some of them have not arrived yet */
+    bool deliver(const uint256_t &blk_hash) {
+        if (storage->is_blk_delivered(blk_hash)) return true;
+        if (!storage->is_blk_fetched(blk_hash)) return false;
+        block_t blk = storage->find_blk(blk_hash);
+        if (!storage->is_blk_fetched(blk->get_qc()->get_obj_hash())) return false;
+        for (const auto &phash: blk->get_parent_hashes())
+            if (!deliver(phash)) return false;
+        if (verify && !blk->verify(this))
+        {
+            stats.ninvalid++;
+            HOTSTUFF_LOG_WARN("verification failed during delivery");
+            return false;
+        }
+        return on_deliver_blk(blk);
+    }
+
+    void feed_msg(const InputLog::Record &rec) {
+        switch (rec.opcode)
+        {
+            case MsgPropose::opcode:
+            {
+                MsgPropose msg{DataStream(rec.payload)};
+                msg.postponed_parse(this);
+                Proposal prop = std::move(msg.proposal);
+                if (!prop.blk) return;
+                run([this, prop]() {
+                    if (!deliver(prop.blk->get_hash())) return false;
+                    on_receive_proposal(prop);
+                    return true;
+                });
+                retry_waiting();
+                break;
+            }
+            case MsgVote::opcode:
+            {
+                MsgVote msg{DataStream(rec.payload)};
+                msg.postponed_parse(this);
+                run([this, vote = std::move(msg.vote)]() {
+                    if (!deliver(vote.blk_hash)) return false;
+                    if (verify && !vote.verify())
+                    {
+                        stats.ninvalid++;
+                        HOTSTUFF_LOG_WARN("invalid vote from %d", vote.voter);
+                    }
+                    else
+                        on_receive_vote(vote);
+                    return true;
+                });
+                break;
+            }
+            case MsgRespBlock::opcode:
+            {
+                MsgRespBlock msg{DataStream(rec.payload)};
+                msg.postponed_parse(this);
+                retry_waiting();
+                break;
+            }
+            case MsgLocalOrder::opcode:
+            {
+                MsgLocalOrder msg{DataStream(rec.payload)};
+                msg.postponed_parse(this);
+                process_local_order(pmaker, msg.local_order);
+                break;
+            }
+        }
+    }
+
+    void feed_cmd(const InputLog::Record &rec) {
+        pmaker.set_proposer(rec.proposer);
+        /* as the cmd_pending handler of HotStuffBase does */
+        cmd_id_t cid = storage->intern_cmd(rec.cmd_hash);
+        if (cid >= decision_waiting.size())
+            decision_waiting.resize(storage->get_cmd_id_bound());
+        if (!decision_waiting[cid])
+        {
+            decision_waiting[cid] = true;
+            storage->retain_cmd(cid);
+        }
+        queue_local_cmd(cid, rec.proposer, blk_size);
+    }
+
+    protected:
+    void do_decide(Finality &&fin) override {
+        stats.ndecided++;
+        cmd_id_t cid = storage->find_cmd_id(fin.cmd_hash);
+        if (cid != hotstuff::CMD_ID_NULL && cid < decision_waiting.size() &&
+            decision_waiting[cid])
+        {
+            decision_waiting[cid] = false;
+            storage->release_cmd(cid);
+        }
+    }
+
+    void do_consensus(const block_t &blk) override { pmaker.on_consensus(blk); }
+
+    void do_broadcast_proposal(const Proposal &) override { stats.nproposed++; }
+
+    void do_vote(ReplicaID last_proposer, const Vote &vote) override {
+        route_vote(pmaker, last_proposer, vote, [this](ReplicaID, const Vote &) {
+            stats.nvotes_sent++;
+        });
+    }
+
+    void do_send_local_order(ReplicaID proposer, const LocalOrder &local_order) override {
+        if (proposer == get_id())
+            process_local_order(pmaker, local_order);
+        else
+            stats.nlocal_orders_sent++;
+    }
+
+    public:
+    hotstuff::part_cert_bt create_part_cert(const PrivKey &priv_key,
+                                            const uint256_t &blk_hash) override {
+        return new PartCertSecp256k1(
+            static_cast<const PrivKeySecp256k1 &>(priv_key), blk_hash);
+    }
+
+    hotstuff::part_cert_bt parse_part_cert(DataStream &s) override {
+        hotstuff::PartCert *pc = new PartCertSecp256k1();
+        s >> *pc;
+        return pc;
+    }
+
+    hotstuff::quorum_cert_bt create_quorum_cert(const uint256_t &blk_hash) override {
+        return new QuorumCertSecp256k1(get_config(), blk_hash);
+    }
+
+    hotstuff::quorum_cert_t parse_quorum_cert(DataStream &s) override {
+        hotstuff::quorum_cert_bt qc = new QuorumCertSecp256k1();
+        s >> *qc;
+        return qc.unwrap();
+    }
+
+    struct Stats {
+        size_t ndecided = 0;
+        size_t nproposed = 0;
+        size_t nvotes_sent = 0;
+        size_t nlocal_orders_sent = 0;
+        size_t ninvalid = 0;
+        size_t nerrors = 0;
+    } stats;
+
+    ReplayCore(const InputLog::Header &header, hotstuff::privkey_bt &&priv_key,
+                int32_t parent_limit, uint32_t blk_size, bool verify):
+            HotStuffCore(header.id, std::move(priv_key)),
+            pmaker(parent_limit), blk_size(blk_size), verify(verify) {
+        for (size_t i = 0; i < header.replicas.size(); i++)
+        {
+            const auto &r = header.replicas[i];
+            add_replica(i, salticidae::PeerId(hotstuff::bytearray_t(r.peer_id)),
+                        new PubKeySecp256k1(r.pubkey));
+        }
+        on_init(header.nfaulty, header.fairness_parameter);
+        pmaker.init(this);
+    }
+
+    void feed(const InputLog::Record &rec) {
+        try {
+            if (rec.type == InputLog::MSG)
+                feed_msg(rec);
+            else
+                feed_cmd(rec);
+        } catch (std::exception &e) {
+            stats.nerrors++;
+            HOTSTUFF_LOG_WARN("input at %.6f s: %s", rec.ts_us * 1e-6, e.what());
+        }
+    }
+
+    size_t get_nwaiting() const { return waiting.size(); }
+};
+
+int main(int argc, char **argv) {
+    Config config("hotstuff.conf");
+    auto opt_privkey = Config::OptValStr::create();
+    auto opt_parent_limit = Config::OptValInt::create(1);
+    auto opt_blk_size = Config::OptValInt::create(0);
+    auto opt_verify = Config::OptValFlag::create(false);
+    auto opt_realtime = Config::OptValFlag::create(false);
+    auto opt_prune_staleness = Config::OptValInt::create(0);
+    auto opt_stat_period = Config::OptValDouble::create(10);
+    auto opt_metrics = Config::OptValFlag::create(false);
+    auto opt_help = Config::OptValFlag::create(false);
+    config.add_opt("privkey", opt_privkey, Config::SET_VAL, -1, "private key of the recorded replica (a random one by default)");
+    config.add_opt("parent-limit", opt_parent_limit, Config::SET_VAL, -1, "maximum number of parents of a proposed block (-1 for all tails)");
+    config.add_opt("block-size", opt_blk_size, Config::SET_VAL, -1, "commands per local order (0 for the recorded one)");
+    config.add_opt("verify", opt_verify, Config::SWITCH_ON, -1, "verify the signatures of the votes and the blocks");
+    config.add_opt("realtime", opt_realtime, Config::SWITCH_ON, -1, "feed the inputs at their recorded pace instead of as fast as possible");
+    config.add_opt("prune-staleness", opt_prune_staleness, Config::SET_VAL, -1, "prune the blocks this many heights below the last executed one, every stat period (0 to disable)");
+    config.add_opt("stat-period", opt_stat_period, Config::SET_VAL, -1, "period of the pruning, in recorded time");
+    config.add_opt("metrics", opt_metrics, Config::SWITCH_ON, -1, "print the metrics of the core at the end");
+    config.add_opt("help", opt_help, Config::SWITCH_ON, 'h', "show this help info");
+    int first = config.parse(argc, argv);
+    if (opt_help->get() || first + 1 != argc)
+    {
+        config.print_help();
+        fprintf(stderr, "usage: %s [options] <input log>\n", argv[0]);
+        return 1;
+    }
+
+    try {
+        InputReader reader(argv[first]);
+        const auto &header = reader.get_header();
+        hotstuff::privkey_bt priv_key;
+        if (opt_privkey->get().empty())
+        {
+            priv_key = new PrivKeySecp256k1();
+            priv_key->from_rand();
+        }
+        else
+            priv_key = new PrivKeySecp256k1(hotstuff::from_hex(opt_privkey->get()));
+        uint32_t blk_size = opt_blk_size->get() > 0 ? opt_blk_size->get() : header.blk_size;
+        ReplayCore core(header, std::move(priv_key),
+                        opt_parent_limit->get(), blk_size, opt_verify->get());
+        fprintf(stderr, "replaying the inputs of replica %d (%lu replicas, "
+                "block size %u)\n", header.id, header.replicas.size(), blk_size);
+
+        using clock = std::chrono::steady_clock;
+        const uint64_t stat_period_us = opt_stat_period->get() * 1e6;
+        uint64_t next_prune_us = stat_period_us;
+        /* by record type: how many and the time spent in the core */
+        size_t nmsgs[MsgLocalOrder::opcode + 1] = {};
+        double msg_sec[MsgLocalOrder::opcode + 1] = {};
+        size_t ncmds = 0;
+        double cmd_sec = 0;
+        uint64_t last_ts_us = 0;
+
+        InputLog::Record rec;
+        auto start = clock::now();
+        while (reader.next(rec))
+        {
+            if (opt_realtime->get())
+                std::this_thread::sleep_until(start + std::chrono::microseconds(rec.ts_us));
+            if (opt_prune_staleness->get() > 0 && rec.ts_us >= next_prune_us)
+            {
+                core.prune(opt_prune_staleness->get());
+                next_prune_us += stat_period_us;
+            }
+            auto t = clock::now();
+            core.feed(rec);
+            double sec = std::chrono::duration<double>(clock::now() - t).count();
+            if (rec.type == InputLog::CMD)
+            {
+                ncmds++;
+                cmd_sec += sec;
+            }
+            else if (rec.opcode <= MsgLocalOrder::opcode)
+            {
+                nmsgs[rec.opcode]++;
+                msg_sec[rec.opcode] += sec;
+            }
+            last_ts_us = rec.ts_us;
+        }
+        double elapsed = std::chrono::duration<double>(clock::now() - start).count();
+
+        static const char *names[] = {"propose", "vote", "req_blk", "resp_blk", "local_order"};
+        printf("%-12s %10s %12s %10s\n", "input", "count", "total (s)", "avg (us)");
+        for (size_t i = 0; i <= MsgLocalOrder::opcode; i++)
+            if (nmsgs[i])
+                printf("%-12s %10lu %12.3f %10.2f\n", names[i], nmsgs[i],
+                        msg_sec[i], msg_sec[i] * 1e6 / nmsgs[i]);
+        if (ncmds)
+            printf("%-12s %10lu %12.3f %10.2f\n", "command", ncmds,
+                    cmd_sec, cmd_sec * 1e6 / ncmds);
+        printf("replayed %.3f s of inputs in %.3f s\n", last_ts_us * 1e-6, elapsed);
+        printf("decided %lu commands (%.0f/s), proposed %lu blocks\n",
+                core.stats.ndecided, elapsed > 0 ? core.stats.ndecided / elapsed : 0,
+                core.stats.nproposed);
+        printf("sent %lu votes and %lu local orders\n",
+                core.stats.nvotes_sent, core.stats.nlocal_orders_sent);
+        if (core.stats.ninvalid || core.stats.nerrors || core.get_nwaiting())
+            printf("%lu invalid, %lu failed and %lu undelivered inputs\n",
+                    core.stats.ninvalid, core.stats.nerrors, core.get_nwaiting());
+        if (opt_metrics->get())
+            printf("%s", core.get_metrics().render().c_str());
+    } catch (std::exception &e) {
+        error(1, 0, "%s", e.what());
+    }
+    return 0;
+}
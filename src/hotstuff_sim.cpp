@@ -0,0 +1,105 @@
+/**
+ * Copyright 2018 VMware
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstdio>
+
+#include <error.h>
+#include "salticidae/util.h"
+#include "hotstuff/sim.h"
+
+using salticidae::Config;
+using hotstuff::DelayDist;
+using hotstuff::SimConfig;
+using hotstuff::Simulator;
+
+int main(int argc, char **argv) {
+    Config config("hotstuff.conf");
+    SimConfig sc;
+    auto opt_nreplicas = Config::OptValInt::create(sc.nreplicas);
+    auto opt_fairness_parameter = Config::OptValDouble::create(sc.fairness_parameter);
+    auto opt_blk_size = Config::OptValInt::create(sc.blk_size);
+    auto opt_parent_limit = Config::OptValInt::create(sc.parent_limit);
+    auto opt_proposer = Config::OptValInt::create(sc.proposer);
+    auto opt_real_crypto = Config::OptValFlag::create(false);
+    auto opt_link_delay = Config::OptValStr::create("const:0.001");
+    auto opt_client_delay = Config::OptValStr::create("uniform:0.001:0.0005");
+    auto opt_bandwidth = Config::OptValDouble::create(0);
+    auto opt_cpu_scale = Config::OptValDouble::create(0);
+    auto opt_ncrashed = Config::OptValInt::create(0);
+    auto opt_nslow = Config::OptValInt::create(0);
+    auto opt_slow_factor = Config::OptValDouble::create(sc.slow_factor);
+    auto opt_cmd_rate = Config::OptValDouble::create(sc.cmd_rate);
+    auto opt_duration = Config::OptValDouble::create(sc.duration);
+    auto opt_warmup = Config::OptValDouble::create(sc.warmup);
+    auto opt_drain = Config::OptValDouble::create(sc.drain);
+    auto opt_prune_staleness = Config::OptValInt::create(0);
+    auto opt_seed = Config::OptValInt::create(sc.seed);
+    auto opt_help = Config::OptValFlag::create(false);
+    config.add_opt("nreplicas", opt_nreplicas, Config::SET_VAL, 'n', "number of replicas");
+    config.add_opt("fairness-parameter", opt_fairness_parameter, Config::SET_VAL, 'f', "fairness parameter (gamma)");
+    config.add_opt("block-size", opt_blk_size, Config::SET_VAL, 'b', "commands per local order");
+    config.add_opt("parent-limit", opt_parent_limit, Config::SET_VAL, -1, "maximum number of parents of a proposed block (-1 for all tails)");
+    config.add_opt("proposer", opt_proposer, Config::SET_VAL, -1, "the fixed proposer");
+    config.add_opt("real-crypto", opt_real_crypto, Config::SWITCH_ON, -1, "sign and verify with secp256k1 instead of dummy certificates");
+    config.add_opt("link-delay", opt_link_delay, Config::SET_VAL, -1, "one-way delay between replicas, in seconds: const:MEAN, uniform:MEAN:JITTER, exp:MEAN or normal:MEAN:STDDEV");
+    config.add_opt("client-delay", opt_client_delay, Config::SET_VAL, -1, "delay from the clients to each replica (same format)");
+    config.add_opt("bandwidth", opt_bandwidth, Config::SET_VAL, -1, "outgoing bytes per second of each replica (0 for unlimited)");
+    config.add_opt("cpu-scale", opt_cpu_scale, Config::SET_VAL, -1, "virtual seconds charged per real second of processing (0 for free processing)");
+    config.add_opt("crashed", opt_ncrashed, Config::SET_VAL, -1, "number of crashed replicas (the last ones)");
+    config.add_opt("slow", opt_nslow, Config::SET_VAL, -1, "number of replicas with slow links (before the crashed ones)");
+    config.add_opt("slow-factor", opt_slow_factor, Config::SET_VAL, -1, "delay multiplier of the slow replicas");
+    config.add_opt("cmd-rate", opt_cmd_rate, Config::SET_VAL, 'r', "client commands per second");
+    config.add_opt("duration", opt_duration, Config::SET_VAL, 'd', "seconds of virtual time during which commands are submitted");
+    config.add_opt("warmup", opt_warmup, Config::SET_VAL, -1, "seconds of virtual time left out of the measurements");
+    config.add_opt("drain", opt_drain, Config::SET_VAL, -1, "seconds of virtual time given to the last commands");
+    config.add_opt("prune-staleness", opt_prune_staleness, Config::SET_VAL, -1, "prune the blocks this many heights below the last executed one, every second (0 to disable)");
+    config.add_opt("seed", opt_seed, Config::SET_VAL, -1, "random seed");
+    config.add_opt("help", opt_help, Config::SWITCH_ON, 'h', "show this help info");
+    config.parse(argc, argv);
+    if (opt_help->get())
+    {
+        config.print_help();
+        return 0;
+    }
+
+    try {
+        sc.nreplicas = opt_nreplicas->get();
+        sc.fairness_parameter = opt_fairness_parameter->get();
+        sc.blk_size = opt_blk_size->get();
+        sc.parent_limit = opt_parent_limit->get();
+        sc.proposer = opt_proposer->get();
+        sc.real_crypto = opt_real_crypto->get();
+        sc.link_delay = DelayDist::parse(opt_link_delay->get());
+        sc.client_delay = DelayDist::parse(opt_client_delay->get());
+        sc.bandwidth = opt_bandwidth->get();
+        sc.cpu_scale = opt_cpu_scale->get();
+        sc.ncrashed = opt_ncrashed->get();
+        sc.nslow = opt_nslow->get();
+        sc.slow_factor = opt_slow_factor->get();
+        sc.cmd_rate = opt_cmd_rate->get();
+        sc.duration = opt_duration->get();
+        sc.warmup = opt_warmup->get();
+        sc.drain = opt_drain->get();
+        sc.prune_staleness = opt_prune_staleness->get();
+        sc.seed = opt_seed->get();
+        Simulator sim(sc);
+        sim.run();
+        printf("%s", sim.report().c_str());
+    } catch (std::exception &e) {
+        error(1, 0, "%s", e.what());
+    }
+    return 0;
+}
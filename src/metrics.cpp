@@ -0,0 +1,269 @@
+/**
+ * Copyright 2018 VMware
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "hotstuff/metrics.h"
+#include "hotstuff/type.h"
+
+namespace hotstuff {
+
+Histogram::Histogram(): count(0), sum(0) {
+    for (auto &b: buckets) b.store(0, std::memory_order_relaxed);
+}
+
+std::vector<uint64_t> Histogram::snapshot() const {
+    std::vector<uint64_t> snap(nbuckets);
+    for (size_t i = 0; i < nbuckets; i++)
+        snap[i] = buckets[i].load(std::memory_order_relaxed);
+    return snap;
+}
+
+std::vector<double> Histogram::quantiles(const std::vector<double> &qs) const {
+    return quantiles(snapshot(), qs);
+}
+
+std::vector<double> Histogram::quantiles(const std::vector<uint64_t> &snap,
+                                        const std::vector<double> &qs) {
+    uint64_t total = 0;
+    for (auto c: snap) total += c;
+    std::vector<double> res;
+    res.reserve(qs.size());
+    size_t i = 0;
+    uint64_t seen = 0;
+    for (double q: qs)
+    {
+        if (!total)
+        {
+            res.push_back(0);
+            continue;
+        }
+        /* rank of the sample at quantile q, counting from 1 */
+        uint64_t rank = q * total;
+        if (rank < 1) rank = 1;
+        if (rank > total) rank = total;
+        while (i < nbuckets && seen + snap[i] < rank)
+            seen += snap[i++];
+        if (i == nbuckets) i = nbuckets - 1;
+        auto r = bucket_range(i);
+        res.push_back((r.first + r.second) / 2.0);
+    }
+    return res;
+}
+
+MetricsRegistry::Metric &MetricsRegistry::add(const std::string &name,
+                                            const std::string &help,
+                                            const std::string &labels,
+                                            Type type) {
+    std::lock_guard<std::mutex> _(lock);
+    Family *family = nullptr;
+    for (auto &f: families)
+        if (f->name == name)
+        {
+            if (f->type != type)
+                throw HotStuffError("metric %s registered with another type", name.c_str());
+            family = f.get();
+            break;
+        }
+    if (!family)
+    {
+        families.emplace_back(new Family{name, help, type, {}});
+        family = families.back().get();
+    }
+    for (auto m: family->metrics)
+        if (m->labels == labels)
+            throw HotStuffError("metric %s{%s} registered twice", name.c_str(), labels.c_str());
+    metrics.emplace_back(new Metric{name, labels, type, nullptr, nullptr, nullptr});
+    auto &m = *metrics.back();
+    switch (type)
+    {
+        case Type::COUNTER: m.counter.reset(new Counter()); break;
+        case Type::GAUGE: m.gauge.reset(new Gauge()); break;
+        case Type::SUMMARY: m.histogram.reset(new Histogram()); break;
+    }
+    family->metrics.push_back(&m);
+    return m;
+}
+
+Counter &MetricsRegistry::counter(const std::string &name, const std::string &help,
+                                const std::string &labels) {
+    return *add(name, help, labels, Type::COUNTER).counter;
+}
+
+Gauge &MetricsRegistry::gauge(const std::string &name, const std::string &help,
+                            const std::string &labels) {
+    return *add(name, help, labels, Type::GAUGE).gauge;
+}
+
+Histogram &MetricsRegistry::histogram(const std::string &name, const std::string &help,
+                                    const std::string &labels) {
+    return *add(name, help, labels, Type::SUMMARY).histogram;
+}
+
+std::string MetricsRegistry::render() const {
+    static const std::vector<double> qs = {0.5, 0.9, 0.99, 0.999};
+    static const char *type_names[] = {"counter", "gauge", "summary"};
+    std::string out;
+    char buf[128];
+    auto sample = [&out](const std::string &name, const std::string &labels,
+                        const char *val) {
+        out += name;
+        if (!labels.empty())
+            out += "{" + labels + "}";
+        out += " ";
+        out += val;
+        out += "\n";
+    };
+    std::lock_guard<std::mutex> _(lock);
+    for (const auto &f: families)
+    {
+        out += "# HELP " + f->name + " " + f->help + "\n";
+        out += "# TYPE " + f->name + " " + type_names[(int)f->type] + "\n";
+        for (const auto m: f->metrics)
+        {
+            switch (m->type)
+            {
+                case Type::COUNTER:
+                    snprintf(buf, sizeof buf, "%" PRIu64, m->counter->get());
+                    sample(m->name, m->labels, buf);
+                    break;
+                case Type::GAUGE:
+                    snprintf(buf, sizeof buf, "%" PRId64, m->gauge->get());
+                    sample(m->name, m->labels, buf);
+                    break;
+                case Type::SUMMARY:
+                {
+                    const auto &h = *m->histogram;
+                    /* read the count first: the quantiles then cover at
+                     * least what it says */
+                    uint64_t count = h.get_count();
+                    uint64_t sum = h.get_sum();
+                    auto vals = h.quantiles(qs);
+                    for (size_t i = 0; i < qs.size(); i++)
+                    {
+                        std::string labels = m->labels;
+                        if (!labels.empty()) labels += ",";
+                        snprintf(buf, sizeof buf, "quantile=\"%g\"", qs[i]);
+                        labels += buf;
+                        snprintf(buf, sizeof buf, "%.6f", vals[i] * 1e-6);
+                        sample(m->name, labels, buf);
+                    }
+                    snprintf(buf, sizeof buf, "%.6f", sum * 1e-6);
+                    sample(m->name + "_sum", m->labels, buf);
+                    snprintf(buf, sizeof buf, "%" PRIu64, count);
+                    sample(m->name + "_count", m->labels, buf);
+                    break;
+                }
+            }
+        }
+    }
+    return out;
+}
+
+MetricsServer::MetricsServer(const MetricsRegistry &registry, uint16_t port,
+                            const std::string &host):
+        registry(registry), running(true) {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof addr);
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1)
+        throw HotStuffError("invalid metrics address %s", host.c_str());
+    listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_fd < 0)
+        throw HotStuffError("metrics socket: %s", strerror(errno));
+    int one = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one);
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof addr) < 0 ||
+        listen(listen_fd, 16) < 0)
+    {
+        int err = errno;
+        close(listen_fd);
+        throw HotStuffError("cannot listen on %s:%u for metrics: %s",
+                            host.c_str(), port, strerror(err));
+    }
+    worker = std::thread([this]() { serve(); });
+}
+
+MetricsServer::~MetricsServer() {
+    running.store(false, std::memory_order_relaxed);
+    worker.join();
+    close(listen_fd);
+}
+
+void MetricsServer::serve() {
+    struct pollfd pfd;
+    pfd.fd = listen_fd;
+    pfd.events = POLLIN;
+    while (running.load(std::memory_order_relaxed))
+    {
+        /* wake up now and then to notice the shutdown */
+        if (poll(&pfd, 1, 200) <= 0) continue;
+        int fd = accept(listen_fd, nullptr, nullptr);
+        if (fd < 0) continue;
+        /* a scraper that stalls only delays the next scrape */
+        struct timeval tv = {1, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof tv);
+        handle(fd);
+        close(fd);
+    }
+}
+
+void MetricsServer::handle(int fd) {
+    std::string req;
+    char buf[1024];
+    while (req.find("\r\n\r\n") == std::string::npos && req.size() < 8192)
+    {
+        ssize_t n = recv(fd, buf, sizeof buf, 0);
+        if (n <= 0) return;
+        req.append(buf, n);
+    }
+    std::string status = "200 OK";
+    std::string body;
+    if (req.compare(0, 4, "GET ") != 0)
+        status = "405 Method Not Allowed";
+    else
+    {
+        auto path = req.substr(4, req.find(' ', 4) - 4);
+        if (path == "/metrics" || path == "/")
+            body = registry.render();
+        else
+            status = "404 Not Found";
+    }
+    std::string resp = "HTTP/1.1 " + status + "\r\n"
+        "Content-Type: text/plain; version=0.0.4\r\n"
+        "Content-Length: " + std::to_string(body.size()) + "\r\n"
+        "Connection: close\r\n\r\n" + body;
+    for (size_t off = 0; off < resp.size();)
+    {
+        ssize_t n = send(fd, resp.data() + off, resp.size() - off, MSG_NOSIGNAL);
+        if (n <= 0) return;
+        off += n;
+    }
+}
+
+}
@@ -33,8 +33,8 @@ namespace hotstuff {
     bool OrderedList::Iterator::operator!=(const Iterator& it) const{
         return node_ptr!=it.node_ptr;
     }
-    uint256_t OrderedList::Iterator::operator*() const{
-        return node_ptr->cmd_hash;
+    cmd_id_t OrderedList::Iterator::operator*() const{
+        return node_ptr->cmd_id;
     }
 
     OrderedList::Iterator OrderedList::Iterator::operator++(int) {
@@ -58,39 +58,45 @@ namespace hotstuff {
         return it;
     }
 
-    OrderedList::OrderedList(){
+    OrderedList::OrderedList(): nnodes(0) {
         /* Head and tail nodes of this list are the dummy nodes */
-        head = new LinkedNode(salticidae::get_hash(0));
-        tail = new LinkedNode(salticidae::get_hash(0));
+        head = new LinkedNode(CMD_ID_NULL);
+        tail = new LinkedNode(CMD_ID_NULL);
         head->next = tail;
         tail->prev = head;
     }
 
-    void OrderedList::push_back(uint256_t cmd_hash){
-        if(linked_cache.count(cmd_hash)>0){
-            return;
+    bool OrderedList::push_back(cmd_id_t cmd_id){
+        if(cmd_id >= linked_cache.size()){
+            linked_cache.resize(cmd_id + 1, nullptr);
         }
-        LinkedNode* node_to_add = new LinkedNode(cmd_hash);
+        if(linked_cache[cmd_id] != nullptr){
+            return false;
+        }
+        LinkedNode* node_to_add = new LinkedNode(cmd_id);
         LinkedNode* last_node = tail->prev;
         last_node->next = node_to_add;
         node_to_add->prev = last_node;
         node_to_add->next = tail;
         tail->prev = node_to_add;
-        linked_cache[cmd_hash] = node_to_add;
+        linked_cache[cmd_id] = node_to_add;
+        nnodes++;
+        return true;
     }
 
-    void OrderedList::remove(uint256_t cmd_hash){
-        if(linked_cache.count(cmd_hash)==0){
-            return;
+    bool OrderedList::remove(cmd_id_t cmd_id){
+        if(cmd_id >= linked_cache.size() || linked_cache[cmd_id] == nullptr){
+            return false;
         }
-        LinkedNode* node_to_remove = linked_cache[cmd_hash];
+        LinkedNode* node_to_remove = linked_cache[cmd_id];
         LinkedNode* prev_node = node_to_remove->prev;
         LinkedNode* next_node = node_to_remove->next;
         prev_node->next = next_node;
         next_node->prev = prev_node;
-        node_to_remove->prev = nullptr;
-        node_to_remove->next = nullptr;
-        linked_cache.erase(cmd_hash);
+        linked_cache[cmd_id] = nullptr;
+        nnodes--;
+        delete node_to_remove;
+        return true;
     }
 
     OrderedList::Iterator OrderedList::begin() const {
@@ -104,14 +110,16 @@ namespace hotstuff {
     }
 
     size_t OrderedList::get_size(){
-        return linked_cache.size();
+        return nnodes;
     }
 
-    std::vector<uint256_t> OrderedList::get_cmds(){
-        std::vector<uint256_t> cmds;
+    std::vector<cmd_id_t> OrderedList::get_cmds(){
+        std::vector<cmd_id_t> cmds;
+        cmds.reserve(nnodes);
         LinkedNode* curr = head->next;
         while(curr!=tail){
-            cmds.push_back(curr->cmd_hash);
+            cmds.push_back(curr->cmd_id);
+            curr = curr->next;
         }
         return cmds;
     }
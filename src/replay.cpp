@@ -0,0 +1,214 @@
+/**
+ * Copyright 2018 VMware
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cerrno>
+#include <cstring>
+
+#include "hotstuff/replay.h"
+
+namespace hotstuff {
+
+const char InputLog::magic[8] = {'H', 'S', 'I', 'N', 'P', 'U', 'T', '1'};
+
+namespace {
+
+void put_le(bytearray_t &buff, uint64_t v, size_t n) {
+    for (size_t i = 0; i < n; i++, v >>= 8)
+        buff.push_back(v & 0xff);
+}
+
+void put_varint(bytearray_t &buff, uint64_t v) {
+    while (v >= 0x80)
+    {
+        buff.push_back((v & 0x7f) | 0x80);
+        v >>= 7;
+    }
+    buff.push_back(v);
+}
+
+void put_bytes(bytearray_t &buff, const uint8_t *data, size_t size) {
+    buff.insert(buff.end(), data, data + size);
+}
+
+/* the reading side: false at the end of the file */
+
+bool get_bytes(FILE *f, uint8_t *data, size_t size) {
+    return fread(data, 1, size, f) == size;
+}
+
+bool get_le(FILE *f, uint64_t &v, size_t n) {
+    uint8_t b[8];
+    if (!get_bytes(f, b, n)) return false;
+    v = 0;
+    for (size_t i = n; i > 0; i--)
+        v = (v << 8) | b[i - 1];
+    return true;
+}
+
+bool get_varint(FILE *f, uint64_t &v) {
+    v = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7)
+    {
+        int c = fgetc(f);
+        if (c == EOF) return false;
+        v |= (uint64_t)(c & 0x7f) << shift;
+        if (!(c & 0x80)) return true;
+    }
+    throw HotStuffError("ill-formed varint in the input log");
+}
+
+/* no record comes close to this: it can only be a corrupted length */
+const uint64_t max_payload = 1 << 30;
+
+}
+
+InputRecorder::InputRecorder(const std::string &fname): last_us(0) {
+    f = fopen(fname.c_str(), "wb");
+    if (!f)
+        throw HotStuffError("cannot create input log %s: %s",
+                            fname.c_str(), strerror(errno));
+    setvbuf(f, nullptr, _IOFBF, 1 << 20);
+}
+
+InputRecorder::~InputRecorder() { fclose(f); }
+
+void InputRecorder::write() {
+    fwrite(buff.data(), 1, buff.size(), f);
+    buff.clear();
+}
+
+void InputRecorder::write_header(const InputLog::Header &header) {
+    put_bytes(buff, (const uint8_t *)InputLog::magic, sizeof InputLog::magic);
+    put_le(buff, header.id, sizeof header.id);
+    put_le(buff, header.nfaulty, sizeof header.nfaulty);
+    uint64_t fp;
+    memcpy(&fp, &header.fairness_parameter, sizeof fp);
+    put_le(buff, fp, sizeof fp);
+    put_le(buff, header.blk_size, sizeof header.blk_size);
+    put_varint(buff, header.replicas.size());
+    for (const auto &r: header.replicas)
+    {
+        bytearray_t peer_id = r.peer_id;
+        put_bytes(buff, peer_id.data(), peer_id.size());
+        put_varint(buff, r.pubkey.size());
+        put_bytes(buff, r.pubkey.data(), r.pubkey.size());
+    }
+    write();
+    t0 = std::chrono::steady_clock::now();
+    last_us = 0;
+}
+
+void InputRecorder::begin_record(InputLog::RecordType type) {
+    uint64_t now = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - t0).count();
+    buff.push_back(type);
+    put_varint(buff, now - last_us);
+    last_us = now;
+}
+
+void InputRecorder::record_msg(opcode_t opcode, const uint8_t *payload, size_t size) {
+    begin_record(InputLog::MSG);
+    put_le(buff, opcode, sizeof opcode);
+    put_varint(buff, size);
+    put_bytes(buff, payload, size);
+    write();
+}
+
+void InputRecorder::record_cmd(const uint256_t &cmd_hash, ReplicaID proposer) {
+    begin_record(InputLog::CMD);
+    bytearray_t hash = cmd_hash;
+    put_bytes(buff, hash.data(), hash.size());
+    put_le(buff, proposer, sizeof proposer);
+    write();
+}
+
+InputReader::InputReader(const std::string &fname): ts_us(0) {
+    f = fopen(fname.c_str(), "rb");
+    if (!f)
+        throw HotStuffError("cannot open input log %s: %s",
+                            fname.c_str(), strerror(errno));
+    setvbuf(f, nullptr, _IOFBF, 1 << 20);
+    char magic[sizeof InputLog::magic];
+    uint64_t id, nfaulty, fp, blk_size, nreplicas;
+    if (!get_bytes(f, (uint8_t *)magic, sizeof magic) ||
+        memcmp(magic, InputLog::magic, sizeof magic) ||
+        !get_le(f, id, sizeof header.id) ||
+        !get_le(f, nfaulty, sizeof header.nfaulty) ||
+        !get_le(f, fp, sizeof fp) ||
+        !get_le(f, blk_size, sizeof header.blk_size) ||
+        !get_varint(f, nreplicas))
+    {
+        fclose(f);
+        throw HotStuffError("%s is not an input log", fname.c_str());
+    }
+    header.id = id;
+    header.nfaulty = nfaulty;
+    memcpy(&header.fairness_parameter, &fp, sizeof fp);
+    header.blk_size = blk_size;
+    for (uint64_t i = 0; i < nreplicas; i++)
+    {
+        uint8_t peer_id[uint256_t::serialized_size];
+        uint64_t len;
+        InputLog::Replica r;
+        if (!get_bytes(f, peer_id, sizeof peer_id) ||
+            !get_varint(f, len) || len > max_payload ||
+            (r.pubkey.resize(len), !get_bytes(f, r.pubkey.data(), len)))
+        {
+            fclose(f);
+            throw HotStuffError("truncated header in %s", fname.c_str());
+        }
+        r.peer_id = uint256_t(peer_id);
+        header.replicas.push_back(std::move(r));
+    }
+}
+
+InputReader::~InputReader() { fclose(f); }
+
+bool InputReader::next(InputLog::Record &rec) {
+    int type = fgetc(f);
+    uint64_t delta;
+    if (type == EOF || !get_varint(f, delta)) return false;
+    ts_us += delta;
+    rec.type = (InputLog::RecordType)type;
+    rec.ts_us = ts_us;
+    switch (rec.type)
+    {
+        case InputLog::MSG:
+        {
+            uint64_t opcode, size;
+            if (!get_le(f, opcode, sizeof rec.opcode) ||
+                !get_varint(f, size)) return false;
+            if (size > max_payload)
+                throw HotStuffError("ill-formed message record in the input log");
+            rec.opcode = opcode;
+            rec.payload.resize(size);
+            return get_bytes(f, rec.payload.data(), size);
+        }
+        case InputLog::CMD:
+        {
+            uint8_t hash[uint256_t::serialized_size];
+            uint64_t proposer;
+            if (!get_bytes(f, hash, sizeof hash) ||
+                !get_le(f, proposer, sizeof rec.proposer)) return false;
+            rec.cmd_hash = uint256_t(hash);
+            rec.proposer = proposer;
+            return true;
+        }
+    }
+    throw HotStuffError("unknown record type 0x%02x in the input log", type);
+}
+
+}
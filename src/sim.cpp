@@ -0,0 +1,552 @@
+/**
+ * Copyright 2018 VMware
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <chrono>
+#include <cmath>
+#include <limits>
+
+#include "hotstuff/sim.h"
+#include "hotstuff/hotstuff.h"
+#include "hotstuff/liveness.h"
+
+#define LOG_WARN HOTSTUFF_LOG_WARN
+
+namespace hotstuff {
+
+DelayDist DelayDist::parse(const std::string &spec) {
+    std::vector<std::string> parts;
+    size_t pos = 0, next;
+    while ((next = spec.find(':', pos)) != std::string::npos)
+    {
+        parts.push_back(spec.substr(pos, next - pos));
+        pos = next + 1;
+    }
+    parts.push_back(spec.substr(pos));
+    static const std::pair<const char *, Type> types[] = {
+        {"const", CONST}, {"uniform", UNIFORM}, {"exp", EXP}, {"normal", NORMAL}
+    };
+    for (const auto &t: types)
+    {
+        if (parts[0] != t.first) continue;
+        size_t nparams = (t.second == UNIFORM || t.second == NORMAL) ? 2 : 1;
+        if (parts.size() != nparams + 1) break;
+        try {
+            DelayDist res(t.second, std::stod(parts[1]),
+                        nparams > 1 ? std::stod(parts[2]) : 0);
+            if (res.mean < 0 || res.jitter < 0) break;
+            return res;
+        } catch (std::logic_error &) {
+            break;
+        }
+    }
+    throw HotStuffError("invalid delay distribution \"%s\"", spec.c_str());
+}
+
+double DelayDist::sample(std::mt19937_64 &rng) const {
+    double res = mean;
+    switch (type)
+    {
+        case CONST:
+            break;
+        case UNIFORM:
+            res = std::uniform_real_distribution<double>(mean - jitter, mean + jitter)(rng);
+            break;
+        case EXP:
+            if (mean > 0)
+                res = std::exponential_distribution<double>(1 / mean)(rng);
+            break;
+        case NORMAL:
+            if (jitter > 0)
+                res = std::normal_distribution<double>(mean, jitter)(rng);
+            break;
+    }
+    return std::max(res, 0.0);
+}
+
+/** A replica of the simulated cluster: the glue of HotStuffBase, with the
+ * network replaced by the event queue of the simulator. */
+class SimReplica: public HotStuffCore {
+    Simulator *sim;
+    PaceMakerDummyFixed pmaker;
+    const uint32_t blk_size;
+    const bool verify;
+    std::vector<bool> decision_waiting;
+    /* a fetch is only requested once, from the first replica known to have
+     * the block */
+    std::unordered_map<uint256_t, std::pair<promise_t, bool>> blk_fetch_waiting;
+    std::unordered_map<uint256_t, promise_t> blk_delivery_waiting;
+
+    template<typename M>
+    void send_msg(M &&msg, ReplicaID replica) {
+        sim->send(id, replica, M::opcode,
+                std::make_shared<const bytearray_t>(std::move(msg.serialized)));
+    }
+
+    void on_fetch_blk(const block_t &blk) {
+        auto it = blk_fetch_waiting.find(blk->get_hash());
+        if (it == blk_fetch_waiting.end()) return;
+        promise_t pm = it->second.first;
+        blk_fetch_waiting.erase(it);
+        pm.resolve(blk);
+    }
+
+    /** Fetch a block, from `replica` unless it is negative. */
+    promise_t async_fetch_blk(const uint256_t &blk_hash, int replica) {
+        if (storage->is_blk_fetched(blk_hash))
+            return promise_t([this, &blk_hash](promise_t pm) {
+                pm.resolve(storage->find_blk(blk_hash));
+            });
+        auto it = blk_fetch_waiting.find(blk_hash);
+        if (it == blk_fetch_waiting.end())
+            it = blk_fetch_waiting.insert(std::make_pair(blk_hash,
+                std::make_pair(promise_t([](promise_t) {}), false))).first;
+        if (replica >= 0 && !it->second.second)
+        {
+            it->second.second = true;
+            sim->result.nfetches++;
+            send_msg(MsgReqBlock(std::vector<uint256_t>{blk_hash}), replica);
+        }
+        return it->second.first;
+    }
+
+    promise_t async_deliver_blk(const uint256_t &blk_hash, ReplicaID replica) {
+        if (storage->is_blk_delivered(blk_hash))
+            return promise_t([this, &blk_hash](promise_t pm) {
+                pm.resolve(storage->find_blk(blk_hash));
+            });
+        auto it = blk_delivery_waiting.find(blk_hash);
+        if (it != blk_delivery_waiting.end())
+            return it->second;
+        promise_t pm([](promise_t) {});
+        blk_delivery_waiting.insert(std::make_pair(blk_hash, pm));
+        async_fetch_blk(blk_hash, replica).then([this, replica](block_t blk) {
+            std::vector<promise_t> pms;
+            pms.push_back(async_fetch_blk(blk->get_qc()->get_obj_hash(), replica));
+            for (const auto &phash: blk->get_parent_hashes())
+                pms.push_back(async_deliver_blk(phash, replica));
+            promise::all(pms).then([this, blk]() { deliver(blk); });
+        });
+        return pm;
+    }
+
+    void deliver(const block_t &blk) {
+        bool valid = (!verify || blk->verify(this)) && on_deliver_blk(blk);
+        auto it = blk_delivery_waiting.find(blk->get_hash());
+        if (it == blk_delivery_waiting.end()) return;
+        promise_t pm = it->second;
+        blk_delivery_waiting.erase(it);
+        if (valid)
+            pm.resolve(blk);
+        else
+        {
+            LOG_WARN("dropping invalid block");
+            pm.reject(blk);
+        }
+    }
+
+    protected:
+    void do_decide(Finality &&fin) override {
+        cmd_id_t cid = storage->find_cmd_id(fin.cmd_hash);
+        if (cid != CMD_ID_NULL && cid < decision_waiting.size() && decision_waiting[cid])
+        {
+            decision_waiting[cid] = false;
+            storage->release_cmd(cid);
+        }
+        sim->on_decide(id, fin.cmd_hash);
+    }
+
+    void do_consensus(const block_t &blk) override { pmaker.on_consensus(blk); }
+
+    void do_broadcast_proposal(const Proposal &prop) override {
+        sim->result.nproposed++;
+        MsgPropose msg(prop);
+        auto payload = std::make_shared<const bytearray_t>(std::move(msg.serialized));
+        for (ReplicaID i = 0; i < get_config().nreplicas; i++)
+            if (i != id) sim->send(id, i, MsgPropose::opcode, payload);
+    }
+
+    void do_vote(ReplicaID last_proposer, const Vote &vote) override {
+        route_vote(pmaker, last_proposer, vote, [this](ReplicaID proposer, const Vote &vote) {
+            send_msg(MsgVote(vote), proposer);
+        });
+    }
+
+    void do_send_local_order(ReplicaID proposer, const LocalOrder &local_order) override {
+        if (proposer == get_id())
+            process_local_order(pmaker, local_order);
+        else
+            send_msg(MsgLocalOrder(local_order), proposer);
+    }
+
+    public:
+    SimReplica(Simulator *sim, ReplicaID id, privkey_bt &&priv_key):
+        HotStuffCore(id, std::move(priv_key)), sim(sim),
+        pmaker(sim->config.proposer, sim->config.parent_limit),
+        blk_size(sim->config.blk_size),
+        verify(sim->config.real_crypto) {}
+
+    /** Join the cluster; only once the replica is fully constructed. */
+    void init(std::vector<pubkey_bt> &pub_keys, uint32_t nfaulty) {
+        for (size_t i = 0; i < pub_keys.size(); i++)
+            add_replica(i, salticidae::PeerId(bytearray_t(salticidae::get_hash(i))),
+                        pub_keys[i]->clone());
+        on_init(nfaulty, sim->config.fairness_parameter);
+        pmaker.init(this);
+    }
+
+    /* as the cmd_pending handler of HotStuffBase does */
+    void on_cmd(const uint256_t &cmd_hash) {
+        cmd_id_t cid = storage->intern_cmd(cmd_hash);
+        if (cid >= decision_waiting.size())
+            decision_waiting.resize(storage->get_cmd_id_bound());
+        if (!decision_waiting[cid])
+        {
+            decision_waiting[cid] = true;
+            storage->retain_cmd(cid);
+        }
+        queue_local_cmd(cid, pmaker.get_proposer(), blk_size);
+    }
+
+    /* as the message handlers of HotStuffBase do */
+    void on_msg(ReplicaID peer, opcode_t opcode, const bytearray_t &payload) {
+        switch (opcode)
+        {
+            case MsgPropose::opcode:
+            {
+                MsgPropose msg{DataStream(payload)};
+                msg.postponed_parse(this);
+                auto &prop = msg.proposal;
+                if (!prop.blk) return;
+                if (prop.proposer != peer)
+                {
+                    LOG_WARN("invalid proposal from %d", prop.proposer);
+                    return;
+                }
+                on_fetch_blk(prop.blk);
+                async_deliver_blk(prop.blk->get_hash(), peer).then(
+                        [this, prop = std::move(prop)]() {
+                    on_receive_proposal(prop);
+                });
+                break;
+            }
+            case MsgVote::opcode:
+            {
+                MsgVote msg{DataStream(payload)};
+                msg.postponed_parse(this);
+                RcObj<Vote> v(new Vote(std::move(msg.vote)));
+                async_deliver_blk(v->blk_hash, peer).then([this, v]() {
+                    if (verify && !v->verify())
+                        LOG_WARN("invalid vote from %d", v->voter);
+                    else
+                        on_receive_vote(*v);
+                });
+                break;
+            }
+            case MsgReqBlock::opcode:
+            {
+                MsgReqBlock msg{DataStream(payload)};
+                std::vector<promise_t> pms;
+                for (const auto &h: msg.blk_hashes)
+                    pms.push_back(async_fetch_blk(h, -1));
+                promise::all(pms).then([this, peer](const promise::values_t values) {
+                    std::vector<block_t> blks;
+                    for (auto &v: values)
+                        blks.push_back(promise::any_cast<block_t>(v));
+                    send_msg(MsgRespBlock(blks), peer);
+                });
+                break;
+            }
+            case MsgRespBlock::opcode:
+            {
+                MsgRespBlock msg{DataStream(payload)};
+                msg.postponed_parse(this);
+                for (const auto &blk: msg.blks)
+                    if (blk) on_fetch_blk(blk);
+                break;
+            }
+            case MsgLocalOrder::opcode:
+            {
+                MsgLocalOrder msg{DataStream(payload)};
+                msg.postponed_parse(this);
+                if (msg.local_order.initiator != peer)
+                {
+                    LOG_WARN("invalid local order from %d", msg.local_order.initiator);
+                    return;
+                }
+                process_local_order(pmaker, msg.local_order);
+                break;
+            }
+        }
+    }
+};
+
+/** SimReplica with its cryptographic implementation, as HotStuff<> is to
+ * HotStuffBase. */
+template<typename PrivKeyType = PrivKeyDummy,
+        typename PartCertType = PartCertDummy,
+        typename QuorumCertType = QuorumCertDummy>
+class SimReplicaImpl: public SimReplica {
+    public:
+    using SimReplica::SimReplica;
+
+    part_cert_bt create_part_cert(const PrivKey &priv_key, const uint256_t &blk_hash) override {
+        return new PartCertType(
+                    static_cast<const PrivKeyType &>(priv_key),
+                    blk_hash);
+    }
+
+    part_cert_bt parse_part_cert(DataStream &s) override {
+        PartCert *pc = new PartCertType();
+        s >> *pc;
+        return pc;
+    }
+
+    quorum_cert_bt create_quorum_cert(const uint256_t &blk_hash) override {
+        return new QuorumCertType(get_config(), blk_hash);
+    }
+
+    quorum_cert_t parse_quorum_cert(DataStream &s) override {
+        quorum_cert_bt qc = new QuorumCertType();
+        s >> *qc;
+        return qc.unwrap();
+    }
+};
+
+using SimReplicaNoSig = SimReplicaImpl<>;
+using SimReplicaSecp256k1 = SimReplicaImpl<PrivKeySecp256k1,
+                                        PartCertSecp256k1, QuorumCertSecp256k1>;
+
+Simulator::Simulator(const SimConfig &config):
+        config(config), rng(config.seed), now(0), seq(0),
+        ncmds(0), has_last_decided(false) {
+    size_t n = config.nreplicas;
+    if (n == 0 || config.ncrashed + config.nslow > n)
+        throw HotStuffError("invalid number of (crashed or slow) replicas");
+    nrunning = n - config.ncrashed;
+    if (config.proposer >= nrunning)
+        throw HotStuffError("the proposer must be running");
+    if (config.blk_size == 0 || config.cmd_rate <= 0)
+        throw HotStuffError("invalid workload");
+    /* as HotStuffBase::start() */
+    nfaulty = (n - 1) / 3;
+    if (config.ncrashed > nfaulty)
+        LOG_WARN("%lu crashed replicas out of %lu: no progress will be made",
+                config.ncrashed, n);
+
+    std::vector<privkey_bt> priv_keys;
+    std::vector<pubkey_bt> pub_keys;
+    for (size_t i = 0; i < n; i++)
+    {
+        privkey_bt priv_key;
+        if (config.real_crypto)
+            priv_key = new PrivKeySecp256k1();
+        else
+            priv_key = new PrivKeyDummy();
+        priv_key->from_rand();
+        pub_keys.push_back(priv_key->get_pubkey());
+        priv_keys.push_back(std::move(priv_key));
+    }
+    for (size_t i = 0; i < n; i++)
+    {
+        if (i >= nrunning)
+        {
+            replicas.emplace_back(nullptr);
+            continue;
+        }
+        if (config.real_crypto)
+            replicas.emplace_back(new SimReplicaSecp256k1(this, i, std::move(priv_keys[i])));
+        else
+            replicas.emplace_back(new SimReplicaNoSig(this, i, std::move(priv_keys[i])));
+        replicas.back()->init(pub_keys, nfaulty);
+    }
+    nic_free.resize(n, 0);
+    cpu_free.resize(n, 0);
+    link_last.resize(n * n, 0);
+}
+
+Simulator::~Simulator() {}
+
+void Simulator::schedule(double time, int target, std::function<void()> fn) {
+    events.push(Event{time, seq++, target, std::move(fn)});
+}
+
+bool Simulator::is_slow(ReplicaID rid) const {
+    return rid + config.nslow >= nrunning && rid < nrunning;
+}
+
+void Simulator::send(ReplicaID from, ReplicaID to, opcode_t opcode,
+                    std::shared_ptr<const bytearray_t> payload) {
+    result.nmsgs++;
+    result.nbytes += payload->size();
+    double depart = now;
+    if (config.bandwidth > 0)
+    {
+        depart = std::max(now, nic_free[from]) + payload->size() / config.bandwidth;
+        nic_free[from] = depart;
+    }
+    if (!replicas[to]) return;
+    double delay = config.link_delay.sample(rng);
+    if (is_slow(from) || is_slow(to)) delay *= config.slow_factor;
+    double &last = link_last[from * config.nreplicas + to];
+    last = std::max(depart + delay, last);
+    schedule(last, to, [this, from, to, opcode, payload]() {
+        replicas[to]->on_msg(from, opcode, *payload);
+    });
+}
+
+void Simulator::submit_cmd() {
+    uint256_t cmd_hash = salticidae::get_hash(ncmds++);
+    auto &st = cmds[cmd_hash];
+    st.submitted = now;
+    st.measured = now >= config.warmup;
+    st.ndecided = 0;
+    st.recv.assign(config.nreplicas, std::numeric_limits<double>::infinity());
+    if (st.measured) result.nsubmitted++;
+    for (ReplicaID i = 0; i < nrunning; i++)
+    {
+        double delay = config.client_delay.sample(rng);
+        if (is_slow(i)) delay *= config.slow_factor;
+        schedule(now + delay, i, [this, i, cmd_hash]() {
+            auto it = cmds.find(cmd_hash);
+            if (it != cmds.end()) it->second.recv[i] = now;
+            replicas[i]->on_cmd(cmd_hash);
+        });
+    }
+    double next = now + std::exponential_distribution<double>(config.cmd_rate)(rng);
+    if (next < config.duration)
+        schedule(next, -1, [this]() { submit_cmd(); });
+}
+
+void Simulator::check_fairness(const uint256_t &prev, const uint256_t &next) {
+    auto p = cmds.find(prev);
+    auto q = cmds.find(next);
+    if (p == cmds.end() || q == cmds.end()) return;
+    size_t nreversed = 0;
+    for (ReplicaID i = 0; i < nrunning; i++)
+        if (q->second.recv[i] < p->second.recv[i]) nreversed++;
+    result.npairs++;
+    if (nreversed >= std::ceil(config.fairness_parameter * nrunning))
+        result.nunfair++;
+}
+
+void Simulator::on_decide(ReplicaID rid, const uint256_t &cmd_hash) {
+    auto it = cmds.find(cmd_hash);
+    if (it == cmds.end()) return;
+    auto &st = it->second;
+    if (++st.ndecided == nfaulty + 1 && st.measured)
+    {
+        result.ncommitted++;
+        latency.observe((now - st.submitted) * 1e6);
+    }
+    if (rid == config.proposer)
+    {
+        if (has_last_decided)
+        {
+            check_fairness(last_decided, cmd_hash);
+            auto prev = cmds.find(last_decided);
+            if (prev != cmds.end() && prev->second.ndecided >= nrunning)
+                cmds.erase(prev);
+        }
+        last_decided = cmd_hash;
+        has_last_decided = true;
+    }
+    /* the observer is done with it as well, unless it is the last one */
+    else if (st.ndecided >= nrunning && !(has_last_decided && cmd_hash == last_decided))
+        cmds.erase(it);
+}
+
+void Simulator::run() {
+    auto start = std::chrono::steady_clock::now();
+    schedule(std::exponential_distribution<double>(config.cmd_rate)(rng), -1,
+            [this]() { submit_cmd(); });
+    const double end = config.duration + config.drain;
+    if (config.prune_staleness)
+        for (double t = 1; t < end; t++)
+            schedule(t, -1, [this]() {
+                for (auto &r: replicas)
+                    if (r) r->prune(config.prune_staleness);
+            });
+    while (!events.empty())
+    {
+        Event ev = std::move(const_cast<Event &>(events.top()));
+        events.pop();
+        if (ev.time > end) break;
+        if (config.cpu_scale > 0 && ev.target >= 0)
+        {
+            double &busy = cpu_free[ev.target];
+            if (busy > ev.time)
+            {
+                /* the replica is still busy: wait in line */
+                ev.time = busy;
+                ev.seq = seq++;
+                events.push(std::move(ev));
+                continue;
+            }
+            now = ev.time;
+            auto t = std::chrono::steady_clock::now();
+            ev.fn();
+            busy = now + config.cpu_scale * std::chrono::duration<double>(
+                std::chrono::steady_clock::now() - t).count();
+        }
+        else
+        {
+            now = ev.time;
+            ev.fn();
+        }
+    }
+    result.virtual_sec = now;
+    result.wall_sec = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+std::string Simulator::report() const {
+    const auto &r = result;
+    std::string res;
+    char buff[256];
+    snprintf(buff, sizeof buff,
+            "%lu replicas (%lu running, %lu slow), proposer %d\n"
+            "simulated %.3f s in %.3f s (%.1fx real time)\n",
+            config.nreplicas, nrunning, config.nslow, config.proposer,
+            r.virtual_sec, r.wall_sec,
+            r.wall_sec > 0 ? r.virtual_sec / r.wall_sec : 0);
+    res += buff;
+    double window = config.duration - config.warmup;
+    snprintf(buff, sizeof buff,
+            "committed %lu of %lu measured commands (%.1f/s)\n",
+            r.ncommitted, r.nsubmitted, window > 0 ? r.ncommitted / window : 0);
+    res += buff;
+    if (latency.get_count())
+    {
+        auto qs = latency.quantiles({0.5, 0.9, 0.99});
+        snprintf(buff, sizeof buff,
+                "latency (ms): mean %.3f, p50 %.3f, p90 %.3f, p99 %.3f\n",
+                latency.get_sum() / 1e3 / latency.get_count(),
+                qs[0] / 1e3, qs[1] / 1e3, qs[2] / 1e3);
+        res += buff;
+    }
+    snprintf(buff, sizeof buff,
+            "%lu blocks proposed, %lu messages (%.1f MB), %lu block fetches\n",
+            r.nproposed, r.nmsgs, r.nbytes / 1e6, r.nfetches);
+    res += buff;
+    snprintf(buff, sizeof buff,
+            "fairness: %lu of %lu consecutive pairs decided against the order "
+            "seen by >= %.0f replicas\n",
+            r.nunfair, r.npairs, std::ceil(config.fairness_parameter * nrunning));
+    res += buff;
+    return res;
+}
+
+}
@@ -0,0 +1,303 @@
+/**
+ * Copyright 2018 VMware
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+#include <cxxabi.h>
+#include <dirent.h>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "hotstuff/stack_sampler.h"
+#include "hotstuff/util.h"
+
+namespace hotstuff {
+
+namespace {
+
+/* pages of sample buffer per thread (a power of two) */
+const size_t nbuff_pages = 64;
+
+std::mutex roles_lock;
+std::unordered_map<pid_t, std::string> roles;
+
+std::mutex session_lock;
+std::thread session;
+std::atomic<bool> running(false);
+std::atomic<bool> cancelled(false);
+
+pid_t gettid_() { return syscall(SYS_gettid); }
+
+std::string thread_role(pid_t tid) {
+    {
+        std::lock_guard<std::mutex> _(roles_lock);
+        auto it = roles.find(tid);
+        if (it != roles.end()) return it->second;
+    }
+    char path[64], comm[64] = {};
+    snprintf(path, sizeof path, "/proc/self/task/%d/comm", (int)tid);
+    FILE *f = fopen(path, "r");
+    if (f)
+    {
+        if (!fgets(comm, sizeof comm, f)) comm[0] = 0;
+        fclose(f);
+    }
+    std::string role(comm);
+    while (!role.empty() && isspace(role.back())) role.pop_back();
+    /* so that the threads of the same kind end up together */
+    role.erase(std::remove_if(role.begin(), role.end(), ::isdigit), role.end());
+    return role.empty() ? "other" : role;
+}
+
+struct ThreadSampler {
+    pid_t tid;
+    std::string role;
+    int fd;
+    void *buff;
+    size_t size;
+
+    ThreadSampler(pid_t tid, std::string role):
+        tid(tid), role(std::move(role)), fd(-1), buff(MAP_FAILED), size(0) {}
+
+    bool open(unsigned freq, std::string &err) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof attr);
+        attr.size = sizeof attr;
+        attr.type = PERF_TYPE_SOFTWARE;
+        attr.config = PERF_COUNT_SW_TASK_CLOCK;
+        attr.freq = 1;
+        attr.sample_freq = freq;
+        attr.sample_type = PERF_SAMPLE_TID | PERF_SAMPLE_CALLCHAIN;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.exclude_callchain_kernel = 1;
+        attr.disabled = 1;
+        attr.wakeup_events = 1;
+        fd = syscall(SYS_perf_event_open, &attr, tid, -1, -1, PERF_FLAG_FD_CLOEXEC);
+        if (fd < 0)
+        {
+            err = strerror(errno);
+            return false;
+        }
+        size = (nbuff_pages + 1) * sysconf(_SC_PAGESIZE);
+        buff = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (buff == MAP_FAILED)
+        {
+            err = strerror(errno);
+            return false;
+        }
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        return true;
+    }
+
+    ~ThreadSampler() {
+        if (buff != MAP_FAILED) munmap(buff, size);
+        if (fd >= 0) close(fd);
+    }
+
+    /* Feed the samples found in the buffer to `on_sample`. */
+    template<typename Func>
+    void read(Func on_sample) {
+        auto meta = (struct perf_event_mmap_page *)buff;
+        auto data = (const uint8_t *)buff + meta->data_offset;
+        const uint64_t dsize = meta->data_size;
+        uint64_t head = __atomic_load_n(&meta->data_head, __ATOMIC_ACQUIRE);
+        uint64_t tail = meta->data_tail;
+        std::vector<uint8_t> rec;
+        while (tail < head)
+        {
+            struct perf_event_header hdr;
+            for (size_t i = 0; i < sizeof hdr; i++)
+                ((uint8_t *)&hdr)[i] = data[(tail + i) % dsize];
+            if (hdr.size < sizeof hdr) break;
+            rec.resize(hdr.size);
+            for (size_t i = 0; i < hdr.size; i++)
+                rec[i] = data[(tail + i) % dsize];
+            tail += hdr.size;
+            if (hdr.type != PERF_RECORD_SAMPLE) continue;
+            /* pid, tid, nr, ips[nr] */
+            const uint8_t *p = rec.data() + sizeof hdr;
+            uint64_t nr;
+            memcpy(&nr, p + 8, sizeof nr);
+            if (sizeof hdr + 16 + nr * 8 > hdr.size) continue;
+            std::vector<uint64_t> ips(nr);
+            memcpy(ips.data(), p + 16, nr * 8);
+            on_sample(ips);
+        }
+        __atomic_store_n(&meta->data_tail, tail, __ATOMIC_RELEASE);
+    }
+};
+
+std::string symbolize(uint64_t ip) {
+    Dl_info info;
+    char buff[64];
+    /* the return addresses point after the call */
+    void *addr = (void *)(uintptr_t)(ip - 1);
+    if (dladdr(addr, &info) && info.dli_sname)
+    {
+        int status;
+        char *name = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+        std::string res = status == 0 ? name : info.dli_sname;
+        free(name);
+        std::replace(res.begin(), res.end(), ';', ':');
+        return res;
+    }
+    if (info.dli_fname)
+    {
+        const char *base = strrchr(info.dli_fname, '/');
+        snprintf(buff, sizeof buff, "+0x%lx",
+                (unsigned long)((uintptr_t)addr - (uintptr_t)info.dli_fbase));
+        return std::string(base ? base + 1 : info.dli_fname) + buff;
+    }
+    snprintf(buff, sizeof buff, "0x%lx", (unsigned long)ip);
+    return buff;
+}
+
+void run_session(double duration, unsigned freq, std::string fname) {
+    std::vector<std::unique_ptr<ThreadSampler>> samplers;
+    const pid_t self = gettid_();
+    std::string err;
+    for (auto tid: StackSampler::list_threads())
+    {
+        if (tid == self) continue;
+        std::unique_ptr<ThreadSampler> s(new ThreadSampler(tid, thread_role(tid)));
+        /* the thread may have exited meanwhile */
+        if (s->open(freq, err))
+            samplers.push_back(std::move(s));
+    }
+    if (samplers.empty())
+    {
+        HOTSTUFF_LOG_WARN("stack sampling unavailable: perf_event_open: %s", err.c_str());
+        running.store(false);
+        return;
+    }
+    HOTSTUFF_LOG_INFO("sampling the stacks of %lu threads at %u Hz for %.1f s",
+                    samplers.size(), freq, duration);
+
+    /* (role, call chain from the leaf) -> count */
+    std::map<std::pair<std::string, std::vector<uint64_t>>, size_t> stacks;
+    size_t nsamples = 0;
+    std::vector<struct pollfd> pfds;
+    for (const auto &s: samplers)
+        pfds.push_back(pollfd{s->fd, POLLIN, 0});
+    auto deadline = std::chrono::steady_clock::now() +
+                    std::chrono::duration<double>(duration);
+    for (;;)
+    {
+        bool done = cancelled.load() || std::chrono::steady_clock::now() >= deadline;
+        if (!done) poll(pfds.data(), pfds.size(), 100);
+        for (const auto &s: samplers)
+            s->read([&](const std::vector<uint64_t> &ips) {
+                std::vector<uint64_t> chain;
+                for (auto ip: ips)
+                    if (ip < PERF_CONTEXT_MAX) chain.push_back(ip);
+                stacks[std::make_pair(s->role, std::move(chain))]++;
+                nsamples++;
+            });
+        if (done) break;
+    }
+    samplers.clear();
+
+    FILE *f = fopen(fname.c_str(), "w");
+    if (!f)
+    {
+        HOTSTUFF_LOG_WARN("cannot write the stacks to %s", fname.c_str());
+        running.store(false);
+        return;
+    }
+    std::unordered_map<uint64_t, std::string> syms;
+    for (const auto &p: stacks)
+    {
+        std::string line = p.first.first;
+        const auto &chain = p.first.second;
+        for (auto it = chain.rbegin(); it != chain.rend(); it++)
+        {
+            auto sit = syms.find(*it);
+            if (sit == syms.end())
+                sit = syms.emplace(*it, symbolize(*it)).first;
+            line += ";" + sit->second;
+        }
+        fprintf(f, "%s %lu\n", line.c_str(), p.second);
+    }
+    fclose(f);
+    HOTSTUFF_LOG_INFO("%lu stack samples written to %s", nsamples, fname.c_str());
+    running.store(false);
+}
+
+}
+
+void StackSampler::set_thread_role(const std::string &role) {
+    std::lock_guard<std::mutex> _(roles_lock);
+    roles[gettid_()] = role;
+}
+
+std::vector<pid_t> StackSampler::list_threads() {
+    std::vector<pid_t> tids;
+    DIR *dir = opendir("/proc/self/task");
+    if (!dir) return tids;
+    while (auto ent = readdir(dir))
+    {
+        if (ent->d_name[0] == '.') continue;
+        tids.push_back(atoi(ent->d_name));
+    }
+    closedir(dir);
+    std::sort(tids.begin(), tids.end());
+    return tids;
+}
+
+void StackSampler::set_new_threads_role(const std::vector<pid_t> &before,
+                                        const std::string &role) {
+    std::lock_guard<std::mutex> _(roles_lock);
+    for (auto tid: list_threads())
+        if (!std::binary_search(before.begin(), before.end(), tid))
+            roles.emplace(tid, role);
+}
+
+bool StackSampler::start(double duration, unsigned freq, const std::string &fname) {
+    std::lock_guard<std::mutex> _(session_lock);
+    if (running.load()) return false;
+    if (session.joinable()) session.join();
+    running.store(true);
+    cancelled.store(false);
+    session = std::thread(run_session, duration, freq, fname);
+    return true;
+}
+
+bool StackSampler::is_running() { return running.load(); }
+
+void StackSampler::stop() {
+    std::lock_guard<std::mutex> _(session_lock);
+    cancelled.store(true);
+    if (session.joinable()) session.join();
+}
+
+}
@@ -0,0 +1,213 @@
+/**
+ * Copyright 2018 VMware
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+#include "hotstuff/tracer.h"
+
+namespace hotstuff {
+
+namespace {
+
+const char *event_names[(int)TraceEvent::NEVENTS] = {
+    "client_in", "local_order", "leader_merge", "proposed",
+    "committed", "executed", "responded"
+};
+
+/* The fields are atomics only so that an export may run while the owner
+ * keeps recording; both sides use relaxed accesses. */
+struct TraceRecord {
+    std::atomic<uint64_t> cmd;
+    std::atomic<uint64_t> ts;
+    std::atomic<uint8_t> ev;
+};
+
+struct TraceRing {
+    std::atomic<uint64_t> head;     /**< number of records ever written */
+    uint32_t tid;
+    std::string name;
+    TraceRecord recs[CmdTracer::ring_size];
+
+    TraceRing(uint32_t tid): head(0), tid(tid), name("thread-" + std::to_string(tid)) {}
+};
+
+/* rings outlive their threads, so that what they recorded can still be
+ * exported */
+std::mutex rings_lock;
+std::vector<TraceRing *> rings;
+thread_local TraceRing *local_ring = nullptr;
+
+/* clock reference taken when tracing is enabled */
+uint64_t ts_base;
+std::chrono::steady_clock::time_point clock_base;
+
+TraceRing *get_local_ring() {
+    if (!local_ring)
+    {
+        std::lock_guard<std::mutex> _(rings_lock);
+        local_ring = new TraceRing(rings.size() + 1);
+        rings.push_back(local_ring);
+    }
+    return local_ring;
+}
+
+struct TraceItem {
+    uint64_t cmd;
+    uint64_t ts;
+    uint8_t ev;
+    uint32_t tid;
+};
+
+}
+
+std::atomic<uint64_t> CmdTracer::threshold(0);
+
+void CmdTracer::record_(uint64_t cmd, TraceEvent ev, uint64_t ts) {
+    auto ring = get_local_ring();
+    uint64_t h = ring->head.load(std::memory_order_relaxed);
+    auto &rec = ring->recs[h & (ring_size - 1)];
+    rec.cmd.store(cmd, std::memory_order_relaxed);
+    rec.ts.store(ts, std::memory_order_relaxed);
+    rec.ev.store((uint8_t)ev, std::memory_order_relaxed);
+    ring->head.store(h + 1, std::memory_order_release);
+}
+
+void CmdTracer::enable(double sample_rate) {
+    if (sample_rate <= 0)
+    {
+        threshold.store(0, std::memory_order_relaxed);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> _(rings_lock);
+        if (!ts_base)
+        {
+            ts_base = now();
+            clock_base = std::chrono::steady_clock::now();
+        }
+    }
+    threshold.store(sample_rate >= 1 ? UINT64_MAX :
+                    (uint64_t)std::ldexp(sample_rate, 64),
+                    std::memory_order_relaxed);
+}
+
+void CmdTracer::set_thread_name(const std::string &name) {
+    auto ring = get_local_ring();
+    std::lock_guard<std::mutex> _(rings_lock);
+    ring->name = name;
+}
+
+size_t CmdTracer::export_chrome_trace(const std::string &fname, uint32_t pid) {
+    std::vector<TraceItem> items;
+    std::vector<std::pair<uint32_t, std::string>> threads;
+    {
+        std::lock_guard<std::mutex> _(rings_lock);
+        for (auto ring: rings)
+        {
+            threads.push_back(std::make_pair(ring->tid, ring->name));
+            uint64_t h = ring->head.load(std::memory_order_acquire);
+            uint64_t first = h > ring_size ? h - ring_size : 0;
+            size_t base = items.size();
+            for (uint64_t i = first; i < h; i++)
+            {
+                const auto &rec = ring->recs[i & (ring_size - 1)];
+                items.push_back(TraceItem{
+                    rec.cmd.load(std::memory_order_relaxed),
+                    rec.ts.load(std::memory_order_relaxed),
+                    rec.ev.load(std::memory_order_relaxed),
+                    ring->tid});
+            }
+            /* drop what the owner may have overwritten meanwhile */
+            std::atomic_thread_fence(std::memory_order_acquire);
+            uint64_t h2 = ring->head.load(std::memory_order_relaxed);
+            if (h2 > first + ring_size)
+            {
+                size_t nstale = std::min(h2 - ring_size - first, h - first);
+                items.erase(items.begin() + base, items.begin() + base + nstale);
+            }
+        }
+    }
+    /* ticks per microsecond */
+    double tpus = 1e-3;
+#if defined(__x86_64__) || defined(__i386__)
+    {
+        auto elapsed = std::chrono::duration<double, std::micro>(
+            std::chrono::steady_clock::now() - clock_base).count();
+        if (elapsed > 0) tpus = (now() - ts_base) / elapsed;
+    }
+#endif
+    auto to_us = [tpus](uint64_t ts) {
+        return ts > ts_base ? (ts - ts_base) / tpus : 0.0;
+    };
+
+    /* the records of a command, in time order, keeping the first of each
+     * event */
+    std::sort(items.begin(), items.end(), [](const TraceItem &a, const TraceItem &b) {
+        return a.cmd < b.cmd || (a.cmd == b.cmd && a.ts < b.ts);
+    });
+
+    FILE *f = fopen(fname.c_str(), "w");
+    if (!f) throw std::runtime_error("cannot open " + fname);
+    fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%u,\"args\":{\"name\":\"replica %u\"}}",
+            pid, pid);
+    for (const auto &t: threads)
+        fprintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%u,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+                pid, t.first, t.second.c_str());
+    size_t ncmds = 0;
+    for (size_t i = 0, j; i < items.size(); i = j)
+    {
+        const uint64_t cmd = items[i].cmd;
+        bool seen[(int)TraceEvent::NEVENTS] = {};
+        const TraceItem *prev = nullptr;
+        for (j = i; j < items.size() && items[j].cmd == cmd; j++)
+        {
+            const auto &it = items[j];
+            if (it.ev >= (int)TraceEvent::NEVENTS || seen[it.ev]) continue;
+            seen[it.ev] = true;
+            double ts = to_us(it.ts);
+            fprintf(f, ",\n{\"name\":\"%s\",\"cat\":\"cmd\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,"
+                        "\"pid\":%u,\"tid\":%u,\"args\":{\"cmd\":\"%016lx\"}}",
+                    event_names[it.ev], ts, pid, it.tid, (unsigned long)cmd);
+            if (prev)
+            {
+                /* one async slice per step, on the track of the command */
+                fprintf(f, ",\n{\"name\":\"%s->%s\",\"cat\":\"cmd\",\"ph\":\"b\",\"id\":\"0x%016lx\","
+                            "\"ts\":%.3f,\"pid\":%u,\"tid\":%u}",
+                        event_names[prev->ev], event_names[it.ev], (unsigned long)cmd,
+                        to_us(prev->ts), pid, prev->tid);
+                fprintf(f, ",\n{\"name\":\"%s->%s\",\"cat\":\"cmd\",\"ph\":\"e\",\"id\":\"0x%016lx\","
+                            "\"ts\":%.3f,\"pid\":%u,\"tid\":%u}",
+                        event_names[prev->ev], event_names[it.ev], (unsigned long)cmd,
+                        ts, pid, it.tid);
+            }
+            prev = &it;
+        }
+        ncmds++;
+    }
+    fprintf(f, "\n]}\n");
+    fclose(f);
+    return ncmds;
+}
+
+}
@@ -16,8 +16,123 @@
 
 #include "hotstuff/util.h"
 
+#ifdef HOTSTUFF_BLK_PROFILE
+#include <algorithm>
+#include <cmath>
+#endif
+
 namespace hotstuff {
 
 Logger logger("hotstuff");
 
+#ifdef HOTSTUFF_BLK_PROFILE
+const char *BlockProfiler::phase_name(Phase phase) {
+    static const char *names[NPHASES] = {
+        "local_order", "proposed", "received", "delivered", "voted",
+        "qc", "committed", "finalized", "executed", "responded"
+    };
+    return names[phase];
+}
+
+BlockProfiler::BlockProfiler(double stale_sec):
+    t0(std::chrono::steady_clock::now()),
+    last_local_order_sent(-1),
+    stale_sec(stale_sec), csv(nullptr) {}
+
+BlockProfiler::~BlockProfiler() {
+    if (csv) fclose(csv);
+}
+
+void BlockProfiler::open_csv(const std::string &fname) {
+    if (csv) fclose(csv);
+    if (!(csv = fopen(fname.c_str(), "w")))
+        throw std::runtime_error("cannot open " + fname);
+    fprintf(csv, "blk,height");
+    for (int i = 0; i < NPHASES; i++)
+        fprintf(csv, ",%s", phase_name((Phase)i));
+    fputc('\n', csv);
+}
+
+BlockProfiler::BlockProfile &BlockProfiler::get(const uint256_t &blk_hash) {
+    auto it = blocks.find(blk_hash);
+    if (it == blocks.end())
+    {
+        BlockProfile p;
+        p.height = 0;
+        std::fill(p.t, p.t + NPHASES, -1);
+        it = blocks.insert(std::make_pair(blk_hash, p)).first;
+    }
+    return it->second;
+}
+
+void BlockProfiler::seen(const uint256_t &blk_hash, uint32_t height,
+                        Phase phase, bool has_own_order) {
+    auto &p = get(blk_hash);
+    if (height) p.height = height;
+    if (p.t[phase] < 0) p.t[phase] = now();
+    if (has_own_order && p.t[LOCAL_ORDER_SENT] < 0)
+        p.t[LOCAL_ORDER_SENT] = last_local_order_sent;
+}
+
+void BlockProfiler::finish(const uint256_t &blk_hash) {
+    auto it = blocks.find(blk_hash);
+    if (it == blocks.end()) return;
+    const auto &p = it->second;
+    double first = -1, prev = -1;
+    for (int i = 0; i < NPHASES; i++)
+    {
+        double t = p.t[i];
+        if (t < 0) continue;
+        if (first < 0) first = t;
+        /* phases may overlap (e.g., a block is committed before it
+         * has been voted by a slow replica); clamp at zero */
+        if (prev >= 0) samples[i].push_back(std::max(t - prev, 0.0));
+        prev = std::max(prev, t);
+    }
+    if (first >= 0) total_samples.push_back(prev - first);
+    if (csv)
+    {
+        fprintf(csv, "%s,%u", get_hex10(blk_hash).c_str(), p.height);
+        for (int i = 0; i < NPHASES; i++)
+        {
+            if (p.t[i] < 0) fputs(",", csv);
+            else fprintf(csv, ",%.6f", p.t[i]);
+        }
+        fputc('\n', csv);
+    }
+    blocks.erase(it);
+}
+
+static void print_percentiles(const char *name, std::vector<double> &v) {
+    auto pct = [&v](double q) {
+        size_t k = std::min(v.size(), (size_t)std::ceil(q * v.size())) - 1;
+        std::nth_element(v.begin(), v.begin() + k, v.end());
+        return v[k] * 1e3;
+    };
+    if (v.empty()) return;
+    double p50 = pct(0.5), p90 = pct(0.9), p99 = pct(0.99), pmax = pct(1);
+    HOTSTUFF_LOG_INFO("%-12s n=%-6lu p50=%.3f p90=%.3f p99=%.3f max=%.3f (ms)",
+                        name, v.size(), p50, p90, p99, pmax);
+    v.clear();
+}
+
+void BlockProfiler::print_stat() {
+    /* forget the blocks that will never be executed */
+    double t = now();
+    for (auto it = blocks.begin(); it != blocks.end();)
+    {
+        const auto &p = it->second;
+        double last = *std::max_element(p.t, p.t + NPHASES);
+        if (t - last > stale_sec) it = blocks.erase(it);
+        else it++;
+    }
+    HOTSTUFF_LOG_INFO("------ block phases (since the previous phase) ------");
+    for (int i = 0; i < NPHASES; i++)
+        print_percentiles(phase_name((Phase)i), samples[i]);
+    print_percentiles("total", total_samples);
+    HOTSTUFF_LOG_INFO("in flight: %lu", blocks.size());
+    if (csv) fflush(csv);
+}
+#endif
+
 }
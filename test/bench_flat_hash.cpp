@@ -0,0 +1,102 @@
+/**
+ * Copyright 2018 VMware
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+#include "salticidae/util.h"
+#include "hotstuff/flat_hash.h"
+
+using hotstuff::Hash256;
+using hotstuff::uint256_t;
+using hotstuff::FlatHashMap;
+using salticidae::ElapsedTime;
+
+/* keys as the consensus sees them: hashes of serialized objects */
+static std::vector<uint256_t> gen_keys(size_t n, uint64_t seed) {
+    std::vector<uint256_t> keys;
+    keys.reserve(n);
+    std::mt19937_64 rng(seed);
+    for (size_t i = 0; i < n; i++)
+    {
+        salticidae::DataStream s;
+        s << rng();
+        keys.push_back(s.get_hash());
+    }
+    return keys;
+}
+
+static void report(const char *name, const char *op, size_t n, ElapsedTime &et) {
+    printf("%-28s %-8s %10.2f Mops/s (%.3f sec)\n",
+            name, op, n / et.elapsed_sec / 1e6, et.elapsed_sec);
+}
+
+template<typename Map, typename Key>
+static void bench(const char *name,
+                const std::vector<Key> &keys, const std::vector<Key> &misses) {
+    Map m;
+    ElapsedTime et;
+    size_t n = keys.size();
+    size_t found = 0;
+
+    et.start();
+    for (size_t i = 0; i < n; i++)
+        m.insert(std::make_pair(keys[i], i));
+    et.stop();
+    report(name, "insert", n, et);
+
+    et.start();
+    for (size_t i = 0; i < n; i++)
+        found += m.find(keys[i]) != m.end();
+    et.stop();
+    report(name, "hit", n, et);
+
+    et.start();
+    for (size_t i = 0; i < n; i++)
+        found += m.find(misses[i]) != m.end();
+    et.stop();
+    report(name, "miss", n, et);
+
+    et.start();
+    for (size_t i = 0; i < n; i += 2)
+        m.erase(keys[i]);
+    for (size_t i = 0; i < n; i += 2)
+        m.insert(std::make_pair(misses[i], i));
+    et.stop();
+    report(name, "churn", n, et);
+
+    if (found != n)
+        fprintf(stderr, "%s: unexpected lookup result %lu\n", name, found);
+}
+
+int main(int argc, char **argv) {
+    size_t n = argc > 1 ? strtoul(argv[1], nullptr, 10) : 1000000;
+    auto keys = gen_keys(n, 1);
+    auto misses = gen_keys(n, 2);
+    std::vector<Hash256> hkeys(keys.begin(), keys.end());
+    std::vector<Hash256> hmisses(misses.begin(), misses.end());
+
+    printf("%lu entries\n", n);
+    bench<std::unordered_map<const uint256_t, size_t>>(
+        "unordered_map<uint256_t>", keys, misses);
+    bench<std::unordered_map<Hash256, size_t>>(
+        "unordered_map<Hash256>", hkeys, hmisses);
+    bench<FlatHashMap<size_t>>("FlatHashMap", hkeys, hmisses);
+    return 0;
+}
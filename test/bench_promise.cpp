@@ -0,0 +1,162 @@
+/**
+ * Copyright 2018 VMware
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <queue>
+#include <vector>
+
+#include "salticidae/util.h"
+#include "salticidae/ref.h"
+#include "hotstuff/promise.hpp"
+#include "hotstuff/alloc_profile.h"
+
+/* Replays the promise traffic one block causes on a replica (see
+ * HotStuffBase::async_fetch_blk/async_deliver_blk, on_propose and the vote
+ * handler) and counts the heap allocations it takes. Built with
+ * HOTSTUFF_ALLOC_PROFILE, the counting is left to the library, which also
+ * breaks it down by phase. */
+
+#ifdef HOTSTUFF_ALLOC_PROFILE
+using hotstuff::AllocProfiler;
+#else
+static size_t nalloc = 0;
+
+void *operator new(size_t size) {
+    nalloc++;
+    if (void *p = malloc(size)) return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+#endif
+
+using promise::promise_t;
+using salticidae::ElapsedTime;
+
+struct Block { uint32_t height; };
+using block_t = salticidae::ArcObj<Block>;
+using ReplicaID = uint16_t;
+
+/* stands in for VeriPool: results are delivered later, in order */
+struct FakeVeriPool {
+    std::queue<promise_t> pending;
+
+    promise_t verify() {
+        promise_t pm([](promise_t &) {});
+        pending.push(pm);
+        return pm;
+    }
+
+    void flush() {
+        while (!pending.empty())
+        {
+            pending.front().resolve(true);
+            pending.pop();
+        }
+    }
+};
+
+static promise_t verify_qc(FakeVeriPool &vpool, size_t nmajority) {
+    std::vector<promise_t> vpm;
+    vpm.reserve(nmajority);
+    for (size_t i = 0; i < nmajority; i++)
+        vpm.push_back(vpool.verify());
+    return promise::all(vpm).then([](const promise::values_t &values) {
+        for (const auto &v: values)
+            if (!promise::any_cast<bool>(v)) return false;
+        return true;
+    });
+}
+
+static void one_block(FakeVeriPool &vpool, const block_t &blk,
+                    size_t nreplicas, size_t &ndelivered) {
+    size_t nmajority = nreplicas - (nreplicas - 1) / 3;
+    HOTSTUFF_ALLOC_SCOPE(DELIVER);
+    /* fetching */
+    promise_t fetch([](promise_t &) {});
+    /* delivery: verify the QC, wait for the parent, then deliver */
+    promise_t deliver([](promise_t &) {});
+    fetch.then([&vpool, deliver, nmajority](block_t blk) {
+        std::vector<promise_t> pms;
+        pms.push_back(verify_qc(vpool, nmajority));
+        pms.push_back(promise_t([](promise_t &pm) { pm.resolve(true); }));
+        promise::all(pms).then([deliver, blk](const promise::values_t values) {
+            deliver.resolve(promise::any_cast<bool>(values[0]) && blk->height);
+        });
+    });
+    fetch.resolve(blk);
+    /* the proposal waits for the delivery */
+    promise::all(std::vector<promise_t>{deliver}).then([&ndelivered]() {
+        ndelivered++;
+    });
+    /* every vote waits for its signature and the delivery */
+    for (size_t i = 0; i < nreplicas; i++)
+    {
+        HOTSTUFF_ALLOC_SCOPE(VOTE);
+        promise::all(std::vector<promise_t>{
+            vpool.verify().then([](bool result) { return result; }),
+            deliver
+        }).then([](const promise::values_t values) {
+            if (!promise::any_cast<bool>(values[0])) abort();
+        });
+    }
+    /* the pacemaker beat and the QC completion */
+    {
+        HOTSTUFF_ALLOC_SCOPE(PROPOSE);
+        promise_t beat([](promise_t &pm) { pm.resolve((ReplicaID)0); });
+        beat.then([](ReplicaID proposer) { (void)proposer; });
+        promise_t qc_finish;
+        qc_finish.then([]() {});
+        vpool.flush();
+        qc_finish.resolve();
+    }
+}
+
+int main(int argc, char **argv) {
+    size_t nblocks = argc > 1 ? strtoul(argv[1], nullptr, 10) : 100000;
+    size_t nreplicas = argc > 2 ? strtoul(argv[2], nullptr, 10) : 4;
+    FakeVeriPool vpool;
+    block_t blk = new Block{1};
+    size_t ndelivered = 0;
+    ElapsedTime et;
+
+    /* warm up the pools */
+    for (size_t i = 0; i < 1000; i++)
+        one_block(vpool, blk, nreplicas, ndelivered);
+#ifdef HOTSTUFF_ALLOC_PROFILE
+    auto start = AllocProfiler::snapshot();
+#else
+    nalloc = 0;
+#endif
+    et.start();
+    for (size_t i = 0; i < nblocks; i++)
+        one_block(vpool, blk, nreplicas, ndelivered);
+    et.stop();
+#ifdef HOTSTUFF_ALLOC_PROFILE
+    auto delta = AllocProfiler::snapshot() - start;
+    size_t nalloc = delta.total_nallocs();
+    printf("%s\n", AllocProfiler::report(delta, nblocks, "block").c_str());
+#endif
+    if (ndelivered != nblocks + 1000)
+        fprintf(stderr, "unexpected number of delivered blocks %lu\n", ndelivered);
+    printf("%lu blocks, %lu replicas: %.2f allocations/block, %.3f us/block\n",
+            nblocks, nreplicas, (double)nalloc / nblocks,
+            et.elapsed_sec * 1e6 / nblocks);
+    return 0;
+}
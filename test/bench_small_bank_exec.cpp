@@ -0,0 +1,133 @@
+/**
+ * Copyright 2018 VMware
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "salticidae/util.h"
+#include "examples/small_bank.h"
+
+using salticidae::ElapsedTime;
+
+/* Execute the same committed batches serially and with SmallBankExecutor
+ * on several thread counts: the final states and the results must match.
+ * Then undo all of them, and load a checkpoint of the state taken meanwhile. */
+
+static const size_t nthreads_list[] = {1, 2, 4, 8};
+static const size_t NCONFIGS = sizeof(nthreads_list) / sizeof(nthreads_list[0]);
+
+int main(int argc, char **argv) {
+    uint64_t n_users = argc > 1 ? strtoul(argv[1], nullptr, 10) : 100000;
+    double skew = argc > 2 ? strtod(argv[2], nullptr) : 0.99;
+    size_t batch_size = argc > 3 ? strtoul(argv[3], nullptr, 10) : 400;
+    size_t nbatches = argc > 4 ? strtoul(argv[4], nullptr, 10) : 1000;
+
+    std::vector<std::unique_ptr<SmallBankManager>> managers;
+    for (size_t i = 0; i <= NCONFIGS; i++)
+        managers.emplace_back(new SmallBankManager(n_users, 0.9, skew));
+
+    std::vector<std::vector<uint64_t>> txs;
+    txs.reserve(batch_size * nbatches);
+    for (size_t i = 0; i < batch_size * nbatches; i++)
+        txs.push_back(managers[0]->get_next_transaction_serialized());
+    std::vector<std::vector<const uint64_t *>> batches(nbatches);
+    for (size_t i = 0; i < txs.size(); i++)
+        batches[i / batch_size].push_back(txs[i].data());
+    printf("%lu users, skew %.2f, %lu batches of %lu\n",
+            n_users, skew, nbatches, batch_size);
+
+    /* the reference: execute_transaction() in order */
+    std::vector<std::pair<uint64_t, uint64_t>> expected;
+    ElapsedTime et;
+    et.start();
+    for (const auto &b: batches)
+        for (auto p: b)
+            expected.push_back(managers[0]->execute_transaction(p));
+    et.stop();
+    printf("%-12s %10.2f Ktx/s\n", "serial", txs.size() / et.elapsed_sec / 1e3);
+
+    int ret = 0;
+    for (size_t c = 0; c < NCONFIGS; c++)
+    {
+        auto &m = managers[c + 1];
+        SmallBankExecutor executor(m.get(), nthreads_list[c]);
+        std::vector<std::pair<uint64_t, uint64_t>> results, all;
+        et.start();
+        for (const auto &b: batches)
+        {
+            executor.execute_batch(b, results);
+            all.insert(all.end(), results.begin(), results.end());
+        }
+        et.stop();
+        bool ok = m->state_digest() == managers[0]->state_digest() && all == expected;
+        printf("%2lu thread(s) %10.2f Ktx/s %s\n", nthreads_list[c],
+                txs.size() / et.elapsed_sec / 1e3, ok ? "ok" : "MISMATCH");
+        if (!ok) ret = 1;
+    }
+
+    /* speculation: executing batches and rolling them back leaves the
+     * state untouched; a checkpoint taken in the middle of them holds the
+     * state from before */
+    char ckpt_path[] = "/tmp/sb-ckpt-XXXXXX";
+    int fd = mkstemp(ckpt_path);
+    if (fd < 0) return 1;
+    close(fd);
+    {
+        auto &m = managers[1];
+        uint64_t digest = m->state_digest();
+        SmallBankExecutor executor(m.get(), nthreads_list[NCONFIGS - 1]);
+        SmallBankManager::undo_log_t undo;
+        std::vector<std::pair<uint64_t, uint64_t>> results;
+        pid_t pid = -1;
+        et.start();
+        for (const auto &b: batches)
+        {
+            m->log_undo(b, undo);
+            executor.execute_batch(b, results);
+            if (pid < 0 && &b == &batches[nbatches / 2])
+                pid = m->checkpoint(ckpt_path, 42, {&undo});
+        }
+        m->rollback(undo);
+        et.stop();
+        bool ok = m->state_digest() == digest;
+        printf("%-12s %10.2f Ktx/s %s\n", "undo",
+                txs.size() / et.elapsed_sec / 1e3, ok ? "ok" : "MISMATCH");
+        if (!ok) ret = 1;
+
+        int status;
+        ok = pid > 0 && waitpid(pid, &status, 0) == pid &&
+            WIFEXITED(status) && WEXITSTATUS(status) == 0;
+        et.start();
+        try {
+            SmallBankCkptHeader header;
+            SmallBank loaded(ckpt_path, true, header);
+            ok = ok && header.height == 42 && loaded.digest() == digest;
+        } catch (std::exception &e) {
+            printf("%s\n", e.what());
+            ok = false;
+        }
+        et.stop();
+        printf("%-12s %10.3f s %s\n", "checkpoint", et.elapsed_sec,
+                ok ? "ok" : "MISMATCH");
+        if (!ok) ret = 1;
+    }
+    unlink(ckpt_path);
+    return ret;
+}
@@ -0,0 +1,96 @@
+/**
+ * Copyright 2018 VMware
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+#include "hotstuff/consensus.h"
+
+using namespace hotstuff;
+
+/* HotStuffCore::fair_order() on local orders whose pairwise majorities
+ * form cycles (rotations of the same sequence), on orders with a
+ * consistent majority and on orders of different commands. */
+
+static int nfailed = 0;
+
+#define CHECK(x) do { if (!(x)) { \
+    printf("%s:%d: %s failed\n", __FILE__, __LINE__, #x); nfailed++; } } while (0)
+
+static std::vector<Hash256> make_cmds(size_t n) {
+    std::vector<Hash256> cmds;
+    for (size_t i = 0; i < n; i++)
+    {
+        DataStream s;
+        s << (uint64_t)i;
+        cmds.push_back(Hash256(s.get_hash()));
+    }
+    return cmds;
+}
+
+static std::vector<Hash256> rotate(std::vector<Hash256> v, size_t k) {
+    std::rotate(v.begin(), v.begin() + k, v.end());
+    return v;
+}
+
+/* the orders, inserted into the map in the given replica order */
+static std::vector<Hash256> finalize(const std::vector<std::vector<Hash256>> &orders,
+                                    const std::vector<ReplicaID> &insertion) {
+    block_orders_t m;
+    for (auto rid: insertion)
+        m[rid] = std::pmr::vector<Hash256>(orders[rid].begin(), orders[rid].end());
+    return HotStuffCore::fair_order(m, 0.5);
+}
+
+static bool is_permutation_of(std::vector<Hash256> a, std::vector<Hash256> b) {
+    std::sort(a.begin(), a.end());
+    std::sort(b.begin(), b.end());
+    return a == b;
+}
+
+int main() {
+    /* a > b > c > a for commands ten apart, over more than 16 commands */
+    auto cmds = make_cmds(30);
+    std::vector<std::vector<Hash256>> cyclic{
+        cmds, rotate(cmds, 10), rotate(cmds, 20)};
+    auto res = finalize(cyclic, {0, 1, 2});
+    CHECK(res.size() == cmds.size());
+    CHECK(is_permutation_of(res, cmds));
+    /* the same on every replica, whatever the order of the map */
+    CHECK(finalize(cyclic, {2, 0, 1}) == res);
+    CHECK(finalize(cyclic, {1, 2, 0}) == res);
+
+    /* a consistent majority is followed */
+    auto reversed = cmds;
+    std::reverse(reversed.begin(), reversed.end());
+    std::vector<std::vector<Hash256>> majority{cmds, cmds, reversed, cmds};
+    CHECK(finalize(majority, {0, 1, 2, 3}) == cmds);
+    CHECK(finalize(majority, {3, 2, 1, 0}) == cmds);
+
+    /* the local orders hold different commands: all of them are ordered,
+     * whichever replica comes first in the map */
+    std::vector<std::vector<Hash256>> partial{
+        {cmds[0], cmds[1]}, {cmds[2], cmds[1], cmds[0]}, {cmds[2]}, {cmds[3], cmds[0]}};
+    auto merged = finalize(partial, {0, 1, 2, 3});
+    CHECK(is_permutation_of(merged, {cmds[0], cmds[1], cmds[2], cmds[3]}));
+    CHECK(finalize(partial, {3, 2, 1, 0}) == merged);
+    CHECK(finalize(partial, {2, 3, 0, 1}) == merged);
+
+    if (nfailed) return 1;
+    printf("ok\n");
+    return 0;
+}